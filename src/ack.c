@@ -0,0 +1,269 @@
+/*
+ * ack.c - rpi-modswitch consumer acknowledgments
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the acknowledgment socket described in ack.h. The
+ * sender's pid comes from SO_PASSCRED, so a consumer cannot be registered on
+ * behalf of another process by accident.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#define _GNU_SOURCE     // struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "ack.h"
+#include "utils.h"
+
+#define DEFAULT_SOCKET "/var/run/modswitch.ack"
+#define SWEEP_NS 1000000000ull
+
+static void ack_defaults(ack_t *a) {
+    if (a->defaults)
+        return;
+    strcpy(a->socket, DEFAULT_SOCKET);
+    a->fd = -1;
+    a->sweep_ns = ACK_NO_DEADLINE;
+    a->defaults = true;
+}
+
+bool ack_conf(ack_t *a, const char *key, const char *value) {
+    ack_defaults(a);
+
+    uintmax_t num;
+    if (strcmp(key, "enable") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        a->enabled = num;
+    } else if (strcmp(key, "socket") == 0) {
+        if (value[0] != '/' || strlen(value) >= sizeof(a->socket))
+            return false;
+        strcpy(a->socket, value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int ack_open(ack_t *a) {
+    ack_defaults(a);
+    if (!a->enabled)
+        return 0;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, a->socket);
+    a->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (a->fd < 0)
+        return -1;
+    int on = 1;
+    unlink(a->socket);      // left over by a crash; the lock file keeps a live daemon safe
+    if (setsockopt(a->fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) < 0 ||
+        bind(a->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(a->socket, 0666) < 0) {
+        int err = errno;
+        close(a->fd);
+        a->fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Lowest state applied by everyone; a state ahead of the published one is not believed.
+static void update_lowest(ack_t *a, uint64_t now) {
+    uint64_t lowest = a->target;
+    for (unsigned i = 0; i < a->n; i++) {
+        if (a->c[i].acked < lowest)
+            lowest = a->c[i].acked;
+    }
+    if (lowest == a->target && a->lowest != a->target && a->target_ns) {
+        a->last_all_ns = now - a->target_ns;
+        if (a->last_all_ns > a->max_all_ns)
+            a->max_all_ns = a->last_all_ns;
+    }
+    a->lowest = lowest;
+    if (lowest == a->target)
+        a->sweep_ns = ACK_NO_DEADLINE;
+}
+
+void ack_transition(ack_t *a, uint64_t seq, uint64_t now) {
+    if (!a->enabled)
+        return;
+    a->target = seq;
+    a->target_ns = now;
+    a->sweep_ns = now + SWEEP_NS;
+    update_lowest(a, now);
+}
+
+static modsw_consumer_t *consumer_find(ack_t *a, const char *name) {
+    for (unsigned i = 0; i < a->n; i++) {
+        if (strncmp(a->c[i].name, name, MODSW_NAME_MAX) == 0)
+            return &a->c[i];
+    }
+    return NULL;
+}
+
+static modsw_consumer_t *consumer_add(ack_t *a, const char *name, pid_t pid) {
+    if (a->n >= MODSW_MAX_CONSUMERS) {
+        fprintf(stderr, "ack.consumer.table_full: cannot register %.*s\n", MODSW_NAME_MAX, name);
+        return NULL;
+    }
+    modsw_consumer_t *c = &a->c[a->n++];
+    memset(c, 0, sizeof(*c));
+    memcpy(c->name, name, MODSW_NAME_MAX);
+    c->pid = pid;
+    return c;
+}
+
+static void consumer_drop(ack_t *a, modsw_consumer_t *c) {
+    *c = a->c[--a->n];
+}
+
+static bool pid_gone(pid_t pid) {
+    return pid <= 0 || (kill(pid, 0) < 0 && errno == ESRCH);
+}
+
+static void handle(ack_t *a, const modsw_ack_msg_t *msg, pid_t pid, uint64_t now) {
+    modsw_consumer_t *c = consumer_find(a, msg->name);
+    uint64_t seq = msg->seq < a->target ? msg->seq : a->target;
+
+    // The socket is open to every user: a name belongs to the process that registered it.
+    if (c && c->pid != pid && (msg->op != MODSW_ACK_REGISTER || !pid_gone(c->pid))) {
+        fprintf(stderr, "ack.consumer.foreign_pid: pid %d cannot act for %.*s (pid %d)\n",
+                (int)pid, MODSW_NAME_MAX, c->name, (int)c->pid);
+        return;
+    }
+
+    switch (msg->op) {
+        case MODSW_ACK_REGISTER:
+            if (!c && !(c = consumer_add(a, msg->name, pid)))
+                return;
+            c->pid = pid;           // a restarted consumer takes its slot back
+            c->acked = seq;
+            break;
+        case MODSW_ACK_APPLIED:
+            if (!c && !(c = consumer_add(a, msg->name, pid)))
+                return;
+            if (seq > c->acked && seq == a->target && msg->applied_ns >= a->target_ns) {
+                c->last_latency_ns = msg->applied_ns - a->target_ns;
+                if (c->last_latency_ns > c->max_latency_ns)
+                    c->max_latency_ns = c->last_latency_ns;
+            }
+            if (seq > c->acked)
+                c->acked = seq;
+            c->acks++;
+            break;
+        case MODSW_ACK_UNREGISTER:
+            if (c)
+                consumer_drop(a, c);
+            break;
+        default:
+            return;
+    }
+    update_lowest(a, now);
+}
+
+bool ack_io(ack_t *a, uint64_t now) {
+    bool changed = false;
+    while (1) {
+        modsw_ack_msg_t msg;
+        union {
+            char buf[CMSG_SPACE(sizeof(struct ucred))];
+            struct cmsghdr align;
+        } ctl;
+        struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+        struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+        ssize_t n = recvmsg(a->fd, &mh, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                perror("ack.io.recvmsg_failed");
+            break;
+        }
+        if ((size_t)n != sizeof(msg) || msg.magic != MODSW_SHM_MAGIC || msg.version != MODSW_SHM_VERSION || !msg.name[0])
+            continue;
+
+        pid_t pid = 0;      // SO_PASSCRED makes the kernel attach it to every message
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
+                struct ucred cred;
+                memcpy(&cred, CMSG_DATA(cm), sizeof(cred));
+                pid = cred.pid;
+            }
+        }
+        if (pid <= 0)
+            continue;
+        handle(a, &msg, pid, now);
+        changed = true;
+    }
+    return changed;
+}
+
+bool ack_timeout(ack_t *a, uint64_t now) {
+    if (!a->enabled || now < a->sweep_ns)
+        return false;
+    a->sweep_ns = now + SWEEP_NS;
+
+    bool changed = false;
+    for (unsigned i = 0; i < a->n; ) {
+        modsw_consumer_t *c = &a->c[i];
+        if (c->acked < a->target && c->pid > 0 && pid_gone(c->pid)) {
+            fprintf(stderr, "ack.consumer.gone: %.*s (pid %d) exited without unregistering, dropped\n",
+                    MODSW_NAME_MAX, c->name, (int)c->pid);
+            consumer_drop(a, c);
+            changed = true;
+        } else {
+            i++;
+        }
+    }
+    if (changed)
+        update_lowest(a, now);
+    return changed;
+}
+
+uint64_t ack_next_deadline(const ack_t *a) {
+    return a->enabled ? a->sweep_ns : ACK_NO_DEADLINE;
+}
+
+void ack_publish(const ack_t *a, modsw_acks_t *out) {
+    out->count = a->n;
+    out->target = a->target;
+    __atomic_store_n(&out->lowest, a->lowest, __ATOMIC_RELEASE);
+    out->last_all_ns = a->last_all_ns;
+    out->max_all_ns = a->max_all_ns;
+    memcpy(out->socket, a->socket, sizeof(out->socket));
+    memcpy(out->c, a->c, sizeof(out->c[0]) * a->n);
+}
+
+void ack_wake(modsw_acks_t *out) {
+    futex_bump_shared(&out->applied);
+}
+
+void ack_close(ack_t *a) {
+    if (!a->enabled || a->fd < 0)
+        return;
+    close(a->fd);
+    a->fd = -1;
+    unlink(a->socket);
+}
@@ -0,0 +1,137 @@
+/*
+ * ack.h - rpi-modswitch consumer acknowledgments
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file runs the [ack] section: a unix datagram socket on which consumers
+ * register by name and report the state they have applied (modsw_ack_msg_t,
+ * sent by libmodsw). A state is identified by stats.transitions at the time
+ * it was published. The socket is open to every user, so the PID the kernel
+ * attaches to a registration owns the name: only that process may report or
+ * unregister under it, and another may take it over once it has exited.
+ *
+ * Consumers only ever send; the daemon stays the sole writer of the shared
+ * memory region, where it publishes every consumer's last applied state and
+ * apply latency, and the lowest state applied by all of them. A consumer
+ * whose process is gone is dropped by a liveness check that runs once per
+ * second while some consumer is behind, so a crash cannot hold waiters up
+ * forever.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef ACK_H
+#define ACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+
+#define ACK_NO_DEADLINE UINT64_MAX
+
+typedef struct ack_t {
+    bool enabled;
+    char socket[MODSW_ACK_PATH_MAX];
+    bool defaults;
+
+    int fd;
+    modsw_consumer_t c[MODSW_MAX_CONSUMERS];
+    unsigned n;
+    uint64_t target;            // state currently published
+    uint64_t target_ns;         // time it was published
+    uint64_t lowest;
+    uint64_t last_all_ns;
+    uint64_t max_all_ns;
+    uint64_t sweep_ns;          // next liveness check, ACK_NO_DEADLINE when nobody is behind
+} ack_t;
+
+
+/**
+ * Apply one key of the [ack] configuration section.
+ *
+ * @param a      Acknowledgments.
+ * @param key    One of enable, socket.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool ack_conf(ack_t *a, const char *key, const char *value);
+
+/**
+ * Bind the socket, replacing a stale one, and make it writable by every
+ * local user. Does nothing if acknowledgments are not enabled.
+ *
+ * @param a      Acknowledgments.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int ack_open(ack_t *a);
+
+/**
+ * A new state was published; every consumer is now behind.
+ *
+ * @param a      Acknowledgments.
+ * @param seq    stats.transitions of the new state.
+ * @param now    Time of the transition.
+ */
+void ack_transition(ack_t *a, uint64_t seq, uint64_t now);
+
+/**
+ * Handle the pending datagrams. Call when the socket is readable.
+ *
+ * @param a      Acknowledgments.
+ * @param now    Current time.
+ * @return       true if the published state changed.
+ */
+bool ack_io(ack_t *a, uint64_t now);
+
+/**
+ * Run the liveness check if it is due.
+ *
+ * @param a      Acknowledgments.
+ * @param now    Current time.
+ * @return       true if the published state changed.
+ */
+bool ack_timeout(ack_t *a, uint64_t now);
+
+/**
+ * Time of the next liveness check.
+ *
+ * @param a      Acknowledgments.
+ * @return       Absolute CLOCK_MONOTONIC time, or ACK_NO_DEADLINE.
+ */
+uint64_t ack_next_deadline(const ack_t *a);
+
+/**
+ * Copy the state of every consumer. Runs inside a shm write section.
+ *
+ * @param a      Acknowledgments.
+ * @param out    Shared memory area.
+ */
+void ack_publish(const ack_t *a, modsw_acks_t *out);
+
+/**
+ * Bump the futex word and wake every waiter. Runs after the write section
+ * that published the change.
+ *
+ * @param out    Shared memory area.
+ */
+void ack_wake(modsw_acks_t *out);
+
+/**
+ * Close and remove the socket.
+ *
+ * @param a      Acknowledgments.
+ */
+void ack_close(ack_t *a);
+
+#endif /* ACK_H */
@@ -19,6 +19,19 @@
  *   - Optional looping until the switch changes state or matches a
  *     specified character.
  *   - Configurable microsecond polling delay.
+ *   - Prints daemon statistics from the shared memory region.
+ *   - Prints the key/value profile of the current mode.
+ *   - Prints per-mode dwell time and transition accounting.
+ *   - Follows the stream of transition and gesture events.
+ *   - Prints pulse counter lines (edges, frequency, duty cycle) and rotary
+ *     encoders (position, detent, velocity).
+ *   - Prints the matrix keypad bitmap.
+ *   - Prints the shift register chain bitset and read timing.
+ *   - Prints queue metrics of the daemon's output sinks.
+ *   - Prints supervised services and switchover timing.
+ *   - Prints acknowledging consumers, or waits until all applied the
+ *     current state.
+ *   - Reads any additional switch group of the daemon by name.
  *   - Designed for simple shell integration and automation.
  *
  * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
@@ -45,51 +58,279 @@
 #include <getopt.h>
 #include <math.h>
 #include "utils.h"
+#include "modsw.h"
 //#include "version.h"
 #include "config.h"
 
-#define SHM_FILE "/modsw"
-#define SHM_SIZE 1
-
-static uint8_t *shm_ptr = NULL;
-static int shm_fd = -1;
+static modsw_t *sw = NULL;
 
 
 static int use_loop_until = 0;
 static int use_specific_char = 0;
+static int use_show_stats = 0;
+static int use_show_profile = 0;
+static int use_show_acct = 0;
+static int use_follow_events = 0;
+static int use_show_counters = 0;
+static int use_show_matrix = 0;
+static int use_show_shiftreg = 0;
+static int use_show_sinks = 0;
+static int use_show_services = 0;
+static int use_show_acks = 0;
+static int use_wait_applied = 0;
 static uint8_t specific_char;
+static const char *group = NULL;    // -g, NULL for the main switch
 
 static uintmax_t delay_us = 1000;
 
 static int setup_shm_reader(void) {
-    shm_fd = shm_open(SHM_FILE, O_RDWR, 0);
-    if (shm_fd < 0) {
-        perror("setup.shm.cannot_open_shm_file");
+    sw = modsw_open_group(group);
+    if (!sw) {
+        if (errno == EPROTO)
+            fprintf(stderr, "setup.shm.bad_shm_header: unknown shared memory layout, daemon version mismatch?\n");
+        else
+            perror("setup.shm.cannot_open_shm_file");
         return -1;
     }
-    
-    shm_ptr = mmap(NULL, SHM_SIZE, PROT_READ, MAP_SHARED, shm_fd, 0);
-    if (shm_ptr == MAP_FAILED) {
-        perror("setup.shm.mmap_failed");
-        close(shm_fd);
+    return 0;
+}
+
+static int read_byte(uint8_t *abyte) {
+    if (!sw) {
+        errno = EFAULT;
         return -1;
     }
+    *abyte = __atomic_load_n(&modsw_shm(sw)->mode_char, __ATOMIC_RELAXED);
+    return 0;
+}
 
+static void print_stats(const modsw_shm_t *snap) {
+    fprintf(stdout, "mode: %c\n", snap->mode_char);
+    fprintf(stdout, "index: %u/%u\n", snap->mode, snap->nmodes);
+    fprintf(stdout, "name: %.*s\n", MODSW_NAME_MAX, snap->name);
+    fprintf(stdout, "raw: 0x%02x\n", snap->raw);
+    fprintf(stdout, "flags: 0x%08x\n", snap->flags);
+    fprintf(stdout, "chatter: 0x%02x\n", snap->chatter);
+    fprintf(stdout, "readers: %" PRIu32 "\n", snap->readers);
+    fprintf(stdout, "changed_ns: %" PRIu64 "\n", snap->changed_ns);
+    fprintf(stdout, "transitions: %" PRIu64 "\n", snap->stats.transitions);
+    fprintf(stdout, "coalesced: %" PRIu64 "\n", snap->stats.coalesced);
+    fprintf(stdout, "invalid: %" PRIu64 "\n", snap->stats.invalid);
+    fprintf(stdout, "gestures: %" PRIu64 "\n", snap->stats.gestures);
+    fprintf(stdout, "reconfigured: %" PRIu64 "\n", snap->stats.reconfigured);
+}
+
+static void print_profile(const modsw_profile_t *prof) {
+    const char *value;
+    for (const char *key = modsw_profile_next(prof, NULL, &value); key; key = modsw_profile_next(prof, key, &value))
+        fprintf(stdout, "%s=%s\n", key, value);
+}
+
+static void print_acct(void) {
+    unsigned nmodes = modsw_shm(sw)->nmodes;
+    fprintf(stdout, "mode\tentries\tdwell_s\t\tlast_entered\n");
+    for (unsigned m = 0; m < nmodes; m++) {
+        modsw_mode_acct_t acct;
+        if (modsw_acct_mode(sw, m, &acct) < 0)
+            return;
+        fprintf(stdout, "%u%s\t%" PRIu32 "\t%.3f\t", m, acct.current ? "*" : "", acct.entries, acct.dwell_ns / 1e9);
+        if (acct.entries)
+            fprintf(stdout, "%" PRIu64 ".%03" PRIu64 "\n", acct.entered_rt_ns / 1000000000u, acct.entered_rt_ns / 1000000u % 1000);
+        else
+            fprintf(stdout, "-\n");
+    }
+    for (unsigned from = 0; from < nmodes; from++) {
+        for (unsigned to = 0; to < nmodes; to++) {
+            uint32_t count;
+            if (modsw_acct_pair(sw, from, to, &count) == 0 && count)
+                fprintf(stdout, "%u->%u\t%" PRIu32 "\n", from, to, count);
+        }
+    }
+}
+
+static void print_counters(void) {
+    unsigned n = modsw_counter_count(sw);
+    for (unsigned i = 0; i < n; i++) {
+        modsw_counter_t c;
+        if (modsw_counter_read(sw, i, &c) < 0)
+            return;
+        fprintf(stdout, "%.*s: pin=%" PRIu32 " edges=%" PRIu64 " rising=%" PRIu64 " falling=%" PRIu64 " freq=%" PRIu64 ".%03" PRIu64 "Hz duty=%.2f%% level=%" PRIu32 " overflows=%" PRIu64 "\n",
+                MODSW_NAME_MAX, c.name, c.pin, c.edges, c.rising, c.falling, c.freq_mhz / 1000, c.freq_mhz % 1000, c.duty_ppm / 1e4, c.level, c.overflows);
+    }
+    n = modsw_encoder_count(sw);
+    for (unsigned i = 0; i < n; i++) {
+        modsw_encoder_t e;
+        if (modsw_encoder_read(sw, i, &e) < 0)
+            return;
+        fprintf(stdout, "%.*s: pins=%" PRIu32 ",%" PRIu32 " position=%" PRId64 " detent=%" PRId64 " velocity=%.3f/s invalid=%" PRIu64 " overflows=%" PRIu64 "\n",
+                MODSW_NAME_MAX, e.name, e.pin_a, e.pin_b, e.position, e.detent, e.velocity_mdps / 1e3, e.invalid, e.overflows);
+    }
+}
+
+static int print_matrix(void) {
+    modsw_matrix_t m;
+    if (modsw_matrix_read(sw, &m) < 0)
+        return -1;
+    for (unsigned r = 0; r < m.rows; r++) {
+        for (unsigned c = 0; c < m.cols; c++)
+            fputc(m.keys & (1ull << (r * m.cols + c)) ? '#' : '.', stdout);
+        fputc('\n', stdout);
+    }
+    fprintf(stdout, "keys: 0x%016" PRIx64 "\n", m.keys);
+    fprintf(stdout, "scans: %" PRIu64 " changes: %" PRIu64 " scan_us: %" PRIu32 " last_scan_ns: %" PRIu64 "\n", m.scans, m.changes, m.scan_us, m.last_scan_ns);
     return 0;
 }
 
-static int read_byte(uint8_t *abyte) {
-    if (!shm_ptr) {
-        errno = EFAULT;
+static int print_shiftreg(void) {
+    modsw_shiftreg_t s;
+    if (modsw_shiftreg_read(sw, &s) < 0)
         return -1;
+    for (unsigned i = 0; i < s.nbits; i++) {
+        if (i && i % 8 == 0)
+            fputc(' ', stdout);
+        fputc(s.bits[i / 64] & (1ull << (i % 64)) ? '1' : '0', stdout);
     }
-    *abyte = shm_ptr[0];
+    fputc('\n', stdout);
+    fprintf(stdout, "bits: %" PRIu32 " reads: %" PRIu64 " changes: %" PRIu64 " scan_us: %" PRIu32 "\n", s.nbits, s.reads, s.changes, s.scan_us);
+    fprintf(stdout, "chain_read: %.1f us bit_rate: %" PRIu64 " bit/s\n", s.read_ns / 1e3, s.bit_rate);
     return 0;
 }
 
+static void print_sinks(void) {
+    static const char *const policy[] = { "drop", "latest", "block" };
+    unsigned n = modsw_sink_count(sw);
+    for (unsigned i = 0; i < n; i++) {
+        modsw_sink_stats_t s;
+        if (modsw_sink_read(sw, i, &s) < 0)
+            return;
+        fprintf(stdout, "%.*s: policy=%s worker=%s depth=%" PRIu32 "/%" PRIu32 " high_water=%" PRIu64 " enqueued=%" PRIu64 " dropped=%" PRIu64 " blocked=%.3fms\n",
+                MODSW_NAME_MAX, s.name, s.policy < 3 ? policy[s.policy] : "?", s.thread ? "thread" : "loop", s.depth, s.capacity,
+                s.high_water, s.enqueued, s.dropped, s.blocked_ns / 1e6);
+        fprintf(stdout, "%*s  delivered=%" PRIu64 " failed=%" PRIu64 " latency last=%.1fus avg=%.1fus max=%.1fus exec last=%.1fus avg=%.1fus max=%.1fus\n",
+                (int)strnlen(s.name, MODSW_NAME_MAX), "", s.delivered, s.failed, s.last_latency_ns / 1e3, s.avg_latency_ns / 1e3, s.max_latency_ns / 1e3,
+                s.last_exec_ns / 1e3, s.avg_exec_ns / 1e3, s.max_exec_ns / 1e3);
+        if (s.rate)
+            fprintf(stdout, "%*s  rate=%" PRIu32 "/s burst=%u suppressed=%" PRIu64 "%s\n",
+                    (int)strnlen(s.name, MODSW_NAME_MAX), "", s.rate, s.burst, s.suppressed, s.holding ? " holding" : "");
+        else
+            fprintf(stdout, "%*s  rate=unlimited\n", (int)strnlen(s.name, MODSW_NAME_MAX), "");
+    }
+}
+
+static int print_services(void) {
+    static const char *const state[] = { "idle", "warming", "standby", "running", "stopping" };
+    static const char *const standby[] = { "none", "fork", "warm" };
+    modsw_services_t sv;
+    if (modsw_services_read(sw, &sv) < 0)
+        return -1;
+    fprintf(stdout, "switchovers=%" PRIu64 " standby_hits=%" PRIu64 " standby_misses=%" PRIu64 " predicted=%" PRId32 "\n",
+            sv.switchovers, sv.standby_hits, sv.standby_misses, sv.predicted);
+    fprintf(stdout, "switchover last=%.1fus avg=%.1fus max=%.1fus drain=%.3fms\n",
+            sv.last_switch_ns / 1e3, sv.avg_switch_ns / 1e3, sv.max_switch_ns / 1e3, sv.last_drain_ns / 1e6);
+    for (uint32_t i = 0; i < sv.count && i < MODSW_MAX_SERVICES; i++) {
+        const modsw_service_t *s = &sv.s[i];
+        fprintf(stdout, "%.*s: %s pid=%" PRId32 " standby=%s starts=%" PRIu64 " restarts=%" PRIu64 " exits=%" PRIu64 " last_status=0x%" PRIx32 "\n",
+                MODSW_NAME_MAX, s->name, s->state < 5 ? state[s->state] : "?", s->pid, s->standby < 3 ? standby[s->standby] : "?",
+                s->starts, s->restarts, s->exits, (uint32_t)s->last_status);
+    }
+    return 0;
+}
+
+static int print_acks(void) {
+    modsw_acks_t acks;
+    if (modsw_acks_read(sw, &acks) < 0)
+        return -1;
+    fprintf(stdout, "target=%" PRIu64 " lowest=%" PRIu64 " consumers=%" PRIu32 " socket=%.*s\n",
+            acks.target, acks.lowest, acks.count, MODSW_ACK_PATH_MAX, acks.socket);
+    fprintf(stdout, "all applied last=%.3fms max=%.3fms\n", acks.last_all_ns / 1e6, acks.max_all_ns / 1e6);
+    for (uint32_t i = 0; i < acks.count && i < MODSW_MAX_CONSUMERS; i++) {
+        const modsw_consumer_t *c = &acks.c[i];
+        fprintf(stdout, "%.*s: pid=%" PRId32 " acked=%" PRIu64 "%s acks=%" PRIu64 " latency last=%.3fms max=%.3fms\n",
+                MODSW_NAME_MAX, c->name, c->pid, c->acked, c->acked < acks.target ? " (behind)" : "",
+                c->acks, c->last_latency_ns / 1e6, c->max_latency_ns / 1e6);
+    }
+    return 0;
+}
+
+// Wait until every consumer has applied the state published right now.
+static int wait_applied(void) {
+    modsw_shm_t snap;
+    if (modsw_snapshot(sw, &snap) < 0)
+        return -1;
+    uint64_t start = monotonic_ns();
+    if (modsw_wait_applied(sw, snap.stats.transitions, -1) < 0)
+        return -1;
+    fprintf(stdout, "%c applied after %.3fms\n", snap.mode_char, (monotonic_ns() - start) / 1e6);
+    return 0;
+}
+
+static void follow_events(void) {
+    uint64_t cursor = modsw_event_head(sw);
+    while (1) {
+        modsw_event_t ev;
+        uint64_t lost;
+        int ret;
+        while ((ret = modsw_event_next(sw, &cursor, &ev, &lost)) > 0) {
+            if (lost)
+                fprintf(stdout, "# %" PRIu64 " events lost\n", lost);
+            if (ev.type == MODSW_EVENT_INPUT)
+                fprintf(stdout, "%" PRIu64 " %" PRIu64 " input %.*s %" PRIu32 "\n", ev.seq, ev.ts_ns, MODSW_NAME_MAX, ev.name, ev.arg);
+            else if (ev.type == MODSW_EVENT_KEY)
+                fprintf(stdout, "%" PRIu64 " %" PRIu64 " key %.*s %s\n", ev.seq, ev.ts_ns, MODSW_NAME_MAX, ev.name, ev.arg ? "down" : "up");
+            else if (ev.type == MODSW_EVENT_DETENT)
+                fprintf(stdout, "%" PRIu64 " %" PRIu64 " detent %.*s %" PRId32 "\n", ev.seq, ev.ts_ns, MODSW_NAME_MAX, ev.name, (int32_t)ev.arg);
+            else if (ev.type == MODSW_EVENT_GESTURE)
+                fprintf(stdout, "%" PRIu64 " %" PRIu64 " gesture %.*s line=%u arg=%" PRIu32 "\n", ev.seq, ev.ts_ns, MODSW_NAME_MAX, ev.name, ev.line, ev.arg);
+            else
+                fprintf(stdout, "%" PRIu64 " %" PRIu64 " mode %u %.*s\n", ev.seq, ev.ts_ns, ev.mode, MODSW_NAME_MAX, ev.name);
+        }
+        if (ret < 0) {
+            perror("main.read.read_shm_event_failed");
+            return;
+        }
+        fflush(stdout);
+        usleep(delay_us);
+    }
+}
+
+// Inverse of modsw_mode_char(), -1 for a character that names no single mode.
+static int mode_of_char(uint8_t c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * -l: sleep on the daemon's futex words instead of polling. A specific mode
+ * waits on that mode's word only, so other transitions never wake us.
+ */
+static int wait_loop(void) {
+    modsw_shm_t snap;
+    if (modsw_snapshot(sw, &snap) < 0)
+        return -1;
+    int mode = use_specific_char ? mode_of_char(specific_char) : -1;
+    if (mode >= 0 && mode < snap.nmodes) {
+        if (modsw_wait_mode(sw, (unsigned)mode, -1) < 0)
+            return -1;
+        fprintf(stdout, "%c\n", specific_char);
+        return 0;
+    }
+    uint8_t last_byte = snap.mode_char;
+    while (1) {
+        if (use_specific_char ? snap.mode_char == specific_char : snap.mode_char != last_byte) {
+            fprintf(stdout, "%c\n", snap.mode_char);
+            return 0;
+        }
+        if (modsw_wait_change(sw, snap.stats.transitions, -1) < 0 || modsw_snapshot(sw, &snap) < 0)
+            return -1;
+    }
+}
+
 static void cleanup(void) {
-    if (shm_ptr) munmap((void *)shm_ptr, SHM_SIZE);
-    if (shm_fd >= 0) close(shm_fd);
+    modsw_close(sw);
+    sw = NULL;
 }
 
 static void handle_signal(int sig) {
@@ -106,10 +347,22 @@ static void return_to_cleanup(int ret) {
 static void usage(const char *prog_name) {
     if (!prog_name) return;
     fprintf(stderr, "cat4mod - rpi-modswitch 2-position DIP switch daemon for raspberry pi\n\n");
-    fprintf(stderr, "Usage: %s [-l -c char] [-s µs]\n\n", prog_name);
+    fprintf(stderr, "Usage: %s [-g group] [-l -c char] [-s µs] [-S] [-p] [-A] [-E] [-C] [-K] [-R] [-Q] [-P] [-a] [-w]\n\n", prog_name);
+    fprintf(stderr, "-g :\tread the switch of a [group.NAME] section instead of the main one\n");
     fprintf(stderr, "-l :\tloop until change\n");
     fprintf(stderr, "    -c :\tspecific char (ascii)\n\n");
-    fprintf(stderr, "-s :\tdelay µs per read\n");
+    fprintf(stderr, "-s :\tdelay µs per read (-E)\n");
+    fprintf(stderr, "-S :\tshow daemon statistics\n");
+    fprintf(stderr, "-p :\tshow profile of the current mode (key=value)\n");
+    fprintf(stderr, "-A :\tshow per-mode dwell time and transition counts\n");
+    fprintf(stderr, "-E :\tfollow transition and gesture events\n");
+    fprintf(stderr, "-C :\tshow pulse counter and rotary encoder lines\n");
+    fprintf(stderr, "-K :\tshow matrix keypad keys\n");
+    fprintf(stderr, "-R :\tshow shift register input chain\n");
+    fprintf(stderr, "-Q :\tshow output sink queue metrics\n");
+    fprintf(stderr, "-P :\tshow supervised services and switchover time\n");
+    fprintf(stderr, "-a :\tshow acknowledging consumers and apply latency\n");
+    fprintf(stderr, "-w :\twait until every consumer applied the current state\n");
     fprintf(stderr, "-h :\tshow this help\n");
     fprintf(stderr, "-v : \tshow version\n\n");
     fprintf(stderr, "Version %s By KaliAssistant\n", VERSION);
@@ -119,8 +372,9 @@ static void usage(const char *prog_name) {
 
 int main(int argc, char **argv) {
     int opt;
-    while ((opt = getopt(argc, argv, "lc:hvs:")) != -1) {
+    while ((opt = getopt(argc, argv, "g:lc:hvs:SpAECKRQPaw")) != -1) {
         switch (opt) {
+            case 'g': group = optarg; break;
             case 'l': use_loop_until = 1; break;
             case 'c':
                 use_specific_char = 1;
@@ -129,6 +383,17 @@ int main(int argc, char **argv) {
                     return 1;
                 }
                 break;
+            case 'S': use_show_stats = 1; break;
+            case 'p': use_show_profile = 1; break;
+            case 'A': use_show_acct = 1; break;
+            case 'E': use_follow_events = 1; break;
+            case 'C': use_show_counters = 1; break;
+            case 'K': use_show_matrix = 1; break;
+            case 'R': use_show_shiftreg = 1; break;
+            case 'Q': use_show_sinks = 1; break;
+            case 'P': use_show_services = 1; break;
+            case 'a': use_show_acks = 1; break;
+            case 'w': use_wait_applied = 1; break;
             case 'h': usage(argv[0]); return 0;
             case 's':
                 if (!xstr2umax(optarg, 10, &delay_us)) {
@@ -154,46 +419,96 @@ int main(int argc, char **argv) {
     signal(SIGSEGV, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    if (setup_shm_reader() < 0) return 1;
-    
-        
-    if (!use_loop_until) {
-        uint8_t modbyte;
-        if (read_byte(&modbyte) < 0) {
-            perror("main.read.read_shm_byte_failed");
+    if (setup_shm_reader() < 0) return_to_cleanup(1);
+
+    if (use_show_stats) {
+        modsw_shm_t snap;
+        if (modsw_snapshot(sw, &snap) < 0) {
+            perror("main.read.read_shm_stats_failed");
+            return_to_cleanup(1);
+        }
+        print_stats(&snap);
+        return_to_cleanup(0);
+    }
+
+    if (use_show_matrix) {
+        if (print_matrix() < 0) {
+            perror("main.read.read_shm_matrix_failed");
+            return_to_cleanup(1);
+        }
+        return_to_cleanup(0);
+    }
+
+    if (use_show_shiftreg) {
+        if (print_shiftreg() < 0) {
+            perror("main.read.read_shm_shiftreg_failed");
+            return_to_cleanup(1);
+        }
+        return_to_cleanup(0);
+    }
+
+    if (use_show_sinks) {
+        print_sinks();
+        return_to_cleanup(0);
+    }
+
+    if (use_show_services) {
+        if (print_services() < 0) {
+            perror("main.read.read_shm_services_failed");
             return_to_cleanup(1);
         }
-        fprintf(stdout, "%c\n", modbyte);
         return_to_cleanup(0);
     }
 
-    uint8_t last_byte;
-    if (read_byte(&last_byte) < 0) {
-        perror("main.read.read_shm_byte_failed");
+    if (use_show_acks) {
+        if (print_acks() < 0) {
+            perror("main.read.read_shm_acks_failed");
+            return_to_cleanup(1);
+        }
+        return_to_cleanup(0);
+    }
+
+    if (use_wait_applied) {
+        if (wait_applied() < 0) {
+            perror("main.read.wait_applied_failed");
+            return_to_cleanup(1);
+        }
+        return_to_cleanup(0);
+    }
+
+    if (use_show_counters) {
+        print_counters();
+        return_to_cleanup(0);
+    }
+
+    if (use_follow_events) {
+        follow_events();
         return_to_cleanup(1);
     }
 
-    while (1) {
+    if (use_show_acct) {
+        print_acct();
+        return_to_cleanup(0);
+    }
+
+    if (use_show_profile) {
+        print_profile(modsw_profile_active(sw, NULL));
+        return_to_cleanup(0);
+    }
+        
+    if (!use_loop_until) {
         uint8_t modbyte;
         if (read_byte(&modbyte) < 0) {
             perror("main.read.read_shm_byte_failed");
             return_to_cleanup(1);
         }
+        fprintf(stdout, "%c\n", modbyte);
+        return_to_cleanup(0);
+    }
 
-        char c = (char)modbyte;
-
-        if (use_specific_char) {
-            if (c == specific_char) {
-                fprintf(stdout, "%c\n", c);
-                return_to_cleanup(0);
-            }
-        } else {
-            if (c != (char)last_byte) {
-                fprintf(stdout, "%c\n", c);
-                return_to_cleanup(0);
-            }
-        }
-        usleep(delay_us);
-    }    
+    if (wait_loop() < 0) {
+        perror("main.read.wait_for_change_failed");
+        return_to_cleanup(1);
+    }
     return_to_cleanup(0);
 }
@@ -0,0 +1,176 @@
+/*
+ * counter.c - rpi-modswitch pulse counting, frequency and duty-cycle lines
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the bucketed sliding-window counters described in
+ * counter.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "counter.h"
+#include "utils.h"
+
+#define DEFAULT_WINDOW_MS 1000
+
+static counter_t *counter_lookup(counter_set_t *set, const char *name) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (strcmp(set->c[i].name, name) == 0)
+            return &set->c[i];
+    }
+    if (set->n >= MODSW_MAX_COUNTERS || strlen(name) >= MODSW_NAME_MAX || !name[0])
+        return NULL;
+
+    counter_t *c = &set->c[set->n++];
+    memset(c, 0, sizeof(*c));
+    strcpy(c->name, name);
+    c->pin = -1;
+    c->bias = 1;
+    c->window_ns = DEFAULT_WINDOW_MS * 1000000ull;
+    c->req_index = -1;
+    return c;
+}
+
+bool counter_conf(counter_set_t *set, const char *name, const char *key, const char *value) {
+    counter_t *c = counter_lookup(set, name);
+    if (!c)
+        return false;
+
+    uintmax_t num;
+    if (strcmp(key, "pin") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 0xffff)
+            return false;
+        c->pin = (int)num;
+    } else if (strcmp(key, "bias") == 0) {
+        if (strcmp(value, "pullup") == 0)
+            c->bias = 1;
+        else if (strcmp(value, "pulldown") == 0)
+            c->bias = 0;
+        else if (strcmp(value, "disabled") == 0)
+            c->bias = -1;
+        else
+            return false;
+    } else if (strcmp(key, "window_ms") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < COUNTER_BUCKETS)
+            return false;
+        c->window_ns = (uint64_t)num * 1000000ull;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void counter_start(counter_t *c, int level, uint64_t now) {
+    c->level = level;
+    c->high_since = now;
+    c->cur = 0;
+    memset(c->bucket, 0, sizeof(c->bucket));
+    for (unsigned b = 0; b < COUNTER_BUCKETS; b++)
+        c->bucket[b].start_ns = now;
+    c->next_rotate_ns = now + c->window_ns / COUNTER_BUCKETS;
+}
+
+void counter_edge(counter_t *c, int rising, uint64_t ts, uint32_t line_seqno) {
+    if (c->last_seqno && line_seqno > c->last_seqno + 1)
+        c->overflows += line_seqno - c->last_seqno - 1;
+    c->last_seqno = line_seqno;
+
+    counter_bucket_t *b = &c->bucket[c->cur];
+    c->edges++;
+    c->last_edge_ns = ts;
+    if (rising) {
+        c->rising++;
+        if (b->rising++ == 0)
+            b->first_rise_ns = ts;
+        b->last_rise_ns = ts;
+        if (!c->level)
+            c->high_since = ts;
+        c->level = 1;
+    } else {
+        c->falling++;
+        if (c->level && ts > c->high_since)
+            b->high_ns += ts - c->high_since;
+        c->level = 0;
+    }
+}
+
+bool counter_timeout(counter_set_t *set, uint64_t now) {
+    bool rotated = false;
+    for (unsigned i = 0; i < set->n; i++) {
+        counter_t *c = &set->c[i];
+        uint64_t slice = c->window_ns / COUNTER_BUCKETS;
+        while (now >= c->next_rotate_ns) {
+            // Close the open high interval so high time stays in the bucket it belongs to.
+            if (c->level && c->next_rotate_ns > c->high_since) {
+                c->bucket[c->cur].high_ns += c->next_rotate_ns - c->high_since;
+                c->high_since = c->next_rotate_ns;
+            }
+            c->cur = (c->cur + 1) % COUNTER_BUCKETS;
+            memset(&c->bucket[c->cur], 0, sizeof(c->bucket[c->cur]));
+            c->bucket[c->cur].start_ns = c->next_rotate_ns;
+            c->next_rotate_ns += slice;
+            rotated = true;
+        }
+    }
+    return rotated;
+}
+
+uint64_t counter_next_deadline(const counter_set_t *set) {
+    uint64_t deadline = COUNTER_NO_DEADLINE;
+    for (unsigned i = 0; i < set->n; i++) {
+        if (set->c[i].next_rotate_ns < deadline)
+            deadline = set->c[i].next_rotate_ns;
+    }
+    return deadline;
+}
+
+void counter_publish(const counter_t *c, uint64_t now, modsw_counter_t *out) {
+    uint64_t first = UINT64_MAX, last = 0, high = 0, start = now;
+    uint64_t rising = 0;
+    for (unsigned b = 0; b < COUNTER_BUCKETS; b++) {
+        const counter_bucket_t *bk = &c->bucket[b];
+        if (bk->start_ns < start)
+            start = bk->start_ns;
+        high += bk->high_ns;
+        if (!bk->rising)
+            continue;
+        rising += bk->rising;
+        if (bk->first_rise_ns < first)
+            first = bk->first_rise_ns;
+        if (bk->last_rise_ns > last)
+            last = bk->last_rise_ns;
+    }
+    if (c->level && now > c->high_since)
+        high += now - c->high_since;
+
+    memcpy(out->name, c->name, MODSW_NAME_MAX);
+    out->pin = (uint32_t)c->pin;
+    out->window_ms = (uint32_t)(c->window_ns / 1000000ull);
+    out->edges = c->edges;
+    out->rising = c->rising;
+    out->falling = c->falling;
+    out->overflows = c->overflows;
+    out->last_edge_ns = c->last_edge_ns;
+    // Period from first to last rising edge in the window: exact for steady signals, no bucket quantization.
+    out->freq_mhz = (rising >= 2 && last > first) ? (rising - 1) * 1000000000000ull / (last - first) : 0;
+    out->duty_ppm = now > start ? (uint32_t)(high * 1000000ull / (now - start)) : 0;
+    out->level = (uint32_t)c->level;
+}
@@ -0,0 +1,126 @@
+/*
+ * counter.h - rpi-modswitch pulse counting, frequency and duty-cycle lines
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file turns kernel-timestamped edge events of spare input lines into
+ * 64-bit edge counts plus frequency and duty cycle over a sliding window.
+ * The window is split into COUNTER_BUCKETS buckets that are rotated from the
+ * daemon's timerfd, so each edge costs a few additions and the daemon reads
+ * edges in batches rather than with one syscall each.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+
+#define COUNTER_BUCKETS 8
+#define COUNTER_NO_DEADLINE UINT64_MAX
+
+typedef struct counter_bucket_t {
+    uint64_t start_ns;
+    uint64_t first_rise_ns;
+    uint64_t last_rise_ns;
+    uint64_t high_ns;
+    uint32_t rising;
+} counter_bucket_t;
+
+typedef struct counter_t {
+    char name[MODSW_NAME_MAX];
+    int pin;                    // -1 if not configured
+    int bias;                   // 1 = pull-up, 0 = pull-down, -1 = disabled
+    uint64_t window_ns;
+    int req_index;              // index in the daemon's line request
+
+    uint64_t edges;
+    uint64_t rising;
+    uint64_t falling;
+    uint64_t overflows;         // edges lost in the kernel queue (line_seqno gaps)
+    uint64_t last_edge_ns;
+    uint32_t last_seqno;
+    int level;
+    uint64_t high_since;
+    counter_bucket_t bucket[COUNTER_BUCKETS];
+    unsigned cur;
+    uint64_t next_rotate_ns;
+} counter_t;
+
+typedef struct counter_set_t {
+    counter_t c[MODSW_MAX_COUNTERS];
+    unsigned n;
+} counter_set_t;
+
+
+/**
+ * Apply one key of a [counter.NAME] configuration section.
+ *
+ * @param set    Counter set.
+ * @param name   Counter name (section suffix).
+ * @param key    One of pin, bias (pullup|pulldown|disabled), window_ms.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool counter_conf(counter_set_t *set, const char *name, const char *key, const char *value);
+
+/**
+ * Reset the measurement state of a counter.
+ *
+ * @param c      Counter.
+ * @param level  Current line level.
+ * @param now    Current time.
+ */
+void counter_start(counter_t *c, int level, uint64_t now);
+
+/**
+ * Account a kernel edge event.
+ *
+ * @param c           Counter.
+ * @param rising      Nonzero for a rising edge.
+ * @param ts          Kernel CLOCK_MONOTONIC timestamp.
+ * @param line_seqno  Per-line sequence number of the event.
+ */
+void counter_edge(counter_t *c, int rising, uint64_t ts, uint32_t line_seqno);
+
+/**
+ * Rotate expired window buckets.
+ *
+ * @param set    Counter set.
+ * @param now    Current time.
+ * @return       true if any counter rotated and should be published.
+ */
+bool counter_timeout(counter_set_t *set, uint64_t now);
+
+/**
+ * Earliest bucket rotation.
+ *
+ * @param set    Counter set.
+ * @return       Absolute CLOCK_MONOTONIC time, or COUNTER_NO_DEADLINE.
+ */
+uint64_t counter_next_deadline(const counter_set_t *set);
+
+/**
+ * Compute the published figures of a counter over its window.
+ *
+ * @param c      Counter.
+ * @param now    Current time.
+ * @param out    Shared memory record to fill.
+ */
+void counter_publish(const counter_t *c, uint64_t now, modsw_counter_t *out);
+
+#endif /* COUNTER_H */
@@ -0,0 +1,101 @@
+/*
+ * decode.c - rpi-modswitch raw line state to mode decoding
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file builds the raw-bits-to-mode lookup tables described in decode.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "decode.h"
+
+static const char * const scheme_names[] = {
+    [DECODE_BINARY] = "binary",
+    [DECODE_GRAY]   = "gray",
+    [DECODE_BCD]    = "bcd",
+    [DECODE_ONEHOT] = "onehot",
+};
+
+bool decode_scheme_from_str(const char *name, decode_scheme_t *scheme) {
+    for (size_t i = 0; i < sizeof(scheme_names)/sizeof(scheme_names[0]); i++) {
+        if (strcmp(name, scheme_names[i]) == 0) {
+            *scheme = (decode_scheme_t)i;
+            return true;
+        }
+    }
+    errno = EINVAL;
+    return false;
+}
+
+static int gray_to_binary(unsigned g) {
+    unsigned b = g;
+    while (g >>= 1)
+        b ^= g;
+    return (int)b;
+}
+
+static int bcd_to_index(unsigned raw, unsigned lines) {
+    int idx = 0;
+    int scale = 1;
+    for (unsigned shift = 0; shift < lines; shift += 4) {
+        unsigned digit = (raw >> shift) & 0x0f;
+        if (digit > 9)
+            return DECODE_INVALID;
+        idx += digit * scale;
+        scale *= 10;
+    }
+    return idx;
+}
+
+static int onehot_to_index(unsigned raw) {
+    if (raw == 0 || (raw & (raw - 1)))
+        return DECODE_INVALID;
+    return __builtin_ctz(raw);
+}
+
+int decode_build(decode_t *dec, decode_scheme_t scheme, unsigned lines) {
+    if (!dec || lines == 0 || lines > MODSW_MAX_LINES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned states = 1u << lines;
+    int max_idx = -1;
+    for (unsigned raw = 0; raw < (1u << MODSW_MAX_LINES); raw++) {
+        int idx = DECODE_INVALID;
+        if (raw < states) {
+            switch (scheme) {
+                case DECODE_BINARY: idx = (int)raw; break;
+                case DECODE_GRAY:   idx = gray_to_binary(raw); break;
+                case DECODE_BCD:    idx = bcd_to_index(raw, lines); break;
+                case DECODE_ONEHOT: idx = onehot_to_index(raw); break;
+                default:
+                    errno = EINVAL;
+                    return -1;
+            }
+        }
+        dec->lut[raw] = (int16_t)idx;
+        if (idx > max_idx)
+            max_idx = idx;
+    }
+    dec->nmodes = (unsigned)(max_idx + 1);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * decode.h - rpi-modswitch raw line state to mode decoding
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file maps the raw bits read from the switch lines to a mode index
+ * through a lookup table that is built once from the configured encoding
+ * scheme, so decoding on the sampling path is a single table load.
+ *
+ * Schemes:
+ *   - binary: raw bits are the mode index (the historic behaviour).
+ *   - gray:   raw bits are a reflected Gray code, as on most rotary switches.
+ *   - bcd:    every 4 lines form one decimal digit, line 0 is the LSB.
+ *   - onehot: exactly one line is active; any other combination is invalid.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+
+#define DECODE_INVALID -1
+
+typedef enum decode_scheme_t {
+    DECODE_BINARY = 0,
+    DECODE_GRAY,
+    DECODE_BCD,
+    DECODE_ONEHOT,
+} decode_scheme_t;
+
+typedef struct decode_t {
+    int16_t lut[1 << MODSW_MAX_LINES];  // raw bits -> mode index or DECODE_INVALID
+    unsigned nmodes;
+} decode_t;
+
+
+/**
+ * Look up an encoding scheme by its configuration name.
+ *
+ * @param name    Scheme name ("binary", "gray", "bcd" or "onehot").
+ * @param scheme  Pointer to store the scheme.
+ * @return        true if the name is known, false otherwise.
+ */
+bool decode_scheme_from_str(const char *name, decode_scheme_t *scheme);
+
+/**
+ * Build the lookup table for a scheme and line count.
+ *
+ * @param dec     Decoder to fill.
+ * @param scheme  Encoding scheme.
+ * @param lines   Number of switch lines, 1 to MODSW_MAX_LINES.
+ * @return        0 on success, -1 with errno set to EINVAL on bad arguments.
+ */
+int decode_build(decode_t *dec, decode_scheme_t scheme, unsigned lines);
+
+/**
+ * Decode raw line bits.
+ *
+ * @param dec     Decoder built by decode_build().
+ * @param raw     Raw line bits, line N in bit N.
+ * @return        Mode index, or DECODE_INVALID if the combination is rejected.
+ */
+static inline int decode_raw(const decode_t *dec, uint8_t raw) {
+    return dec->lut[raw];
+}
+
+#endif /* DECODE_H */
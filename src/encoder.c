@@ -0,0 +1,174 @@
+/*
+ * encoder.c - rpi-modswitch quadrature rotary encoder decoding
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the table-driven quadrature decoder described in
+ * encoder.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "encoder.h"
+#include "utils.h"
+
+/*
+ * Indexed by old_state << 2 | new_state with state = A << 1 | B. Clockwise is
+ * 00 -> 10 -> 11 -> 01 -> 00 (A leads B). An edge changes exactly one bit, so
+ * only the entries with a step are ever used.
+ */
+static const int8_t quad_table[16] = {
+     0, -1, +1,  0,
+    +1,  0,  0, -1,
+    -1,  0,  0, +1,
+     0, +1, -1,  0,
+};
+
+static encoder_t *encoder_lookup(encoder_set_t *set, const char *name) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (strcmp(set->e[i].name, name) == 0)
+            return &set->e[i];
+    }
+    if (set->n >= MODSW_MAX_ENCODERS || strlen(name) >= MODSW_NAME_MAX || !name[0])
+        return NULL;
+
+    encoder_t *e = &set->e[set->n++];
+    memset(e, 0, sizeof(*e));
+    strcpy(e->name, name);
+    e->pin_a = -1;
+    e->pin_b = -1;
+    e->bias = 1;
+    e->steps_per_detent = 4;
+    e->req_a = -1;
+    e->req_b = -1;
+    return e;
+}
+
+bool encoder_conf(encoder_set_t *set, const char *name, const char *key, const char *value) {
+    encoder_t *e = encoder_lookup(set, name);
+    if (!e)
+        return false;
+
+    uintmax_t num;
+    if (strcmp(key, "pin_a") == 0 || strcmp(key, "pin_b") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 0xffff)
+            return false;
+        if (key[4] == 'a')
+            e->pin_a = (int)num;
+        else
+            e->pin_b = (int)num;
+    } else if (strcmp(key, "bias") == 0) {
+        if (strcmp(value, "pullup") == 0)
+            e->bias = 1;
+        else if (strcmp(value, "pulldown") == 0)
+            e->bias = 0;
+        else if (strcmp(value, "disabled") == 0)
+            e->bias = -1;
+        else
+            return false;
+    } else if (strcmp(key, "steps_per_detent") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1 || num > 4)
+            return false;
+        e->steps_per_detent = (unsigned)num;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void encoder_start(encoder_t *e, int a, int b, uint64_t now) {
+    e->state = (uint8_t)((!!a << 1) | !!b);
+    e->last_detent_ns = now;
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b && (a < 0)) ? q - 1 : q;
+}
+
+void encoder_edge(encoder_t *e, int line_b, int level, uint64_t ts, uint32_t line_seqno) {
+    uint32_t *last = line_b ? &e->last_seqno_b : &e->last_seqno_a;
+    bool gap = *last && line_seqno > *last + 1;
+    if (gap)
+        e->overflows += line_seqno - *last - 1;
+    *last = line_seqno;
+
+    /*
+     * The same level twice on a line, or a gap in its sequence numbers,
+     * means an edge was lost or bounced away: the direction of this one is
+     * unknown, so only take over the level.
+     */
+    uint8_t bit = line_b ? 0x01 : 0x02;
+    uint8_t next = level ? (e->state | bit) : (e->state & ~bit);
+    if (next == e->state || gap) {
+        e->state = next;
+        e->invalid++;
+        return;
+    }
+    int8_t step = quad_table[e->state << 2 | next];
+    e->state = next;
+
+    e->position += step;
+    int64_t detent = floor_div(e->position, e->steps_per_detent);
+    if (detent == e->detent)
+        return;
+
+    uint64_t dt = ts > e->last_detent_ns ? ts - e->last_detent_ns : 1;
+    int64_t v = (int64_t)(1000000000000ull / dt) * (detent > e->detent ? 1 : -1);
+    // Smooth over a few detents so one slow or quick click does not dominate.
+    e->velocity_mdps = e->velocity_mdps ? (e->velocity_mdps * 3 + v) / 4 : v;
+    e->detent = detent;
+    e->last_detent_ns = ts;
+    e->changed = true;
+}
+
+bool encoder_timeout(encoder_set_t *set, uint64_t now) {
+    bool changed = false;
+    for (unsigned i = 0; i < set->n; i++) {
+        encoder_t *e = &set->e[i];
+        if (e->velocity_mdps && now - e->last_detent_ns >= ENCODER_IDLE_NS) {
+            e->velocity_mdps = 0;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+uint64_t encoder_next_deadline(const encoder_set_t *set) {
+    uint64_t deadline = ENCODER_NO_DEADLINE;
+    for (unsigned i = 0; i < set->n; i++) {
+        const encoder_t *e = &set->e[i];
+        if (e->velocity_mdps && e->last_detent_ns + ENCODER_IDLE_NS < deadline)
+            deadline = e->last_detent_ns + ENCODER_IDLE_NS;
+    }
+    return deadline;
+}
+
+void encoder_publish(const encoder_t *e, modsw_encoder_t *out) {
+    memcpy(out->name, e->name, MODSW_NAME_MAX);
+    out->pin_a = (uint32_t)e->pin_a;
+    out->pin_b = (uint32_t)e->pin_b;
+    out->position = e->position;
+    out->detent = e->detent;
+    out->velocity_mdps = e->velocity_mdps;
+    out->invalid = e->invalid;
+    out->overflows = e->overflows;
+    out->last_detent_ns = e->last_detent_ns;
+}
@@ -0,0 +1,121 @@
+/*
+ * encoder.h - rpi-modswitch quadrature rotary encoder decoding
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file decodes the A/B lines of an incremental rotary encoder from edge
+ * events. Every edge updates the 2-bit (A, B) state and a 16-entry transition
+ * table gives the step, +1 or -1. An edge that repeats its line's level, or
+ * follows a gap in the line's sequence numbers, is contact noise or a lost
+ * edge: it moves nothing and is only counted as invalid.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+
+#define ENCODER_NO_DEADLINE UINT64_MAX
+#define ENCODER_IDLE_NS 250000000ull    // velocity drops to 0 after this long without a detent
+
+typedef struct encoder_t {
+    char name[MODSW_NAME_MAX];
+    int pin_a;                  // -1 if not configured
+    int pin_b;
+    int bias;                   // 1 = pull-up, 0 = pull-down, -1 = disabled
+    unsigned steps_per_detent;
+    int req_a;                  // indexes in the daemon's line request
+    int req_b;
+
+    uint8_t state;              // A << 1 | B
+    int64_t position;           // quadrature steps
+    int64_t detent;
+    int64_t velocity_mdps;      // detents per second * 1000, signed
+    uint64_t invalid;
+    uint64_t overflows;
+    uint32_t last_seqno_a;
+    uint32_t last_seqno_b;
+    uint64_t last_detent_ns;
+    bool changed;               // detent moved since the last publish
+} encoder_t;
+
+typedef struct encoder_set_t {
+    encoder_t e[MODSW_MAX_ENCODERS];
+    unsigned n;
+} encoder_set_t;
+
+
+/**
+ * Apply one key of an [encoder.NAME] configuration section.
+ *
+ * @param set    Encoder set.
+ * @param name   Encoder name (section suffix).
+ * @param key    One of pin_a, pin_b, bias (pullup|pulldown|disabled),
+ *               steps_per_detent.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool encoder_conf(encoder_set_t *set, const char *name, const char *key, const char *value);
+
+/**
+ * Reset an encoder to the current line levels.
+ *
+ * @param e      Encoder.
+ * @param a      Level of line A.
+ * @param b      Level of line B.
+ * @param now    Current time.
+ */
+void encoder_start(encoder_t *e, int a, int b, uint64_t now);
+
+/**
+ * Account an edge event on line A or B.
+ *
+ * @param e           Encoder.
+ * @param line_b      Nonzero if the edge is on line B.
+ * @param level       New level of that line.
+ * @param ts          Kernel CLOCK_MONOTONIC timestamp.
+ * @param line_seqno  Per-line sequence number of the event.
+ */
+void encoder_edge(encoder_t *e, int line_b, int level, uint64_t ts, uint32_t line_seqno);
+
+/**
+ * Drop the velocity of encoders that stopped turning.
+ *
+ * @param set    Encoder set.
+ * @param now    Current time.
+ * @return       true if any encoder changed and should be published.
+ */
+bool encoder_timeout(encoder_set_t *set, uint64_t now);
+
+/**
+ * Earliest velocity timeout.
+ *
+ * @param set    Encoder set.
+ * @return       Absolute CLOCK_MONOTONIC time, or ENCODER_NO_DEADLINE.
+ */
+uint64_t encoder_next_deadline(const encoder_set_t *set);
+
+/**
+ * Fill the shared memory record of an encoder.
+ *
+ * @param e      Encoder.
+ * @param out    Shared memory record.
+ */
+void encoder_publish(const encoder_t *e, modsw_encoder_t *out);
+
+#endif /* ENCODER_H */
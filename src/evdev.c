@@ -0,0 +1,172 @@
+/*
+ * evdev.c - rpi-modswitch uinput input device sink
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the uinput sink described in evdev.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include "evdev.h"
+#include "utils.h"
+
+#define DEFAULT_NAME "modswitch"
+
+static void evdev_defaults(evdev_sink_t *e) {
+    if (e->sw_code_set)
+        return;
+    strcpy(e->name, DEFAULT_NAME);
+    for (unsigned i = 0; i < MODSW_MAX_LINES; i++)
+        e->sw_code[i] = -1;
+    e->fd = -1;
+    e->mode = -1;
+    e->sw_code_set = true;
+}
+
+bool evdev_conf(evdev_sink_t *e, const char *key, const char *value) {
+    evdev_defaults(e);
+
+    uintmax_t num;
+    unsigned idx;
+    int len = 0;
+    if (strcmp(key, "enable") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        e->enabled = num;
+    } else if (strcmp(key, "name") == 0) {
+        if (!value[0] || strlen(value) >= sizeof(e->name))
+            return false;
+        strcpy(e->name, value);
+    } else if (sscanf(key, "sw%u_code%n", &idx, &len) == 1 && key[len] == '\0') {
+        if (idx >= MODSW_MAX_LINES || !xstr2umax(value, 0, &num) || num > SW_MAX)
+            return false;
+        e->sw_code[idx] = (int)num;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int evdev_open(evdev_sink_t *e, unsigned lines) {
+    evdev_defaults(e);
+    if (!e->enabled)
+        return 0;
+
+    int err;
+    e->lines = lines;
+    e->fd = open(EVDEV_UINPUT_PATH, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (e->fd < 0)
+        return -1;
+
+    bool any_sw = false;
+    for (unsigned i = 0; i < lines; i++)
+        any_sw |= e->sw_code[i] >= 0;
+    if (ioctl(e->fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+        ioctl(e->fd, UI_SET_EVBIT, EV_MSC) < 0 ||
+        ioctl(e->fd, UI_SET_MSCBIT, MSC_SCAN) < 0 ||
+        (any_sw && ioctl(e->fd, UI_SET_EVBIT, EV_SW) < 0))
+        goto fail;
+    for (unsigned i = 0; i < lines; i++) {
+        if (e->sw_code[i] >= 0 && ioctl(e->fd, UI_SET_SWBIT, e->sw_code[i]) < 0)
+            goto fail;
+    }
+    for (unsigned m = 0; m < EVDEV_MODE_KEYS; m++) {
+        if (ioctl(e->fd, UI_SET_KEYBIT, BTN_TRIGGER_HAPPY1 + m) < 0)
+            goto fail;
+    }
+
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = 0x1d6b;           // Linux Foundation
+    setup.id.product = 0x4d53;          // "MS"
+    setup.id.version = 1;
+    snprintf(setup.name, sizeof(setup.name), "%s", e->name);
+    if (ioctl(e->fd, UI_DEV_SETUP, &setup) < 0 || ioctl(e->fd, UI_DEV_CREATE) < 0)
+        goto fail;
+    e->raw = 0;
+    e->mode = -1;
+    return 0;
+
+fail:
+    err = errno;
+    close(e->fd);
+    e->fd = -1;
+    errno = err;
+    return -1;
+}
+
+static void put_event(struct input_event *ev, unsigned *n, uint16_t type, uint16_t code, int32_t value) {
+    memset(&ev[*n], 0, sizeof(ev[*n]));
+    ev[*n].type = type;
+    ev[*n].code = code;
+    ev[*n].value = value;
+    (*n)++;
+}
+
+int evdev_publish(evdev_sink_t *e, uint8_t raw, unsigned mode) {
+    if (!e->enabled || e->fd < 0)
+        return 0;
+
+    // Lines, two mode keys, the scan code and the report go out in one write.
+    struct input_event ev[MODSW_MAX_LINES + 4];
+    unsigned n = 0;
+    for (unsigned i = 0; i < e->lines; i++) {
+        if (e->sw_code[i] >= 0 && (e->mode < 0 || ((raw ^ e->raw) & (1u << i))))
+            put_event(ev, &n, EV_SW, e->sw_code[i], !!(raw & (1u << i)));
+    }
+    if (e->mode >= 0 && e->mode < EVDEV_MODE_KEYS)
+        put_event(ev, &n, EV_KEY, BTN_TRIGGER_HAPPY1 + e->mode, 0);
+    if (mode < EVDEV_MODE_KEYS)
+        put_event(ev, &n, EV_KEY, BTN_TRIGGER_HAPPY1 + mode, 1);
+    put_event(ev, &n, EV_MSC, MSC_SCAN, (int32_t)mode);
+    put_event(ev, &n, EV_SYN, SYN_REPORT, 0);
+
+    e->raw = raw;
+    e->mode = (int)mode;
+    ssize_t len = write(e->fd, ev, n * sizeof(ev[0]));
+    if (len < 0)
+        return -1;
+    if ((size_t)len != n * sizeof(ev[0])) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int evdev_deliver(void *ctx, const sink_msg_t *msg) {
+    if (msg->ev.type != MODSW_EVENT_MODE)
+        return 0;
+    return evdev_publish(ctx, msg->raw, msg->ev.mode);
+}
+
+void evdev_close(evdev_sink_t *e) {
+    if (!e->enabled || e->fd < 0)
+        return;
+    ioctl(e->fd, UI_DEV_DESTROY);
+    close(e->fd);
+    e->fd = -1;
+}
@@ -0,0 +1,105 @@
+/*
+ * evdev.h - rpi-modswitch uinput input device sink
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file exposes published transitions as a standard evdev input device
+ * created through /dev/uinput, so consumers get kernel-queued, timestamped,
+ * poll()-able events without touching shared memory.
+ *
+ * On every published transition the sink writes one packet:
+ *   - EV_SW for every switch line that has an swN_code and changed level.
+ *   - EV_KEY release of the previous mode's key and press of the new one,
+ *     BTN_TRIGGER_HAPPY1 + mode, for the first EVDEV_MODE_KEYS modes.
+ *   - EV_MSC MSC_SCAN with the mode index, for every mode.
+ *   - SYN_REPORT.
+ *
+ * Switch lines are not mapped to EV_SW codes by default: codes such as
+ * SW_LID or SW_RFKILL_ALL have system-wide meaning (logind suspends on a
+ * closed lid), so the mapping has to be chosen explicitly.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef EVDEV_H
+#define EVDEV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+#include "sink.h"
+
+#define EVDEV_UINPUT_PATH "/dev/uinput"
+#define EVDEV_MODE_KEYS 40              // BTN_TRIGGER_HAPPY1 .. BTN_TRIGGER_HAPPY40
+
+typedef struct evdev_sink_t {
+    bool enabled;
+    char name[80];                      // UINPUT_MAX_NAME_SIZE
+    int sw_code[MODSW_MAX_LINES];       // EV_SW code of each line, -1 = none
+    bool sw_code_set;                   // defaults applied
+
+    int fd;
+    unsigned lines;
+    uint8_t raw;                        // last written line levels
+    int mode;                           // last written mode, -1 = none yet
+} evdev_sink_t;
+
+
+/**
+ * Apply one key of the [uinput] configuration section.
+ *
+ * @param e      Sink.
+ * @param key    One of enable, name, swN_code.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool evdev_conf(evdev_sink_t *e, const char *key, const char *value);
+
+/**
+ * Create the uinput device. Does nothing if the sink is not enabled.
+ *
+ * @param e      Sink.
+ * @param lines  Number of switch lines.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int evdev_open(evdev_sink_t *e, unsigned lines);
+
+/**
+ * Write a published transition to the device.
+ *
+ * @param e      Sink.
+ * @param raw    Line levels of the published state, line N in bit N.
+ * @param mode   Published mode index.
+ * @return       0 on success or if the sink is closed, -1 with errno set.
+ */
+int evdev_publish(evdev_sink_t *e, uint8_t raw, unsigned mode);
+
+/**
+ * Sink delivery function: writes MODSW_EVENT_MODE messages with
+ * evdev_publish() and ignores the rest.
+ *
+ * @param ctx    The evdev_sink_t.
+ * @param msg    Message.
+ * @return       0 on success, -1 with errno set.
+ */
+int evdev_deliver(void *ctx, const sink_msg_t *msg);
+
+/**
+ * Destroy the device.
+ *
+ * @param e      Sink.
+ */
+void evdev_close(evdev_sink_t *e);
+
+#endif /* EVDEV_H */
@@ -0,0 +1,182 @@
+/*
+ * gesture.c - rpi-modswitch hold, long-press and toggle gesture recognizer
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the gesture state machines described in gesture.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "gesture.h"
+#include "utils.h"
+
+static const char * const type_names[] = {
+    [GESTURE_HOLD]      = "hold",
+    [GESTURE_LONGPRESS] = "longpress",
+    [GESTURE_TOGGLES]   = "toggles",
+};
+
+static gesture_t *gesture_lookup(gesture_set_t *set, const char *name) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (strcmp(set->g[i].name, name) == 0)
+            return &set->g[i];
+    }
+    if (set->n >= GESTURE_MAX || strlen(name) >= MODSW_NAME_MAX || !name[0])
+        return NULL;
+
+    gesture_t *g = &set->g[set->n++];
+    memset(g, 0, sizeof(*g));
+    strcpy(g->name, name);
+    g->line = -1;
+    g->type = GESTURE_HOLD;
+    g->time_ns = 1000000000ull;
+    g->count = 2;
+    return g;
+}
+
+bool gesture_conf(gesture_set_t *set, const char *name, const char *key, const char *value) {
+    gesture_t *g = gesture_lookup(set, name);
+    if (!g)
+        return false;
+
+    uintmax_t num;
+    if (strcmp(key, "line") == 0) {
+        if (!xstr2umax(value, 10, &num) || num >= MODSW_MAX_LINES)
+            return false;
+        g->line = (int)num;
+    } else if (strcmp(key, "type") == 0) {
+        for (size_t i = 0; i < sizeof(type_names)/sizeof(type_names[0]); i++) {
+            if (strcmp(value, type_names[i]) == 0) {
+                g->type = (gesture_type_t)i;
+                return true;
+            }
+        }
+        return false;
+    } else if (strcmp(key, "time_ms") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        g->time_ns = (uint64_t)num * 1000000ull;
+    } else if (strcmp(key, "count") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1)
+            return false;
+        g->count = (unsigned)num;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int gesture_init(gesture_set_t *set, unsigned lines, uint64_t debounce_ns, uint8_t raw, uint64_t now) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (set->g[i].line < 0 || (unsigned)set->g[i].line >= lines) {
+            fprintf(stderr, "gesture.init.invalid_line: gesture '%s' needs a line below %u\n", set->g[i].name, lines);
+            return -1;
+        }
+        set->g[i].fired = raw & (1u << set->g[i].line);    // no hold for a line already active at startup
+        set->g[i].toggles = 0;
+    }
+    set->debounce_ns = debounce_ns;
+    set->level = raw;
+    set->pending = raw;
+    for (unsigned l = 0; l < MODSW_MAX_LINES; l++) {
+        set->edge_ns[l] = now;
+        set->active_since[l] = now;
+    }
+    return 0;
+}
+
+static void line_edge(gesture_set_t *set, unsigned line, bool active, uint64_t ts, gesture_cb cb, void *user) {
+    uint64_t held = ts - set->active_since[line];
+    if (active)
+        set->active_since[line] = ts;
+
+    for (unsigned i = 0; i < set->n; i++) {
+        gesture_t *g = &set->g[i];
+        if ((unsigned)g->line != line)
+            continue;
+        switch (g->type) {
+            case GESTURE_HOLD:
+                g->fired = false;
+                break;
+            case GESTURE_LONGPRESS:
+                if (!active && held >= g->time_ns)
+                    cb(user, i, g, ts, (uint32_t)(held / 1000000ull));
+                break;
+            case GESTURE_TOGGLES:
+                if (g->toggles == 0 || ts - g->first_edge_ns > g->time_ns) {
+                    g->first_edge_ns = ts;
+                    g->toggles = 0;
+                }
+                if (++g->toggles >= g->count) {
+                    cb(user, i, g, ts, g->toggles);
+                    g->toggles = 0;
+                }
+                break;
+        }
+    }
+}
+
+void gesture_sample(gesture_set_t *set, uint8_t raw, uint64_t now, gesture_cb cb, void *user) {
+    if (set->n == 0)
+        return;
+
+    // A changed line has to stay put for debounce_ns; its edge is dated at the first sample that saw it.
+    uint8_t changed = raw ^ set->pending;
+    for (unsigned l = 0; changed >> l; l++) {
+        if (changed & (1u << l))
+            set->edge_ns[l] = now;
+    }
+    set->pending = raw;
+
+    uint8_t diff = set->pending ^ set->level;
+    for (unsigned l = 0; diff >> l; l++) {
+        if (!(diff & (1u << l)) || now - set->edge_ns[l] < set->debounce_ns)
+            continue;
+        set->level ^= (uint8_t)(1u << l);
+        line_edge(set, l, set->level & (1u << l), set->edge_ns[l], cb, user);
+    }
+}
+
+void gesture_timeout(gesture_set_t *set, uint64_t now, gesture_cb cb, void *user) {
+    for (unsigned i = 0; i < set->n; i++) {
+        gesture_t *g = &set->g[i];
+        if (g->type != GESTURE_HOLD || g->fired || !(set->level & (1u << g->line)))
+            continue;
+        if (now - set->active_since[g->line] >= g->time_ns) {
+            g->fired = true;
+            cb(user, i, g, set->active_since[g->line] + g->time_ns, (uint32_t)(g->time_ns / 1000000ull));
+        }
+    }
+}
+
+uint64_t gesture_next_deadline(const gesture_set_t *set) {
+    uint64_t deadline = GESTURE_NO_DEADLINE;
+    for (unsigned i = 0; i < set->n; i++) {
+        const gesture_t *g = &set->g[i];
+        if (g->type != GESTURE_HOLD || g->fired || !(set->level & (1u << g->line)))
+            continue;
+        uint64_t t = set->active_since[g->line] + g->time_ns;
+        if (t < deadline)
+            deadline = t;
+    }
+    return deadline;
+}
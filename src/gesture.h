@@ -0,0 +1,127 @@
+/*
+ * gesture.h - rpi-modswitch hold, long-press and toggle gesture recognizer
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file turns debounced edges of individual switch lines into gestures,
+ * so the same lines can double as buttons. Each line runs a small state
+ * machine driven by edge timestamps; the only timer it needs (for `hold`) is
+ * reported through gesture_next_deadline() so the daemon can fold it into
+ * its single timerfd.
+ *
+ * Gesture types:
+ *   - hold:      line active for time_ms; fires while still held.
+ *   - longpress: line released after being active for at least time_ms.
+ *   - toggles:   `count` edges on the line within time_ms.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+
+#define GESTURE_MAX 16
+#define GESTURE_NO_DEADLINE UINT64_MAX
+
+typedef enum gesture_type_t {
+    GESTURE_HOLD = 0,
+    GESTURE_LONGPRESS,
+    GESTURE_TOGGLES,
+} gesture_type_t;
+
+typedef struct gesture_t {
+    char name[MODSW_NAME_MAX];
+    int line;                   // switch line index, -1 if not configured
+    gesture_type_t type;
+    uint64_t time_ns;
+    unsigned count;             // edges for GESTURE_TOGGLES
+
+    bool fired;                 // hold already reported for this press
+    unsigned toggles;
+    uint64_t first_edge_ns;
+} gesture_t;
+
+typedef struct gesture_set_t {
+    gesture_t g[GESTURE_MAX];
+    unsigned n;
+    uint64_t debounce_ns;
+    uint8_t level;              // debounced line levels, line N in bit N
+    uint8_t pending;            // raw levels that still have to stay stable
+    uint64_t edge_ns[MODSW_MAX_LINES];      // first sample of a pending change
+    uint64_t active_since[MODSW_MAX_LINES];
+} gesture_set_t;
+
+/* Called for every recognized gesture; arg is the held time in ms for
+ * hold/longpress and the edge count for toggles. */
+typedef void (*gesture_cb)(void *user, unsigned index, const gesture_t *g, uint64_t ts, uint32_t arg);
+
+
+/**
+ * Apply one key of a [gesture.NAME] configuration section.
+ *
+ * @param set    Gesture set.
+ * @param name   Gesture name (section suffix).
+ * @param key    One of line, type, time_ms, count.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool gesture_conf(gesture_set_t *set, const char *name, const char *key, const char *value);
+
+/**
+ * Validate the configured gestures against the number of switch lines and
+ * reset their state.
+ *
+ * @param set          Gesture set.
+ * @param lines        Number of switch lines.
+ * @param debounce_ns  Time a line must be stable before its edge counts.
+ * @param raw          Current line levels.
+ * @param now          Current time.
+ * @return             0 on success, -1 on an invalid gesture.
+ */
+int gesture_init(gesture_set_t *set, unsigned lines, uint64_t debounce_ns, uint8_t raw, uint64_t now);
+
+/**
+ * Feed a sample of the raw line levels.
+ *
+ * @param set    Gesture set.
+ * @param raw    Raw line levels, line N in bit N.
+ * @param now    Sample time.
+ * @param cb     Callback for recognized gestures.
+ * @param user   Passed to cb.
+ */
+void gesture_sample(gesture_set_t *set, uint8_t raw, uint64_t now, gesture_cb cb, void *user);
+
+/**
+ * Fire gestures whose timers expired.
+ *
+ * @param set    Gesture set.
+ * @param now    Current time.
+ * @param cb     Callback for recognized gestures.
+ * @param user   Passed to cb.
+ */
+void gesture_timeout(gesture_set_t *set, uint64_t now, gesture_cb cb, void *user);
+
+/**
+ * Earliest pending gesture timer.
+ *
+ * @param set    Gesture set.
+ * @return       Absolute CLOCK_MONOTONIC time, or GESTURE_NO_DEADLINE.
+ */
+uint64_t gesture_next_deadline(const gesture_set_t *set);
+
+#endif /* GESTURE_H */
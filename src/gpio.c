@@ -0,0 +1,215 @@
+/*
+ * gpio.c - rpi-modswitch GPIO v2 line request helper
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the single-request line helper described in gpio.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "gpio.h"
+
+void gpio_req_init(gpio_req_t *req, const char *chip_path, const char *consumer) {
+    memset(req, 0, sizeof(*req));
+    req->chip_path = chip_path;
+    req->consumer = consumer;
+    req->chip_fd = -1;
+    req->fd = -1;
+}
+
+int gpio_req_index(const gpio_req_t *req, uint32_t offset) {
+    for (unsigned i = 0; i < req->n; i++) {
+        if (req->offsets[i] == offset)
+            return (int)i;
+    }
+    return -1;
+}
+
+int gpio_req_add(gpio_req_t *req, uint32_t offset, uint64_t flags) {
+    if (gpio_req_index(req, offset) >= 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (req->n >= GPIO_V2_LINES_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    req->offsets[req->n] = offset;
+    req->flags[req->n] = flags;
+    return (int)req->n++;
+}
+
+// Line flags the kernel reports back for a requested line, as far as we set them.
+#define INFO_FLAGS_MASK (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_ACTIVE_LOW | \
+                         GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING | \
+                         GPIO_V2_LINE_FLAG_OPEN_DRAIN | GPIO_V2_LINE_FLAG_OPEN_SOURCE | \
+                         GPIO_V2_LINE_FLAG_BIAS_PULL_UP | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN | GPIO_V2_LINE_FLAG_BIAS_DISABLED)
+
+// Issue the line request on the open chip.
+static int gpio_req_issue(gpio_req_t *req) {
+    struct gpio_v2_line_request lr;
+    memset(&lr, 0, sizeof(lr));
+    memcpy(lr.offsets, req->offsets, sizeof(uint32_t) * req->n);
+    snprintf(lr.consumer, sizeof(lr.consumer), "%s", req->consumer);
+    lr.num_lines = req->n;
+    lr.event_buffer_size = GPIO_EVENT_BUFFER_SIZE;
+
+    // Line 0's flags are the default; every other distinct flag set becomes an attribute.
+    lr.config.flags = req->flags[0];
+    uint64_t outputs = 0;
+    for (unsigned i = 0; i < req->n; i++) {
+        if (req->flags[i] & GPIO_V2_LINE_FLAG_OUTPUT)
+            outputs |= 1ull << i;
+        if (req->flags[i] == lr.config.flags)
+            continue;
+        unsigned a;
+        for (a = 0; a < lr.config.num_attrs; a++) {
+            if (lr.config.attrs[a].attr.flags == req->flags[i])
+                break;
+        }
+        if (a == lr.config.num_attrs) {
+            if (a >= GPIO_V2_LINE_NUM_ATTRS_MAX - 1) {  // keep one slot for output values
+                errno = E2BIG;
+                return -1;
+            }
+            lr.config.attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+            lr.config.attrs[a].attr.flags = req->flags[i];
+            lr.config.num_attrs++;
+        }
+        lr.config.attrs[a].mask |= 1ull << i;
+    }
+    if (outputs) {
+        struct gpio_v2_line_config_attribute *attr = &lr.config.attrs[lr.config.num_attrs++];
+        attr->attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        attr->attr.values = req->out_init;
+        attr->mask = outputs;
+    }
+
+    if (ioctl(req->chip_fd, GPIO_V2_GET_LINE_IOCTL, &lr) < 0)
+        return -1;
+    req->fd = lr.fd;
+    int fl = fcntl(req->fd, F_GETFL);
+    if (fl >= 0)
+        fcntl(req->fd, F_SETFL, fl | O_NONBLOCK);
+    return 0;
+}
+
+int gpio_req_open(gpio_req_t *req) {
+    req->chip_fd = open(req->chip_path, O_RDONLY | O_CLOEXEC);
+    if (req->chip_fd < 0)
+        return -1;
+    if (gpio_req_issue(req) < 0) {
+        int err = errno;
+        close(req->chip_fd);
+        req->chip_fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int gpio_req_watch(gpio_req_t *req) {
+    for (unsigned i = 0; i < req->n; i++) {
+        struct gpio_v2_line_info info;
+        memset(&info, 0, sizeof(info));
+        info.offset = req->offsets[i];
+        if (ioctl(req->chip_fd, GPIO_V2_GET_LINEINFO_WATCH_IOCTL, &info) < 0)
+            return -1;
+    }
+    int fl = fcntl(req->chip_fd, F_GETFL);
+    if (fl < 0 || fcntl(req->chip_fd, F_SETFL, fl | O_NONBLOCK) < 0)
+        return -1;
+    req->watching = true;
+    return 0;
+}
+
+ssize_t gpio_req_read_changes(const gpio_req_t *req, struct gpio_v2_line_info_changed *ev, size_t max) {
+    ssize_t len = read(req->chip_fd, ev, sizeof(*ev) * max);
+    if (len < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return len / (ssize_t)sizeof(*ev);
+}
+
+bool gpio_req_info_ok(const gpio_req_t *req, int idx, const struct gpio_v2_line_info *info) {
+    return (info->flags & GPIO_V2_LINE_FLAG_USED) &&
+           strncmp(info->consumer, req->consumer, sizeof(info->consumer)) == 0 &&
+           (info->flags & INFO_FLAGS_MASK) == (req->flags[idx] & INFO_FLAGS_MASK);
+}
+
+int gpio_req_reopen(gpio_req_t *req) {
+    if (req->fd >= 0)
+        close(req->fd);
+    req->fd = -1;
+    if (gpio_req_issue(req) < 0)
+        return -1;
+
+    // Our own release and request are queued on the watch by now; drop them and check the result directly.
+    if (req->watching) {
+        struct gpio_v2_line_info_changed ev[16];
+        while (gpio_req_read_changes(req, ev, sizeof(ev)/sizeof(ev[0])) > 0)
+            ;
+    }
+    for (unsigned i = 0; i < req->n; i++) {
+        struct gpio_v2_line_info info;
+        memset(&info, 0, sizeof(info));
+        info.offset = req->offsets[i];
+        if (ioctl(req->chip_fd, GPIO_V2_GET_LINEINFO_IOCTL, &info) < 0)
+            return -1;
+        if (!gpio_req_info_ok(req, (int)i, &info)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int gpio_req_get(const gpio_req_t *req, uint64_t mask, uint64_t *bits) {
+    struct gpio_v2_line_values values = { .bits = 0, .mask = mask };
+    if (ioctl(req->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+        return -1;
+    *bits = values.bits & mask;
+    return 0;
+}
+
+int gpio_req_set(const gpio_req_t *req, uint64_t mask, uint64_t bits) {
+    struct gpio_v2_line_values values = { .bits = bits, .mask = mask };
+    return ioctl(req->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+ssize_t gpio_req_read_events(const gpio_req_t *req, struct gpio_v2_line_event *ev, size_t max) {
+    ssize_t len = read(req->fd, ev, sizeof(*ev) * max);
+    if (len < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return len / (ssize_t)sizeof(*ev);
+}
+
+void gpio_req_close(gpio_req_t *req) {
+    if (req->fd >= 0)
+        close(req->fd);
+    if (req->chip_fd >= 0)
+        close(req->chip_fd);
+    req->fd = -1;
+    req->chip_fd = -1;
+    req->watching = false;
+}
@@ -0,0 +1,169 @@
+/*
+ * gpio.h - rpi-modswitch GPIO v2 line request helper
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file collects every line the daemon needs from a gpiochip, whatever
+ * its role (switch input, edge counter, ...), and requests all of them with a
+ * single GPIO v2 line request. Lines with different flags are expressed as
+ * per-line configuration attributes, so one file descriptor serves value
+ * reads, value writes and edge events for the whole chip.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <linux/gpio.h>
+
+#define GPIO_EVENT_BUFFER_SIZE 1024     // kernel side edge event queue of the request
+
+typedef struct gpio_req_t {
+    const char *chip_path;
+    const char *consumer;
+    int chip_fd;
+    int fd;                             // line request fd, -1 until opened
+    unsigned n;
+    uint32_t offsets[GPIO_V2_LINES_MAX];
+    uint64_t flags[GPIO_V2_LINES_MAX];  // GPIO_V2_LINE_FLAG_*
+    uint64_t out_init;                  // initial values of output lines, bit = request index
+    bool watching;                      // line info changes are queued on chip_fd
+} gpio_req_t;
+
+
+/**
+ * Prepare an empty request.
+ *
+ * @param req       Request to initialize.
+ * @param chip_path Path of the gpiochip character device.
+ * @param consumer  Consumer label shown by the kernel.
+ */
+void gpio_req_init(gpio_req_t *req, const char *chip_path, const char *consumer);
+
+/**
+ * Add a line to the request before it is opened.
+ *
+ * @param req       Request.
+ * @param offset    Line offset on the chip.
+ * @param flags     GPIO_V2_LINE_FLAG_* for this line.
+ * @return          Index of the line in the request (bit position in value
+ *                  masks), or -1 with errno set (EEXIST, ENOSPC).
+ */
+int gpio_req_add(gpio_req_t *req, uint32_t offset, uint64_t flags);
+
+/**
+ * Index of an already added line.
+ *
+ * @param req       Request.
+ * @param offset    Line offset on the chip.
+ * @return          Index, or -1 if the line is not part of the request.
+ */
+int gpio_req_index(const gpio_req_t *req, uint32_t offset);
+
+/**
+ * Issue the line request.
+ *
+ * @param req       Request.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int gpio_req_open(gpio_req_t *req);
+
+/**
+ * Watch the info of every requested line, so that changes made by anyone
+ * else (another process, a driver) queue a gpio_v2_line_info_changed on
+ * chip_fd, which becomes non-blocking. Nothing is queued while the lines
+ * are left alone.
+ *
+ * @param req       Opened request.
+ * @return          0 on success, -1 with errno set on failure (ENOTTY on
+ *                  kernels without the v2 watch).
+ */
+int gpio_req_watch(gpio_req_t *req);
+
+/**
+ * Read a batch of queued line info changes without blocking.
+ *
+ * @param req       Watched request.
+ * @param ev        Destination array.
+ * @param max       Capacity of ev.
+ * @return          Number of changes, 0 if none are queued, -1 on failure.
+ */
+ssize_t gpio_req_read_changes(const gpio_req_t *req, struct gpio_v2_line_info_changed *ev, size_t max);
+
+/**
+ * Whether line info still shows a line as requested by us, with the
+ * direction, bias, polarity and edge flags we asked for.
+ *
+ * @param req       Request.
+ * @param idx       Index of the line in the request.
+ * @param info      Line info reported by the kernel.
+ * @return          true if the line is configured as requested.
+ */
+bool gpio_req_info_ok(const gpio_req_t *req, int idx, const struct gpio_v2_line_info *info);
+
+/**
+ * Release the lines and request them again with the original flags on the
+ * open chip, keeping the watch. The changes caused by the re-request itself
+ * are discarded, then every line's info is checked. The line request fd
+ * changes.
+ *
+ * @param req       Opened request.
+ * @return          0 on success, -1 with errno set on failure (EIO if a
+ *                  line still is not configured as requested); the lines
+ *                  may then not be requested at all (fd == -1).
+ */
+int gpio_req_reopen(gpio_req_t *req);
+
+/**
+ * Read line values with one ioctl.
+ *
+ * @param req       Opened request.
+ * @param mask      Lines to read, bit = request index.
+ * @param bits      Receives the values.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int gpio_req_get(const gpio_req_t *req, uint64_t mask, uint64_t *bits);
+
+/**
+ * Set output line values with one ioctl.
+ *
+ * @param req       Opened request.
+ * @param mask      Lines to set, bit = request index.
+ * @param bits      Values.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int gpio_req_set(const gpio_req_t *req, uint64_t mask, uint64_t bits);
+
+/**
+ * Read a batch of queued edge events without blocking.
+ *
+ * @param req       Opened request.
+ * @param ev        Destination array.
+ * @param max       Capacity of ev.
+ * @return          Number of events, 0 if none are queued, -1 on failure.
+ */
+ssize_t gpio_req_read_events(const gpio_req_t *req, struct gpio_v2_line_event *ev, size_t max);
+
+/**
+ * Release the lines and close the chip.
+ *
+ * @param req       Request.
+ */
+void gpio_req_close(gpio_req_t *req);
+
+#endif /* GPIO_H */
@@ -0,0 +1,282 @@
+/*
+ * group.c - rpi-modswitch additional switch groups
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the switch groups described in group.h. A group runs
+ * the same settle and decode steps as the main switch, on its own bits of
+ * every sample.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "group.h"
+#include "utils.h"
+
+#define AREA_SIZE(size) (((size) + 7) & ~(size_t)7)
+
+static bool valid_name(const char *name) {
+    if (!name[0] || strlen(name) >= MODSW_NAME_MAX)
+        return false;
+    for (const char *p = name; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '-' || *p == '_'))
+            return false;
+    }
+    return true;
+}
+
+static group_t *group_lookup(group_set_t *set, const char *name) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (strcmp(set->g[i].name, name) == 0)
+            return &set->g[i];
+    }
+    if (set->n >= GROUP_MAX || !valid_name(name))
+        return NULL;
+
+    group_t *g = &set->g[set->n++];
+    memset(g, 0, sizeof(*g));
+    strcpy(g->name, name);
+    for (unsigned i = 0; i < MODSW_MAX_LINES; i++) {
+        g->sw_pin[i] = -1;
+        g->req_index[i] = -1;
+    }
+    g->pullupdown = 1;
+    g->scheme = DECODE_BINARY;
+    g->shm_fd = -1;
+    return g;
+}
+
+bool group_conf(group_set_t *set, const char *name, const char *key, const char *value) {
+    group_t *g = group_lookup(set, name);
+    if (!g)
+        return false;
+
+    uintmax_t num;
+    unsigned idx;
+    int len = 0;
+    if (sscanf(key, "sw%u_pin%n", &idx, &len) == 1 && key[len] == '\0') {
+        if (idx >= MODSW_MAX_LINES || !xstr2umax(value, 10, &num) || num > 0xffff)
+            return false;
+        g->sw_pin[idx] = (int)num;
+    } else if (sscanf(key, "mode%u_name%n", &idx, &len) == 1 && key[len] == '\0') {
+        if (idx >= MODSW_MAX_MODES || strlen(value) >= MODSW_NAME_MAX)
+            return false;
+        strcpy(g->mode_name[idx], value);
+    } else if (strcmp(key, "pullupdown") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        g->pullupdown = (int)num;
+    } else if (strcmp(key, "scheme") == 0) {
+        return decode_scheme_from_str(value, &g->scheme);
+    } else if (strcmp(key, "settle_us") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        g->settle_ns = (uint64_t)num * 1000;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int group_set_add_lines(group_set_t *set, gpio_req_t *req, uint64_t edge_flags) {
+    set->mask = 0;
+    for (unsigned i = 0; i < set->n; i++) {
+        group_t *g = &set->g[i];
+        uint64_t flags = GPIO_V2_LINE_FLAG_INPUT | edge_flags;
+        if (g->pullupdown)
+            flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP | GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+        else
+            flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+        for (unsigned l = 0; l < g->lines; l++) {
+            g->req_index[l] = gpio_req_add(req, (uint32_t)g->sw_pin[l], flags);
+            if (g->req_index[l] < 0)
+                return -1;
+            set->mask |= 1ull << g->req_index[l];
+        }
+    }
+    return 0;
+}
+
+/*
+ * Same layout as the main region, minus the areas a group never has: header,
+ * accounting, event ring and wake words.
+ */
+static int group_open(group_t *g, bool named) {
+    if (decode_build(&g->decoder, g->scheme, g->lines) < 0)
+        return -1;
+    for (unsigned m = 0; m < g->decoder.nmodes; m++) {
+        if (g->mode_name[m][0] == '\0')
+            snprintf(g->mode_name[m], MODSW_NAME_MAX, "%u", m);
+    }
+
+    size_t header_size = AREA_SIZE(sizeof(modsw_shm_t));
+    size_t acct_size = AREA_SIZE(sizeof(modsw_acct_t) + sizeof(uint32_t) * g->decoder.nmodes * g->decoder.nmodes);
+    size_t events_size = AREA_SIZE(sizeof(modsw_events_t));
+    size_t wake_size = AREA_SIZE(sizeof(modsw_wake_t));
+    g->shm_size = header_size + acct_size + events_size + wake_size;
+
+    if (named) {
+        snprintf(g->shm_name, sizeof(g->shm_name), "%s%s", MODSW_SHM_GROUP_PREFIX, g->name);
+        g->shm_fd = shm_open(g->shm_name, O_RDWR | O_CREAT, 0666);
+        if (g->shm_fd < 0)
+            return -1;
+        if (ftruncate(g->shm_fd, (off_t)g->shm_size) < 0)
+            return -1;
+    }
+    void *ptr = mmap(NULL, g->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED | (named ? 0 : MAP_ANONYMOUS), g->shm_fd, 0);
+    if (ptr == MAP_FAILED)
+        return -1;
+    g->shm = ptr;
+
+    memset(g->shm, 0, g->shm_size);
+    g->shm->mode_char = '?';
+    g->shm->version = MODSW_SHM_VERSION;
+    g->shm->magic = MODSW_SHM_MAGIC;
+    g->shm->size = (uint32_t)g->shm_size;
+    g->shm->nmodes = (uint16_t)g->decoder.nmodes;
+    g->shm->acct_off = (uint32_t)header_size;
+    g->shm->acct_len = (uint32_t)acct_size;
+    g->shm->events_off = (uint32_t)(header_size + acct_size);
+    g->shm->wake_off = (uint32_t)(header_size + acct_size + events_size);
+    g->acct = (modsw_acct_t *)((uint8_t *)g->shm + g->shm->acct_off);
+    g->events = (modsw_events_t *)((uint8_t *)g->shm + g->shm->events_off);
+    g->wake = (modsw_wake_t *)((uint8_t *)g->shm + g->shm->wake_off);
+
+    g->published = -1;
+    g->settled = -1;
+    g->pending = -1;
+    return 0;
+}
+
+int group_set_open(group_set_t *set, uint64_t settle_ns, bool named) {
+    for (unsigned i = 0; i < set->n; i++) {
+        group_t *g = &set->g[i];
+        if (!g->settle_ns)
+            g->settle_ns = settle_ns;
+        if (group_open(g, named) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Called inside a shm write section, like the main switch's transition.
+static void group_transition(group_t *g, int mode, uint8_t raw, uint64_t now) {
+    modsw_acct_t *acct = g->acct;
+    if (g->published >= 0) {
+        acct->dwell_ns[g->published] += now - acct->entered_ns[g->published];
+        acct->pairs[g->published * g->decoder.nmodes + mode]++;
+    }
+    acct->entered_ns[mode] = now;
+    acct->entered_rt_ns[mode] = realtime_ns();
+    acct->entries[mode]++;
+
+    uint32_t from = g->published < 0 ? UINT32_MAX : (uint32_t)g->published;
+    g->published = mode;
+    g->shm->mode_char = modsw_mode_char(mode);
+    g->shm->raw = raw;
+    g->shm->mode = (uint16_t)mode;
+    memcpy(g->shm->name, g->mode_name[mode], MODSW_NAME_MAX);
+    g->shm->changed_ns = now;
+    g->shm->stats.transitions++;
+
+    uint64_t head = g->events->head;
+    modsw_event_t *ev = &g->events->ring[head % MODSW_EVENT_RING];
+    memset(ev, 0, sizeof(*ev));
+    ev->seq = head;
+    ev->ts_ns = now;
+    ev->type = MODSW_EVENT_MODE;
+    ev->mode = (uint16_t)mode;
+    ev->arg = from;
+    memcpy(ev->name, g->shm->name, MODSW_NAME_MAX);
+    __atomic_store_n(&g->events->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void group_sample(group_t *g, uint64_t bits, uint64_t now) {
+    uint8_t raw = 0;
+    for (unsigned l = 0; l < g->lines; l++)
+        raw |= (uint8_t)((bits >> g->req_index[l] & 1) << l);
+
+    if (raw != g->pending) {
+        if (g->pending != g->settled) {
+            modsw_shm_write_begin(g->shm);
+            g->shm->stats.coalesced++;
+            modsw_shm_write_end(g->shm);
+        }
+        g->pending = raw;
+        g->pending_since = now;
+    }
+    if (g->pending == g->settled || now - g->pending_since < g->settle_ns)
+        return;
+
+    g->settled = g->pending;
+    int mode = decode_raw(&g->decoder, raw);
+    bool switched = false;
+    modsw_shm_write_begin(g->shm);
+    if (mode == DECODE_INVALID) {
+        g->shm->flags |= MODSW_FLAG_INVALID;
+        g->shm->stats.invalid++;
+    } else {
+        g->shm->flags &= ~MODSW_FLAG_INVALID;
+        if (mode != g->published) {
+            group_transition(g, mode, raw, now);
+            switched = true;
+        }
+    }
+    modsw_shm_write_end(g->shm);
+    if (switched) {
+        futex_bump_shared(&g->wake->mode[mode]);
+        futex_bump_shared(&g->wake->change);
+    }
+}
+
+void group_set_sample(group_set_t *set, uint64_t bits, uint64_t now) {
+    for (unsigned i = 0; i < set->n; i++)
+        group_sample(&set->g[i], bits, now);
+}
+
+void group_set_flag(group_set_t *set, uint32_t flag, bool on) {
+    for (unsigned i = 0; i < set->n; i++) {
+        group_t *g = &set->g[i];
+        modsw_shm_write_begin(g->shm);
+        if (on)
+            g->shm->flags |= flag;
+        else
+            g->shm->flags &= ~flag;
+        modsw_shm_write_end(g->shm);
+    }
+}
+
+void group_set_close(group_set_t *set) {
+    for (unsigned i = 0; i < set->n; i++) {
+        group_t *g = &set->g[i];
+        if (g->shm)
+            munmap(g->shm, g->shm_size);
+        g->shm = NULL;
+        if (g->shm_fd >= 0) {
+            close(g->shm_fd);
+            shm_unlink(g->shm_name);
+        }
+        g->shm_fd = -1;
+    }
+}
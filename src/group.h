@@ -0,0 +1,135 @@
+/*
+ * group.h - rpi-modswitch additional switch groups
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file runs the [group.NAME] sections: switches that are independent of
+ * the main one, each with its own lines, decode scheme, settle window and
+ * mode names, published to its own shared memory object /modsw.NAME with the
+ * same layout as /modsw (state, accounting, event ring and wake words), so
+ * modsw_open_group() and cat4mod -g read it like the main switch.
+ *
+ * Group lines are added to the daemon's single line request and read by the
+ * same ioctl and sampling tick as the main switch lines, so another group
+ * costs a few more bits per read rather than another poll loop. Gestures,
+ * profiles, sinks, services and acknowledgments stay with the main switch.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "modsw_shm.h"
+#include "decode.h"
+#include "gpio.h"
+
+#define GROUP_MAX 4
+#define GROUP_SHM_NAME_MAX (sizeof(MODSW_SHM_GROUP_PREFIX) + MODSW_NAME_MAX)
+
+typedef struct group_t {
+    char name[MODSW_NAME_MAX];
+    int sw_pin[MODSW_MAX_LINES];    // swN_pin, -1 if not configured
+    unsigned lines;                 // set by the configuration checker
+    int pullupdown;                 // 1 = pull-up (lines active-low), 0 = pull-down
+    uint64_t settle_ns;             // 0 = the [user] settle_us of the main switch
+    decode_scheme_t scheme;
+    char mode_name[MODSW_MAX_MODES][MODSW_NAME_MAX];
+    int req_index[MODSW_MAX_LINES]; // index of each line in the daemon's line request
+
+    decode_t decoder;
+    char shm_name[GROUP_SHM_NAME_MAX];
+    int shm_fd;
+    size_t shm_size;
+    modsw_shm_t *shm;
+    modsw_acct_t *acct;
+    modsw_events_t *events;
+    modsw_wake_t *wake;
+    int published;                  // -1 until the first valid state settled
+    int settled;
+    int pending;
+    uint64_t pending_since;
+} group_t;
+
+typedef struct group_set_t {
+    group_t g[GROUP_MAX];
+    unsigned n;
+    uint64_t mask;                  // request indices of every group line
+} group_set_t;
+
+
+/**
+ * Apply one key of a [group.NAME] configuration section.
+ *
+ * @param set    Group set.
+ * @param name   Group name (section suffix), letters, digits, '-' and '_'.
+ * @param key    One of sw0_pin..sw7_pin, pullupdown, scheme, settle_us,
+ *               mode0_name..mode255_name.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool group_conf(group_set_t *set, const char *name, const char *key, const char *value);
+
+/**
+ * Add the lines of every group to the daemon's line request, after the
+ * main switch lines.
+ *
+ * @param set    Group set.
+ * @param req    Line request, not opened yet.
+ * @param edge_flags  GPIO_V2_LINE_FLAG_EDGE_* to request with every line, or 0.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int group_set_add_lines(group_set_t *set, gpio_req_t *req, uint64_t edge_flags);
+
+/**
+ * Build the decoders and create the shared memory object of every group.
+ *
+ * @param set        Group set.
+ * @param settle_ns  Settle window of groups that do not set their own.
+ * @param named      false to map private memory no reader can open, as a
+ *                   replay does.
+ * @return           0 on success, -1 with errno set on failure.
+ */
+int group_set_open(group_set_t *set, uint64_t settle_ns, bool named);
+
+/**
+ * Feed one sample of the line request to every group: settle, decode and
+ * publish transitions to the group's own region.
+ *
+ * @param set    Group set.
+ * @param bits   Values of the line request, covering set->mask.
+ * @param now    Time of the sample.
+ */
+void group_set_sample(group_set_t *set, uint64_t bits, uint64_t now);
+
+/**
+ * Set or clear a MODSW_FLAG_* in the region of every group.
+ *
+ * @param set    Group set.
+ * @param flag   Flag.
+ * @param on     true to set it, false to clear it.
+ */
+void group_set_flag(group_set_t *set, uint32_t flag, bool on);
+
+/**
+ * Unmap and remove the shared memory objects.
+ *
+ * @param set    Group set.
+ */
+void group_set_close(group_set_t *set);
+
+#endif /* GROUP_H */
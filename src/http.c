@@ -0,0 +1,519 @@
+/*
+ * http.c - rpi-modswitch loopback HTTP endpoint
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the HTTP server described in http.h. Every client has
+ * a fixed input and output buffer; nothing is allocated per request, and a
+ * write that does not fit closes the connection instead of growing memory.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#define _GNU_SOURCE     // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "http.h"
+#include "utils.h"
+
+#define DEFAULT_BIND "127.0.0.1"
+#define DEFAULT_PORT 8787
+#define DEFAULT_MAX_CLIENTS 8
+#define DEFAULT_POLL_S 30
+#define REQUEST_TIMEOUT_NS 10000000000ull
+#define KEEPALIVE_NS 15000000000ull
+#define JSON_MAX 768
+
+static void http_defaults(http_t *h) {
+    if (h->defaults)
+        return;
+    strcpy(h->bind, DEFAULT_BIND);
+    h->port = DEFAULT_PORT;
+    h->max_clients = DEFAULT_MAX_CLIENTS;
+    h->poll_ns = DEFAULT_POLL_S * 1000000000ull;
+    h->listen_fd = -1;
+    h->defaults = true;
+}
+
+bool http_conf(http_t *h, const char *key, const char *value) {
+    http_defaults(h);
+
+    uintmax_t num;
+    if (strcmp(key, "enable") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        h->enabled = num;
+    } else if (strcmp(key, "bind") == 0) {
+        if (!value[0] || strlen(value) >= sizeof(h->bind))
+            return false;
+        strcpy(h->bind, value);
+    } else if (strcmp(key, "port") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0 || num > 0xffff)
+            return false;
+        h->port = (uint16_t)num;
+    } else if (strcmp(key, "max_clients") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0 || num > HTTP_MAX_CLIENTS)
+            return false;
+        h->max_clients = (unsigned)num;
+    } else if (strcmp(key, "poll_s") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0 || num > 3600)
+            return false;
+        h->poll_ns = (uint64_t)num * 1000000000ull;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int http_open(http_t *h) {
+    http_defaults(h);
+    if (!h->enabled)
+        return 0;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%u", h->port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICHOST | AI_PASSIVE };
+    struct addrinfo *res;
+    int ret = getaddrinfo(h->bind, port, &hints, &res);
+    if (ret != 0) {
+        fprintf(stderr, "http.open.bad_bind_address: %s: %s\n", h->bind, gai_strerror(ret));
+        errno = EINVAL;
+        return -1;
+    }
+    h->listen_fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (h->listen_fd < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(h->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(h->listen_fd, res->ai_addr, res->ai_addrlen) < 0 || listen(h->listen_fd, 8) < 0) {
+        int err = errno;
+        freeaddrinfo(res);
+        close(h->listen_fd);
+        h->listen_fd = -1;
+        errno = err;
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    h->clients = calloc(h->max_clients, sizeof(http_client_t));
+    if (!h->clients) {
+        close(h->listen_fd);
+        h->listen_fd = -1;
+        return -1;
+    }
+    for (unsigned i = 0; i < h->max_clients; i++)
+        h->clients[i].fd = -1;
+    return 0;
+}
+
+int http_start(http_t *h, int epoll_fd, uint32_t tag, const modsw_shm_t *shm, const modsw_events_t *ring) {
+    if (!h->enabled)
+        return 0;
+    h->epoll_fd = epoll_fd;
+    h->tag = tag;
+    h->shm = shm;
+    h->ring = ring;
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = tag };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, h->listen_fd, &ev);
+}
+
+bool http_owns(const http_t *h, uint32_t tag) {
+    return h->enabled && tag >= h->tag && tag - h->tag <= h->max_clients;
+}
+
+static void drop_client(http_client_t *c) {
+    close(c->fd);           // also leaves the epoll set
+    c->fd = -1;
+    c->state = HTTP_FREE;
+    c->events = 0;
+}
+
+static void set_interest(http_t *h, http_client_t *c) {
+    uint32_t events = EPOLLIN | EPOLLRDHUP | (c->out_len ? EPOLLOUT : 0);
+    if (events == c->events)
+        return;
+    struct epoll_event ev = { .events = events, .data.u32 = h->tag + 1 + (uint32_t)(c - h->clients) };
+    if (epoll_ctl(h->epoll_fd, c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        perror("http.epoll.epoll_ctl_failed");
+        drop_client(c);
+        return;
+    }
+    c->events = events;
+}
+
+// Write as much of the output buffer as the socket takes; false if the client was dropped.
+static bool flush_client(http_t *h, http_client_t *c) {
+    size_t off = 0;
+    while (off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + off, c->out_len - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            drop_client(c);
+            return false;
+        }
+        off += (size_t)n;
+    }
+    memmove(c->out, c->out + off, c->out_len - off);
+    c->out_len -= off;
+    if (c->state == HTTP_DONE && c->out_len == 0) {
+        drop_client(c);
+        return false;
+    }
+    set_interest(h, c);
+    return c->fd >= 0;
+}
+
+static bool append(http_client_t *c, const char *data, size_t len) {
+    if (c->out_len + len > sizeof(c->out))
+        return false;
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return true;
+}
+
+// The event loop is the only writer of the shm, so no sequence lock is needed here.
+static int state_json(const http_t *h, char *buf, size_t size) {
+    const modsw_shm_t *shm = h->shm;
+    char name[MODSW_NAME_MAX * 6 + 1];
+    json_escape(name, sizeof(name), shm->name, MODSW_NAME_MAX);
+    return snprintf(buf, size,
+                    "{\"seq\":%" PRIu64 ",\"mode\":%u,\"char\":\"%c\",\"name\":\"%s\",\"raw\":%u,\"valid\":%s,\"nmodes\":%u"
+                    ",\"changed_ns\":%" PRIu64 ",\"transitions\":%" PRIu64 ",\"coalesced\":%" PRIu64 ",\"invalid\":%" PRIu64 ",\"gestures\":%" PRIu64 "}",
+                    h->state_seq, shm->mode, modsw_mode_char(shm->mode), name, shm->raw, (shm->flags & MODSW_FLAG_INVALID) ? "false" : "true", shm->nmodes,
+                    shm->changed_ns, shm->stats.transitions, shm->stats.coalesced, shm->stats.invalid, shm->stats.gestures);
+}
+
+static const char *event_type(uint16_t type) {
+    switch (type) {
+        case MODSW_EVENT_MODE: return "mode";
+        case MODSW_EVENT_GESTURE: return "gesture";
+        case MODSW_EVENT_DETENT: return "detent";
+        case MODSW_EVENT_KEY: return "key";
+        case MODSW_EVENT_INPUT: return "input";
+        default: return "unknown";
+    }
+}
+
+// SSE frame of one event; its id is the seq a reconnecting client passes back.
+static int event_frame(const modsw_event_t *ev, char *buf, size_t size) {
+    char name[MODSW_NAME_MAX * 6 + 1];
+    json_escape(name, sizeof(name), ev->name, MODSW_NAME_MAX);
+    return snprintf(buf, size,
+                    "id: %" PRIu64 "\nevent: %s\ndata: {\"seq\":%" PRIu64 ",\"type\":\"%s\",\"mode\":%u,\"line\":%u,\"gesture\":%u"
+                    ",\"arg\":%" PRIu32 ",\"name\":\"%s\",\"ts_ns\":%" PRIu64 "}\n\n",
+                    ev->seq + 1, event_type(ev->type), ev->seq + 1, event_type(ev->type), ev->mode, ev->line, ev->gesture,
+                    ev->arg, name, ev->ts_ns);
+}
+
+static void respond(http_t *h, http_client_t *c, const char *status, const char *type, const char *body) {
+    char hdr[256];
+    size_t len = strlen(body);
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n",
+                     status, type, len);
+    c->out_len = 0;
+    append(c, hdr, (size_t)n);
+    append(c, body, len);
+    c->state = HTTP_DONE;
+    flush_client(h, c);
+}
+
+static void respond_state(http_t *h, http_client_t *c) {
+    char body[JSON_MAX];
+    int n = state_json(h, body, sizeof(body) - 1);
+    if (n < 0 || (size_t)n >= sizeof(body) - 1)
+        n = snprintf(body, sizeof(body), "{}");
+    body[n++] = '\n';
+    body[n] = '\0';
+    respond(h, c, "200 OK", "application/json", body);
+}
+
+static void start_stream(http_t *h, http_client_t *c, bool replay, uint64_t now) {
+    static const char hdr[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-store\r\n"
+                              "Connection: keep-alive\r\n\r\nretry: 2000\n\n";
+    append(c, hdr, sizeof(hdr) - 1);
+    c->state = HTTP_SSE;
+    c->deadline_ns = now + KEEPALIVE_NS;
+
+    char buf[JSON_MAX];
+    if (!replay) {
+        // A fresh stream starts with the current state.
+        int n = state_json(h, buf, sizeof(buf));
+        if (n > 0 && (size_t)n < sizeof(buf)) {
+            append(c, "event: state\ndata: ", 19);
+            append(c, buf, (size_t)n);
+            append(c, "\n\n", 2);
+        }
+    } else {
+        // Everything after the client's last id that the ring still holds.
+        uint64_t head = h->ring->head;
+        uint64_t from = head > MODSW_EVENT_RING ? head - MODSW_EVENT_RING : 0;
+        if (c->since > from)
+            from = c->since;
+        for (uint64_t seq = from; seq < head; seq++) {
+            int n = event_frame(&h->ring->ring[seq % MODSW_EVENT_RING], buf, sizeof(buf));
+            if (n < 0 || (size_t)n >= sizeof(buf) || !append(c, buf, (size_t)n))
+                break;
+        }
+    }
+    flush_client(h, c);
+}
+
+static bool parse_since(const char *query, uint64_t *since) {
+    for (const char *p = query; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+        if (strncmp(p, "since=", 6) == 0) {
+            char num[24];
+            size_t len = strcspn(p + 6, "&");
+            uintmax_t v;
+            if (len == 0 || len >= sizeof(num))
+                return false;
+            memcpy(num, p + 6, len);
+            num[len] = '\0';
+            if (!xstr2umax(num, 10, &v))
+                return false;
+            *since = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool header_since(const char *headers, uint64_t *since) {
+    for (const char *p = strstr(headers, "\r\n"); p; p = strstr(p + 2, "\r\n")) {
+        if (strncasecmp(p + 2, "Last-Event-ID:", 14) != 0)
+            continue;
+        const char *v = p + 16;
+        while (*v == ' ' || *v == '\t')
+            v++;
+        char num[24];
+        size_t len = strcspn(v, " \t\r\n");
+        uintmax_t n;
+        if (len == 0 || len >= sizeof(num))
+            return false;
+        memcpy(num, v, len);
+        num[len] = '\0';
+        if (!xstr2umax(num, 10, &n))
+            return false;
+        *since = n;
+        return true;
+    }
+    return false;
+}
+
+static void handle_request(http_t *h, http_client_t *c, uint64_t now) {
+    char *end = strstr(c->in, "\r\n\r\n");
+    *end = '\0';
+    char *sp1 = strchr(c->in, ' ');
+    char *sp2 = sp1 ? strchr(sp1 + 1, ' ') : NULL;
+    if (!sp1 || !sp2 || strncmp(sp2 + 1, "HTTP/1.", 7) != 0) {
+        respond(h, c, "400 Bad Request", "text/plain", "bad request\n");
+        return;
+    }
+    *sp1 = '\0';
+    *sp2 = '\0';
+    char *target = sp1 + 1;
+    if (strcmp(c->in, "GET") != 0) {
+        respond(h, c, "405 Method Not Allowed", "text/plain", "only GET is supported\n");
+        return;
+    }
+    char *query = strchr(target, '?');
+    if (query)
+        *query++ = '\0';
+
+    uint64_t since;
+    bool has_since = parse_since(query, &since);
+    if (strcmp(target, "/state") == 0) {
+        if (!has_since || since < h->state_seq) {
+            respond_state(h, c);
+        } else {
+            c->state = HTTP_POLL;
+            c->since = since;
+            c->deadline_ns = now + h->poll_ns;
+            set_interest(h, c);
+        }
+    } else if (strcmp(target, "/events") == 0) {
+        if (!has_since)
+            has_since = header_since(sp2 + 1, &since);
+        c->since = has_since ? since : 0;
+        start_stream(h, c, has_since, now);
+    } else {
+        respond(h, c, "404 Not Found", "text/plain", "not found\n");
+    }
+}
+
+static void accept_clients(http_t *h, uint64_t now) {
+    while (1) {
+        int fd = accept4(h->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("http.accept.accept_failed");
+            return;
+        }
+        http_client_t *c = NULL;
+        for (unsigned i = 0; i < h->max_clients && !c; i++) {
+            if (h->clients[i].state == HTTP_FREE)
+                c = &h->clients[i];
+        }
+        if (!c) {
+            static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->state = HTTP_READ;
+        c->events = 0;
+        c->in_len = 0;
+        c->out_len = 0;
+        c->deadline_ns = now + REQUEST_TIMEOUT_NS;
+        set_interest(h, c);
+    }
+}
+
+static void read_client(http_t *h, http_client_t *c, uint64_t now) {
+    while (c->fd >= 0) {
+        char discard[256];
+        bool reading = c->state == HTTP_READ;
+        char *dst = reading ? c->in + c->in_len : discard;
+        size_t room = reading ? sizeof(c->in) - 1 - c->in_len : sizeof(discard);
+        if (room == 0) {
+            respond(h, c, "431 Request Header Fields Too Large", "text/plain", "request too large\n");
+            return;
+        }
+        ssize_t n = recv(c->fd, dst, room, MSG_DONTWAIT);
+        if (n == 0) {
+            drop_client(c);
+            return;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                drop_client(c);
+            return;
+        }
+        if (!reading)
+            continue;       // nothing more is expected once the request is in
+        c->in_len += (size_t)n;
+        c->in[c->in_len] = '\0';
+        if (strstr(c->in, "\r\n\r\n"))
+            handle_request(h, c, now);
+    }
+}
+
+void http_io(http_t *h, uint32_t tag, uint32_t events, uint64_t now) {
+    if (tag == h->tag) {
+        accept_clients(h, now);
+        return;
+    }
+    http_client_t *c = &h->clients[tag - h->tag - 1];
+    if (c->fd < 0)
+        return;
+    if (events & EPOLLERR) {
+        drop_client(c);
+        return;
+    }
+    if ((events & EPOLLOUT) && !flush_client(h, c))
+        return;
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+        read_client(h, c, now);
+}
+
+void http_timeout(http_t *h, uint64_t now) {
+    if (!h->enabled)
+        return;
+    for (unsigned i = 0; i < h->max_clients; i++) {
+        http_client_t *c = &h->clients[i];
+        if (c->state == HTTP_FREE || now < c->deadline_ns)
+            continue;
+        switch (c->state) {
+            case HTTP_READ:
+            case HTTP_DONE:
+                drop_client(c);
+                break;
+            case HTTP_POLL:
+                respond_state(h, c);        // unchanged, the client polls again
+                break;
+            case HTTP_SSE:
+                c->deadline_ns = now + KEEPALIVE_NS;
+                if (append(c, ": keepalive\n\n", 13))
+                    flush_client(h, c);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+uint64_t http_next_deadline(const http_t *h) {
+    uint64_t deadline = HTTP_NO_DEADLINE;
+    if (!h->enabled)
+        return deadline;
+    for (unsigned i = 0; i < h->max_clients; i++) {
+        if (h->clients[i].state != HTTP_FREE && h->clients[i].deadline_ns < deadline)
+            deadline = h->clients[i].deadline_ns;
+    }
+    return deadline;
+}
+
+int http_deliver(void *ctx, const sink_msg_t *msg) {
+    http_t *h = ctx;
+    if (msg->ev.type == MODSW_EVENT_MODE)
+        h->state_seq = msg->ev.seq + 1;
+
+    char buf[JSON_MAX];
+    int n = event_frame(&msg->ev, buf, sizeof(buf));
+    uint64_t now = monotonic_ns();
+    for (unsigned i = 0; i < h->max_clients; i++) {
+        http_client_t *c = &h->clients[i];
+        if (c->state == HTTP_POLL && h->state_seq > c->since) {
+            respond_state(h, c);
+        } else if (c->state == HTTP_SSE && n > 0 && (size_t)n < sizeof(buf)) {
+            if (!append(c, buf, (size_t)n)) {
+                fprintf(stderr, "http.stream.client_too_slow: dropping an event stream client\n");
+                drop_client(c);
+                continue;
+            }
+            c->deadline_ns = now + KEEPALIVE_NS;
+            flush_client(h, c);
+        }
+    }
+    return 0;
+}
+
+void http_close(http_t *h) {
+    if (!h->enabled || !h->clients)
+        return;
+    for (unsigned i = 0; i < h->max_clients; i++) {
+        if (h->clients[i].fd >= 0)
+            drop_client(&h->clients[i]);
+    }
+    if (h->listen_fd >= 0)
+        close(h->listen_fd);
+    h->listen_fd = -1;
+    free(h->clients);
+    h->clients = NULL;
+}
@@ -0,0 +1,172 @@
+/*
+ * http.h - rpi-modswitch loopback HTTP endpoint
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file is a tiny HTTP/1.1 server for local management UIs, run by the
+ * daemon's event loop like the MQTT client. It is off by default and binds to
+ * 127.0.0.1 unless told otherwise.
+ *
+ *   GET /state              current state as JSON, answered at once.
+ *   GET /state?since=SEQ    long-poll: answered once the state's seq is
+ *                           greater than SEQ, or with the unchanged state
+ *                           after poll_s seconds.
+ *   GET /events             Server-Sent Events stream of every event in the
+ *                           ring (mode, gesture, detent, key, input). A
+ *                           Last-Event-ID header or ?since=SEQ replays what
+ *                           the ring still holds after SEQ.
+ *
+ * The seq of a state is the event ring position just past the mode event
+ * that produced it, so a client simply passes back the seq it last saw.
+ * Responses other than SSE close the connection. A client that does not
+ * keep up with its SSE stream is disconnected once its buffer is full.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+#include "sink.h"
+
+#define HTTP_NO_DEADLINE UINT64_MAX
+#define HTTP_MAX_CLIENTS 32
+#define HTTP_IN_SIZE 2048
+#define HTTP_OUT_SIZE 16384
+
+typedef enum http_state_t {
+    HTTP_FREE = 0,
+    HTTP_READ,                  // reading the request
+    HTTP_POLL,                  // long-poll waiting for a newer state
+    HTTP_SSE,                   // event stream
+    HTTP_DONE,                  // response queued, close once written
+} http_state_t;
+
+typedef struct http_client_t {
+    int fd;
+    http_state_t state;
+    uint32_t events;            // registered epoll interest
+    uint64_t deadline_ns;       // request timeout, poll timeout or SSE keepalive
+    uint64_t since;
+    size_t in_len;
+    size_t out_len;
+    char in[HTTP_IN_SIZE];
+    char out[HTTP_OUT_SIZE];
+} http_client_t;
+
+typedef struct http_t {
+    bool enabled;
+    char bind[64];
+    uint16_t port;
+    unsigned max_clients;
+    uint64_t poll_ns;
+    bool defaults;
+
+    int listen_fd;
+    int epoll_fd;
+    uint32_t tag;               // listening socket; client i uses tag + 1 + i
+    const modsw_shm_t *shm;
+    const modsw_events_t *ring;
+    uint64_t state_seq;         // seq of the current state
+    http_client_t *clients;
+} http_t;
+
+
+/**
+ * Apply one key of the [http] configuration section.
+ *
+ * @param h      Server.
+ * @param key    One of enable, bind, port, max_clients, poll_s.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool http_conf(http_t *h, const char *key, const char *value);
+
+/**
+ * Bind the listening socket. Does nothing if the server is not enabled.
+ *
+ * @param h      Server.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int http_open(http_t *h);
+
+/**
+ * Attach to the daemon's epoll set and shared memory.
+ *
+ * @param h         Server.
+ * @param epoll_fd  Epoll instance.
+ * @param tag       epoll_data.u32 of the listening socket; tags up to
+ *                  tag + HTTP_MAX_CLIENTS are reserved for clients.
+ * @param shm       Daemon shared memory, source of /state.
+ * @param ring      Event ring, source of SSE replays.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int http_start(http_t *h, int epoll_fd, uint32_t tag, const modsw_shm_t *shm, const modsw_events_t *ring);
+
+/**
+ * Whether an epoll tag belongs to the server.
+ *
+ * @param h      Server.
+ * @param tag    epoll_data.u32 of an event.
+ * @return       true if http_io() should handle it.
+ */
+bool http_owns(const http_t *h, uint32_t tag);
+
+/**
+ * Handle readiness of the listening socket or of a client.
+ *
+ * @param h         Server.
+ * @param tag       epoll_data.u32 of the event.
+ * @param events    EPOLL* bits.
+ * @param now       Current time.
+ */
+void http_io(http_t *h, uint32_t tag, uint32_t events, uint64_t now);
+
+/**
+ * Run expired timers: request and long-poll timeouts, SSE keepalives.
+ *
+ * @param h      Server.
+ * @param now    Current time.
+ */
+void http_timeout(http_t *h, uint64_t now);
+
+/**
+ * Time of the next timer.
+ *
+ * @param h      Server.
+ * @return       Absolute CLOCK_MONOTONIC time, or HTTP_NO_DEADLINE.
+ */
+uint64_t http_next_deadline(const http_t *h);
+
+/**
+ * Sink delivery function: streams the event to SSE clients and answers
+ * long-polls on mode events. Must be drained by the event loop.
+ *
+ * @param ctx    The http_t.
+ * @param msg    Message.
+ * @return       0.
+ */
+int http_deliver(void *ctx, const sink_msg_t *msg);
+
+/**
+ * Close every connection and the listening socket.
+ *
+ * @param h      Server.
+ */
+void http_close(http_t *h);
+
+#endif /* HTTP_H */
@@ -0,0 +1,442 @@
+/*
+ * journal.c - rpi-modswitch on-disk transition journal
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the journal described in journal.h: the writer side
+ * used by modswitchd and the segment scanning and record decoding shared
+ * with journal4mod.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "journal.h"
+#include "utils.h"
+
+#define DEFAULT_SIZE (4u << 20)             // months of transitions at a few per hour
+#define MIN_SIZE (64u << 10)
+#define MAX_SIZE (1u << 30)
+#define DEFAULT_FLUSH_MS 60000
+#define DEFAULT_FLUSH_COUNT 32
+#define RETRY_NS 100000000ull               // sealing retry while the flusher is busy
+
+static void futex_wait(uint32_t *addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len--) {
+        crc ^= *p++;
+        for (unsigned k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+    }
+    return crc;
+}
+
+// CRC of a block with its crc field taken as 0.
+static uint32_t block_crc(const journal_block_t *b) {
+    journal_block_t hdr = *b;
+    hdr.crc = 0;
+    uint32_t crc = crc32_update(0xffffffffu, &hdr, sizeof(hdr));
+    return ~crc32_update(crc, b->data, b->len);
+}
+
+static uint32_t file_crc(const journal_file_t *f) {
+    journal_file_t hdr = *f;
+    hdr.crc = 0;
+    return ~crc32_update(0xffffffffu, &hdr, sizeof(hdr));
+}
+
+static size_t block_size(const journal_block_t *b) {
+    return (sizeof(*b) + b->len + 7) & ~(size_t)7;
+}
+
+static unsigned put_varint(uint8_t *p, uint64_t v) {
+    unsigned n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static bool get_varint(const uint8_t *p, unsigned len, unsigned *pos, uint64_t *v) {
+    *v = 0;
+    for (unsigned shift = 0; shift < 64 && *pos < len; shift += 7) {
+        uint8_t byte = p[(*pos)++];
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void journal_defaults(journal_t *j) {
+    if (j->defaults)
+        return;
+    strcpy(j->path, JOURNAL_DEFAULT_PATH);
+    j->size = DEFAULT_SIZE;
+    j->flush_ns = DEFAULT_FLUSH_MS * 1000000ull;
+    j->flush_count = DEFAULT_FLUSH_COUNT;
+    j->fd = -1;
+    j->defaults = true;
+}
+
+bool journal_conf(journal_t *j, const char *key, const char *value) {
+    journal_defaults(j);
+
+    uintmax_t num;
+    if (strcmp(key, "enable") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        j->enabled = num;
+    } else if (strcmp(key, "path") == 0) {
+        if (value[0] != '/' || strlen(value) >= sizeof(j->path))
+            return false;
+        strcpy(j->path, value);
+    } else if (strcmp(key, "size") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < MIN_SIZE || num > MAX_SIZE)
+            return false;
+        j->size = num & ~(uintmax_t)7;
+    } else if (strcmp(key, "flush_ms") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0 || num > 86400000)
+            return false;
+        j->flush_ns = (uint64_t)num * 1000000ull;
+    } else if (strcmp(key, "flush_count") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0 || num > (JOURNAL_BLOCK_MAX - sizeof(journal_block_t)) / JOURNAL_RECORD_MAX)
+            return false;
+        j->flush_count = (unsigned)num;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const journal_file_t *journal_header(const uint8_t *map, uint64_t size) {
+    const journal_file_t *f = (const journal_file_t *)map;
+    if (size < JOURNAL_DATA_OFF || f->magic != JOURNAL_FILE_MAGIC || f->version != JOURNAL_VERSION ||
+        f->crc != file_crc(f) || f->size > size || f->size < JOURNAL_DATA_OFF + JOURNAL_BLOCK_MAX)
+        return NULL;
+    return f;
+}
+
+static bool block_valid(const uint8_t *map, uint64_t size, uint64_t off) {
+    const journal_block_t *b = (const journal_block_t *)(map + off);
+    return b->len <= JOURNAL_BLOCK_MAX - sizeof(*b) && off + block_size(b) <= size && b->seq != 0 &&
+           b->crc == block_crc(b);
+}
+
+unsigned journal_scan(const uint8_t *map, uint64_t size,
+                      void (*fn)(void *user, uint64_t off, const journal_block_t *b), void *user) {
+    unsigned bad = 0;
+    uint64_t off = JOURNAL_DATA_OFF;
+    while (off + sizeof(journal_block_t) <= size) {
+        const journal_block_t *b = (const journal_block_t *)(map + off);
+        if (b->magic != JOURNAL_BLOCK_MAGIC) {
+            off += 8;
+        } else if (!block_valid(map, size, off)) {
+            bad++;
+            off += 8;
+        } else {
+            fn(user, off, b);
+            off += block_size(b);
+        }
+    }
+    return bad;
+}
+
+bool journal_record_next(const journal_block_t *b, unsigned *pos, int64_t prev, journal_record_t *rec) {
+    unsigned p = *pos;
+    uint64_t delta, mode;
+    if (p >= b->len || !get_varint(b->data, b->len, &p, &delta) || !get_varint(b->data, b->len, &p, &mode) ||
+        p >= b->len || (mode >> 1) >= MODSW_MAX_MODES)
+        return false;
+    rec->ts_us = prev + (int64_t)((delta >> 1) ^ -(delta & 1));    // zigzag
+    rec->mode = (uint16_t)(mode >> 1);
+    rec->start = mode & JOURNAL_MODE_START;
+    rec->raw = b->data[p++];
+    *pos = p;
+    return true;
+}
+
+typedef struct newest_t {
+    uint64_t seq;
+    uint64_t end;
+} newest_t;
+
+static void find_newest(void *user, uint64_t off, const journal_block_t *b) {
+    newest_t *n = user;
+    if (b->seq > n->seq) {
+        n->seq = b->seq;
+        n->end = off + block_size(b);
+    }
+}
+
+static int create_segment(journal_t *j) {
+    int err = posix_fallocate(j->fd, 0, (off_t)j->size);   // blocks never allocate or touch metadata later
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    j->map = mmap(NULL, j->size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+    if (j->map == MAP_FAILED) {
+        j->map = NULL;
+        return -1;
+    }
+    journal_file_t *f = (journal_file_t *)j->map;
+    f->magic = JOURNAL_FILE_MAGIC;
+    f->version = JOURNAL_VERSION;
+    f->size = j->size;
+    f->created_us = (int64_t)(realtime_ns() / 1000);
+    f->block_max = JOURNAL_BLOCK_MAX;
+    f->crc = file_crc(f);
+    return msync(j->map, j->size, MS_SYNC);     // only the header page is dirty
+}
+
+static void release(journal_t *j) {
+    if (j->map)
+        munmap(j->map, j->size);
+    j->map = NULL;
+    if (j->fd >= 0)
+        close(j->fd);
+    j->fd = -1;
+}
+
+static int open_segment(journal_t *j) {
+    char dir[PATH_MAX];
+    strcpy(dir, j->path);
+    char *slash = strrchr(dir, '/');
+    if (slash != dir) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+            return -1;
+    }
+    j->fd = open(j->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (j->fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(j->fd, &st) < 0)
+        return -1;
+    const journal_file_t *f = NULL;
+    if ((uint64_t)st.st_size >= JOURNAL_DATA_OFF) {
+        j->map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+        if (j->map == MAP_FAILED) {
+            j->map = NULL;
+            return -1;
+        }
+        f = journal_header(j->map, (uint64_t)st.st_size);
+        if (!f)
+            munmap(j->map, (size_t)st.st_size);
+    }
+    j->map = NULL;
+    if (!f) {
+        if (st.st_size)
+            fprintf(stderr, "journal.open.bad_header: %s is no journal segment, starting a new one\n", j->path);
+        if (ftruncate(j->fd, 0) < 0 || create_segment(j) < 0)
+            return -1;
+        j->write_off = JOURNAL_DATA_OFF;
+        j->next_seq = 1;
+        return 0;
+    }
+
+    if (f->size != j->size)
+        fprintf(stderr, "journal.open.size_kept: %s keeps its size of %" PRIu64 " bytes\n", j->path, f->size);
+    // Map exactly the segment; a longer file keeps its tail untouched.
+    uint64_t size = f->size;
+    munmap((void *)f, (size_t)st.st_size);
+    j->size = size;
+    j->map = mmap(NULL, j->size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+    if (j->map == MAP_FAILED) {
+        j->map = NULL;
+        return -1;
+    }
+
+    newest_t newest = { 0, JOURNAL_DATA_OFF };
+    journal_scan(j->map, j->size, find_newest, &newest);
+    j->next_seq = newest.seq + 1;
+    j->write_off = newest.end;
+    if (j->write_off + sizeof(journal_block_t) <= j->size &&
+        ((const journal_block_t *)(j->map + j->write_off))->magic == JOURNAL_BLOCK_MAGIC &&
+        !block_valid(j->map, j->size, j->write_off))
+        fprintf(stderr, "journal.open.torn_tail: discarded a partially written block at offset %" PRIu64 "\n", j->write_off);
+    return 0;
+}
+
+int journal_open(journal_t *j) {
+    journal_defaults(j);
+    if (!j->enabled)
+        return 0;
+    if (open_segment(j) < 0) {
+        int err = errno;
+        release(j);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Copy a sealed block into the mapping and wait until it is on the card.
+static void write_block(journal_t *j, const journal_block_t *b) {
+    size_t len = block_size(b);
+    if (j->write_off + len > j->size)
+        j->write_off = JOURNAL_DATA_OFF;    // wrap, the oldest blocks go first
+    memcpy(j->map + j->write_off, b, sizeof(*b) + b->len);
+    memset(j->map + j->write_off + sizeof(*b) + b->len, 0, len - sizeof(*b) - b->len);
+
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = j->write_off & ~(page - 1);
+    if (msync(j->map + start, j->write_off + len - start, MS_SYNC) < 0) {
+        perror("journal.flush.msync_failed");
+        __atomic_add_fetch(&j->failed, 1, __ATOMIC_RELAXED);
+    }
+    j->write_off += len;
+    __atomic_add_fetch(&j->blocks, 1, __ATOMIC_RELAXED);
+}
+
+static void *journal_flusher(void *arg) {
+    journal_t *j = arg;
+    while (1) {
+        uint32_t wake = __atomic_load_n(&j->wake, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&j->sealed_ready, __ATOMIC_ACQUIRE)) {
+            write_block(j, (const journal_block_t *)j->sealed_buf);
+            __atomic_store_n(&j->sealed_ready, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (__atomic_load_n(&j->stop, __ATOMIC_ACQUIRE))
+            break;
+        futex_wait(&j->wake, wake);
+    }
+    return NULL;
+}
+
+int journal_start(journal_t *j) {
+    if (!j->enabled)
+        return 0;
+    if ((errno = pthread_create(&j->thread, NULL, journal_flusher, j)) != 0)
+        return -1;
+    j->started = true;
+    return 0;
+}
+
+/*
+ * Hand the open block to the flusher. Fails while the flusher still owns the
+ * previous one; the records then stay in the open block.
+ */
+static bool seal(journal_t *j) {
+    journal_block_t *b = (journal_block_t *)j->block_buf;
+    if (__atomic_load_n(&j->sealed_ready, __ATOMIC_ACQUIRE)) {
+        j->retry_ns = monotonic_ns() + RETRY_NS;
+        return false;
+    }
+    b->magic = JOURNAL_BLOCK_MAGIC;
+    b->seq = j->next_seq++;
+    b->crc = block_crc(b);
+    memcpy(j->sealed_buf, b, sizeof(*b) + b->len);
+    memset(b, 0, sizeof(*b));
+    j->open_since_ns = 0;
+    j->retry_ns = 0;
+
+    __atomic_store_n(&j->sealed_ready, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&j->wake, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&j->wake);
+    return true;
+}
+
+int journal_deliver(void *ctx, const sink_msg_t *msg) {
+    journal_t *j = ctx;
+    if (msg->ev.type != MODSW_EVENT_MODE)
+        return 0;
+
+    journal_block_t *b = (journal_block_t *)j->block_buf;
+    if (sizeof(*b) + b->len + JOURNAL_RECORD_MAX > JOURNAL_BLOCK_MAX && !seal(j)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    int64_t ts = (int64_t)(msg->rt_ns / 1000);
+    if (b->count == 0) {
+        b->first_us = ts;
+        j->prev_us = ts;
+        j->open_since_ns = monotonic_ns();
+    }
+    int64_t delta = ts - j->prev_us;
+    uint64_t mode = (uint64_t)msg->ev.mode << 1 | (msg->ev.arg == UINT32_MAX ? JOURNAL_MODE_START : 0);
+    b->len += put_varint(b->data + b->len, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    b->len += put_varint(b->data + b->len, mode);
+    b->data[b->len++] = msg->raw;
+    b->last_us = ts;
+    b->count++;
+    j->prev_us = ts;
+    j->records++;
+
+    if (b->count >= j->flush_count)
+        seal(j);            // retried by journal_timeout() if the flusher is busy
+    return 0;
+}
+
+uint64_t journal_next_deadline(const journal_t *j) {
+    if (!j->enabled || !j->open_since_ns)
+        return JOURNAL_NO_DEADLINE;
+    uint64_t due = j->open_since_ns + j->flush_ns;
+    if (((const journal_block_t *)j->block_buf)->count >= j->flush_count)
+        due = 0;
+    return j->retry_ns > due ? j->retry_ns : due;
+}
+
+void journal_timeout(journal_t *j, uint64_t now) {
+    if (now >= journal_next_deadline(j))
+        seal(j);
+}
+
+void journal_close(journal_t *j) {
+    if (!j->enabled)
+        return;
+    if (j->started) {
+        __atomic_store_n(&j->stop, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&j->wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&j->wake);
+        pthread_join(j->thread, NULL);      // writes a pending sealed block first
+        j->started = false;
+    }
+    // Without a flusher, whatever is sealed or still open is written here.
+    for (unsigned i = 0; i < 2 && j->map; i++) {
+        if (j->sealed_ready) {
+            write_block(j, (const journal_block_t *)j->sealed_buf);
+            j->sealed_ready = 0;
+        }
+        if (((journal_block_t *)j->block_buf)->count)
+            seal(j);
+    }
+    release(j);
+}
@@ -0,0 +1,228 @@
+/*
+ * journal.h - rpi-modswitch on-disk transition journal
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file runs the [journal] sink: a long-lived audit trail of published
+ * mode transitions in one preallocated segment file, written through a
+ * shared mapping, for boards whose storage is an SD card.
+ *
+ * A transition costs a few bytes: the CLOCK_REALTIME delta to the previous
+ * record in microseconds (zigzag varint, so a clock step backwards still
+ * fits), the mode index with a daemon-start bit (varint) and the raw line
+ * bits. Records collect in an open block in memory and reach the file only
+ * when the block is sealed, after flush_count records or flush_ms after its
+ * first record, so the card sees one small write per batch instead of one
+ * per transition. Sealing happens in the event loop; a flusher thread copies
+ * the block into the mapping and msync()s it, so a slow card never stalls
+ * the switch.
+ *
+ * Every block carries a sequence number and a CRC-32 over header and
+ * payload. Blocks are appended one after another and the segment wraps
+ * around to its start when full, overwriting the oldest ones. On recovery
+ * every valid block is found by its magic and CRC, the newest one decides
+ * where writing continues, and a partially written block at the tail is
+ * detected and discarded. journal4mod decodes the segment and looks up the
+ * mode active at a given time by a binary search over the block index.
+ *
+ * Layout (little endian, all offsets 8-byte aligned):
+ *
+ *   journal_file_t        file header at offset 0
+ *   journal_block_t + records, ...   from JOURNAL_DATA_OFF
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include "sink.h"
+
+#define JOURNAL_FILE_MAGIC 0x314a534d       // "MSJ1"
+#define JOURNAL_BLOCK_MAGIC 0x4b4c424a      // "JBLK"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BLOCK_MAX 4096              // header and records of one block
+#define JOURNAL_RECORD_MAX 16               // longest encoded record
+#define JOURNAL_NO_DEADLINE UINT64_MAX
+#define JOURNAL_DEFAULT_PATH "/var/lib/modswitch/journal"
+
+#define JOURNAL_MODE_START 1                // record mode bit: first transition after a daemon start
+
+typedef struct journal_file_t {
+    uint32_t magic;             // JOURNAL_FILE_MAGIC
+    uint16_t version;           // JOURNAL_VERSION
+    uint16_t reserved;
+    uint64_t size;              // segment size in bytes, the file is preallocated to it
+    int64_t created_us;         // CLOCK_REALTIME when the segment was created
+    uint32_t block_max;         // JOURNAL_BLOCK_MAX of the writer
+    uint32_t crc;               // CRC-32 of this header with crc = 0
+} journal_file_t;
+
+#define JOURNAL_DATA_OFF ((sizeof(journal_file_t) + 7) & ~(size_t)7)
+
+typedef struct journal_block_t {
+    uint32_t magic;             // JOURNAL_BLOCK_MAGIC
+    uint32_t crc;               // CRC-32 of header and payload with crc = 0
+    uint64_t seq;               // increases by one per block, starts at 1
+    int64_t first_us;           // CLOCK_REALTIME of the first record
+    int64_t last_us;            // of the last record
+    uint16_t count;             // records
+    uint16_t len;               // payload bytes after the header
+    uint32_t reserved;
+    uint8_t data[];
+} journal_block_t;
+
+typedef struct journal_record_t {
+    int64_t ts_us;              // CLOCK_REALTIME
+    uint16_t mode;
+    uint8_t raw;
+    bool start;                 // first transition after the daemon started
+} journal_record_t;
+
+typedef struct journal_t {
+    bool enabled;
+    char path[PATH_MAX];
+    uint64_t size;
+    uint64_t flush_ns;
+    unsigned flush_count;
+    bool defaults;
+
+    int fd;
+    uint8_t *map;
+    uint64_t write_off;         // flusher thread only once started
+    uint64_t next_seq;
+
+    // Open block, event loop only.
+    uint64_t block_buf[JOURNAL_BLOCK_MAX / 8];
+    uint64_t open_since_ns;     // CLOCK_MONOTONIC of the first record, 0 = empty
+    uint64_t retry_ns;          // sealing waits for the flusher until then
+    int64_t prev_us;
+
+    // Sealed block, owned by the flusher thread while sealed_ready is set.
+    uint64_t sealed_buf[JOURNAL_BLOCK_MAX / 8];
+    uint32_t sealed_ready;
+    uint32_t wake;              // futex word
+    uint32_t stop;
+    pthread_t thread;
+    bool started;
+
+    uint64_t records;
+    uint64_t blocks;            // written by the flusher
+    uint64_t failed;            // blocks whose msync failed
+} journal_t;
+
+
+/**
+ * Apply one key of the [journal] configuration section.
+ *
+ * @param j      Journal.
+ * @param key    One of enable, path, size (bytes), flush_ms, flush_count.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool journal_conf(journal_t *j, const char *key, const char *value);
+
+/**
+ * Create or recover the segment file and map it. A file with a valid header
+ * keeps its size; writing continues after its newest valid block. Does
+ * nothing if the journal is not enabled.
+ *
+ * @param j      Journal.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int journal_open(journal_t *j);
+
+/**
+ * Start the flusher thread.
+ *
+ * @param j      Journal.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int journal_start(journal_t *j);
+
+/**
+ * Sink delivery function: appends MODSW_EVENT_MODE messages to the open
+ * block and seals it once it holds flush_count records. Never blocks.
+ *
+ * @param ctx    The journal_t.
+ * @param msg    Message.
+ * @return       0 on success, -1 with errno set to ENOBUFS if the block is
+ *               full while the flusher is still busy with the previous one.
+ */
+int journal_deliver(void *ctx, const sink_msg_t *msg);
+
+/**
+ * Time at which the open block is due for sealing.
+ *
+ * @param j      Journal.
+ * @return       Absolute CLOCK_MONOTONIC time, or JOURNAL_NO_DEADLINE.
+ */
+uint64_t journal_next_deadline(const journal_t *j);
+
+/**
+ * Seal the open block if it is due.
+ *
+ * @param j      Journal.
+ * @param now    Current time.
+ */
+void journal_timeout(journal_t *j, uint64_t now);
+
+/**
+ * Stop the flusher, write the open block synchronously and unmap the file.
+ *
+ * @param j      Journal.
+ */
+void journal_close(journal_t *j);
+
+/**
+ * Check a mapped file header.
+ *
+ * @param map    Start of the file.
+ * @param size   Size of the file.
+ * @return       Header, or NULL if the file is no journal segment.
+ */
+const journal_file_t *journal_header(const uint8_t *map, uint64_t size);
+
+/**
+ * Find every valid block of a segment, in file order.
+ *
+ * @param map    Start of the segment.
+ * @param size   Segment size from the header.
+ * @param fn     Called for each valid block with its offset.
+ * @param user   Passed to fn.
+ * @return       Number of block headers whose payload failed the length or
+ *               CRC check: a torn tail, or an old block partly overwritten
+ *               after the segment wrapped.
+ */
+unsigned journal_scan(const uint8_t *map, uint64_t size,
+                      void (*fn)(void *user, uint64_t off, const journal_block_t *b), void *user);
+
+/**
+ * Decode the next record of a block.
+ *
+ * @param b      Valid block.
+ * @param pos    Payload position, 0 for the first record; advanced.
+ * @param prev   Time of the previous record, b->first_us for the first.
+ * @param rec    Receives the record.
+ * @return       true if a record was decoded, false at the end or on a
+ *               malformed payload.
+ */
+bool journal_record_next(const journal_block_t *b, unsigned *pos, int64_t prev, journal_record_t *rec);
+
+#endif /* JOURNAL_H */
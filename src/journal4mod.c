@@ -0,0 +1,256 @@
+/*
+ * journal4mod.c - rpi-modswitch transition journal decoder
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * journal4mod reads the segment file written by the daemon's [journal] sink
+ * (see journal.h). It works on a copy or on the live file, and never writes.
+ *
+ * Features:
+ *   - Prints every recorded transition, oldest first.
+ *   - Answers which mode was active at a given time, by a binary search over
+ *     the block index and decoding a single block.
+ *   - Lists the block index, and reports damaged blocks (a torn tail or
+ *     blocks overwritten after the segment wrapped).
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "journal.h"
+//#include "version.h"
+#include "config.h"
+
+typedef struct block_ref_t {
+    uint64_t seq;
+    const journal_block_t *b;
+} block_ref_t;
+
+typedef struct block_index_t {
+    block_ref_t *ref;
+    size_t n;
+    size_t cap;
+} block_index_t;
+
+static const char *journal_file = JOURNAL_DEFAULT_PATH;
+static int use_list_blocks = 0;
+static int use_at_time = 0;
+static int64_t at_us;
+
+static void index_add(void *user, uint64_t off, const journal_block_t *b) {
+    (void)off;
+    block_index_t *idx = user;
+    if (idx->n == idx->cap) {
+        size_t cap = idx->cap ? idx->cap * 2 : 256;
+        block_ref_t *ref = realloc(idx->ref, cap * sizeof(*ref));
+        if (!ref) {
+            perror("index.add.realloc_failed");
+            exit(1);
+        }
+        idx->ref = ref;
+        idx->cap = cap;
+    }
+    idx->ref[idx->n++] = (block_ref_t){ b->seq, b };
+}
+
+static int by_seq(const void *a, const void *b) {
+    uint64_t x = ((const block_ref_t *)a)->seq, y = ((const block_ref_t *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+// "SECONDS[.FRACTION]" since the epoch, to microseconds.
+static bool parse_time(const char *str, int64_t *us) {
+    char *end;
+    errno = 0;
+    long long sec = strtoll(str, &end, 10);
+    if (errno || end == str)
+        return false;
+    int64_t frac = 0;
+    if (*end == '.') {
+        int digits = 0;
+        for (end++; *end >= '0' && *end <= '9'; end++) {
+            if (digits++ < 6)
+                frac = frac * 10 + (*end - '0');
+        }
+        for (; digits < 6; digits++)
+            frac *= 10;
+    }
+    if (*end != '\0')
+        return false;
+    *us = (int64_t)sec * 1000000 + (sec < 0 ? -frac : frac);
+    return true;
+}
+
+static void print_time(int64_t us) {
+    fprintf(stdout, "%" PRId64 ".%06" PRId64, us / 1000000, (us % 1000000 + 1000000) % 1000000);
+}
+
+static void print_records(const block_index_t *idx) {
+    for (size_t i = 0; i < idx->n; i++) {
+        const journal_block_t *b = idx->ref[i].b;
+        journal_record_t rec;
+        unsigned pos = 0;
+        int64_t prev = b->first_us;
+        while (journal_record_next(b, &pos, prev, &rec)) {
+            print_time(rec.ts_us);
+            fprintf(stdout, "\t%u\t0x%02x%s\n", rec.mode, rec.raw, rec.start ? "\tstart" : "");
+            prev = rec.ts_us;
+        }
+    }
+}
+
+static void print_blocks(const block_index_t *idx, const uint8_t *map) {
+    fprintf(stdout, "seq\toffset\trecords\tbytes\tfirst\t\t\tlast\n");
+    for (size_t i = 0; i < idx->n; i++) {
+        const journal_block_t *b = idx->ref[i].b;
+        fprintf(stdout, "%" PRIu64 "\t%" PRIu64 "\t%u\t%u\t", b->seq, (uint64_t)((const uint8_t *)b - map),
+                b->count, (unsigned)(sizeof(*b) + b->len));
+        print_time(b->first_us);
+        fprintf(stdout, "\t");
+        print_time(b->last_us);
+        fprintf(stdout, "\n");
+    }
+}
+
+/*
+ * Blocks are in sequence order, and so in time order unless the wall clock
+ * was stepped back. The mode at T comes from the last block that starts at or
+ * before T: its last record at or before T, or its last record at all when
+ * T falls between this block and the next.
+ */
+static int print_mode_at(const block_index_t *idx, int64_t t) {
+    size_t lo = 0, hi = idx->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->ref[mid].b->first_us <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0) {
+        fprintf(stderr, "query.mode_at.no_record: the journal starts after that time\n");
+        return -1;
+    }
+
+    const journal_block_t *b = idx->ref[lo - 1].b;
+    journal_record_t rec, found = {0};
+    unsigned pos = 0;
+    int64_t prev = b->first_us;
+    while (journal_record_next(b, &pos, prev, &rec) && rec.ts_us <= t) {
+        found = rec;
+        prev = rec.ts_us;
+    }
+    fprintf(stdout, "mode: %u\n", found.mode);
+    fprintf(stdout, "raw: 0x%02x\n", found.raw);
+    fprintf(stdout, "since: ");
+    print_time(found.ts_us);
+    fprintf(stdout, "%s\n", found.start ? " (daemon start)" : "");
+    fprintf(stdout, "block: %" PRIu64 "\n", b->seq);
+    return 0;
+}
+
+static void usage(const char *prog_name) {
+    if (!prog_name) return;
+    fprintf(stderr, "journal4mod - rpi-modswitch transition journal decoder\n\n");
+    fprintf(stderr, "Usage: %s [-f journal] [-t seconds] [-b]\n\n", prog_name);
+    fprintf(stderr, "-f :\tjournal segment file, default is '%s'\n", JOURNAL_DEFAULT_PATH);
+    fprintf(stderr, "-t :\tshow the mode active at this time (seconds since the epoch, with fraction)\n");
+    fprintf(stderr, "-b :\tlist the block index\n");
+    fprintf(stderr, "-h :\tshow this help\n");
+    fprintf(stderr, "-v :\tshow version\n\n");
+    fprintf(stderr, "Without -t or -b, every transition is printed: time, mode, raw lines.\n\n");
+    fprintf(stderr, "Version %s By KaliAssistant\n", VERSION);
+    fprintf(stderr, "Github: https://github.com/KaliAssistant/rpi-modswitch.git\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:bhv")) != -1) {
+        switch (opt) {
+            case 'f': journal_file = optarg; break;
+            case 't':
+                use_at_time = 1;
+                if (!parse_time(optarg, &at_us)) {
+                    fprintf(stderr, "main.optarg.cannot_parse_time: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'b': use_list_blocks = 1; break;
+            case 'h': usage(argv[0]); return 0;
+            case 'v':
+                fprintf(stdout, "%s\n", VERSION);
+                return 0;
+            case '?':
+                fprintf(stderr, "See '%s -h' for help.\n", argv[0]);
+                return 1;
+            default:
+                errno = EFAULT;
+                perror("main.getopt.got_impossible_default");
+                abort();
+        }
+    }
+
+    int fd = open(journal_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("main.open.cannot_open_journal");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "main.open.empty_journal: %s\n", journal_file);
+        return 1;
+    }
+    const uint8_t *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("main.open.mmap_failed");
+        return 1;
+    }
+    const journal_file_t *f = journal_header(map, (uint64_t)st.st_size);
+    if (!f) {
+        fprintf(stderr, "main.open.bad_header: %s is no journal segment\n", journal_file);
+        return 1;
+    }
+
+    block_index_t idx = {0};
+    unsigned bad = journal_scan(map, f->size, index_add, &idx);
+    qsort(idx.ref, idx.n, sizeof(idx.ref[0]), by_seq);
+    if (bad)
+        fprintf(stderr, "main.scan.damaged_blocks: %u skipped (torn tail or overwritten after wrap)\n", bad);
+
+    int ret = 0;
+    if (use_list_blocks)
+        print_blocks(&idx, map);
+    else if (use_at_time)
+        ret = print_mode_at(&idx, at_us) < 0;
+    else
+        print_records(&idx);
+
+    free(idx.ref);
+    munmap((void *)map, (size_t)st.st_size);
+    close(fd);
+    return ret;
+}
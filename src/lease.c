@@ -0,0 +1,176 @@
+/*
+ * lease.c - rpi-modswitch reader lease table
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the lease table described in lease.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "lease.h"
+#include "utils.h"
+
+int lease_open(lease_table_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (t->wake_fd < 0) {
+        t->fd = -1;
+        return -1;
+    }
+    t->fd = shm_open(MODSW_SHM_LEASES, O_RDWR | O_CREAT, 0666);
+    if (t->fd < 0) {
+        int err = errno;
+        close(t->wake_fd);
+        t->wake_fd = -1;
+        errno = err;
+        return -1;
+    }
+    // The umask would keep readers of other users out.
+    if (fchmod(t->fd, 0666) < 0 || ftruncate(t->fd, sizeof(modsw_leases_t)) < 0)
+        goto fail;
+    void *ptr = mmap(NULL, sizeof(modsw_leases_t), PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+    if (ptr == MAP_FAILED)
+        goto fail;
+    t->map = ptr;
+
+    memset(t->map, 0, sizeof(*t->map));
+    t->map->version = MODSW_SHM_VERSION;
+    t->map->count = MODSW_LEASE_MAX;
+    __atomic_store_n(&t->map->magic, MODSW_SHM_MAGIC, __ATOMIC_RELEASE);
+    t->period_ns = 1000000000ull;
+    return 0;
+
+fail:;
+    int err = errno;
+    close(t->fd);
+    shm_unlink(MODSW_SHM_LEASES);
+    t->fd = -1;
+    close(t->wake_fd);
+    t->wake_fd = -1;
+    errno = err;
+    return -1;
+}
+
+// Readers write the word from other processes, so the futex is a shared one.
+static void *lease_watch(void *arg) {
+    lease_table_t *t = arg;
+    uint32_t seen = __atomic_load_n(&t->map->wake, __ATOMIC_ACQUIRE);
+    while (!__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE)) {
+        syscall(SYS_futex, &t->map->wake, FUTEX_WAIT, seen, NULL, NULL, 0);
+        uint32_t now = __atomic_load_n(&t->map->wake, __ATOMIC_ACQUIRE);
+        if (now == seen)
+            continue;
+        seen = now;
+        uint64_t one = 1;
+        if (write(t->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("lease.watch.eventfd_write_failed");
+    }
+    return NULL;
+}
+
+int lease_start(lease_table_t *t) {
+    if (!t->map)
+        return 0;
+    if ((errno = pthread_create(&t->thread, NULL, lease_watch, t)) != 0)
+        return -1;
+    t->started = true;
+    return 0;
+}
+
+void lease_set_period(lease_table_t *t, uint64_t period_ns, uint64_t now) {
+    t->period_ns = period_ns;
+    if (!t->map)
+        return;
+    if (period_ns == 0)
+        t->next_check_ns = LEASE_NO_DEADLINE;
+    else if (t->next_check_ns > now + period_ns)
+        t->next_check_ns = now + period_ns;
+}
+
+void lease_io(lease_table_t *t, uint64_t now) {
+    uint64_t count;
+    while (read(t->wake_fd, &count, sizeof(count)) > 0)
+        ;
+    t->next_check_ns = now;
+}
+
+uint64_t lease_next_deadline(const lease_table_t *t) {
+    return t->map ? t->next_check_ns : LEASE_NO_DEADLINE;
+}
+
+// A PID we may not signal still belongs to a live process.
+static bool process_alive(uint32_t pid) {
+    return pid <= INT32_MAX && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+bool lease_timeout(lease_table_t *t, uint64_t now) {
+    if (!t->map || now < t->next_check_ns)
+        return false;
+    t->next_check_ns = t->period_ns ? now + t->period_ns : LEASE_NO_DEADLINE;
+
+    uint32_t now_s = (uint32_t)(now / 1000000000ull);
+    unsigned live = 0;
+    for (unsigned i = 0; i < MODSW_LEASE_MAX; i++) {
+        uint64_t word = __atomic_load_n(&t->map->lease[i], __ATOMIC_ACQUIRE);
+        if (word == 0)
+            continue;
+        if (!process_alive(MODSW_LEASE_PID(word))) {
+            // Fails harmlessly if the slot was refreshed or reclaimed meanwhile.
+            __atomic_compare_exchange_n(&t->map->lease[i], &word, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        // Signed, a heartbeat may be a second ahead of now.
+        if (MODSW_LEASE_SEC(word) == MODSW_LEASE_WAITING || (int32_t)(now_s - MODSW_LEASE_SEC(word)) < MODSW_LEASE_TTL_S)
+            live++;
+    }
+    bool changed = live != t->live;
+    t->live = live;
+    return changed;
+}
+
+void lease_close(lease_table_t *t) {
+    if (t->started) {
+        __atomic_store_n(&t->stop, 1, __ATOMIC_RELEASE);
+        futex_bump_shared(&t->map->wake);
+        pthread_join(t->thread, NULL);
+        t->started = false;
+    }
+    if (t->wake_fd >= 0)
+        close(t->wake_fd);
+    t->wake_fd = -1;
+    if (t->map)
+        munmap(t->map, sizeof(*t->map));
+    t->map = NULL;
+    if (t->fd >= 0) {
+        close(t->fd);
+        shm_unlink(MODSW_SHM_LEASES);
+    }
+    t->fd = -1;
+}
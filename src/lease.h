@@ -0,0 +1,113 @@
+/*
+ * lease.h - rpi-modswitch reader lease table
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file keeps the daemon's side of the reader leases described in
+ * modsw_shm.h: it creates the MODSW_SHM_LEASES object, counts the live
+ * leases and frees the slots of readers that died without releasing them.
+ * The count decides whether the acquisition loop samples at full rate or
+ * idles on line edges.
+ *
+ * A reader whose lease becomes live wakes the table's futex word. A watcher
+ * thread sleeps on it and turns each wakeup into a readable eventfd, so the
+ * event loop sees new readers at once and needs no periodic check while
+ * nobody holds a lease.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "modsw_shm.h"
+
+#define LEASE_NO_DEADLINE UINT64_MAX
+
+typedef struct lease_table_t {
+    int fd;
+    modsw_leases_t *map;
+    unsigned live;              // at the last check
+    uint64_t period_ns;         // between checks, 0 = only when woken
+    uint64_t next_check_ns;
+    int wake_fd;                // eventfd, readable after a reader woke the table
+    pthread_t thread;           // watcher of map->wake
+    bool started;
+    uint32_t stop;
+} lease_table_t;
+
+
+/**
+ * Create the lease table, writable by every user.
+ *
+ * @param t      Lease table.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int lease_open(lease_table_t *t);
+
+/**
+ * Start the watcher thread. Signals the event loop handles must already be
+ * blocked.
+ *
+ * @param t      Lease table, opened.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int lease_start(lease_table_t *t);
+
+/**
+ * Set how often the table is checked. Live leases need checks to notice
+ * lapsed heartbeats; without any, a wakeup is all that can change the count.
+ *
+ * @param t      Lease table.
+ * @param period_ns  Time between checks, 0 to check only when woken.
+ * @param now    Current time.
+ */
+void lease_set_period(lease_table_t *t, uint64_t period_ns, uint64_t now);
+
+/**
+ * Consume the wakeups behind a readable wake_fd and make a check due now.
+ *
+ * @param t      Lease table.
+ * @param now    Current time.
+ */
+void lease_io(lease_table_t *t, uint64_t now);
+
+/**
+ * Time of the next check.
+ *
+ * @param t      Lease table.
+ * @return       Absolute CLOCK_MONOTONIC time, or LEASE_NO_DEADLINE.
+ */
+uint64_t lease_next_deadline(const lease_table_t *t);
+
+/**
+ * Count the live leases if a check is due.
+ *
+ * @param t      Lease table.
+ * @param now    Current time.
+ * @return       true if the number of live leases changed.
+ */
+bool lease_timeout(lease_table_t *t, uint64_t now);
+
+/**
+ * Stop the watcher, unmap and remove the lease table.
+ *
+ * @param t      Lease table.
+ */
+void lease_close(lease_table_t *t);
+
+#endif /* LEASE_H */
@@ -0,0 +1,782 @@
+/*
+ * libmodsw.c - rpi-modswitch shared memory reader library
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the reader API described in modsw.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "modsw.h"
+
+struct modsw_t {
+    int fd;
+    size_t size;
+    const modsw_shm_t *shm;
+    int ack_fd;                 // connected to the ack socket once registered, -1 otherwise
+    char consumer[MODSW_NAME_MAX];
+    modsw_leases_t *leases;     // NULL if no lease could be claimed
+    uint64_t *lease;            // our slot in it
+    uint32_t waiters;           // threads blocked in a wait on this handle
+};
+
+static uint32_t monotonic_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+/*
+ * Wake an idling daemon if the slot was not live before `old` was replaced,
+ * so it goes back to full rate without polling the table.
+ */
+static void lease_wake(modsw_leases_t *leases, uint64_t old) {
+    uint32_t sec = MODSW_LEASE_SEC(old);
+    if (old && (sec == MODSW_LEASE_WAITING || monotonic_s() - sec < MODSW_LEASE_TTL_S))
+        return;
+    __atomic_add_fetch(&leases->wake, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &leases->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Claim a free slot of the daemon's lease table. Best effort: without one
+ * the handle works the same, the daemon just may be idling.
+ */
+static void lease_claim(modsw_t *sw) {
+    int fd = shm_open(MODSW_SHM_LEASES, O_RDWR, 0);
+    if (fd < 0)
+        return;
+    struct stat st;
+    void *ptr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(modsw_leases_t))
+        ptr = mmap(NULL, sizeof(modsw_leases_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return;
+    modsw_leases_t *leases = ptr;
+    if (__atomic_load_n(&leases->magic, __ATOMIC_ACQUIRE) != MODSW_SHM_MAGIC || leases->version != MODSW_SHM_VERSION) {
+        munmap(ptr, sizeof(modsw_leases_t));
+        return;
+    }
+
+    uint64_t word = MODSW_LEASE_WORD(getpid(), monotonic_s());
+    unsigned count = leases->count < MODSW_LEASE_MAX ? leases->count : MODSW_LEASE_MAX;
+    for (unsigned i = 0; i < count; i++) {
+        uint64_t free_slot = 0;
+        if (__atomic_compare_exchange_n(&leases->lease[i], &free_slot, word, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            sw->leases = leases;
+            sw->lease = &leases->lease[i];
+            lease_wake(leases, 0);
+            return;
+        }
+    }
+    munmap(ptr, sizeof(modsw_leases_t));
+}
+
+/*
+ * Refresh the heartbeat once per MODSW_LEASE_BEAT_S; a clock read otherwise.
+ * A slot that is no longer ours (taken over after a fork, or freed), or that
+ * a blocked waiter keeps live, is left alone.
+ */
+static void lease_beat(const modsw_t *sw) {
+    if (!sw->lease)
+        return;
+    uint32_t now_s = monotonic_s();
+    uint64_t word = __atomic_load_n(sw->lease, __ATOMIC_RELAXED);
+    if (MODSW_LEASE_SEC(word) == MODSW_LEASE_WAITING || now_s - MODSW_LEASE_SEC(word) < MODSW_LEASE_BEAT_S ||
+        MODSW_LEASE_PID(word) != (uint32_t)getpid())
+        return;
+    if (__atomic_compare_exchange_n(sw->lease, &word, MODSW_LEASE_WORD(getpid(), now_s), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        lease_wake(sw->leases, word);
+}
+
+// Store sec in our slot, unless it is no longer ours; returns the word replaced.
+static uint64_t lease_store(const modsw_t *sw, uint32_t sec) {
+    uint64_t word = __atomic_load_n(sw->lease, __ATOMIC_SEQ_CST);
+    while (MODSW_LEASE_PID(word) == (uint32_t)getpid() &&
+           !__atomic_compare_exchange_n(sw->lease, &word, MODSW_LEASE_WORD(getpid(), sec), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ;
+    return word;
+}
+
+/*
+ * A blocked waiter needs no heartbeat: the first one to block marks the
+ * slot as waiting, the last one to return resumes the heartbeat. Checking
+ * the count again after the heartbeat is stored catches a thread that
+ * blocked in between.
+ */
+static void lease_wait_begin(const modsw_t *sw) {
+    if (!sw->lease)
+        return;
+    uint32_t *waiters = (uint32_t *)&sw->waiters;     // the handle itself is never const
+    if (__atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST) == 0) {
+        uint64_t old = lease_store(sw, MODSW_LEASE_WAITING);
+        if (MODSW_LEASE_PID(old) == (uint32_t)getpid())
+            lease_wake(sw->leases, old);
+    }
+}
+
+static void lease_wait_end(const modsw_t *sw) {
+    if (!sw->lease)
+        return;
+    uint32_t *waiters = (uint32_t *)&sw->waiters;
+    if (__atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST) != 0)
+        return;
+    lease_store(sw, monotonic_s());
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) != 0)
+        lease_store(sw, MODSW_LEASE_WAITING);
+}
+
+static void lease_release(modsw_t *sw) {
+    if (!sw->leases)
+        return;
+    uint64_t word = __atomic_load_n(sw->lease, __ATOMIC_RELAXED);
+    if (MODSW_LEASE_PID(word) == (uint32_t)getpid())
+        __atomic_compare_exchange_n(sw->lease, &word, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    munmap(sw->leases, sizeof(modsw_leases_t));
+    sw->leases = NULL;
+    sw->lease = NULL;
+}
+
+modsw_t *modsw_open(const char *shm_name) {
+    modsw_t *sw = calloc(1, sizeof(*sw));
+    if (!sw)
+        return NULL;
+    sw->ack_fd = -1;
+
+    sw->fd = shm_open(shm_name ? shm_name : MODSW_SHM_FILE, O_RDONLY, 0);
+    if (sw->fd < 0)
+        goto fail;
+
+    struct stat st;
+    if (fstat(sw->fd, &st) < 0)
+        goto fail;
+    if ((size_t)st.st_size < sizeof(modsw_shm_t)) {
+        errno = EPROTO;
+        goto fail;
+    }
+    sw->size = (size_t)st.st_size;
+
+    void *ptr = mmap(NULL, sw->size, PROT_READ, MAP_SHARED, sw->fd, 0);
+    if (ptr == MAP_FAILED)
+        goto fail;
+    sw->shm = ptr;
+
+    if (sw->shm->magic != MODSW_SHM_MAGIC || sw->shm->version != MODSW_SHM_VERSION || sw->shm->size > sw->size) {
+        errno = EPROTO;
+        goto fail;
+    }
+    lease_claim(sw);
+    return sw;
+
+fail:;
+    int err = errno;
+    modsw_close(sw);
+    errno = err;
+    return NULL;
+}
+
+modsw_t *modsw_open_group(const char *group) {
+    if (!group)
+        return modsw_open(NULL);
+    char name[sizeof(MODSW_SHM_GROUP_PREFIX) + MODSW_NAME_MAX];
+    if (strlen(group) >= MODSW_NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    snprintf(name, sizeof(name), "%s%s", MODSW_SHM_GROUP_PREFIX, group);
+    return modsw_open(name);
+}
+
+void modsw_close(modsw_t *sw) {
+    if (!sw)
+        return;
+    if (sw->ack_fd >= 0)
+        modsw_consumer_unregister(sw);
+    lease_release(sw);
+    if (sw->shm)
+        munmap((void *)sw->shm, sw->size);
+    if (sw->fd >= 0)
+        close(sw->fd);
+    free(sw);
+}
+
+const modsw_shm_t *modsw_shm(const modsw_t *sw) {
+    return sw->shm;
+}
+
+int modsw_snapshot(const modsw_t *sw, modsw_shm_t *snap) {
+    if (!sw || !snap) {
+        errno = EFAULT;
+        return -1;
+    }
+    lease_beat(sw);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(snap, sw->shm, sizeof(*snap));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+static const modsw_profile_t *profile_at(const modsw_t *sw, uint32_t off) {
+    if (off == 0 || off % 8 || (size_t)off + sizeof(modsw_profile_t) > sw->size)
+        return NULL;
+    const modsw_profile_t *prof = (const modsw_profile_t *)((const uint8_t *)sw->shm + off);
+    if ((size_t)off + sizeof(modsw_profile_t) + prof->len > sw->size)
+        return NULL;
+    return prof;
+}
+
+const modsw_profile_t *modsw_profile_active(const modsw_t *sw, uint32_t *gen) {
+    uint64_t word = __atomic_load_n(&sw->shm->profile, __ATOMIC_ACQUIRE);
+    if (gen)
+        *gen = (uint32_t)(word >> 32);
+    return profile_at(sw, (uint32_t)word);
+}
+
+const modsw_profile_t *modsw_profile_for(const modsw_t *sw, unsigned mode) {
+    uint32_t off = sw->shm->profiles_off;
+    if (off == 0 || mode >= MODSW_MAX_MODES || (size_t)off + sizeof(uint32_t) * MODSW_MAX_MODES > sw->size)
+        return NULL;
+    const uint32_t *index = (const uint32_t *)((const uint8_t *)sw->shm + off);
+    return profile_at(sw, index[mode]);
+}
+
+const char *modsw_profile_next(const modsw_profile_t *prof, const char *key, const char **value) {
+    if (!prof || prof->len == 0)
+        return NULL;
+    const char *end = prof->data + prof->len;
+    const char *p;
+    if (!key) {
+        p = prof->data;
+    } else {
+        const char *v = key + strlen(key) + 1;
+        p = v + strlen(v) + 1;
+    }
+    if (p >= end)
+        return NULL;
+    if (value)
+        *value = p + strlen(p) + 1;
+    return p;
+}
+
+const char *modsw_profile_get(const modsw_profile_t *prof, const char *key) {
+    const char *value;
+    for (const char *k = modsw_profile_next(prof, NULL, &value); k; k = modsw_profile_next(prof, k, &value)) {
+        if (strcmp(k, key) == 0)
+            return value;
+    }
+    return NULL;
+}
+
+static const modsw_acct_t *acct_area(const modsw_t *sw, unsigned nmodes) {
+    uint32_t off = sw->shm->acct_off;
+    size_t need = sizeof(modsw_acct_t) + sizeof(uint32_t) * nmodes * nmodes;
+    if (off == 0 || sw->shm->acct_len < need || (size_t)off + need > sw->size)
+        return NULL;
+    return (const modsw_acct_t *)((const uint8_t *)sw->shm + off);
+}
+
+int modsw_acct_mode(const modsw_t *sw, unsigned mode, modsw_mode_acct_t *acct) {
+    if (!sw || !acct) {
+        errno = EFAULT;
+        return -1;
+    }
+    unsigned nmodes = sw->shm->nmodes;
+    const modsw_acct_t *area = acct_area(sw, nmodes);
+    if (!area || mode >= nmodes) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        acct->dwell_ns = area->dwell_ns[mode];
+        acct->entered_ns = area->entered_ns[mode];
+        acct->entered_rt_ns = area->entered_rt_ns[mode];
+        acct->entries = area->entries[mode];
+        acct->current = sw->shm->stats.transitions && sw->shm->mode == mode;
+    } while (modsw_shm_read_retry(sw->shm, seq));
+
+    if (acct->current) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+        if (now > acct->entered_ns)
+            acct->dwell_ns += now - acct->entered_ns;
+    }
+    return 0;
+}
+
+int modsw_acct_pair(const modsw_t *sw, unsigned from, unsigned to, uint32_t *count) {
+    if (!sw || !count) {
+        errno = EFAULT;
+        return -1;
+    }
+    unsigned nmodes = sw->shm->nmodes;
+    const modsw_acct_t *area = acct_area(sw, nmodes);
+    if (!area || from >= nmodes || to >= nmodes) {
+        errno = EINVAL;
+        return -1;
+    }
+    *count = __atomic_load_n(&area->pairs[from * nmodes + to], __ATOMIC_RELAXED);
+    return 0;
+}
+
+static const modsw_events_t *events_area(const modsw_t *sw) {
+    uint32_t off = sw->shm->events_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_events_t) > sw->size)
+        return NULL;
+    return (const modsw_events_t *)((const uint8_t *)sw->shm + off);
+}
+
+uint64_t modsw_event_head(const modsw_t *sw) {
+    const modsw_events_t *events = events_area(sw);
+    return events ? __atomic_load_n(&events->head, __ATOMIC_ACQUIRE) : 0;
+}
+
+int modsw_event_next(const modsw_t *sw, uint64_t *cursor, modsw_event_t *ev, uint64_t *lost) {
+    if (!sw || !cursor || !ev) {
+        errno = EFAULT;
+        return -1;
+    }
+    const modsw_events_t *events = events_area(sw);
+    if (!events) {
+        errno = EPROTO;
+        return -1;
+    }
+    lease_beat(sw);
+
+    uint64_t skipped = 0;
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        uint64_t head = events->head;
+        if (*cursor >= head) {
+            if (lost)
+                *lost = 0;
+            return 0;
+        }
+        if (head - *cursor > MODSW_EVENT_RING) {
+            skipped += head - MODSW_EVENT_RING - *cursor;
+            *cursor = head - MODSW_EVENT_RING;
+        }
+        memcpy(ev, &events->ring[*cursor % MODSW_EVENT_RING], sizeof(*ev));
+    } while (modsw_shm_read_retry(sw->shm, seq) || ev->seq != *cursor);
+
+    (*cursor)++;
+    if (lost)
+        *lost = skipped;
+    return 1;
+}
+
+static const modsw_counters_t *counters_area(const modsw_t *sw) {
+    uint32_t off = sw->shm->counters_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_counters_t) > sw->size)
+        return NULL;
+    return (const modsw_counters_t *)((const uint8_t *)sw->shm + off);
+}
+
+unsigned modsw_counter_count(const modsw_t *sw) {
+    const modsw_counters_t *counters = counters_area(sw);
+    if (!counters)
+        return 0;
+    return counters->count < MODSW_MAX_COUNTERS ? counters->count : MODSW_MAX_COUNTERS;
+}
+
+int modsw_counter_read(const modsw_t *sw, unsigned index, modsw_counter_t *counter) {
+    if (!sw || !counter) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (index >= modsw_counter_count(sw)) {
+        errno = ENOENT;
+        return -1;
+    }
+    const modsw_counters_t *counters = counters_area(sw);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(counter, &counters->c[index], sizeof(*counter));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+static const modsw_encoders_t *encoders_area(const modsw_t *sw) {
+    uint32_t off = sw->shm->encoders_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_encoders_t) > sw->size)
+        return NULL;
+    return (const modsw_encoders_t *)((const uint8_t *)sw->shm + off);
+}
+
+unsigned modsw_encoder_count(const modsw_t *sw) {
+    const modsw_encoders_t *encoders = encoders_area(sw);
+    if (!encoders)
+        return 0;
+    return encoders->count < MODSW_MAX_ENCODERS ? encoders->count : MODSW_MAX_ENCODERS;
+}
+
+int modsw_encoder_read(const modsw_t *sw, unsigned index, modsw_encoder_t *encoder) {
+    if (!sw || !encoder) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (index >= modsw_encoder_count(sw)) {
+        errno = ENOENT;
+        return -1;
+    }
+    const modsw_encoders_t *encoders = encoders_area(sw);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(encoder, &encoders->e[index], sizeof(*encoder));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+int modsw_matrix_read(const modsw_t *sw, modsw_matrix_t *matrix) {
+    if (!sw || !matrix) {
+        errno = EFAULT;
+        return -1;
+    }
+    uint32_t off = sw->shm->matrix_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_matrix_t) > sw->size) {
+        errno = ENOENT;
+        return -1;
+    }
+    const modsw_matrix_t *area = (const modsw_matrix_t *)((const uint8_t *)sw->shm + off);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(matrix, area, sizeof(*matrix));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+int modsw_shiftreg_read(const modsw_t *sw, modsw_shiftreg_t *chain) {
+    if (!sw || !chain) {
+        errno = EFAULT;
+        return -1;
+    }
+    uint32_t off = sw->shm->shiftreg_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_shiftreg_t) > sw->size) {
+        errno = ENOENT;
+        return -1;
+    }
+    const modsw_shiftreg_t *area = (const modsw_shiftreg_t *)((const uint8_t *)sw->shm + off);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(chain, area, sizeof(*chain));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+static const modsw_sinks_t *sinks_area(const modsw_t *sw) {
+    uint32_t off = sw->shm->sinks_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_sinks_t) > sw->size)
+        return NULL;
+    return (const modsw_sinks_t *)((const uint8_t *)sw->shm + off);
+}
+
+unsigned modsw_sink_count(const modsw_t *sw) {
+    const modsw_sinks_t *sinks = sinks_area(sw);
+    if (!sinks)
+        return 0;
+    uint32_t count = __atomic_load_n(&sinks->count, __ATOMIC_RELAXED);
+    return count < MODSW_MAX_SINKS ? count : MODSW_MAX_SINKS;
+}
+
+int modsw_sink_read(const modsw_t *sw, unsigned index, modsw_sink_stats_t *stats) {
+    if (!sw || !stats) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (index >= modsw_sink_count(sw)) {
+        errno = ENOENT;
+        return -1;
+    }
+    const modsw_sinks_t *sinks = sinks_area(sw);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(stats, &sinks->s[index], sizeof(*stats));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+int modsw_services_read(const modsw_t *sw, modsw_services_t *services) {
+    if (!sw || !services) {
+        errno = EFAULT;
+        return -1;
+    }
+    uint32_t off = sw->shm->services_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_services_t) > sw->size) {
+        errno = ENOENT;
+        return -1;
+    }
+    const modsw_services_t *area = (const modsw_services_t *)((const uint8_t *)sw->shm + off);
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(services, area, sizeof(*services));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+static const modsw_acks_t *acks_area(const modsw_t *sw) {
+    uint32_t off = sw->shm->acks_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_acks_t) > sw->size)
+        return NULL;
+    return (const modsw_acks_t *)((const uint8_t *)sw->shm + off);
+}
+
+int modsw_acks_read(const modsw_t *sw, modsw_acks_t *acks) {
+    if (!sw || !acks) {
+        errno = EFAULT;
+        return -1;
+    }
+    const modsw_acks_t *area = acks_area(sw);
+    if (!area) {
+        errno = ENOENT;
+        return -1;
+    }
+    uint32_t seq;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        memcpy(acks, area, sizeof(*acks));
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return 0;
+}
+
+static int ack_send(modsw_t *sw, uint16_t op, uint64_t seq) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    modsw_ack_msg_t msg = {
+        .magic = MODSW_SHM_MAGIC,
+        .version = MODSW_SHM_VERSION,
+        .op = op,
+        .seq = seq,
+        .applied_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec,
+    };
+    memcpy(msg.name, sw->consumer, MODSW_NAME_MAX);
+    return send(sw->ack_fd, &msg, sizeof(msg), 0) == (ssize_t)sizeof(msg) ? 0 : -1;
+}
+
+int modsw_consumer_register(modsw_t *sw, const char *name, uint64_t seq) {
+    if (!sw || !name) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (!name[0] || strlen(name) >= MODSW_NAME_MAX || sw->ack_fd >= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    const modsw_acks_t *area = acks_area(sw);
+    if (!area) {
+        errno = ENOENT;
+        return -1;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    memcpy(addr.sun_path, area->socket, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    sw->ack_fd = fd;
+    memset(sw->consumer, 0, sizeof(sw->consumer));
+    strcpy(sw->consumer, name);
+    if (ack_send(sw, MODSW_ACK_REGISTER, seq) < 0) {
+        int err = errno;
+        close(fd);
+        sw->ack_fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int modsw_consumer_ack(modsw_t *sw, uint64_t seq) {
+    if (!sw) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (sw->ack_fd < 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    return ack_send(sw, MODSW_ACK_APPLIED, seq);
+}
+
+int modsw_consumer_unregister(modsw_t *sw) {
+    if (!sw) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (sw->ack_fd < 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    int ret = ack_send(sw, MODSW_ACK_UNREGISTER, 0);
+    int err = errno;
+    close(sw->ack_fd);
+    sw->ack_fd = -1;
+    errno = err;
+    return ret;
+}
+
+// Absolute CLOCK_MONOTONIC deadline for a relative timeout, NULL for none.
+static const struct timespec *wait_deadline(struct timespec *ts, int timeout_ms) {
+    if (timeout_ms < 0)
+        return NULL;
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/*
+ * Sleep while *word == val. Returns -1 only on a timeout or a real error.
+ * The lease stays live for the whole wait without waking up to refresh it,
+ * so a long wait keeps the daemon at full rate.
+ */
+static int futex_wait_until(const modsw_t *sw, const uint32_t *word, uint32_t val, const struct timespec *deadline) {
+    lease_wait_begin(sw);
+    long ret = syscall(SYS_futex, word, FUTEX_WAIT_BITSET, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+    int err = errno;
+    lease_wait_end(sw);
+    if (ret < 0 && err != EAGAIN && err != EINTR) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int modsw_wait_applied(const modsw_t *sw, uint64_t seq, int timeout_ms) {
+    if (!sw) {
+        errno = EFAULT;
+        return -1;
+    }
+    const modsw_acks_t *area = acks_area(sw);
+    if (!area) {
+        errno = ENOENT;
+        return -1;
+    }
+    struct timespec ts;
+    const struct timespec *deadline = wait_deadline(&ts, timeout_ms);
+    // The word is read before `lowest`, so a change in between fails the wait.
+    while (1) {
+        uint32_t word = __atomic_load_n(&area->applied, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&area->lowest, __ATOMIC_ACQUIRE) >= seq)
+            return 0;
+        if (futex_wait_until(sw, &area->applied, word, deadline) < 0)
+            return -1;
+    }
+}
+
+static const modsw_wake_t *wake_area(const modsw_t *sw) {
+    uint32_t off = sw->shm->wake_off;
+    if (off == 0 || (size_t)off + sizeof(modsw_wake_t) > sw->size)
+        return NULL;
+    return (const modsw_wake_t *)((const uint8_t *)sw->shm + off);
+}
+
+// Transition count and mode, consistent with each other.
+static uint64_t published_state(const modsw_t *sw, unsigned *mode) {
+    uint32_t seq;
+    uint64_t transitions;
+    do {
+        seq = modsw_shm_read_begin(sw->shm);
+        transitions = sw->shm->stats.transitions;
+        *mode = sw->shm->mode;
+    } while (modsw_shm_read_retry(sw->shm, seq));
+    return transitions;
+}
+
+int modsw_wait_change(const modsw_t *sw, uint64_t seq, int timeout_ms) {
+    if (!sw) {
+        errno = EFAULT;
+        return -1;
+    }
+    const modsw_wake_t *wake = wake_area(sw);
+    if (!wake) {
+        errno = EPROTO;
+        return -1;
+    }
+    struct timespec ts;
+    const struct timespec *deadline = wait_deadline(&ts, timeout_ms);
+    while (1) {
+        unsigned mode;
+        uint32_t word = __atomic_load_n(&wake->change, __ATOMIC_ACQUIRE);
+        if (published_state(sw, &mode) != seq)
+            return 0;
+        if (futex_wait_until(sw, &wake->change, word, deadline) < 0)
+            return -1;
+    }
+}
+
+int modsw_wait_mode(const modsw_t *sw, unsigned mode, int timeout_ms) {
+    if (!sw) {
+        errno = EFAULT;
+        return -1;
+    }
+    const modsw_wake_t *wake = wake_area(sw);
+    if (!wake) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (mode >= MODSW_MAX_MODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct timespec ts;
+    const struct timespec *deadline = wait_deadline(&ts, timeout_ms);
+    while (1) {
+        unsigned current;
+        uint32_t word = __atomic_load_n(&wake->mode[mode], __ATOMIC_ACQUIRE);
+        if (published_state(sw, &current) != 0 && current == mode)
+            return 0;
+        if (futex_wait_until(sw, &wake->mode[mode], word, deadline) < 0)
+            return -1;
+    }
+}
@@ -0,0 +1,151 @@
+/*
+ * matrix.c - rpi-modswitch matrix keypad scanning backend
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the matrix scanner described in matrix.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "matrix.h"
+#include "utils.h"
+
+#define DEFAULT_SCAN_US 2000
+#define DEFAULT_IDLE_SCAN_US 20000
+#define DEFAULT_IDLE_AFTER_MS 1000
+#define DEFAULT_DEBOUNCE_SCANS 3
+
+bool matrix_conf(matrix_t *m, const char *key, const char *value) {
+    if (m->scan_ns == 0) {
+        m->scan_ns = DEFAULT_SCAN_US * 1000ull;
+        m->idle_scan_ns = DEFAULT_IDLE_SCAN_US * 1000ull;
+        m->idle_after_ns = DEFAULT_IDLE_AFTER_MS * 1000000ull;
+        m->debounce = DEFAULT_DEBOUNCE_SCANS;
+    }
+
+    uintmax_t num;
+    int n;
+    if (strcmp(key, "rows") == 0) {
+        if ((n = xstr2intlist(value, m->rows, MATRIX_MAX_ROWS)) < 1)
+            return false;
+        m->nrows = (unsigned)n;
+    } else if (strcmp(key, "cols") == 0) {
+        if ((n = xstr2intlist(value, m->cols, MATRIX_MAX_COLS)) < 1)
+            return false;
+        m->ncols = (unsigned)n;
+    } else if (strcmp(key, "scan_us") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        m->scan_ns = (uint64_t)num * 1000ull;
+    } else if (strcmp(key, "idle_scan_us") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        m->idle_scan_ns = (uint64_t)num * 1000ull;
+    } else if (strcmp(key, "idle_after_ms") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        m->idle_after_ns = (uint64_t)num * 1000000ull;
+    } else if (strcmp(key, "debounce_scans") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1 || num > VDEBOUNCE_MAX_SAMPLES)
+            return false;
+        m->debounce = (unsigned)num;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int matrix_add_lines(matrix_t *m, gpio_req_t *req) {
+    uint64_t row_flags = GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_OPEN_DRAIN | GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+    uint64_t col_flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP | GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+    m->row_mask = 0;
+    m->col_mask = 0;
+    for (unsigned r = 0; r < m->nrows; r++) {
+        if ((m->req_row[r] = gpio_req_add(req, m->rows[r], row_flags)) < 0)
+            return -1;
+        m->row_mask |= 1ull << m->req_row[r];
+    }
+    for (unsigned c = 0; c < m->ncols; c++) {
+        if ((m->req_col[c] = gpio_req_add(req, m->cols[c], col_flags)) < 0)
+            return -1;
+        m->col_mask |= 1ull << m->req_col[c];
+    }
+    return 0;
+}
+
+void matrix_start(matrix_t *m, uint64_t now) {
+    m->keys = 0;
+    if (m->nrows)
+        vdebounce_init(&m->vd, m->nrows * m->ncols, m->debounce, NULL);
+    m->next_scan_ns = now;
+    m->last_activity_ns = now;
+}
+
+int matrix_scan(matrix_t *m, const gpio_req_t *req, uint64_t now, uint64_t *changed) {
+    *changed = 0;
+    if (m->nrows == 0 || now < m->next_scan_ns)
+        return 0;
+
+    uint64_t start = monotonic_ns();    // now is when the loop woke, not when the scan began
+    uint64_t raw = 0;
+    for (unsigned r = 0; r < m->nrows; r++) {
+        uint64_t bits;
+        if (gpio_req_set(req, m->row_mask, 1ull << m->req_row[r]) < 0 ||
+            gpio_req_get(req, m->col_mask, &bits) < 0)
+            return -1;
+        for (unsigned c = 0; c < m->ncols; c++) {
+            if (bits & (1ull << m->req_col[c]))
+                raw |= 1ull << (r * m->ncols + c);
+        }
+    }
+    if (gpio_req_set(req, m->row_mask, 0) < 0)
+        return -1;
+
+    uint64_t diff = raw ^ m->keys;
+    vdebounce_sample(&m->vd, &raw, changed);
+    m->keys = m->vd.state[0];
+
+    uint64_t end = monotonic_ns();
+    m->last_scan_ns = end - start;
+    m->scans++;
+    if (*changed)
+        m->changes++;
+    if (raw || diff)
+        m->last_activity_ns = now;
+    bool idle = now - m->last_activity_ns >= m->idle_after_ns;
+    m->next_scan_ns = now + (idle ? m->idle_scan_ns : m->scan_ns);
+    return 1;
+}
+
+uint64_t matrix_next_deadline(const matrix_t *m) {
+    return m->nrows ? m->next_scan_ns : MATRIX_NO_DEADLINE;
+}
+
+void matrix_publish(const matrix_t *m, uint64_t now, modsw_matrix_t *out) {
+    out->rows = m->nrows;
+    out->cols = m->ncols;
+    out->keys = m->keys;
+    out->scans = m->scans;
+    out->changes = m->changes;
+    out->last_scan_ns = m->last_scan_ns;
+    out->scan_us = (uint32_t)((now - m->last_activity_ns >= m->idle_after_ns ? m->idle_scan_ns : m->scan_ns) / 1000);
+}
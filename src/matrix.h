@@ -0,0 +1,121 @@
+/*
+ * matrix.h - rpi-modswitch matrix keypad scanning backend
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file scans a row/column switch matrix through the daemon's line
+ * request. Rows are open-drain outputs driven active (low) one at a time,
+ * columns are pulled-up active-low inputs, and each row costs one set and one
+ * get ioctl. Keys are debounced over consecutive scans with vertical counters
+ * (see vdebounce.h), and the scan interval drops to idle_scan_us once the panel has been
+ * quiet for idle_after_ms.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+#include "gpio.h"
+#include "vdebounce.h"
+
+#define MATRIX_MAX_ROWS 8
+#define MATRIX_MAX_COLS 8
+#define MATRIX_NO_DEADLINE UINT64_MAX
+
+typedef struct matrix_t {
+    int rows[MATRIX_MAX_ROWS];
+    int cols[MATRIX_MAX_COLS];
+    unsigned nrows;             // 0 = no matrix configured
+    unsigned ncols;
+    uint64_t scan_ns;
+    uint64_t idle_scan_ns;
+    uint64_t idle_after_ns;
+    unsigned debounce;          // scans a key must disagree before it flips
+
+    int req_row[MATRIX_MAX_ROWS];
+    int req_col[MATRIX_MAX_COLS];
+    uint64_t row_mask;          // line request bits of all rows
+    uint64_t col_mask;
+
+    uint64_t keys;              // debounced, bit = row * ncols + col
+    vdebounce_t vd;
+    uint64_t next_scan_ns;
+    uint64_t last_activity_ns;
+    uint64_t scans;
+    uint64_t changes;
+    uint64_t last_scan_ns;      // duration of the last scan
+} matrix_t;
+
+
+/**
+ * Apply one key of the [matrix] configuration section.
+ *
+ * @param m      Matrix.
+ * @param key    One of rows, cols, scan_us, idle_scan_us, idle_after_ms,
+ *               debounce_scans.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool matrix_conf(matrix_t *m, const char *key, const char *value);
+
+/**
+ * Add the row and column lines to the daemon's line request.
+ *
+ * @param m      Matrix.
+ * @param req    Line request that is not opened yet.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int matrix_add_lines(matrix_t *m, gpio_req_t *req);
+
+/**
+ * Start scanning.
+ *
+ * @param m      Matrix.
+ * @param now    Current time.
+ */
+void matrix_start(matrix_t *m, uint64_t now);
+
+/**
+ * Scan the matrix if its interval has elapsed.
+ *
+ * @param m        Matrix.
+ * @param req      Opened line request.
+ * @param now      Current time.
+ * @param changed  Receives the keys whose debounced state flipped.
+ * @return         1 if a scan ran, 0 if it was not due, -1 on ioctl failure.
+ */
+int matrix_scan(matrix_t *m, const gpio_req_t *req, uint64_t now, uint64_t *changed);
+
+/**
+ * Time of the next scan.
+ *
+ * @param m      Matrix.
+ * @return       Absolute CLOCK_MONOTONIC time, or MATRIX_NO_DEADLINE.
+ */
+uint64_t matrix_next_deadline(const matrix_t *m);
+
+/**
+ * Fill the shared memory record of the matrix.
+ *
+ * @param m      Matrix.
+ * @param now    Current time.
+ * @param out    Shared memory record.
+ */
+void matrix_publish(const matrix_t *m, uint64_t now, modsw_matrix_t *out);
+
+#endif /* MATRIX_H */
@@ -0,0 +1,360 @@
+/*
+ * modsw.h - rpi-modswitch shared memory reader library
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * libmodsw gives consumers of the switch state a small API over the shared
+ * memory region published by modswitchd, so they do not need to know its
+ * layout or locking rules.
+ *
+ * Functions:
+ *   - modsw_open(): Map the shared memory region of the daemon.
+ *   - modsw_open_group(): Map the region of a [group.NAME] switch.
+ *   - modsw_close(): Unmap it again.
+ *   - modsw_snapshot(): Copy a consistent view of the state and statistics.
+ *   - modsw_profile_active(): Lock-free lookup of the current mode's profile.
+ *   - modsw_profile_for(): Profile of any mode.
+ *   - modsw_profile_get(): Look up a key in a profile.
+ *   - modsw_profile_next(): Iterate over the pairs of a profile.
+ *   - modsw_acct_mode(): Dwell time and entries of a mode.
+ *   - modsw_acct_pair(): Number of transitions between two modes.
+ *   - modsw_event_head(): Position of the next event in the stream.
+ *   - modsw_event_next(): Read the stream of transitions and gestures.
+ *   - modsw_counter_count(): Number of pulse counter lines.
+ *   - modsw_counter_read(): Edge count, frequency and duty cycle of a counter.
+ *   - modsw_encoder_count(): Number of rotary encoders.
+ *   - modsw_encoder_read(): Position, detent and velocity of an encoder.
+ *   - modsw_matrix_read(): Key bitmap and scan statistics of the keypad.
+ *   - modsw_shiftreg_read(): Bitset and read timing of the shift register chain.
+ *   - modsw_sink_count() / modsw_sink_read(): Queue metrics of the output sinks.
+ *   - modsw_services_read(): Supervised services and switchover timing.
+ *   - modsw_consumer_register() / modsw_consumer_ack(): Report applied states.
+ *   - modsw_wait_applied(): Wait until every consumer applied a state.
+ *   - modsw_acks_read(): Registered consumers and their apply latency.
+ *   - modsw_wait_change() / modsw_wait_mode(): Sleep until the switch changes
+ *     or reaches a mode, woken only by the transitions asked for.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef MODSW_H
+#define MODSW_H
+
+#include <stdint.h>
+#include "modsw_shm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct modsw_t modsw_t;
+
+typedef struct modsw_mode_acct_t {
+    uint64_t dwell_ns;          // cumulative, including the current visit
+    uint64_t entered_ns;        // CLOCK_MONOTONIC of the last entry, 0 = never
+    uint64_t entered_rt_ns;     // CLOCK_REALTIME of the last entry
+    uint32_t entries;
+    int current;                // nonzero if this is the current mode
+} modsw_mode_acct_t;
+
+
+/**
+ * Map the shared memory region of the daemon. The handle also claims a
+ * reader lease, kept alive by the calls below and released by
+ * modsw_close(), so the daemon samples at full rate while it is in use.
+ *
+ * @param shm_name  Shared memory object name, NULL for MODSW_SHM_FILE.
+ * @return          Handle, or NULL with errno set on failure
+ *                  (EPROTO if the region has an unknown layout).
+ */
+modsw_t *modsw_open(const char *shm_name);
+
+/**
+ * Map the region of an additional switch group, MODSW_SHM_GROUP_PREFIX
+ * followed by its name. Everything but the main switch's areas (profiles,
+ * counters, sinks, ...) reads the same as with modsw_open().
+ *
+ * @param group     Group name from the daemon's configuration, NULL for
+ *                  the main switch.
+ * @return          Handle, or NULL with errno set on failure
+ *                  (ENAMETOOLONG for an overlong name).
+ */
+modsw_t *modsw_open_group(const char *group);
+
+/**
+ * Unmap the region and free the handle.
+ *
+ * @param sw        Handle from modsw_open(), may be NULL.
+ */
+void modsw_close(modsw_t *sw);
+
+/**
+ * Direct read-only access to the mapped region. Reading through it does not
+ * refresh the reader lease.
+ *
+ * @param sw        Handle from modsw_open().
+ * @return          Start of the region.
+ */
+const modsw_shm_t *modsw_shm(const modsw_t *sw);
+
+/**
+ * Copy a consistent snapshot of the state and statistics header.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param snap      Destination.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int modsw_snapshot(const modsw_t *sw, modsw_shm_t *snap);
+
+/**
+ * Profile of the current mode, found with a single atomic load.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param gen       Optional; receives the generation, which changes on every
+ *                  published transition.
+ * @return          Immutable profile, or NULL if the mode has none.
+ */
+const modsw_profile_t *modsw_profile_active(const modsw_t *sw, uint32_t *gen);
+
+/**
+ * Profile of a specific mode.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param mode      Mode index.
+ * @return          Immutable profile, or NULL if the mode has none.
+ */
+const modsw_profile_t *modsw_profile_for(const modsw_t *sw, unsigned mode);
+
+/**
+ * Look up a key in a profile.
+ *
+ * @param prof      Profile, may be NULL.
+ * @param key       Key to look up.
+ * @return          Value, or NULL if the key is not present.
+ */
+const char *modsw_profile_get(const modsw_profile_t *prof, const char *key);
+
+/**
+ * Iterate over the key/value pairs of a profile.
+ *
+ * @param prof      Profile, may be NULL.
+ * @param key       Previous key, NULL to start.
+ * @param value     Receives the value of the returned key.
+ * @return          Next key, or NULL at the end.
+ */
+const char *modsw_profile_next(const modsw_profile_t *prof, const char *key, const char **value);
+
+/**
+ * Accounting of a mode. The dwell time of the current visit is added here
+ * from its entry timestamp.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param mode      Mode index, below modsw_shm(sw)->nmodes.
+ * @param acct      Destination.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int modsw_acct_mode(const modsw_t *sw, unsigned mode, modsw_mode_acct_t *acct);
+
+/**
+ * Number of published transitions from one mode to another.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param from      Source mode index.
+ * @param to        Destination mode index.
+ * @param count     Destination.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int modsw_acct_pair(const modsw_t *sw, unsigned from, unsigned to, uint32_t *count);
+
+/**
+ * Position the next event will take, to start following the stream "now".
+ *
+ * @param sw        Handle from modsw_open().
+ * @return          Event sequence number.
+ */
+uint64_t modsw_event_head(const modsw_t *sw);
+
+/**
+ * Read the event at *cursor and advance it. If the daemon has already
+ * overwritten that event, the cursor skips to the oldest one still held.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param cursor    In/out stream position.
+ * @param ev        Destination.
+ * @param lost      Optional; receives the number of events skipped.
+ * @return          1 if an event was read, 0 if none is pending,
+ *                  -1 with errno set on failure.
+ */
+int modsw_event_next(const modsw_t *sw, uint64_t *cursor, modsw_event_t *ev, uint64_t *lost);
+
+/**
+ * Number of configured pulse counter lines.
+ *
+ * @param sw        Handle from modsw_open().
+ * @return          Counter count, 0 if none.
+ */
+unsigned modsw_counter_count(const modsw_t *sw);
+
+/**
+ * Copy a consistent view of a pulse counter.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param index     Counter index, below modsw_counter_count().
+ * @param counter   Destination.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int modsw_counter_read(const modsw_t *sw, unsigned index, modsw_counter_t *counter);
+
+/**
+ * Number of configured rotary encoders.
+ *
+ * @param sw        Handle from modsw_open().
+ * @return          Encoder count, 0 if none.
+ */
+unsigned modsw_encoder_count(const modsw_t *sw);
+
+/**
+ * Copy a consistent view of a rotary encoder.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param index     Encoder index, below modsw_encoder_count().
+ * @param encoder   Destination.
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int modsw_encoder_read(const modsw_t *sw, unsigned index, modsw_encoder_t *encoder);
+
+/**
+ * Copy a consistent view of the matrix keypad.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param matrix    Destination.
+ * @return          0 on success, -1 with errno set (ENOENT if no matrix is
+ *                  configured).
+ */
+int modsw_matrix_read(const modsw_t *sw, modsw_matrix_t *matrix);
+
+/**
+ * Copy a consistent view of the shift register input chain.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param chain     Destination.
+ * @return          0 on success, -1 with errno set (ENOENT if no chain is
+ *                  configured).
+ */
+int modsw_shiftreg_read(const modsw_t *sw, modsw_shiftreg_t *chain);
+
+/**
+ * Number of output sinks other than shared memory.
+ *
+ * @param sw        Handle from modsw_open().
+ * @return          Sink count, 0 if none are configured.
+ */
+unsigned modsw_sink_count(const modsw_t *sw);
+
+/**
+ * Copy a consistent view of one sink's queue metrics.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param index     Sink index, below modsw_sink_count().
+ * @param stats     Destination.
+ * @return          0 on success, -1 with errno set (ENOENT for a bad index).
+ */
+int modsw_sink_read(const modsw_t *sw, unsigned index, modsw_sink_stats_t *stats);
+
+/**
+ * Copy a consistent view of the mode-driven supervisor.
+ *
+ * @param sw        Handle from modsw_open().
+ * @param services  Destination.
+ * @return          0 on success, -1 with errno set (ENOENT if no service is
+ *                  configured).
+ */
+int modsw_services_read(const modsw_t *sw, modsw_services_t *services);
+
+/**
+ * Register as a consumer the daemon waits for, and report the state already
+ * applied. A state is identified by stats.transitions of a snapshot taken
+ * before applying it. The registration ends with
+ * modsw_consumer_unregister(), modsw_close() or the exit of the process.
+ * @param sw        Handle from modsw_open().
+ * @param name      Consumer name, unique among consumers; a process that
+ *                  registers a taken name replaces the previous holder.
+ * @param seq       State applied so far, 0 for none.
+ * @return          0 on success, -1 with errno set (ENOENT if acknowledgments
+ *                  are not enabled, EINVAL if already registered).
+ */
+int modsw_consumer_register(modsw_t *sw, const char *name, uint64_t seq);
+
+/**
+ * Report that a state has been applied.
+ * @param sw        Handle registered with modsw_consumer_register().
+ * @param seq       stats.transitions of the applied state.
+ * @return          0 on success, -1 with errno set (ENOTCONN if not
+ *                  registered).
+ */
+int modsw_consumer_ack(modsw_t *sw, uint64_t seq);
+
+/**
+ * End the registration.
+ * @param sw        Handle registered with modsw_consumer_register().
+ * @return          0 on success, -1 with errno set on failure.
+ */
+int modsw_consumer_unregister(modsw_t *sw);
+
+/**
+ * Block until every registered consumer has applied a state, with a futex
+ * wait on the shared memory region.
+ * @param sw        Handle from modsw_open().
+ * @param seq       stats.transitions of the state to wait for.
+ * @param timeout_ms  Upper bound, -1 to wait forever.
+ * @return          0 once applied, -1 with errno set (ETIMEDOUT, or ENOENT if
+ *                  acknowledgments are not enabled).
+ */
+int modsw_wait_applied(const modsw_t *sw, uint64_t seq, int timeout_ms);
+
+/**
+ * Copy a consistent view of the registered consumers.
+ * @param sw        Handle from modsw_open().
+ * @param acks      Destination.
+ * @return          0 on success, -1 with errno set (ENOENT if acknowledgments
+ *                  are not enabled).
+ */
+int modsw_acks_read(const modsw_t *sw, modsw_acks_t *acks);
+
+/**
+ * Block until a transition after a given one is published.
+ * @param sw        Handle from modsw_open().
+ * @param seq       stats.transitions of the state already seen.
+ * @param timeout_ms  Upper bound, -1 to wait forever.
+ * @return          0 once stats.transitions differs, -1 with errno set
+ *                  (ETIMEDOUT on timeout).
+ */
+int modsw_wait_change(const modsw_t *sw, uint64_t seq, int timeout_ms);
+
+/**
+ * Block until a mode is the published one. Returns at once if it already
+ * is; other transitions do not wake the caller.
+ * @param sw        Handle from modsw_open().
+ * @param mode      Mode index.
+ * @param timeout_ms  Upper bound, -1 to wait forever.
+ * @return          0 once the mode is published, -1 with errno set
+ *                  (ETIMEDOUT on timeout, EINVAL for a bad mode).
+ */
+int modsw_wait_mode(const modsw_t *sw, unsigned mode, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODSW_H */
@@ -0,0 +1,98 @@
+/*
+ * modsw_plugin.h - rpi-modswitch in-daemon plugin ABI
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file describes the interface of plugins loaded by modswitchd from a
+ * [plugin.NAME] section. A plugin is a shared object exporting one symbol:
+ *
+ *   const modsw_plugin_t modsw_plugin = {
+ *       .abi_version = MODSW_PLUGIN_ABI_VERSION,
+ *       .size = sizeof(modsw_plugin_t),
+ *       .init = my_init,
+ *       .on_transition = my_transition,
+ *   };
+ *
+ * Every callback is optional. init() and shutdown() run on the daemon's main
+ * thread, before sampling starts and after it has stopped. on_transition()
+ * and on_tick() run on an executor thread owned by the plugin, one call at a
+ * time, fed through a bounded queue: a slow plugin loses messages (see the
+ * sink metrics) but never delays sampling or other outputs.
+ *
+ * New callbacks are only ever appended; the daemon checks `size` before using
+ * any of them, so plugins built against an older header keep loading.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef MODSW_PLUGIN_H
+#define MODSW_PLUGIN_H
+
+#include <stdint.h>
+
+#define MODSW_PLUGIN_ABI_VERSION 1
+#define MODSW_PLUGIN_SYMBOL "modsw_plugin"
+#define MODSW_PLUGIN_NO_MODE UINT32_MAX
+
+typedef struct modsw_plugin_event_t {
+    uint64_t seq;               // position in the daemon's event stream
+    uint64_t ts_ns;             // CLOCK_MONOTONIC time of the transition
+    uint64_t rt_ns;             // CLOCK_REALTIME when it was handed to the plugins
+    uint32_t mode;              // new mode index
+    uint32_t from;              // previous mode index, MODSW_PLUGIN_NO_MODE on the first publish
+    uint32_t raw;               // switch line levels
+    const char *name;           // NUL-terminated name of the new mode, valid during the call
+} modsw_plugin_event_t;
+
+typedef struct modsw_plugin_t {
+    uint32_t abi_version;       // MODSW_PLUGIN_ABI_VERSION
+    uint32_t size;              // sizeof(modsw_plugin_t) the plugin was built with
+
+    /**
+     * Set the plugin up.
+     *
+     * @param ctx    Receives the context handed to every other callback.
+     * @param arg    The `arg` key of the plugin's section, "" if unset.
+     * @return       0 on success; anything else unloads the plugin.
+     */
+    int (*init)(void **ctx, const char *arg);
+
+    /**
+     * A mode transition was published.
+     *
+     * @param ctx    Context from init().
+     * @param ev     Transition.
+     * @return       0 on success, -1 to have the call counted as failed.
+     */
+    int (*on_transition)(void *ctx, const modsw_plugin_event_t *ev);
+
+    /**
+     * Periodic call every tick_ms of the plugin's section. Ticks that come
+     * due while one is still queued are skipped.
+     *
+     * @param ctx    Context from init().
+     * @param now    CLOCK_MONOTONIC time the tick came due.
+     * @return       0 on success, -1 to have the call counted as failed.
+     */
+    int (*on_tick)(void *ctx, uint64_t now);
+
+    /**
+     * Release everything; the plugin is unloaded right after.
+     *
+     * @param ctx    Context from init().
+     */
+    void (*shutdown)(void *ctx);
+} modsw_plugin_t;
+
+#endif /* MODSW_PLUGIN_H */
@@ -0,0 +1,434 @@
+/*
+ * modsw_shm.h - rpi-modswitch shared memory layout
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file describes the layout of the shared memory region written by
+ * modswitchd and read by cat4mod and other consumers.
+ *
+ * The first byte of the region is still the legacy ASCII mode byte ('0'–'3'
+ * for a plain 2-line switch, see modsw_mode_char() for larger modes), so
+ * readers that only map a single byte keep working unchanged. Everything after
+ * it is guarded by a sequence lock: the daemon makes `seq` odd while it updates
+ * the region and even again when it is done, and readers retry when they
+ * observe an odd or changed sequence.
+ *
+ * Per-mode profiles are packed once at startup into immutable blobs that
+ * follow the header inside the same region. The daemon switches the active
+ * one by storing a single (generation, offset) word, so a reader only needs
+ * one atomic load to find the profile of the current mode.
+ *
+ * Mode accounting (dwell time, entries, transition pairs) lives in its own
+ * area and is only touched on transitions; the dwell time of the current
+ * visit is computed by readers from entered_ns, so an idle daemon pays
+ * nothing for it.
+ *
+ * Every published transition and every recognized gesture is also appended
+ * to an event ring, so consumers can follow the stream instead of sampling
+ * the current state. The daemon's other outputs (sinks) are fed from the same
+ * ring, and their queue metrics are published once per second.
+ *
+ * Consumers that must be waited for register on the daemon's ack socket and
+ * report every state they have applied, by its transition count. The daemon
+ * publishes the lowest count applied by all of them; whoever needs the whole
+ * system switched waits on a single futex word for it to reach the target.
+ *
+ * Readers that block until the switch changes, or until it reaches one
+ * mode, sleep on futex words too: one for any transition and one per mode,
+ * so a transition only wakes the waiters that asked for it.
+ *
+ * Additional switch groups are published to their own regions, named
+ * MODSW_SHM_GROUP_PREFIX followed by the group name, with the same layout
+ * but only the state, accounting, event ring and wake areas.
+ *
+ * Readers hold leases in a small separate object, MODSW_SHM_LEASES, the only
+ * one they may write to: a slot with their PID and a heartbeat that libmodsw
+ * claims on open and refreshes while the reader uses it. With no live lease
+ * and quiet lines the daemon stops polling and waits for line edges, and
+ * MODSW_FLAG_IDLE says so; the published state stays current either way.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef MODSW_SHM_H
+#define MODSW_SHM_H
+
+#include <stdint.h>
+
+#define MODSW_SHM_FILE "/modsw"
+#define MODSW_SHM_GROUP_PREFIX "/modsw."   // followed by the name of a [group.NAME] switch
+#define MODSW_SHM_MAGIC 0x4d4f4453      // "MODS"
+#define MODSW_SHM_LEASES "/modsw-leases"   // reader lease table, writable by every reader
+#define MODSW_SHM_VERSION 18
+
+#define MODSW_MAX_LINES 8
+#define MODSW_MAX_MODES (1 << MODSW_MAX_LINES)
+#define MODSW_NAME_MAX 32
+
+#define MODSW_FLAG_INVALID 0x01         // lines currently settle on a rejected combination
+#define MODSW_FLAG_CHATTER 0x02         // transitions come faster than a sink's rate limit
+#define MODSW_FLAG_SUSPECT 0x04         // lines were reconfigured behind the daemon's back
+#define MODSW_FLAG_IDLE 0x08            // no reader holds a lease, lines are watched for edges only
+
+#define MODSW_LEASE_MAX 64
+#define MODSW_LEASE_TTL_S 5             // a lease without a heartbeat for this long is not live
+#define MODSW_LEASE_BEAT_S 1            // readers refresh their heartbeat this often
+#define MODSW_LEASE_WAITING UINT32_MAX  // heartbeat of a reader blocked in a wait: live while its process is
+
+#define MODSW_MAX_COUNTERS 8
+#define MODSW_MAX_ENCODERS 4
+#define MODSW_SHIFTREG_MAX_BITS 256
+#define MODSW_SHIFTREG_WORDS (MODSW_SHIFTREG_MAX_BITS / 64)
+#define MODSW_MAX_SINKS 8
+#define MODSW_MAX_SERVICES 8
+#define MODSW_MAX_CONSUMERS 16
+#define MODSW_ACK_PATH_MAX 108          // sizeof(sockaddr_un.sun_path)
+
+#define MODSW_ACK_REGISTER 1            // modsw_ack_msg_t operations
+#define MODSW_ACK_APPLIED 2
+#define MODSW_ACK_UNREGISTER 3
+
+#define MODSW_EVENT_RING 64             // power of two
+#define MODSW_EVENT_MODE 1              // published mode transition
+#define MODSW_EVENT_GESTURE 2           // recognized gesture on a switch line
+#define MODSW_EVENT_DETENT 3            // rotary encoder moved to a new detent
+#define MODSW_EVENT_KEY 4               // matrix key pressed or released
+#define MODSW_EVENT_INPUT 5             // shift register input changed
+
+
+typedef struct modsw_stats_t {
+    uint64_t transitions;       // published state changes
+    uint64_t coalesced;         // intermediate states swallowed by the settle window
+    uint64_t invalid;           // settled states rejected by the decoder
+    uint64_t gestures;          // recognized gestures
+    uint64_t reconfigured;      // line info changes made by someone else
+} modsw_stats_t;
+
+typedef struct modsw_shm_t {
+    uint8_t mode_char;          // legacy ASCII mode byte, must stay at offset 0
+    uint8_t raw;                // raw line bits of the published state
+    uint16_t version;
+    uint32_t magic;
+    uint32_t seq;               // sequence lock, odd while the daemon is writing
+    uint32_t flags;             // MODSW_FLAG_*
+    uint16_t mode;              // decoded mode index
+    uint16_t nmodes;            // number of modes the decoder can produce
+    uint32_t size;              // total size of the region in bytes
+    uint64_t changed_ns;        // CLOCK_MONOTONIC time of the last publish
+    char name[MODSW_NAME_MAX];  // NUL-terminated name of the current mode
+    uint64_t profile;           // generation << 32 | profile offset, offset 0 = none
+    uint32_t profiles_off;      // offset of the per-mode profile index, 0 = none
+    uint32_t profiles_len;      // bytes from profiles_off to the end of the blobs
+    uint32_t acct_off;          // offset of the modsw_acct_t area
+    uint32_t acct_len;
+    uint32_t events_off;        // offset of the modsw_events_t ring
+    uint32_t counters_off;      // offset of the modsw_counters_t area, 0 = none
+    uint32_t encoders_off;      // offset of the modsw_encoders_t area, 0 = none
+    uint32_t matrix_off;        // offset of the modsw_matrix_t area, 0 = none
+    uint32_t shiftreg_off;      // offset of the modsw_shiftreg_t area, 0 = none
+    uint32_t sinks_off;         // offset of the modsw_sinks_t area, 0 = none
+    uint32_t services_off;      // offset of the modsw_services_t area, 0 = none
+    uint32_t acks_off;          // offset of the modsw_acks_t area, 0 = none
+    uint32_t wake_off;          // offset of the modsw_wake_t futex words
+    uint32_t chatter;           // lines that changed within the last second while MODSW_FLAG_CHATTER
+    uint32_t readers;           // live reader leases at the daemon's last check
+    uint32_t reserved;
+    modsw_stats_t stats;
+} modsw_shm_t;
+
+/*
+ * Per-mode accounting, updated under the sequence lock on every published
+ * transition. pairs[] holds nmodes * nmodes counters, [from * nmodes + to].
+ */
+typedef struct modsw_acct_t {
+    uint64_t dwell_ns[MODSW_MAX_MODES];       // closed visits only, see above
+    uint64_t entered_ns[MODSW_MAX_MODES];     // CLOCK_MONOTONIC of the last entry, 0 = never
+    uint64_t entered_rt_ns[MODSW_MAX_MODES];  // CLOCK_REALTIME of the last entry
+    uint32_t entries[MODSW_MAX_MODES];
+    uint32_t pairs[];
+} modsw_acct_t;
+
+typedef struct modsw_event_t {
+    uint64_t seq;               // position in the stream, starts at 0
+    uint64_t ts_ns;             // CLOCK_MONOTONIC time of the event
+    uint16_t type;              // MODSW_EVENT_*
+    uint16_t mode;              // current mode index after the event
+    uint8_t line;               // switch line of a gesture, encoder index of a detent,
+                                // key index (row * cols + col) of a key, bit of an input
+    uint8_t gesture;            // gesture index from the configuration
+    uint16_t reserved;
+    uint32_t arg;               // gesture: held ms or edge count; mode: previous mode;
+                                // detent: new detent as int32_t; key: 1 pressed, 0 released;
+                                // input: new level
+    uint32_t reserved2;
+    char name[MODSW_NAME_MAX];  // mode or gesture name
+} modsw_event_t;
+
+/* Event N is stored in ring[N % MODSW_EVENT_RING]; head is the next N. */
+typedef struct modsw_events_t {
+    uint64_t head;
+    uint64_t reserved;
+    modsw_event_t ring[MODSW_EVENT_RING];
+} modsw_events_t;
+
+/*
+ * Pulse counter line, refreshed under the sequence lock every time a window
+ * bucket rotates (window_ms / 8).
+ */
+typedef struct modsw_counter_t {
+    char name[MODSW_NAME_MAX];
+    uint32_t pin;
+    uint32_t window_ms;
+    uint64_t edges;
+    uint64_t rising;
+    uint64_t falling;
+    uint64_t overflows;         // edges dropped by the kernel event queue
+    uint64_t last_edge_ns;      // kernel CLOCK_MONOTONIC timestamp
+    uint64_t freq_mhz;          // rising edge frequency over the window, in mHz
+    uint32_t duty_ppm;          // high time over the window, in parts per million
+    uint32_t level;
+} modsw_counter_t;
+
+typedef struct modsw_counters_t {
+    uint32_t count;
+    uint32_t reserved;
+    modsw_counter_t c[MODSW_MAX_COUNTERS];
+} modsw_counters_t;
+
+/*
+ * Quadrature rotary encoder, refreshed under the sequence lock after every
+ * batch of edge events that moved it by a detent.
+ */
+typedef struct modsw_encoder_t {
+    char name[MODSW_NAME_MAX];
+    uint32_t pin_a;
+    uint32_t pin_b;
+    int64_t position;           // quadrature steps
+    int64_t detent;
+    int64_t velocity_mdps;      // detents per second * 1000, signed, 0 when idle
+    uint64_t invalid;           // edges of unknown direction: repeated level or after lost edges
+    uint64_t overflows;         // edges dropped by the kernel event queue
+    uint64_t last_detent_ns;
+} modsw_encoder_t;
+
+typedef struct modsw_encoders_t {
+    uint32_t count;
+    uint32_t reserved;
+    modsw_encoder_t e[MODSW_MAX_ENCODERS];
+} modsw_encoders_t;
+
+/* Matrix keypad, refreshed under the sequence lock after every scan. */
+typedef struct modsw_matrix_t {
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t keys;              // debounced key bitmap, bit = row * cols + col
+    uint64_t scans;
+    uint64_t changes;           // scans that changed the bitmap
+    uint64_t last_scan_ns;      // duration of the last scan
+    uint32_t scan_us;           // current interval, larger while idle
+    uint32_t reserved;
+} modsw_matrix_t;
+
+/*
+ * Shift register input chain, refreshed under the sequence lock after every
+ * full chain read.
+ */
+typedef struct modsw_shiftreg_t {
+    uint32_t nbits;             // chain length
+    uint32_t scan_us;
+    uint64_t bits[MODSW_SHIFTREG_WORDS];  // bit N in bits[N / 64], first bit shifted out = 0
+    uint64_t reads;
+    uint64_t changes;           // reads that changed the published bitset
+    uint64_t read_ns;           // duration of the last full chain read
+    uint64_t bit_rate;          // bits per second achieved by the last read
+} modsw_shiftreg_t;
+
+/* Queue metrics of one output sink, refreshed once per second. */
+typedef struct modsw_sink_stats_t {
+    char name[MODSW_NAME_MAX];
+    uint32_t policy;            // 0 drop, 1 latest, 2 block
+    uint32_t thread;            // 1 = own worker thread, 0 = drained by the event loop
+    uint32_t capacity;
+    uint32_t depth;             // queued when the metrics were taken
+    uint64_t enqueued;
+    uint64_t dropped;           // rejected or evicted by the full-queue policy
+    uint64_t high_water;
+    uint64_t blocked_ns;        // time the event loop spent waiting (block policy)
+    uint64_t delivered;
+    uint64_t failed;            // delivered but reported an error
+    uint64_t last_latency_ns;   // queueing plus delivery time
+    uint64_t max_latency_ns;
+    uint64_t avg_latency_ns;
+    uint64_t last_exec_ns;      // time spent in the output itself (a plugin's callback)
+    uint64_t max_exec_ns;
+    uint64_t avg_exec_ns;
+    uint64_t suppressed;        // mode transitions coalesced away by the rate limit
+    uint32_t rate;              // mode transitions per second, 0 = unlimited
+    uint16_t burst;
+    uint16_t holding;           // 1 while a transition waits for a token
+} modsw_sink_stats_t;
+
+typedef struct modsw_sinks_t {
+    uint32_t count;
+    uint32_t reserved;
+    modsw_sink_stats_t s[MODSW_MAX_SINKS];
+} modsw_sinks_t;
+
+/* Supervised service, refreshed under the sequence lock whenever it changes state. */
+typedef struct modsw_service_t {
+    char name[MODSW_NAME_MAX];
+    int32_t pid;                // 0 when no process exists
+    uint32_t state;             // 0 idle, 1 warming up, 2 standby, 3 running, 4 stopping
+    uint32_t standby;           // 0 none, 1 pre-forked before exec, 2 started then stopped
+    int32_t last_status;        // wait status of the last exit
+    uint64_t starts;            // processes spawned, standby included
+    uint64_t restarts;          // respawns after an unexpected exit
+    uint64_t exits;
+} modsw_service_t;
+
+/*
+ * Mode-driven supervisor. A switchover is the time from the published
+ * transition until every service of the new mode was resumed or spawned;
+ * drain is the time until the services of the old mode had exited.
+ */
+typedef struct modsw_services_t {
+    uint32_t count;
+    int32_t predicted;          // mode whose services are kept on standby, -1 = none
+    uint64_t switchovers;
+    uint64_t standby_hits;      // services resumed from standby on a switchover
+    uint64_t standby_misses;    // services that had to be spawned on a switchover
+    uint64_t last_switch_ns;
+    uint64_t max_switch_ns;
+    uint64_t avg_switch_ns;
+    uint64_t last_drain_ns;
+    modsw_service_t s[MODSW_MAX_SERVICES];
+} modsw_services_t;
+
+/*
+ * Futex words, incremented after the write section of every published
+ * transition and woken with FUTEX_WAKE: `change` for any transition, mode[M]
+ * only when mode M is entered.
+ */
+typedef struct modsw_wake_t {
+    uint32_t change;
+    uint32_t reserved;
+    uint32_t mode[MODSW_MAX_MODES];
+} modsw_wake_t;
+
+/* Datagram a consumer sends to the ack socket. */
+typedef struct modsw_ack_msg_t {
+    uint32_t magic;             // MODSW_SHM_MAGIC
+    uint16_t version;           // MODSW_SHM_VERSION
+    uint16_t op;                // MODSW_ACK_*
+    uint64_t seq;               // stats.transitions of the applied state, 0 = none yet
+    uint64_t applied_ns;        // CLOCK_MONOTONIC time it was applied
+    char name[MODSW_NAME_MAX];  // consumer name, unique
+} modsw_ack_msg_t;
+
+/* Registered consumer, refreshed under the sequence lock on every ack. */
+typedef struct modsw_consumer_t {
+    char name[MODSW_NAME_MAX];
+    int32_t pid;                // sender of the registration, the only one heard under this name
+    uint32_t reserved;
+    uint64_t acked;             // last state applied
+    uint64_t acks;
+    uint64_t last_latency_ns;   // from the transition to its application
+    uint64_t max_latency_ns;
+} modsw_consumer_t;
+
+/*
+ * Acknowledgments. `lowest` is also stored atomically and `applied` is a
+ * futex word incremented after every change of it, so a waiter only needs
+ * FUTEX_WAIT on `applied` while lowest < the state it waits for.
+ */
+typedef struct modsw_acks_t {
+    uint32_t applied;           // futex word
+    uint32_t count;             // registered consumers in c[]
+    uint64_t target;            // stats.transitions of the published state
+    uint64_t lowest;            // lowest state applied by every consumer, == target when done
+    uint64_t last_all_ns;       // time from the last transition until all had applied it
+    uint64_t max_all_ns;
+    char socket[MODSW_ACK_PATH_MAX];  // path of the ack socket
+    uint32_t reserved;
+    modsw_consumer_t c[MODSW_MAX_CONSUMERS];
+} modsw_acks_t;
+
+/*
+ * Reader leases. Each slot is one word, claimed and refreshed by
+ * compare-and-swap: the reader's PID in the upper half and the
+ * CLOCK_MONOTONIC second of its last heartbeat in the lower one, 0 if free.
+ * A reader blocked in a wait stores MODSW_LEASE_WAITING instead of
+ * heartbeats. Readers only claim free slots; the daemon frees those of dead
+ * processes. A reader whose lease becomes live, by a claim or after its
+ * heartbeat had lapsed, bumps `wake` and wakes it, so an idling daemon
+ * notices at once without polling the table.
+ */
+typedef struct modsw_leases_t {
+    uint32_t magic;             // MODSW_SHM_MAGIC, stored last by the daemon
+    uint16_t version;           // MODSW_SHM_VERSION
+    uint16_t count;             // slots in lease[]
+    uint32_t wake;              // futex word
+    uint32_t reserved;
+    uint64_t lease[MODSW_LEASE_MAX];
+} modsw_leases_t;
+
+#define MODSW_LEASE_WORD(pid, sec) ((uint64_t)(uint32_t)(pid) << 32 | (uint32_t)(sec))
+#define MODSW_LEASE_PID(word) ((uint32_t)((word) >> 32))
+#define MODSW_LEASE_SEC(word) ((uint32_t)(word))
+
+/*
+ * Profile blob: `count` pairs of NUL-terminated "key" "value" strings in
+ * data[]. Blobs are 8-byte aligned and never modified after startup. The
+ * profile index at profiles_off holds one uint32_t blob offset per mode
+ * (MODSW_MAX_MODES entries, 0 when that mode has no profile).
+ */
+typedef struct modsw_profile_t {
+    uint16_t mode;
+    uint16_t count;
+    uint32_t len;               // bytes used in data[]
+    char data[];
+} modsw_profile_t;
+
+
+/* Legacy ASCII byte for a mode index: '0'-'9', then 'a'-'z', then '#'. */
+static inline uint8_t modsw_mode_char(unsigned mode) {
+    if (mode < 10)
+        return '0' + mode;
+    if (mode < 36)
+        return 'a' + (mode - 10);
+    return '#';
+}
+
+static inline void modsw_shm_write_begin(modsw_shm_t *shm) {
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void modsw_shm_write_end(modsw_shm_t *shm) {
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t modsw_shm_read_begin(const modsw_shm_t *shm) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return seq;
+}
+
+static inline int modsw_shm_read_retry(const modsw_shm_t *shm, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif /* MODSW_SHM_H */
@@ -16,9 +16,34 @@
  * or configuration changes without restarting services or reading GPIO directly.
  *
  * Features:
- *   - Reads DIP switch state using /dev/gpiochipN line handles.
+ *   - Reads DIP switch state using one /dev/gpiochipN v2 line request.
  *   - Configurable GPIO pins, pull-up/pull-down mode, and polling delay.
- *   - Single-byte shared memory output (ASCII '0', '1', '2', or '3').
+ *   - Up to 8 switch lines decoded to named modes (binary, Gray, BCD, one-hot).
+ *   - Additional independent switch groups, each with its own lines, decode
+ *     and shared memory object, read by the same line request and loop.
+ *   - Settle window that coalesces multi-line changes into one transition.
+ *   - Line info watch that flags and re-requests lines reconfigured by
+ *     another process or driver.
+ *   - Per-mode key/value profiles published as immutable shared memory blobs.
+ *   - Per-mode dwell time, entry and transition pair accounting.
+ *   - Hold, long-press and toggle gestures on individual switch lines.
+ *   - Event ring with every transition and gesture, driven by one timerfd.
+ *   - Pulse counter lines with frequency and duty cycle from kernel edge
+ *     timestamps, read in batches.
+ *   - Quadrature rotary encoders with position, detent and velocity.
+ *   - Matrix keypad scanning with debounce and idle-adaptive scan rate.
+ *   - Cascaded 74HC165 shift register input chains of up to 256 bits.
+ *   - Optional uinput device emitting EV_SW/EV_KEY events on transitions.
+ *   - Outputs other than shared memory fed through per-sink bounded queues.
+ *   - Atomically replaced state file for file-watching consumers.
+ *   - Compact, checksummed on-disk journal of every transition.
+ *   - Non-blocking MQTT publisher with retained mode and periodic stats.
+ *   - Legacy single-byte shared memory output (ASCII '0', '1', '2', or '3'),
+ *     followed by a sequence-locked state and statistics area.
+ *   - Reader leases: without live readers, polling stops and the switch lines
+ *     are only watched for edges.
+ *   - Scripted replay of switch input on a virtual clock, printing the
+ *     published sequence, for exercising timing logic without hardware.
  *   - Daemon mode support for SysVinit-based systems.
  *   - Prevents multiple instances via PID lock file.
  *
@@ -46,46 +71,151 @@
 #include <linux/gpio.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
 #include <getopt.h>
+#include <time.h>
 #include "ini.h"
 #include "utils.h"
+#include "modsw_shm.h"
+#include "decode.h"
+#include "profile.h"
+#include "gesture.h"
+#include "gpio.h"
+#include "counter.h"
+#include "encoder.h"
+#include "matrix.h"
+#include "shiftreg.h"
+#include "evdev.h"
+#include "sink.h"
+#include "statefile.h"
+#include "mqtt.h"
+#include "http.h"
+#include "plugin.h"
+#include "supervisor.h"
+#include "ack.h"
+#include "group.h"
+#include "journal.h"
+#include "replay.h"
+#include "lease.h"
 //#include "version.h"
 #include "config.h"
 
-#define SHM_FILE "/modsw"
-#define SHM_SIZE 1        // ascii number 0x30 + 0, 1, 2, 3; use 1 byte only.
+#define SHM_FILE MODSW_SHM_FILE
+#define SHM_HEADER_SIZE ((sizeof(modsw_shm_t) + 7) & ~(size_t)7)   // legacy ascii byte at offset 0, then state and stats.
 
 #define LOCK_FILE "/var/run/modswitch.lock"
 #define MODSWITCH_CONF_FILE "/etc/modswitch/modswitch.conf"
 #define MAIN_GPIOCHIP "/dev/gpiochip0"
 
-#define DEFAULT_CONF_SW0_GPIO 10
+#define DEFAULT_CONF_SW0_GPIO 10    // sw2_pin..sw7_pin are unset by default
 #define DEFAULT_CONF_SW1_GPIO  7
 #define DEFAULT_CONF_GPIO_PULLUPDOWN 1      // 1 = PULLUP; 0 = PULLDOWN
 #define DEFAULT_CONF_DELAY_US 1000
+#define DEFAULT_CONF_SETTLE_US 5000         // all lines quiet this long before publishing
+#define DEFAULT_CONF_IDLE 1                 // 1 = stop polling while no reader holds a lease
+#define DEFAULT_CONF_IDLE_DELAY_US 1000000  // background sampling while idle, 0 = edges only
+#define LEASE_CHECK_NS 1000000000ull        // lease checks at full rate; idle, only a reader's wakeup checks
+#define LINE_RETRY_NS 1000000000ull         // re-request attempts while our lines are taken
 
 static int is_daemon = 0;
 static char *modswitch_conf_file = MODSWITCH_CONF_FILE;
+static const char *replay_file = NULL;     // -r: lines come from this script, time is virtual
 
 
 typedef struct modswitch_conf_t {
-    int sw0_pin;
-    int sw1_pin;
+    int sw_pin[MODSW_MAX_LINES];    // swN_pin, -1 if not configured
+    unsigned lines;                 // number of configured switch lines
     int pullupdown;
     uintmax_t delay_us;
+    uintmax_t settle_us;
+    int idle;
+    uintmax_t idle_delay_us;
+    decode_scheme_t scheme;
+    char mode_name[MODSW_MAX_MODES][MODSW_NAME_MAX];
+    profile_set_t profiles;         // every other key of the [mode.N] sections
+    gesture_set_t gestures;         // [gesture.NAME] sections
+    counter_set_t counters;         // [counter.NAME] sections
+    encoder_set_t encoders;         // [encoder.NAME] sections
+    matrix_t matrix;                // [matrix] section
+    shiftreg_t shiftreg;            // [shiftreg] section
+    evdev_sink_t uinput;            // [uinput] section
+    sink_conf_t uinput_queue;
+    statefile_t statefile;          // [statefile] section
+    sink_conf_t statefile_queue;
+    journal_t journal;              // [journal] section
+    sink_conf_t journal_queue;
+    mqtt_t mqtt;                    // [mqtt] section
+    sink_conf_t mqtt_queue;
+    http_t http;                    // [http] section
+    sink_conf_t http_queue;
+    plugin_set_t plugins;           // [plugin.NAME] sections
+    supervisor_t services;          // [service.NAME] sections
+    ack_t ack;                      // [ack] section
+    group_set_t groups;             // [group.NAME] sections
 }modswitch_conf_t;
 
 static int lock_fd = -1;
 static int shm_fd = -1;
-static uint8_t *shm_ptr = NULL;
-static int gpio_fd = -1;
-static int gpio_line_fd = -1;
+static modsw_shm_t *shm_ptr = NULL;
+static size_t shm_size = 0;
+static modsw_acct_t *acct_ptr = NULL;
+static modsw_events_t *events_ptr = NULL;
+static modsw_counters_t *counters_ptr = NULL;
+static modsw_encoders_t *encoders_ptr = NULL;
+static modsw_matrix_t *matrix_ptr = NULL;
+static modsw_shiftreg_t *shiftreg_ptr = NULL;
+static modsw_sinks_t *sinks_ptr = NULL;
+static modsw_services_t *services_ptr = NULL;
+static modsw_acks_t *acks_ptr = NULL;
+static modsw_wake_t *wake_ptr = NULL;
+static sink_set_t sinks;
+static uint64_t fanned = 0;     // next event ring position to hand to the sinks
+static uint64_t line_changed_ns[MODSW_MAX_LINES];  // last published change of each switch line
+static int timer_fd = -1;
+static int epoll_fd = -1;
+static int stop_fd = -1;                        // signalfd for SIGINT and SIGTERM
+static bool stop_requested = false;
+
+enum { EV_SRC_TIMER = 1, EV_SRC_GPIO, EV_SRC_LINEINFO, EV_SRC_MQTT, EV_SRC_CHILD, EV_SRC_ACK, EV_SRC_STOP, EV_SRC_LEASE, EV_SRC_HTTP };     // EV_SRC_HTTP must stay last, clients follow it
+static gpio_req_t gpio_req;
+static bool lines_lost = false;                 // re-request failed, nothing is sampled until a retry works
+static uint64_t suspect_deadline = UINT64_MAX;  // next retry while lines_lost, else when MODSW_FLAG_SUSPECT clears
+static replay_t replay;
+static lease_table_t leases = { .fd = -1, .wake_fd = -1 };
+static bool idling = false;                     // no live lease and quiet lines: edges and idle_delay_us only
+static uint64_t awake_until = 0;                // full rate after a switch line edge, until it has settled
+static uint64_t idle_hold_ns = 0;               // longest settle window plus one sampling tick
+static uint64_t replay_printed = 0;             // next event ring position to print
+static uint64_t replay_group_printed[GROUP_MAX];
+
+// Owner of an edge-detecting line, looked up by line request index for every event.
+typedef struct line_owner_t {
+    uint8_t type;       // LINE_OWNER_*
+    uint8_t index;      // counter or encoder index
+    uint8_t line_b;     // encoder: line B rather than A
+} line_owner_t;
+enum { LINE_OWNER_NONE = 0, LINE_OWNER_COUNTER, LINE_OWNER_ENCODER };
+static line_owner_t line_owner[GPIO_V2_LINES_MAX];
+static decode_t decoder;
 
 static modswitch_conf_t modswitch_default_conf = {
-    .sw0_pin = DEFAULT_CONF_SW0_GPIO,
-    .sw1_pin = DEFAULT_CONF_SW1_GPIO,
+    .sw_pin = { DEFAULT_CONF_SW0_GPIO, DEFAULT_CONF_SW1_GPIO, -1, -1, -1, -1, -1, -1 },
     .pullupdown = DEFAULT_CONF_GPIO_PULLUPDOWN,
-    .delay_us = DEFAULT_CONF_DELAY_US
+    .delay_us = DEFAULT_CONF_DELAY_US,
+    .settle_us = DEFAULT_CONF_SETTLE_US,
+    .idle = DEFAULT_CONF_IDLE,
+    .idle_delay_us = DEFAULT_CONF_IDLE_DELAY_US,
+    .scheme = DECODE_BINARY,
+    .uinput_queue = SINK_CONF_DEFAULT,
+    .statefile_queue = { .queue_len = 4, .policy = SINK_POLICY_LATEST, .thread = true,     // only the newest state matters
+                         .rate = SINK_DEFAULT_RATE, .burst = SINK_DEFAULT_BURST },
+    .journal_queue = SINK_CONF_DEFAULT,
+    .mqtt_queue = { .queue_len = 16, .policy = SINK_POLICY_DROP, .thread = false, .rate = SINK_DEFAULT_RATE, .burst = SINK_DEFAULT_BURST },
+    .http_queue = { .queue_len = 64, .policy = SINK_POLICY_DROP, .thread = false, .rate = SINK_DEFAULT_RATE, .burst = SINK_DEFAULT_BURST },
+    .services = { .signal_fd = -1 },
 };
 
 static const int available_switch_gpio[] = {
@@ -98,49 +228,247 @@ static const int available_switch_gpio[] = {
 static int conf_handler(void *user, const char *section, const char *name, const char *value) {
     modswitch_conf_t *config = (modswitch_conf_t *)user;
     #define CONF_MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-    if (CONF_MATCH("gpio", "sw0_pin")) {
-        config->sw0_pin = atoi(value);
-    } else if (CONF_MATCH("gpio", "sw1_pin")) {
-        config->sw1_pin = atoi(value);
+    unsigned idx;
+    int len = 0;
+    if (strcmp(section, "gpio") == 0 && sscanf(name, "sw%u_pin%n", &idx, &len) == 1 && name[len] == '\0') {
+        if (idx >= MODSW_MAX_LINES)
+            return 0;
+        config->sw_pin[idx] = atoi(value);
+    } else if (strncmp(section, "mode.", 5) == 0) {
+        uintmax_t mode;
+        if (!xstr2umax(section + 5, 10, &mode) || mode >= MODSW_MAX_MODES)
+            return 0;
+        if (strcmp(name, "name") != 0)
+            return profile_set_add(&config->profiles, (unsigned)mode, name, value) == 0;
+        if (strlen(value) >= MODSW_NAME_MAX)
+            return 0;
+        strcpy(config->mode_name[mode], value);
+    } else if (strncmp(section, "counter.", 8) == 0) {
+        return counter_conf(&config->counters, section + 8, name, value);
+    } else if (strncmp(section, "encoder.", 8) == 0) {
+        return encoder_conf(&config->encoders, section + 8, name, value);
+    } else if (strcmp(section, "matrix") == 0) {
+        return matrix_conf(&config->matrix, name, value);
+    } else if (strcmp(section, "shiftreg") == 0) {
+        return shiftreg_conf(&config->shiftreg, name, value);
+    } else if (strcmp(section, "uinput") == 0) {
+        return sink_conf(&config->uinput_queue, name, value) || evdev_conf(&config->uinput, name, value);
+    } else if (strcmp(section, "statefile") == 0) {
+        return sink_conf(&config->statefile_queue, name, value) || statefile_conf(&config->statefile, name, value);
+    } else if (strcmp(section, "journal") == 0) {
+        return sink_conf(&config->journal_queue, name, value) || journal_conf(&config->journal, name, value);
+    } else if (strcmp(section, "mqtt") == 0) {
+        return sink_conf(&config->mqtt_queue, name, value) || mqtt_conf(&config->mqtt, name, value);
+    } else if (strncmp(section, "service.", 8) == 0) {
+        return supervisor_conf(&config->services, section + 8, name, value);
+    } else if (strncmp(section, "plugin.", 7) == 0) {
+        return plugin_conf(&config->plugins, section + 7, name, value);
+    } else if (strncmp(section, "group.", 6) == 0) {
+        return group_conf(&config->groups, section + 6, name, value);
+    } else if (strcmp(section, "ack") == 0) {
+        return ack_conf(&config->ack, name, value);
+    } else if (strcmp(section, "http") == 0) {
+        return sink_conf(&config->http_queue, name, value) || http_conf(&config->http, name, value);
+    } else if (strncmp(section, "gesture.", 8) == 0) {
+        return gesture_conf(&config->gestures, section + 8, name, value);
+    } else if (CONF_MATCH("decode", "scheme")) {
+        return decode_scheme_from_str(value, &config->scheme);
     } else if (CONF_MATCH("gpio", "pullupdown")) {
         config->pullupdown = atoi(value);
     } else if (CONF_MATCH("user", "delay_us")) {
         return xstr2umax(value, 10, &config->delay_us);
+    } else if (CONF_MATCH("user", "settle_us")) {
+        return xstr2umax(value, 10, &config->settle_us);
+    } else if (CONF_MATCH("user", "idle")) {
+        config->idle = atoi(value);
+    } else if (CONF_MATCH("user", "idle_delay_us")) {
+        return xstr2umax(value, 10, &config->idle_delay_us);
     } else {
         return 0;
     }
     return 1;
 }
 
-static int conf_checker(const modswitch_conf_t *conf) {
+typedef struct pin_claims_t {
+    int pin[sizeof(available_switch_gpio)/sizeof(int)];  // every claim is a distinct valid pin
+    char owner[sizeof(available_switch_gpio)/sizeof(int)][MODSW_NAME_MAX + 32];
+    unsigned n;
+} pin_claims_t;
+
+// A GPIO may belong to one line of one section only; gpio_req_add would otherwise fail with a bare EEXIST.
+static bool claim_pin(pin_claims_t *claims, int pin, const char *owner) {
+    for (unsigned i = 0; i < claims->n; i++) {
+        if (claims->pin[i] == pin) {
+            fprintf(stderr, "conf.ini_checker.pin_conflict: %s and %s both use pin %d\n", claims->owner[i], owner, pin);
+            return false;
+        }
+    }
+    claims->pin[claims->n] = pin;
+    snprintf(claims->owner[claims->n], sizeof(claims->owner[0]), "%s", owner);
+    claims->n++;
+    return true;
+}
+
+// Runs after the per-section checks, so every pin is valid and the table cannot overflow.
+static int check_pin_claims(const modswitch_conf_t *conf) {
+    static const char *shiftreg_pin[] = { "load", "clock", "data" };
+    pin_claims_t claims = { .n = 0 };
+    char owner[MODSW_NAME_MAX + 32];
+    for (unsigned i = 0; i < conf->lines; i++) {
+        snprintf(owner, sizeof(owner), "switch %u", i);
+        if (!claim_pin(&claims, conf->sw_pin[i], owner))
+            return -1;
+    }
+    for (unsigned i = 0; i < conf->groups.n; i++) {
+        const group_t *g = &conf->groups.g[i];
+        for (unsigned l = 0; l < g->lines; l++) {
+            snprintf(owner, sizeof(owner), "group '%s' switch %u", g->name, l);
+            if (!claim_pin(&claims, g->sw_pin[l], owner))
+                return -1;
+        }
+    }
+    for (unsigned i = 0; i < conf->counters.n; i++) {
+        snprintf(owner, sizeof(owner), "counter '%s'", conf->counters.c[i].name);
+        if (!claim_pin(&claims, conf->counters.c[i].pin, owner))
+            return -1;
+    }
+    for (unsigned i = 0; i < conf->encoders.n; i++) {
+        const encoder_t *e = &conf->encoders.e[i];
+        snprintf(owner, sizeof(owner), "encoder '%s' pin_a", e->name);
+        if (!claim_pin(&claims, e->pin_a, owner))
+            return -1;
+        snprintf(owner, sizeof(owner), "encoder '%s' pin_b", e->name);
+        if (!claim_pin(&claims, e->pin_b, owner))
+            return -1;
+    }
+    for (unsigned i = 0; i < conf->matrix.nrows; i++) {
+        snprintf(owner, sizeof(owner), "matrix row %u", i);
+        if (!claim_pin(&claims, conf->matrix.rows[i], owner))
+            return -1;
+    }
+    for (unsigned i = 0; i < conf->matrix.ncols; i++) {
+        snprintf(owner, sizeof(owner), "matrix col %u", i);
+        if (!claim_pin(&claims, conf->matrix.cols[i], owner))
+            return -1;
+    }
+    if (conf->shiftreg.nbits) {
+        const shiftreg_t *s = &conf->shiftreg;
+        int pins[3] = { s->load_pin, s->clock_pin, s->data_pin };
+        for (unsigned i = 0; i < 3; i++) {
+            snprintf(owner, sizeof(owner), "shiftreg %s pin", shiftreg_pin[i]);
+            if (!claim_pin(&claims, pins[i], owner))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int conf_checker(modswitch_conf_t *conf) {
     if (!conf) {
         errno = EFAULT;
         perror("conf.ini_checker.got_null_conf");
         abort();
     }
-    if (!int_in_list(conf->sw0_pin, available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
-        fprintf(stderr, "conf.ini_checker.invalid_config: invalid switch 0 pin: %d\n", conf->sw0_pin);
-        return -1;
+    conf->lines = 0;
+    for (unsigned i = 0; i < MODSW_MAX_LINES; i++) {
+        if (conf->sw_pin[i] >= 0)
+            conf->lines = i + 1;
     }
-    if (!int_in_list(conf->sw1_pin, available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
-        fprintf(stderr, "conf.ini_checker.invalid_config: invalid switch 1 pin: %d\n", conf->sw1_pin);
+    if (conf->lines == 0) {
+        fprintf(stderr, "conf.ini_checker.invalid_config: no switch pins configured\n");
         return -1;
     }
+    for (unsigned i = 0; i < conf->lines; i++) {
+        if (!int_in_list(conf->sw_pin[i], available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
+            fprintf(stderr, "conf.ini_checker.invalid_config: invalid switch %u pin: %d\n", i, conf->sw_pin[i]);
+            return -1;
+        }
+    }
+    for (unsigned i = 0; i < conf->groups.n; i++) {
+        group_t *g = &conf->groups.g[i];
+        g->lines = 0;
+        for (unsigned l = 0; l < MODSW_MAX_LINES; l++) {
+            if (g->sw_pin[l] >= 0)
+                g->lines = l + 1;
+        }
+        if (g->lines == 0) {
+            fprintf(stderr, "conf.ini_checker.invalid_config: group '%s' has no switch pins\n", g->name);
+            return -1;
+        }
+        for (unsigned l = 0; l < g->lines; l++) {
+            if (!int_in_list(g->sw_pin[l], available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
+                fprintf(stderr, "conf.ini_checker.invalid_config: invalid group '%s' switch %u pin: %d\n", g->name, l, g->sw_pin[l]);
+                return -1;
+            }
+        }
+    }
     if (conf->pullupdown > 1 || conf->pullupdown < 0) {
         fprintf(stderr, "conf.ini_checker.invalid_config: invalid pullupdown mode: %d\n", conf->pullupdown);
         return -1;
     }
+    for (unsigned i = 0; i < conf->counters.n; i++) {
+        const counter_t *c = &conf->counters.c[i];
+        if (!int_in_list(c->pin, available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
+            fprintf(stderr, "conf.ini_checker.invalid_config: invalid counter '%s' pin: %d\n", c->name, c->pin);
+            return -1;
+        }
+    }
+    for (unsigned i = 0; i < conf->encoders.n; i++) {
+        const encoder_t *e = &conf->encoders.e[i];
+        if (!int_in_list(e->pin_a, available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int)) ||
+            !int_in_list(e->pin_b, available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
+            fprintf(stderr, "conf.ini_checker.invalid_config: invalid encoder '%s' pins: %d, %d\n", e->name, e->pin_a, e->pin_b);
+            return -1;
+        }
+    }
+    if ((conf->matrix.nrows == 0) != (conf->matrix.ncols == 0)) {
+        fprintf(stderr, "conf.ini_checker.invalid_config: matrix needs both rows and cols\n");
+        return -1;
+    }
+    for (unsigned i = 0; i < conf->matrix.nrows + conf->matrix.ncols; i++) {
+        int pin = i < conf->matrix.nrows ? conf->matrix.rows[i] : conf->matrix.cols[i - conf->matrix.nrows];
+        if (!int_in_list(pin, available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
+            fprintf(stderr, "conf.ini_checker.invalid_config: invalid matrix pin: %d\n", pin);
+            return -1;
+        }
+    }
+    if (conf->shiftreg.nbits) {
+        const shiftreg_t *s = &conf->shiftreg;
+        int pins[3] = { s->load_pin, s->clock_pin, s->data_pin };
+        for (unsigned i = 0; i < 3; i++) {
+            if (!int_in_list(pins[i], available_switch_gpio, sizeof(available_switch_gpio)/sizeof(int))) {
+                fprintf(stderr, "conf.ini_checker.invalid_config: invalid shiftreg pins: %d, %d, %d\n", s->load_pin, s->clock_pin, s->data_pin);
+                return -1;
+            }
+        }
+    }
 
-    return 0;
+    return check_pin_claims(conf);
 }
 
 static void cleanup() {
-    if (gpio_line_fd >= 0)
-        close(gpio_line_fd);
-    if (gpio_fd >= 0)
-        close(gpio_fd);
+    if (timer_fd >= 0)
+        close(timer_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (stop_fd >= 0)
+        close(stop_fd);
+    gpio_req_close(&gpio_req);
+    unsigned stuck = sink_set_stop(&sinks);
+    evdev_close(&modswitch_default_conf.uinput);
+    statefile_close(&modswitch_default_conf.statefile);
+    journal_close(&modswitch_default_conf.journal);         // after the sinks, so nothing is lost
+    mqtt_close(&modswitch_default_conf.mqtt);
+    http_close(&modswitch_default_conf.http);
+    if (!stuck)     // else an executor may still run plugin code
+        plugin_set_close(&modswitch_default_conf.plugins);
+    supervisor_close(&modswitch_default_conf.services);
+    ack_close(&modswitch_default_conf.ack);
+    group_set_close(&modswitch_default_conf.groups);
+    replay_free(&replay);
+    lease_close(&leases);
     if (shm_ptr)
-        munmap(shm_ptr, SHM_SIZE);
+        munmap(shm_ptr, shm_size);
     if (shm_fd >= 0) {
         close(shm_fd);
         shm_unlink(SHM_FILE);
@@ -151,56 +479,641 @@ static void cleanup() {
     }
 }
 
-static void signal_handler(int signum)
-{
-    (void)signum;
-    cleanup();
-    exit(0);
+/*
+ * Append an event to the ring. Must be called inside a shm write section so
+ * readers never see a half-written entry.
+ */
+static void push_event(uint16_t type, uint64_t ts, uint8_t line, uint8_t gesture, uint32_t arg, const char *name) {
+    uint64_t head = events_ptr->head;
+    modsw_event_t *ev = &events_ptr->ring[head % MODSW_EVENT_RING];
+    ev->seq = head;
+    ev->ts_ns = ts;
+    ev->type = type;
+    ev->mode = shm_ptr->mode;
+    ev->line = line;
+    ev->gesture = gesture;
+    ev->arg = arg;
+    memcpy(ev->name, name, MODSW_NAME_MAX);
+    __atomic_store_n(&events_ptr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t bias_flags(int bias) {
+    if (bias > 0)
+        return GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    if (bias == 0)
+        return GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+    return GPIO_V2_LINE_FLAG_BIAS_DISABLED;
 }
 
+/*
+ * Request every line of the chip at once. Switch lines come first so their
+ * request index equals their switch index; with pull-ups they are requested
+ * active-low, so a read returns active bits directly. Group switch lines
+ * follow, so one read covers every switch. When the daemon may idle, switch
+ * lines also report edges, which is all it waits for while idle.
+ */
 static int setup_gpio() {
-    gpio_fd = open(MAIN_GPIOCHIP, O_RDONLY);
-    if (gpio_fd < 0) {
-        perror("gpio.setup.cannot_open_gpiochip");
+    gpio_req_init(&gpio_req, MAIN_GPIOCHIP, "modswitchd");
+    memset(line_owner, 0, sizeof(line_owner));
+
+    uint64_t edge_flags = modswitch_default_conf.idle ? GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING : 0;
+    uint64_t sw_flags = GPIO_V2_LINE_FLAG_INPUT | edge_flags | bias_flags(modswitch_default_conf.pullupdown);
+    if (modswitch_default_conf.pullupdown)
+        sw_flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+    for (unsigned i = 0; i < modswitch_default_conf.lines; i++) {
+        if (gpio_req_add(&gpio_req, modswitch_default_conf.sw_pin[i], sw_flags) < 0) {
+            perror("gpio.setup.cannot_add_switch_line");
+            return -1;
+        }
+    }
+    if (group_set_add_lines(&modswitch_default_conf.groups, &gpio_req, edge_flags) < 0) {
+        perror("gpio.setup.cannot_add_group_line");
         return -1;
     }
 
-    struct gpiohandle_request req = {0};
-    req.lineoffsets[0] = modswitch_default_conf.sw0_pin;
-    req.lineoffsets[1] = modswitch_default_conf.sw1_pin;
-    req.lines = 2;
-    
-    if (modswitch_default_conf.pullupdown)
-        req.flags = GPIOHANDLE_REQUEST_INPUT | GPIOHANDLE_REQUEST_BIAS_PULL_UP;
-    else
-        req.flags = GPIOHANDLE_REQUEST_INPUT | GPIOHANDLE_REQUEST_BIAS_PULL_DOWN;
+    counter_set_t *counters = &modswitch_default_conf.counters;
+    for (unsigned i = 0; i < counters->n; i++) {
+        uint64_t flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING | bias_flags(counters->c[i].bias);
+        int idx = gpio_req_add(&gpio_req, counters->c[i].pin, flags);
+        if (idx < 0) {
+            perror("gpio.setup.cannot_add_counter_line");
+            return -1;
+        }
+        counters->c[i].req_index = idx;
+        line_owner[idx] = (line_owner_t){ LINE_OWNER_COUNTER, (uint8_t)i, 0 };
+    }
+
+    encoder_set_t *encoders = &modswitch_default_conf.encoders;
+    for (unsigned i = 0; i < encoders->n; i++) {
+        encoder_t *e = &encoders->e[i];
+        uint64_t flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING | bias_flags(e->bias);
+        e->req_a = gpio_req_add(&gpio_req, e->pin_a, flags);
+        e->req_b = gpio_req_add(&gpio_req, e->pin_b, flags);
+        if (e->req_a < 0 || e->req_b < 0) {
+            perror("gpio.setup.cannot_add_encoder_line");
+            return -1;
+        }
+        line_owner[e->req_a] = (line_owner_t){ LINE_OWNER_ENCODER, (uint8_t)i, 0 };
+        line_owner[e->req_b] = (line_owner_t){ LINE_OWNER_ENCODER, (uint8_t)i, 1 };
+    }
 
-    if (ioctl(gpio_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
-        perror("gpio.setup.get_linehandle_ioctl_failed");
-        close(gpio_fd);
+    if (modswitch_default_conf.matrix.nrows && matrix_add_lines(&modswitch_default_conf.matrix, &gpio_req) < 0) {
+        perror("gpio.setup.cannot_add_matrix_line");
+        return -1;
+    }
+    if (modswitch_default_conf.shiftreg.nbits && shiftreg_add_lines(&modswitch_default_conf.shiftreg, &gpio_req) < 0) {
+        perror("gpio.setup.cannot_add_shiftreg_line");
         return -1;
     }
 
-    gpio_line_fd = req.fd;
+    if (replay_file)        // the request only maps lines to bits
+        return 0;
+    if (gpio_req_open(&gpio_req) < 0) {
+        perror("gpio.setup.get_line_ioctl_failed");
+        return -1;
+    }
     return 0;
 }
 
-static int get_gpio(int *sw0_ptr, int *sw1_ptr) {
-    struct gpiohandle_data data;
-    if (ioctl(gpio_line_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+/*
+ * Read all switch lines as active bits with one ioctl: the main switch's
+ * line N in bit N of raw_ptr, the group lines at their request index in
+ * group_bits. A replay script uses the same bit layout.
+ */
+static int get_gpio(uint8_t *raw_ptr, uint64_t *group_bits) {
+    uint64_t main_mask = (1ull << modswitch_default_conf.lines) - 1;
+    uint64_t mask = main_mask | modswitch_default_conf.groups.mask;
+    uint64_t bits;
+    if (replay_file) {
+        bits = replay_levels(&replay, monotonic_ns()) & mask;
+    } else if (gpio_req_get(&gpio_req, mask, &bits) < 0) {
         perror("gpio.get.get_line_values_ioctl_failed");
         return -1;
     }
-    *sw0_ptr = data.values[0];
-    *sw1_ptr = data.values[1];
+    *raw_ptr = (uint8_t)(bits & main_mask);     // group lines would read as extra main lines
+    *group_bits = bits;
+    return 0;
+}
+
+// Seed counters and encoders with the current levels of their edge lines.
+static void start_edge_lines(uint64_t now) {
+    counter_set_t *counters = &modswitch_default_conf.counters;
+    encoder_set_t *encoders = &modswitch_default_conf.encoders;
+    uint64_t mask = 0, bits = 0;
+    for (unsigned i = 0; i < GPIO_V2_LINES_MAX; i++) {
+        if (line_owner[i].type != LINE_OWNER_NONE)
+            mask |= 1ull << i;
+    }
+    if (mask && gpio_req_get(&gpio_req, mask, &bits) < 0)
+        perror("gpio.edge.get_line_values_ioctl_failed");
+    for (unsigned i = 0; i < counters->n; i++)
+        counter_start(&counters->c[i], !!(bits & (1ull << counters->c[i].req_index)), now);
+    for (unsigned i = 0; i < encoders->n; i++) {
+        encoder_t *e = &encoders->e[i];
+        encoder_start(e, !!(bits & (1ull << e->req_a)), !!(bits & (1ull << e->req_b)), now);
+    }
+}
+
+static void publish_counters(uint64_t now) {
+    counter_set_t *counters = &modswitch_default_conf.counters;
+    modsw_shm_write_begin(shm_ptr);
+    for (unsigned i = 0; i < counters->n; i++)
+        counter_publish(&counters->c[i], now, &counters_ptr->c[i]);
+    modsw_shm_write_end(shm_ptr);
+}
+
+/*
+ * Publish encoders that moved, with one detent event each. Called once per
+ * drained batch, so a fast spin costs one shm update rather than one per edge.
+ */
+static void publish_encoders(bool force) {
+    encoder_set_t *encoders = &modswitch_default_conf.encoders;
+    modsw_shm_write_begin(shm_ptr);
+    for (unsigned i = 0; i < encoders->n; i++) {
+        encoder_t *e = &encoders->e[i];
+        if (!e->changed && !force)
+            continue;
+        encoder_publish(e, &encoders_ptr->e[i]);
+        if (e->changed)
+            push_event(MODSW_EVENT_DETENT, e->last_detent_ns, (uint8_t)i, 0, (uint32_t)(int32_t)e->detent, e->name);
+        e->changed = false;
+    }
+    modsw_shm_write_end(shm_ptr);
+}
+
+static int scan_matrix(uint64_t now) {
+    matrix_t *m = &modswitch_default_conf.matrix;
+    uint64_t changed;
+    int ret = matrix_scan(m, &gpio_req, now, &changed);
+    if (ret < 0) {
+        perror("gpio.matrix.scan_ioctl_failed");
+        return -1;
+    }
+    if (ret == 0)
+        return 0;
+
+    modsw_shm_write_begin(shm_ptr);
+    matrix_publish(m, now, matrix_ptr);
+    for (unsigned k = 0; changed >> k; k++) {
+        if (!(changed & (1ull << k)))
+            continue;
+        char name[MODSW_NAME_MAX] = {0};
+        snprintf(name, sizeof(name), "r%uc%u", k / m->ncols, k % m->ncols);
+        push_event(MODSW_EVENT_KEY, now, (uint8_t)k, 0, !!(m->keys & (1ull << k)), name);
+    }
+    modsw_shm_write_end(shm_ptr);
+    return 0;
+}
+
+static int scan_shiftreg(uint64_t now) {
+    shiftreg_t *s = &modswitch_default_conf.shiftreg;
+    uint64_t changed[MODSW_SHIFTREG_WORDS];
+    int ret = shiftreg_scan(s, &gpio_req, now, changed);
+    if (ret < 0) {
+        perror("gpio.shiftreg.read_ioctl_failed");
+        return -1;
+    }
+    if (ret == 0)
+        return 0;
+
+    modsw_shm_write_begin(shm_ptr);
+    shiftreg_publish(s, shiftreg_ptr);
+    for (unsigned i = 0; i < s->nbits; i++) {
+        if (!(changed[i / 64] & (1ull << (i % 64))))
+            continue;
+        char name[MODSW_NAME_MAX] = {0};
+        snprintf(name, sizeof(name), "in%u", i);
+        push_event(MODSW_EVENT_INPUT, now, (uint8_t)i, 0, !!(s->bits[i / 64] & (1ull << (i % 64))), name);
+    }
+    modsw_shm_write_end(shm_ptr);
+    return 0;
+}
+
+/*
+ * Open every configured output and register it with its queue. Sinks only
+ * see the event ring, so they can be set up before shared memory exists.
+ */
+static int setup_sinks(void) {
+    evdev_sink_t *uinput = &modswitch_default_conf.uinput;
+    if (evdev_open(uinput, modswitch_default_conf.lines) < 0) {
+        perror("sink.setup.cannot_create_uinput_device");
+        return -1;
+    }
+    if (uinput->enabled && !sink_set_add(&sinks, "uinput", &modswitch_default_conf.uinput_queue, evdev_deliver, uinput)) {
+        perror("sink.setup.cannot_add_uinput_sink");
+        return -1;
+    }
+
+    statefile_t *statefile = &modswitch_default_conf.statefile;
+    if (statefile_open(statefile) < 0) {
+        perror("sink.setup.cannot_create_state_directory");
+        return -1;
+    }
+    if (statefile->enabled && !sink_set_add(&sinks, "statefile", &modswitch_default_conf.statefile_queue, statefile_deliver, statefile)) {
+        perror("sink.setup.cannot_add_statefile_sink");
+        return -1;
+    }
+
+    // Neither must a failing card: the journal is an audit trail, not the switch.
+    journal_t *journal = &modswitch_default_conf.journal;
+    if (journal_open(journal) < 0) {
+        fprintf(stderr, "sink.setup.journal_disabled: cannot open %s: %s, continuing without journal\n",
+                journal->path, strerror(errno));
+        journal->enabled = false;
+    }
+    modswitch_default_conf.journal_queue.thread = false;    // appending never blocks, its flusher does the writing
+    if (journal->enabled && !sink_set_add(&sinks, "journal", &modswitch_default_conf.journal_queue, journal_deliver, journal)) {
+        perror("sink.setup.cannot_add_journal_sink");
+        return -1;
+    }
+
+    // An unreachable broker must not keep the switch from working.
+    mqtt_t *mqtt = &modswitch_default_conf.mqtt;
+    if (mqtt_open(mqtt) < 0) {
+        fprintf(stderr, "sink.setup.mqtt_disabled: continuing without mqtt\n");
+        mqtt->enabled = false;
+    }
+    modswitch_default_conf.mqtt_queue.thread = false;   // the client lives in the event loop
+    if (mqtt->enabled && !sink_set_add(&sinks, "mqtt", &modswitch_default_conf.mqtt_queue, mqtt_deliver, mqtt)) {
+        perror("sink.setup.cannot_add_mqtt_sink");
+        return -1;
+    }
+
+    http_t *http = &modswitch_default_conf.http;
+    if (http_open(http) < 0) {
+        fprintf(stderr, "sink.setup.http_disabled: cannot listen on %s port %u: %s, continuing without http\n",
+                http->bind, http->port, strerror(errno));
+        http->enabled = false;
+    }
+    modswitch_default_conf.http_queue.thread = false;   // the server lives in the event loop
+    if (http->enabled && !sink_set_add(&sinks, "http", &modswitch_default_conf.http_queue, http_deliver, http)) {
+        perror("sink.setup.cannot_add_http_sink");
+        return -1;
+    }
+
+    if (plugin_set_open(&modswitch_default_conf.plugins, &sinks) < 0) {
+        perror("sink.setup.cannot_add_plugin_sink");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Hand the events appended to the ring since the last call to the sinks.
+ * Runs outside any shm write section, so a sink with the block policy never
+ * holds readers up.
+ */
+static void fan_out(uint64_t now) {
+    if (sinks.n == 0)
+        return;
+    uint64_t head = events_ptr->head;
+    if (head - fanned > MODSW_EVENT_RING) {
+        sink_set_lost(&sinks, head - fanned - MODSW_EVENT_RING);
+        fanned = head - MODSW_EVENT_RING;
+    }
+    if (fanned == head)
+        return;
+
+    sink_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.rt_ns = realtime_ns();
+    msg.raw = shm_ptr->raw;
+    for (; fanned < head; fanned++) {
+        msg.ev = events_ptr->ring[fanned % MODSW_EVENT_RING];
+        sink_set_publish(&sinks, &msg, now);
+    }
+    sink_set_drain(&sinks);
+}
+
+static void print_event(const char *group, const modsw_event_t *ev) {
+    uint64_t ts = ev->ts_ns - replay.start_ns;
+    if (group)
+        fprintf(stdout, "group %s ", group);
+    if (ev->type == MODSW_EVENT_GESTURE)
+        fprintf(stdout, "%" PRIu64 " %" PRIu64 " gesture %.*s line=%u arg=%" PRIu32 "\n", ev->seq, ts, MODSW_NAME_MAX, ev->name, ev->line, ev->arg);
+    else
+        fprintf(stdout, "%" PRIu64 " %" PRIu64 " mode %u %.*s\n", ev->seq, ts, ev->mode, MODSW_NAME_MAX, ev->name);
+}
+
+static void print_ring(const char *group, const modsw_events_t *events, uint64_t *printed) {
+    uint64_t head = events->head;
+    if (head - *printed > MODSW_EVENT_RING) {
+        fprintf(stdout, "# %" PRIu64 " events lost\n", head - *printed - MODSW_EVENT_RING);
+        *printed = head - MODSW_EVENT_RING;
+    }
+    for (; *printed < head; (*printed)++)
+        print_event(group, &events->ring[*printed % MODSW_EVENT_RING]);
+}
+
+/*
+ * Print what a replay published since the last call, in the format of
+ * cat4mod -E with times relative to the start of the replay, so two runs of
+ * a script can be compared line by line.
+ */
+static void print_replayed(void) {
+    print_ring(NULL, events_ptr, &replay_printed);
+    group_set_t *groups = &modswitch_default_conf.groups;
+    for (unsigned i = 0; i < groups->n; i++)
+        print_ring(groups->g[i].name, groups->g[i].events, &replay_group_printed[i]);
+    fflush(stdout);
+}
+
+/*
+ * Raise MODSW_FLAG_CHATTER while some sink holds transitions back, with the
+ * lines that changed during the last SINK_CHATTER_NS, and clear it once the
+ * switch has calmed down.
+ */
+static void publish_chatter(uint64_t now) {
+    bool chattering = sink_set_chattering(&sinks, now);
+    uint32_t lines = 0;
+    for (unsigned i = 0; chattering && i < modswitch_default_conf.lines; i++) {
+        if (line_changed_ns[i] && now - line_changed_ns[i] < SINK_CHATTER_NS)
+            lines |= 1u << i;
+    }
+    bool flagged = shm_ptr->flags & MODSW_FLAG_CHATTER;
+    if (chattering == flagged && lines == shm_ptr->chatter)
+        return;
+    if (chattering && !flagged)
+        fprintf(stderr, "main.chatter.detected: switch lines 0x%02x change faster than the sink rate limits\n", lines);
+    else if (!chattering && flagged)
+        fprintf(stderr, "main.chatter.cleared: switch lines are quiet again\n");
+    modsw_shm_write_begin(shm_ptr);
+    if (chattering)
+        shm_ptr->flags |= MODSW_FLAG_CHATTER;
+    else
+        shm_ptr->flags &= ~MODSW_FLAG_CHATTER;
+    shm_ptr->chatter = lines;
+    modsw_shm_write_end(shm_ptr);
+}
+
+static void publish_services(void) {
+    if (!services_ptr)
+        return;
+    modsw_shm_write_begin(shm_ptr);
+    supervisor_publish(&modswitch_default_conf.services, services_ptr);
+    modsw_shm_write_end(shm_ptr);
+}
+
+static void publish_acks(void) {
+    if (!acks_ptr)
+        return;
+    modsw_shm_write_begin(shm_ptr);
+    ack_publish(&modswitch_default_conf.ack, acks_ptr);
+    modsw_shm_write_end(shm_ptr);
+    ack_wake(acks_ptr);
+}
+
+static void publish_sink_metrics(uint64_t now) {
+    if (now < sink_set_next_deadline(&sinks))
+        return;
+    modsw_shm_write_begin(shm_ptr);
+    sink_set_metrics(&sinks, now, sinks_ptr);
+    modsw_shm_write_end(shm_ptr);
+}
+
+// Drain queued edge events in batches; one read() covers up to 64 edges.
+static int read_gpio_events(void) {
+    struct gpio_v2_line_event ev[64];
+    ssize_t n;
+    bool switch_edge = false;
+    if (lines_lost)         // readable in the same batch as the change that lost them
+        return 0;
+    while ((n = gpio_req_read_events(&gpio_req, ev, sizeof(ev)/sizeof(ev[0]))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            int idx = gpio_req_index(&gpio_req, ev[i].offset);
+            if (idx < 0)
+                continue;
+            int rising = ev[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+            const line_owner_t *owner = &line_owner[idx];
+            if (owner->type == LINE_OWNER_COUNTER)
+                counter_edge(&modswitch_default_conf.counters.c[owner->index], rising, ev[i].timestamp_ns, ev[i].line_seqno);
+            else if (owner->type == LINE_OWNER_ENCODER)
+                encoder_edge(&modswitch_default_conf.encoders.e[owner->index], owner->line_b, rising, ev[i].timestamp_ns, ev[i].line_seqno);
+            else
+                switch_edge = true;     // only switch lines report edges besides those
+        }
+    }
+    if (n < 0) {
+        perror("gpio.event.read_line_events_failed");
+        return -1;
+    }
+    if (modswitch_default_conf.encoders.n)
+        publish_encoders(false);
+    if (switch_edge)
+        awake_until = monotonic_ns() + idle_hold_ns;
+    return 0;
+}
+
+static bool has_edge_lines(void) {
+    return modswitch_default_conf.counters.n || modswitch_default_conf.encoders.n || modswitch_default_conf.idle;
+}
+
+static void publish_readers(void) {
+    modsw_shm_write_begin(shm_ptr);
+    shm_ptr->readers = leases.live;
+    modsw_shm_write_end(shm_ptr);
+}
+
+/*
+ * Sample at full rate while a reader holds a lease or the lines are moving.
+ * Otherwise only a switch line edge, or a background sample every
+ * idle_delay_us, wakes the loop; the edge brings back full rate until the
+ * lines have settled again, so the published state never goes stale.
+ */
+static void update_idle(uint64_t now, bool quiet, uint64_t *next_sample) {
+    if (!modswitch_default_conf.idle)
+        return;
+    bool idle = leases.live == 0 && quiet && now >= awake_until;
+    if (idle == idling)
+        return;
+    idling = idle;
+    uint64_t idle_delay_ns = (uint64_t)modswitch_default_conf.idle_delay_us * 1000;
+    if (idle)
+        *next_sample = idle_delay_ns ? now + idle_delay_ns : UINT64_MAX;
+    else
+        *next_sample = now;
+    lease_set_period(&leases, idle ? 0 : LEASE_CHECK_NS, now);
+
+    modsw_shm_write_begin(shm_ptr);
+    if (idle)
+        shm_ptr->flags |= MODSW_FLAG_IDLE;
+    else
+        shm_ptr->flags &= ~MODSW_FLAG_IDLE;
+    modsw_shm_write_end(shm_ptr);
+    group_set_flag(&modswitch_default_conf.groups, MODSW_FLAG_IDLE, idle);
+}
+
+/*
+ * Request the lines again after someone else changed them. Until that works
+ * nothing is sampled and a retry runs every LINE_RETRY_NS; afterwards the
+ * suspect flag stays up for one more settle window, so the state published
+ * while it clears comes from lines configured by us.
+ */
+static void rerequest_lines(uint64_t now) {
+    if (gpio_req_reopen(&gpio_req) < 0) {
+        if (!lines_lost)
+            perror("gpio.watch.rerequest_failed");
+        lines_lost = true;
+        suspect_deadline = now + LINE_RETRY_NS;
+        return;
+    }
+    struct epoll_event gpio_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_GPIO };
+    if (has_edge_lines() && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, gpio_req.fd, &gpio_ev) < 0)
+        perror("gpio.watch.epoll_ctl_failed");
+    start_edge_lines(now);
+    if (lines_lost)
+        fprintf(stderr, "gpio.watch.rerequested: lines are configured as requested again\n");
+    lines_lost = false;
+    suspect_deadline = now + (uint64_t)modswitch_default_conf.settle_us * 1000;
+}
+
+static const char *line_change_str(uint32_t type) {
+    switch (type) {
+        case GPIO_V2_LINE_CHANGED_REQUESTED: return "requested";
+        case GPIO_V2_LINE_CHANGED_RELEASED: return "released";
+        case GPIO_V2_LINE_CHANGED_CONFIG: return "reconfigured";
+        default: return "changed";
+    }
+}
+
+/*
+ * Line info changes only arrive when someone touches one of our lines, so the
+ * watch costs nothing while the system is quiet. Changes that leave a line
+ * as we requested it are ignored.
+ */
+static void read_line_changes(uint64_t now) {
+    struct gpio_v2_line_info_changed ev[16];
+    ssize_t n;
+    unsigned unexpected = 0;
+    while ((n = gpio_req_read_changes(&gpio_req, ev, sizeof(ev)/sizeof(ev[0]))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            const struct gpio_v2_line_info *info = &ev[i].info;
+            int idx = gpio_req_index(&gpio_req, info->offset);
+            if (idx < 0 || gpio_req_info_ok(&gpio_req, idx, info))
+                continue;
+            fprintf(stderr, "gpio.watch.line_changed: line %u %s, consumer '%.*s', flags 0x%" PRIx64 ", requested 0x%" PRIx64 "\n",
+                    info->offset, line_change_str(ev[i].event_type), GPIO_MAX_NAME_SIZE, info->consumer,
+                    (uint64_t)info->flags, gpio_req.flags[idx]);
+            unexpected++;
+        }
+    }
+    if (n < 0)
+        perror("gpio.watch.read_line_info_failed");
+    if (!unexpected)
+        return;
+
+    modsw_shm_write_begin(shm_ptr);
+    shm_ptr->flags |= MODSW_FLAG_SUSPECT;
+    shm_ptr->stats.reconfigured += unexpected;
+    modsw_shm_write_end(shm_ptr);
+    group_set_flag(&modswitch_default_conf.groups, MODSW_FLAG_SUSPECT, true);
+    rerequest_lines(now);
+}
+
+static void line_watch_timeout(uint64_t now) {
+    if (now < suspect_deadline)
+        return;
+    if (lines_lost) {
+        rerequest_lines(now);
+        return;
+    }
+    suspect_deadline = UINT64_MAX;
+    modsw_shm_write_begin(shm_ptr);
+    shm_ptr->flags &= ~MODSW_FLAG_SUSPECT;
+    modsw_shm_write_end(shm_ptr);
+    group_set_flag(&modswitch_default_conf.groups, MODSW_FLAG_SUSPECT, false);
+}
+
+/*
+ * Close the visit of `from` and open one for `to`. Called inside a shm write
+ * section; the open visit is never accumulated here, readers add it lazily.
+ */
+static void account_transition(int from, int to, uint64_t now) {
+    if (from >= 0) {
+        acct_ptr->dwell_ns[from] += now - acct_ptr->entered_ns[from];
+        acct_ptr->pairs[from * decoder.nmodes + to]++;
+    }
+    acct_ptr->entered_ns[to] = now;
+    acct_ptr->entered_rt_ns[to] = realtime_ns();
+    acct_ptr->entries[to]++;
+}
+
+static void on_gesture(void *user, unsigned index, const gesture_t *g, uint64_t ts, uint32_t arg) {
+    (void)user;
+    modsw_shm_write_begin(shm_ptr);
+    shm_ptr->stats.gestures++;
+    push_event(MODSW_EVENT_GESTURE, ts, (uint8_t)g->line, (uint8_t)index, arg, g->name);
+    modsw_shm_write_end(shm_ptr);
+}
+
+/*
+ * Arm the timerfd for an absolute CLOCK_MONOTONIC deadline and wait until it
+ * expires or a line event arrives. On the virtual clock nothing sleeps: ready
+ * descriptors are served, and if there are none the clock jumps to the
+ * deadline.
+ */
+static int wait_events(uint64_t deadline) {
+    int timeout = 0;
+    if (!vclock_active()) {
+        struct itimerspec its = {0};
+        its.it_value.tv_sec = (time_t)(deadline / 1000000000ull);
+        its.it_value.tv_nsec = (long)(deadline % 1000000000ull);
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+            perror("timer.wait.timerfd_settime_failed");
+            return -1;
+        }
+        timeout = -1;
+    }
+
+    struct epoll_event evs[16];
+    int n = epoll_wait(epoll_fd, evs, sizeof(evs)/sizeof(evs[0]), timeout);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        perror("timer.wait.epoll_wait_failed");
+        return -1;
+    }
+    if (n == 0 && vclock_active())
+        vclock_advance(deadline);
+    for (int i = 0; i < n; i++) {
+        if (evs[i].data.u32 == EV_SRC_TIMER) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                perror("timer.wait.read_timerfd_failed");
+                return -1;
+            }
+        } else if (evs[i].data.u32 == EV_SRC_GPIO) {
+            if (read_gpio_events() < 0)
+                return -1;
+        } else if (evs[i].data.u32 == EV_SRC_LINEINFO) {
+            read_line_changes(monotonic_ns());
+        } else if (evs[i].data.u32 == EV_SRC_MQTT) {
+            mqtt_io(&modswitch_default_conf.mqtt, evs[i].events, monotonic_ns());
+        } else if (evs[i].data.u32 == EV_SRC_CHILD) {
+            if (supervisor_reap(&modswitch_default_conf.services, monotonic_ns()))
+                publish_services();
+        } else if (evs[i].data.u32 == EV_SRC_ACK) {
+            if (ack_io(&modswitch_default_conf.ack, monotonic_ns()))
+                publish_acks();
+        } else if (evs[i].data.u32 == EV_SRC_STOP) {
+            struct signalfd_siginfo si;
+            if (read(stop_fd, &si, sizeof(si)) == sizeof(si))
+                stop_requested = true;
+        } else if (evs[i].data.u32 == EV_SRC_LEASE) {
+            lease_io(&leases, monotonic_ns());
+        } else if (http_owns(&modswitch_default_conf.http, evs[i].data.u32)) {
+            http_io(&modswitch_default_conf.http, evs[i].data.u32, evs[i].events, monotonic_ns());
+        }
+    }
     return 0;
 }
 
 static void usage(const char *prog_name) {
     if (!prog_name) return;
     fprintf(stderr, "modswitchd - rpi-modswitch 2-position DIP switch daemon for raspberry pi\n\n");
-    fprintf(stderr, "Usage: %s -c <config file> [-Dhv]\n\n", prog_name);
+    fprintf(stderr, "Usage: %s -c <config file> [-r script] [-Dhv]\n\n", prog_name);
     fprintf(stderr, "-c :\t<modswitch.conf>, modswitch config file, default is '/etc/modswitch/modswitch.conf'\n");
+    fprintf(stderr, "-r :\treplay switch input from a script on a virtual clock and print the published events\n");
     fprintf(stderr, "-D :\trun as daemon mode (SysVinit)\n");
     fprintf(stderr, "-h :\tshow this help\n");
     fprintf(stderr, "-v :\tshow version\n\n");
@@ -211,7 +1124,7 @@ static void usage(const char *prog_name) {
 
 int main(int argc, char **argv) {
     int opt;
-    while ((opt = getopt(argc, argv, "c:Dhv")) != -1) {
+    while ((opt = getopt(argc, argv, "c:r:Dhv")) != -1) {
         switch (opt) {
             case 'h':
                 usage(argv[0]);
@@ -222,6 +1135,9 @@ int main(int argc, char **argv) {
             case 'c':
                 modswitch_conf_file = optarg;
                 break;
+            case 'r':
+                replay_file = optarg;
+                break;
             case 'D':
                 is_daemon = 1;
                 break;
@@ -253,21 +1169,61 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    
-
-    lock_fd = open(LOCK_FILE, O_CREAT | O_RDWR, 0644);
-    if (lock_fd < 0) {
-        perror("main.process.cannot_open_lock_file");
+    if (decode_build(&decoder, modswitch_default_conf.scheme, modswitch_default_conf.lines) < 0) {
+        perror("main.conf_parse.cannot_build_decoder");
         return 1;
     }
-    if (flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
-        if (errno == EWOULDBLOCK) {
-            fprintf(stderr, "main.process.flock_error: another instance is already running.\n");
+    for (unsigned i = 0; i < decoder.nmodes; i++) {
+        if (modswitch_default_conf.mode_name[i][0] == '\0')
+            snprintf(modswitch_default_conf.mode_name[i], MODSW_NAME_MAX, "%u", i);
+    }
+
+    if (replay_file) {
+        int replay_err = replay_load(&replay, replay_file);
+        if (replay_err < 0) {
+            perror("main.replay.cannot_load_script");
             return 1;
-        } else {
-            perror("main.process.flock_error");
+        } else if (replay_err) {
+            fprintf(stderr, "main.replay.bad_script: bad replay script (first error on line %d)\n", replay_err);
             return 1;
         }
+        modswitch_default_conf.idle = 0;    // a script has no edges to wake on
+        // Edge timestamps and clocked scans come from the kernel, a script has neither.
+        if (modswitch_default_conf.counters.n || modswitch_default_conf.encoders.n ||
+            modswitch_default_conf.matrix.nrows || modswitch_default_conf.shiftreg.nbits) {
+            fprintf(stderr, "main.replay.unsupported_config: counters, encoders, matrix and shift registers cannot be replayed\n");
+            return 1;
+        }
+        // A replay only prints: its virtual timestamps must not reach devices, files, the network or services.
+        modswitch_default_conf.uinput.enabled = false;
+        modswitch_default_conf.statefile.enabled = false;
+        modswitch_default_conf.journal.enabled = false;
+        modswitch_default_conf.mqtt.enabled = false;
+        modswitch_default_conf.http.enabled = false;
+        modswitch_default_conf.plugins.n = 0;
+        modswitch_default_conf.services.n = 0;
+        modswitch_default_conf.ack.enabled = false;
+        vclock_start();
+    }
+
+    
+
+    // A replay publishes into private memory, so it may run next to the daemon.
+    if (!replay_file) {
+        lock_fd = open(LOCK_FILE, O_CREAT | O_RDWR, 0644);
+        if (lock_fd < 0) {
+            perror("main.process.cannot_open_lock_file");
+            return 1;
+        }
+        if (flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
+            if (errno == EWOULDBLOCK) {
+                fprintf(stderr, "main.process.flock_error: another instance is already running.\n");
+                return 1;
+            } else {
+                perror("main.process.flock_error");
+                return 1;
+            }
+        }
     }
 
     if (is_daemon) {
@@ -287,40 +1243,401 @@ int main(int argc, char **argv) {
         open("/dev/null", O_RDWR);
         chdir("/");
     }
-    ftruncate(lock_fd, 0);
-    dprintf(lock_fd, "%d\n", getpid());
+    if (lock_fd >= 0) {
+        ftruncate(lock_fd, 0);
+        dprintf(lock_fd, "%d\n", getpid());
+    }
+
+    // Before the lines are requested: without a lease table there is no idling, so no edge flags either.
+    if (!replay_file && lease_open(&leases) < 0) {
+        fprintf(stderr, "main.process.lease_disabled: cannot create %s: %s, sampling at full rate\n", MODSW_SHM_LEASES, strerror(errno));
+        modswitch_default_conf.idle = 0;
+    }
 
     if (setup_gpio() < 0) {
         fprintf(stderr, "main.process.setup_gpio: cannot setup gpio.\n");
+        lease_close(&leases);
+        return 1;
+    }
+    if (!replay_file && gpio_req_watch(&gpio_req) < 0)
+        fprintf(stderr, "main.process.line_watch_disabled: cannot watch line info: %s, continuing without\n", strerror(errno));
+
+    /*
+     * Before any thread exists, so SIGINT and SIGTERM stay blocked in all of
+     * them and only reach the event loop, which shuts down on its own thread.
+     */
+    sigset_t stop_set;
+    sigemptyset(&stop_set);
+    sigaddset(&stop_set, SIGINT);
+    sigaddset(&stop_set, SIGTERM);
+    if ((errno = pthread_sigmask(SIG_BLOCK, &stop_set, NULL)) != 0 ||
+        (stop_fd = signalfd(-1, &stop_set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        perror("main.process.cannot_create_signalfd");
+        cleanup();
+        return 1;
+    }
+
+    // Before any thread exists, so SIGCHLD stays blocked in all of them.
+    if (supervisor_open(&modswitch_default_conf.services) < 0) {
+        perror("main.process.cannot_setup_supervisor");
+        cleanup();
+        return 1;
+    }
+
+    ack_t *ack = &modswitch_default_conf.ack;
+    if (ack_open(ack) < 0) {
+        fprintf(stderr, "main.process.ack_disabled: cannot bind %s: %s, continuing without acknowledgments\n",
+                ack->socket, strerror(errno));
+        ack->enabled = false;
+    }
+
+    if (setup_sinks() < 0) {
+        fprintf(stderr, "main.process.setup_sinks: cannot setup output sinks.\n");
+        cleanup();
         return 1;
     }
 
-    shm_fd = shm_open(SHM_FILE, O_RDWR | O_CREAT, 0666);
-    if (shm_fd < 0) {
+    if (!replay_file)
+        shm_fd = shm_open(SHM_FILE, O_RDWR | O_CREAT, 0666);
+    if (!replay_file && shm_fd < 0) {
         perror("main.process.cannot_open_shm_file");
         cleanup();
         return 1;
     }
-    ftruncate(shm_fd, SHM_SIZE);
-    shm_ptr = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    size_t acct_size = (sizeof(modsw_acct_t) + sizeof(uint32_t) * decoder.nmodes * decoder.nmodes + 7) & ~(size_t)7;
+    size_t events_size = (sizeof(modsw_events_t) + 7) & ~(size_t)7;
+    size_t counters_size = modswitch_default_conf.counters.n ? (sizeof(modsw_counters_t) + 7) & ~(size_t)7 : 0;
+    size_t encoders_size = modswitch_default_conf.encoders.n ? (sizeof(modsw_encoders_t) + 7) & ~(size_t)7 : 0;
+    size_t matrix_size = modswitch_default_conf.matrix.nrows ? (sizeof(modsw_matrix_t) + 7) & ~(size_t)7 : 0;
+    size_t shiftreg_size = modswitch_default_conf.shiftreg.nbits ? (sizeof(modsw_shiftreg_t) + 7) & ~(size_t)7 : 0;
+    size_t sinks_size = sinks.n ? (sizeof(modsw_sinks_t) + 7) & ~(size_t)7 : 0;
+    size_t services_size = modswitch_default_conf.services.n ? (sizeof(modsw_services_t) + 7) & ~(size_t)7 : 0;
+    size_t acks_size = modswitch_default_conf.ack.enabled ? (sizeof(modsw_acks_t) + 7) & ~(size_t)7 : 0;
+    size_t wake_size = (sizeof(modsw_wake_t) + 7) & ~(size_t)7;
+    size_t profiles_size = profile_set_packed_size(&modswitch_default_conf.profiles);
+    shm_size = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size + services_size + acks_size + wake_size + profiles_size;
+    if (shm_fd >= 0)
+        ftruncate(shm_fd, shm_size);
+    shm_ptr = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED | (shm_fd < 0 ? MAP_ANONYMOUS : 0), shm_fd, 0);
     if (shm_ptr == MAP_FAILED) {
+        shm_ptr = NULL;
         perror("main.process.mmap_failed");
         cleanup();
         return 1;
     }
+    memset(shm_ptr, 0, shm_size);
+    shm_ptr->mode_char = '?';
+    shm_ptr->version = MODSW_SHM_VERSION;
+    shm_ptr->magic = MODSW_SHM_MAGIC;
+    shm_ptr->size = (uint32_t)shm_size;
+    shm_ptr->nmodes = (uint16_t)decoder.nmodes;
+    acct_ptr = (modsw_acct_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE);
+    shm_ptr->acct_off = SHM_HEADER_SIZE;
+    shm_ptr->acct_len = (uint32_t)acct_size;
+    events_ptr = (modsw_events_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size);
+    shm_ptr->events_off = SHM_HEADER_SIZE + acct_size;
+    if (counters_size) {
+        counters_ptr = (modsw_counters_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size);
+        counters_ptr->count = modswitch_default_conf.counters.n;
+        shm_ptr->counters_off = SHM_HEADER_SIZE + acct_size + events_size;
+    }
+    if (encoders_size) {
+        encoders_ptr = (modsw_encoders_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size);
+        encoders_ptr->count = modswitch_default_conf.encoders.n;
+        shm_ptr->encoders_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size;
+    }
+    if (matrix_size) {
+        matrix_ptr = (modsw_matrix_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size);
+        shm_ptr->matrix_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size;
+    }
+    if (shiftreg_size) {
+        shiftreg_ptr = (modsw_shiftreg_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size);
+        shm_ptr->shiftreg_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size;
+    }
+    if (sinks_size) {
+        sinks_ptr = (modsw_sinks_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size);
+        shm_ptr->sinks_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size;
+    }
+    if (services_size) {
+        services_ptr = (modsw_services_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size);
+        shm_ptr->services_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size;
+        services_ptr->count = modswitch_default_conf.services.n;
+        services_ptr->predicted = -1;
+    }
+    if (acks_size) {
+        acks_ptr = (modsw_acks_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size + services_size);
+        shm_ptr->acks_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size + services_size;
+        ack_publish(&modswitch_default_conf.ack, acks_ptr);
+    }
+    wake_ptr = (modsw_wake_t *)((uint8_t *)shm_ptr + SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size + services_size + acks_size);
+    shm_ptr->wake_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size + services_size + acks_size;
+    if (profiles_size) {
+        size_t profiles_off = SHM_HEADER_SIZE + acct_size + events_size + counters_size + encoders_size + matrix_size + shiftreg_size + sinks_size + services_size + acks_size + wake_size;
+        profile_set_pack(&modswitch_default_conf.profiles, shm_ptr, profiles_off);
+        shm_ptr->profiles_off = profiles_off;
+        shm_ptr->profiles_len = (uint32_t)profiles_size;
+    }
+    profile_set_free(&modswitch_default_conf.profiles);  // blob_off[] is all the loop needs
+
+    if (group_set_open(&modswitch_default_conf.groups, (uint64_t)modswitch_default_conf.settle_us * 1000, !replay_file) < 0) {
+        perror("main.process.cannot_open_group_shm_file");
+        cleanup();
+        return 1;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd < 0) {
+        perror("main.process.cannot_create_timerfd");
+        cleanup();
+        return 1;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("main.process.cannot_create_epoll");
+        cleanup();
+        return 1;
+    }
+    struct epoll_event timer_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_TIMER };
+    struct epoll_event gpio_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_GPIO };
+    struct epoll_event lineinfo_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_LINEINFO };
+    struct epoll_event child_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_CHILD };
+    struct epoll_event ack_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_ACK };
+    struct epoll_event stop_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_STOP };
+    struct epoll_event lease_ev = { .events = EPOLLIN, .data.u32 = EV_SRC_LEASE };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_ev) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &stop_ev) < 0 ||
+        (leases.map && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, leases.wake_fd, &lease_ev) < 0) ||
+        (has_edge_lines() && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, gpio_req.fd, &gpio_ev) < 0) ||
+        (gpio_req.watching && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, gpio_req.chip_fd, &lineinfo_ev) < 0) ||
+        (modswitch_default_conf.services.n && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, modswitch_default_conf.services.signal_fd, &child_ev) < 0) ||
+        (modswitch_default_conf.ack.enabled && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, modswitch_default_conf.ack.fd, &ack_ev) < 0)) {
+        perror("main.process.epoll_ctl_failed");
+        cleanup();
+        return 1;
+    }
+
+    uint64_t settle_ns = (uint64_t)modswitch_default_conf.settle_us * 1000;
+    uint64_t delay_ns = (uint64_t)modswitch_default_conf.delay_us * 1000;
+    idle_hold_ns = settle_ns;
+    for (unsigned i = 0; i < modswitch_default_conf.groups.n; i++) {
+        if (modswitch_default_conf.groups.g[i].settle_ns > idle_hold_ns)
+            idle_hold_ns = modswitch_default_conf.groups.g[i].settle_ns;
+    }
+    idle_hold_ns += delay_ns;
+    int published = -1;     // nothing published yet, first valid settled mode always goes out
+    int settled = -1;
+    int pending = -1;
+    uint64_t pending_since = 0;
+    uint32_t profile_gen = 0;
 
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    uint8_t combined;
+    uint64_t group_bits;
+    if (replay_file)
+        replay_start(&replay, monotonic_ns(), idle_hold_ns + delay_ns);
+    if (get_gpio(&combined, &group_bits) < 0) {
+        cleanup();
+        return 1;
+    }
+    uint64_t now = monotonic_ns();
+    if (gesture_init(&modswitch_default_conf.gestures, modswitch_default_conf.lines, settle_ns, combined, now) < 0) {
+        fprintf(stderr, "main.process.gesture_init: invalid gesture configuration.\n");
+        cleanup();
+        return 1;
+    }
+    start_edge_lines(now);
+    matrix_start(&modswitch_default_conf.matrix, now);
+    shiftreg_start(&modswitch_default_conf.shiftreg, now);
+    if (sink_set_start(&sinks, now) < 0) {
+        perror("main.process.cannot_start_sink_workers");
+        cleanup();
+        return 1;
+    }
+    if (journal_start(&modswitch_default_conf.journal) < 0) {
+        perror("main.process.cannot_start_journal_flusher");
+        cleanup();
+        return 1;
+    }
+    if (lease_start(&leases) < 0) {
+        perror("main.process.cannot_start_lease_watcher");
+        cleanup();
+        return 1;
+    }
+    mqtt_start(&modswitch_default_conf.mqtt, epoll_fd, EV_SRC_MQTT, now);
+    plugin_set_start(&modswitch_default_conf.plugins, now);
+    if (http_start(&modswitch_default_conf.http, epoll_fd, EV_SRC_HTTP, shm_ptr, events_ptr) < 0) {
+        perror("main.process.cannot_start_http");
+        cleanup();
+        return 1;
+    }
+    if (modswitch_default_conf.encoders.n)
+        publish_encoders(true);
+    uint64_t next_sample = now;
 
+    /*
+     * Sampling ticks, gesture timers and counter window rotation share one
+     * timerfd, armed for whichever deadline comes first. Counter edges wake
+     * the same epoll through the line request fd.
+     */
     while (1) {
-        int sw0, sw1;
-        if (get_gpio(&sw0, &sw1) < 0) {
+        // Nothing is sampled or scanned while the lines are lost.
+        uint64_t deadline = gesture_next_deadline(&modswitch_default_conf.gestures);
+        if (!lines_lost && next_sample < deadline)
+            deadline = next_sample;
+        uint64_t counter_deadline = counter_next_deadline(&modswitch_default_conf.counters);
+        if (counter_deadline < deadline)
+            deadline = counter_deadline;
+        uint64_t encoder_deadline = encoder_next_deadline(&modswitch_default_conf.encoders);
+        if (encoder_deadline < deadline)
+            deadline = encoder_deadline;
+        uint64_t matrix_deadline = matrix_next_deadline(&modswitch_default_conf.matrix);
+        if (!lines_lost && matrix_deadline < deadline)
+            deadline = matrix_deadline;
+        uint64_t shiftreg_deadline = shiftreg_next_deadline(&modswitch_default_conf.shiftreg);
+        if (!lines_lost && shiftreg_deadline < deadline)
+            deadline = shiftreg_deadline;
+        uint64_t sink_deadline = sink_set_next_deadline(&sinks);
+        if (sink_deadline < deadline)
+            deadline = sink_deadline;
+        uint64_t journal_deadline = journal_next_deadline(&modswitch_default_conf.journal);
+        if (journal_deadline < deadline)
+            deadline = journal_deadline;
+        uint64_t mqtt_deadline = mqtt_next_deadline(&modswitch_default_conf.mqtt);
+        if (mqtt_deadline < deadline)
+            deadline = mqtt_deadline;
+        uint64_t http_deadline = http_next_deadline(&modswitch_default_conf.http);
+        if (http_deadline < deadline)
+            deadline = http_deadline;
+        uint64_t plugin_deadline = plugin_set_next_deadline(&modswitch_default_conf.plugins);
+        if (plugin_deadline < deadline)
+            deadline = plugin_deadline;
+        uint64_t supervisor_deadline = supervisor_next_deadline(&modswitch_default_conf.services);
+        if (supervisor_deadline < deadline)
+            deadline = supervisor_deadline;
+        uint64_t ack_deadline = ack_next_deadline(&modswitch_default_conf.ack);
+        if (ack_deadline < deadline)
+            deadline = ack_deadline;
+        if (suspect_deadline < deadline)
+            deadline = suspect_deadline;
+        uint64_t lease_deadline = lease_next_deadline(&leases);
+        if (lease_deadline < deadline)
+            deadline = lease_deadline;
+        if (replay_file && replay_next_deadline(&replay) < deadline)
+            deadline = replay_next_deadline(&replay);
+        if (wait_events(deadline) < 0) {
+            cleanup();
+            return 1;
+        }
+        if (stop_requested)
+            break;
+        now = monotonic_ns();
+
+        line_watch_timeout(now);
+        if (!lines_lost && now >= next_sample) {
+            uint64_t idle_delay_ns = (uint64_t)modswitch_default_conf.idle_delay_us * 1000;
+            if (idling) {
+                next_sample = idle_delay_ns ? now + idle_delay_ns : UINT64_MAX;
+            } else {
+                next_sample += delay_ns;
+                if (next_sample <= now)
+                    next_sample = now + delay_ns;
+            }
+
+            if (get_gpio(&combined, &group_bits) < 0) {
+                cleanup();
+                return 1;
+            }
+            group_set_sample(&modswitch_default_conf.groups, group_bits, now);
+            gesture_sample(&modswitch_default_conf.gestures, combined, now, on_gesture, NULL);
+
+            /*
+             * Contacts of a multi-bit flip never close at the same instant, so a
+             * new combined state is held back until every line has been quiet
+             * for settle_us. States that get replaced before settling are only
+             * counted.
+             */
+            if (combined != pending) {
+                if (pending != settled) {
+                    modsw_shm_write_begin(shm_ptr);
+                    shm_ptr->stats.coalesced++;
+                    modsw_shm_write_end(shm_ptr);
+                }
+                pending = combined;
+                pending_since = now;
+            }
+            if (pending != settled && now - pending_since >= settle_ns) {
+                bool switched = false;
+                int switched_from = -1;
+                settled = pending;
+                int mode = decode_raw(&decoder, combined);
+                modsw_shm_write_begin(shm_ptr);
+                if (mode == DECODE_INVALID) {
+                    shm_ptr->flags |= MODSW_FLAG_INVALID;
+                    shm_ptr->stats.invalid++;
+                } else {
+                    shm_ptr->flags &= ~MODSW_FLAG_INVALID;
+                    if (mode != published) {
+                        account_transition(published, mode, now);
+                        for (unsigned i = 0; i < modswitch_default_conf.lines; i++) {
+                            if ((shm_ptr->raw ^ combined) >> i & 1)
+                                line_changed_ns[i] = now;
+                        }
+                        uint32_t from = published < 0 ? UINT32_MAX : (uint32_t)published;
+                        published = mode;
+                        shm_ptr->mode_char = modsw_mode_char(mode);
+                        shm_ptr->raw = combined;
+                        shm_ptr->mode = (uint16_t)mode;
+                        memcpy(shm_ptr->name, modswitch_default_conf.mode_name[mode], MODSW_NAME_MAX);
+                        shm_ptr->changed_ns = now;
+                        shm_ptr->stats.transitions++;
+                        uint64_t profile = ((uint64_t)++profile_gen << 32) | modswitch_default_conf.profiles.blob_off[mode];
+                        __atomic_store_n(&shm_ptr->profile, profile, __ATOMIC_RELEASE);
+                        push_event(MODSW_EVENT_MODE, now, 0, 0, from, shm_ptr->name);
+                        switched_from = from == UINT32_MAX ? -1 : (int)from;
+                        switched = true;
+                    }
+                }
+                modsw_shm_write_end(shm_ptr);
+                // Forking never happens inside the write section.
+                if (switched) {
+                    futex_bump_shared(&wake_ptr->mode[published]);
+                    futex_bump_shared(&wake_ptr->change);
+                    supervisor_switch(&modswitch_default_conf.services, published, switched_from, acct_ptr, decoder.nmodes, now);
+                    publish_services();
+                    ack_transition(&modswitch_default_conf.ack, shm_ptr->stats.transitions, now);
+                    publish_acks();
+                }
+            }
+        }
+        gesture_timeout(&modswitch_default_conf.gestures, now, on_gesture, NULL);
+        if (counter_timeout(&modswitch_default_conf.counters, now))
+            publish_counters(now);
+        if (encoder_timeout(&modswitch_default_conf.encoders, now))
+            publish_encoders(true);
+        if (!lines_lost && (scan_matrix(now) < 0 || scan_shiftreg(now) < 0)) {
             cleanup();
             return 1;
         }
-        uint8_t combined = (((modswitch_default_conf.pullupdown ? !sw1 : sw1) << 1) | (modswitch_default_conf.pullupdown ? !sw0 : sw0)) & 0x03;
-        shm_ptr[0] = combined + '0'; // ascii
-        usleep(modswitch_default_conf.delay_us);
+        fan_out(now);
+        if (sink_set_timeout(&sinks, now))
+            sink_set_drain(&sinks);
+        journal_timeout(&modswitch_default_conf.journal, now);
+        publish_chatter(now);
+        publish_sink_metrics(now);
+        mqtt_timeout(&modswitch_default_conf.mqtt, now, shm_ptr);
+        http_timeout(&modswitch_default_conf.http, now);
+        plugin_set_timeout(&modswitch_default_conf.plugins, now);
+        if (supervisor_timeout(&modswitch_default_conf.services, now))
+            publish_services();
+        if (ack_timeout(&modswitch_default_conf.ack, now))
+            publish_acks();
+        if (lease_timeout(&leases, now))
+            publish_readers();
+        update_idle(now, pending == settled, &next_sample);
+        if (replay_file) {
+            print_replayed();
+            if (replay_done(&replay, now))
+                break;
+        }
     }
     cleanup();
     return 0;
@@ -0,0 +1,578 @@
+/*
+ * mqtt.c - rpi-modswitch MQTT publisher sink
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the MQTT client described in mqtt.h. Packets are
+ * serialized into one output buffer that is written whenever the socket is
+ * writable; pending messages are only serialized while there is room, so a
+ * stalled broker costs a fixed amount of memory.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "mqtt.h"
+#include "utils.h"
+
+#define DEFAULT_PORT 1883
+#define DEFAULT_QOS 1
+#define DEFAULT_KEEPALIVE_S 30
+#define DEFAULT_STATS_S 60
+#define DEFAULT_BACKOFF_MIN_MS 1000
+#define DEFAULT_BACKOFF_MAX_MS 60000
+#define CONNECT_TIMEOUT_NS 10000000000ull
+
+#define PKT_CONNECT 0x10
+#define PKT_CONNACK 0x20
+#define PKT_PUBLISH 0x30
+#define PKT_PUBACK 0x40
+#define PKT_PINGREQ 0xc0
+#define PKT_PINGRESP 0xd0
+#define PKT_DISCONNECT 0xe0
+
+static void mqtt_defaults(mqtt_t *m) {
+    if (m->defaults)
+        return;
+    m->port = DEFAULT_PORT;
+    m->qos = DEFAULT_QOS;
+    m->retain = true;
+    m->keepalive_s = DEFAULT_KEEPALIVE_S;
+    m->stats_ns = DEFAULT_STATS_S * 1000000000ull;
+    m->backoff_min_ns = DEFAULT_BACKOFF_MIN_MS * 1000000ull;
+    m->backoff_max_ns = DEFAULT_BACKOFF_MAX_MS * 1000000ull;
+    m->fd = -1;
+    m->defaults = true;
+}
+
+static bool conf_str(char *dst, size_t size, const char *value) {
+    if (!value[0] || strlen(value) >= size)
+        return false;
+    strcpy(dst, value);
+    return true;
+}
+
+bool mqtt_conf(mqtt_t *m, const char *key, const char *value) {
+    mqtt_defaults(m);
+
+    uintmax_t num;
+    if (strcmp(key, "enable") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        m->enabled = num;
+    } else if (strcmp(key, "host") == 0) {
+        return conf_str(m->host, sizeof(m->host), value);
+    } else if (strcmp(key, "port") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0 || num > 0xffff)
+            return false;
+        m->port = (uint16_t)num;
+    } else if (strcmp(key, "client_id") == 0) {
+        return conf_str(m->client_id, sizeof(m->client_id), value);
+    } else if (strcmp(key, "topic") == 0) {
+        return conf_str(m->topic, sizeof(m->topic), value) && strpbrk(value, "+#") == NULL;
+    } else if (strcmp(key, "username") == 0) {
+        return conf_str(m->username, sizeof(m->username), value);
+    } else if (strcmp(key, "password") == 0) {
+        return conf_str(m->password, sizeof(m->password), value);
+    } else if (strcmp(key, "qos") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        m->qos = (unsigned)num;
+    } else if (strcmp(key, "retain") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        m->retain = num;
+    } else if (strcmp(key, "keepalive_s") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 0xffff)
+            return false;
+        m->keepalive_s = (unsigned)num;
+    } else if (strcmp(key, "stats_s") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        m->stats_ns = (uint64_t)num * 1000000000ull;
+    } else if (strcmp(key, "backoff_min_ms") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        m->backoff_min_ns = (uint64_t)num * 1000000ull;
+    } else if (strcmp(key, "backoff_max_ms") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        m->backoff_max_ns = (uint64_t)num * 1000000ull;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int mqtt_open(mqtt_t *m) {
+    mqtt_defaults(m);
+    if (!m->enabled)
+        return 0;
+    if (!m->host[0]) {
+        fprintf(stderr, "mqtt.open.no_host: [mqtt] host is not set\n");
+        return -1;
+    }
+    if (m->backoff_max_ns < m->backoff_min_ns)
+        m->backoff_max_ns = m->backoff_min_ns;
+
+    char hostname[48] = "modswitch";
+    gethostname(hostname, sizeof(hostname) - 1);
+    if (!m->topic[0])
+        snprintf(m->topic, sizeof(m->topic), "modswitch/%s", hostname);
+    if (!m->client_id[0])
+        snprintf(m->client_id, sizeof(m->client_id), "modswitchd-%s", hostname);
+
+    char port[8];
+    snprintf(port, sizeof(port), "%u", m->port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    int ret = getaddrinfo(m->host, port, &hints, &res);
+    if (ret != 0) {
+        fprintf(stderr, "mqtt.open.cannot_resolve_host: %s: %s\n", m->host, gai_strerror(ret));
+        return -1;
+    }
+    memcpy(&m->addr, res->ai_addr, res->ai_addrlen);
+    m->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void set_interest(mqtt_t *m, uint32_t events) {
+    if (m->fd < 0 || events == m->epoll_events)
+        return;
+    struct epoll_event ev = { .events = events, .data.u32 = m->epoll_tag };
+    if (epoll_ctl(m->epoll_fd, m->epoll_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, m->fd, &ev) < 0) {
+        perror("mqtt.epoll.epoll_ctl_failed");
+        return;
+    }
+    m->epoll_events = events;
+}
+
+static void update_interest(mqtt_t *m) {
+    if (m->state == MQTT_CONNECTING)
+        set_interest(m, EPOLLOUT);
+    else
+        set_interest(m, EPOLLIN | (m->out_len ? EPOLLOUT : 0));
+}
+
+static void drop_connection(mqtt_t *m, uint64_t now, const char *why) {
+    if (m->fd >= 0)
+        close(m->fd);       // also leaves the epoll set
+    if (m->state == MQTT_CONNECTED)
+        m->disconnects++;
+
+    m->fd = -1;
+    m->epoll_events = 0;
+    m->state = MQTT_DISCONNECTED;
+    m->out_len = 0;
+    m->in_len = 0;
+    m->ping_sent_ns = 0;
+    m->online.valid = false;
+    // Spread reconnects of a fleet over the last quarter of the backoff.
+    uint64_t delay = m->backoff_ns - m->backoff_ns / 4 * (now % 1024) / 1024;
+    m->reconnect_ns = now + delay;
+    fprintf(stderr, "mqtt.connection.lost: %s, retry in %" PRIu64 " ms\n", why, delay / 1000000);
+    m->backoff_ns = m->backoff_ns * 2 < m->backoff_max_ns ? m->backoff_ns * 2 : m->backoff_max_ns;
+}
+
+static bool append(mqtt_t *m, const uint8_t *pkt, size_t len) {
+    if (m->out_len + len > sizeof(m->out))
+        return false;
+    memcpy(m->out + m->out_len, pkt, len);
+    m->out_len += len;
+    return true;
+}
+
+static size_t put_varlen(uint8_t *p, size_t n) {
+    size_t i = 0;
+    do {
+        uint8_t b = n % 128;
+        n /= 128;
+        p[i++] = b | (n ? 0x80 : 0);
+    } while (n);
+    return i;
+}
+
+static size_t put_str(uint8_t *p, const char *s, size_t len) {
+    p[0] = (uint8_t)(len >> 8);
+    p[1] = (uint8_t)len;
+    memcpy(p + 2, s, len);
+    return len + 2;
+}
+
+static bool send_connect(mqtt_t *m) {
+    char will_topic[MQTT_TOPIC_MAX];
+    snprintf(will_topic, sizeof(will_topic), "%s/online", m->topic);
+    size_t id_len = strlen(m->client_id), wt_len = strlen(will_topic);
+    size_t user_len = strlen(m->username), pass_len = strlen(m->password);
+
+    uint8_t flags = 0x02 | 0x04 | (uint8_t)(m->qos << 3) | 0x20;     // clean session, retained will
+    size_t rem = 10 + 2 + id_len + 2 + wt_len + 2 + 1;
+    if (user_len) {
+        flags |= 0x80;
+        rem += 2 + user_len;
+    }
+    if (user_len && pass_len) {
+        flags |= 0x40;
+        rem += 2 + pass_len;
+    }
+
+    uint8_t pkt[512];
+    uint8_t *p = pkt;
+    *p++ = PKT_CONNECT;
+    p += put_varlen(p, rem);
+    p += put_str(p, "MQTT", 4);
+    *p++ = 4;                   // protocol level 3.1.1
+    *p++ = flags;
+    *p++ = (uint8_t)(m->keepalive_s >> 8);
+    *p++ = (uint8_t)m->keepalive_s;
+    p += put_str(p, m->client_id, id_len);
+    p += put_str(p, will_topic, wt_len);
+    p += put_str(p, "0", 1);
+    if (flags & 0x80)
+        p += put_str(p, m->username, user_len);
+    if (flags & 0x40)
+        p += put_str(p, m->password, pass_len);
+    return append(m, pkt, (size_t)(p - pkt));
+}
+
+static bool send_publish(mqtt_t *m, mqtt_msg_t *msg) {
+    size_t topic_len = strlen(msg->topic);
+    uint8_t pkt[8 + MQTT_TOPIC_MAX + MQTT_PAYLOAD_MAX];
+    uint8_t *p = pkt;
+    *p++ = PKT_PUBLISH | (msg->sent && m->qos ? 0x08 : 0) | (uint8_t)(m->qos << 1) | (msg->retain ? 0x01 : 0);
+    p += put_varlen(p, 2 + topic_len + (m->qos ? 2 : 0) + msg->len);
+    p += put_str(p, msg->topic, topic_len);
+    if (m->qos) {
+        if (!msg->id) {
+            if (++m->next_id == 0)
+                m->next_id = 1;
+            msg->id = m->next_id;
+        }
+        *p++ = (uint8_t)(msg->id >> 8);
+        *p++ = (uint8_t)msg->id;
+    }
+    memcpy(p, msg->payload, msg->len);
+    p += msg->len;
+    if (!append(m, pkt, (size_t)(p - pkt)))
+        return false;
+    msg->sent = true;
+    msg->inflight = true;
+    m->published++;
+    if (m->qos == 0)
+        msg->valid = false;
+    return true;
+}
+
+static void flush_out(mqtt_t *m, uint64_t now) {
+    size_t off = 0;
+    while (off < m->out_len) {
+        ssize_t n = send(m->fd, m->out + off, m->out_len - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            drop_connection(m, now, strerror(errno));
+            return;
+        }
+        off += (size_t)n;
+        m->last_tx_ns = now;
+    }
+    memmove(m->out, m->out + off, m->out_len - off);
+    m->out_len -= off;
+}
+
+/*
+ * Serialize whatever is pending and fits, then write. With QoS 1 a message
+ * stays valid until its PUBACK; one already written on this connection is
+ * only written again, with DUP and the same id, after a reconnect.
+ */
+static void pump(mqtt_t *m, uint64_t now) {
+    if (m->state == MQTT_CONNECTED) {
+        mqtt_msg_t *queue[] = { &m->online, &m->mode, &m->stats };
+        for (unsigned i = 0; i < sizeof(queue)/sizeof(queue[0]); i++) {
+            if (queue[i]->valid && !queue[i]->inflight && !send_publish(m, queue[i]))
+                break;
+        }
+    }
+    if (m->fd >= 0 && m->state != MQTT_CONNECTING && m->out_len)
+        flush_out(m, now);
+    if (m->fd >= 0)
+        update_interest(m);
+}
+
+static void start_connect(mqtt_t *m, uint64_t now) {
+    m->fd = socket(m->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m->fd < 0) {
+        drop_connection(m, now, strerror(errno));
+        return;
+    }
+    int one = 1;
+    setsockopt(m->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    m->connect_deadline_ns = now + CONNECT_TIMEOUT_NS;
+    m->state = MQTT_CONNECTING;
+    if (connect(m->fd, (struct sockaddr *)&m->addr, m->addrlen) < 0 && errno != EINPROGRESS) {
+        drop_connection(m, now, strerror(errno));
+        return;
+    }
+    update_interest(m);
+}
+
+static void on_connected(mqtt_t *m, uint64_t now) {
+    m->state = MQTT_CONNACK_WAIT;
+    m->mode.inflight = false;
+    m->stats.inflight = false;
+    if (!send_connect(m)) {
+        drop_connection(m, now, "connect packet too large");
+        return;
+    }
+    flush_out(m, now);
+}
+
+void mqtt_start(mqtt_t *m, int epoll_fd, uint32_t tag, uint64_t now) {
+    if (!m->enabled)
+        return;
+    m->epoll_fd = epoll_fd;
+    m->epoll_tag = tag;
+    m->backoff_ns = m->backoff_min_ns;
+    m->reconnect_ns = now;
+    m->next_stats_ns = now + m->stats_ns;
+    snprintf(m->online.topic, sizeof(m->online.topic), "%s/online", m->topic);
+    snprintf(m->mode.topic, sizeof(m->mode.topic), "%s/mode", m->topic);
+    snprintf(m->stats.topic, sizeof(m->stats.topic), "%s/stats", m->topic);
+    m->online.retain = true;
+    m->mode.retain = m->retain;
+}
+
+static void on_puback(mqtt_t *m, uint16_t id) {
+    mqtt_msg_t *queue[] = { &m->online, &m->mode, &m->stats };
+    for (unsigned i = 0; i < sizeof(queue)/sizeof(queue[0]); i++) {
+        if (queue[i]->valid && queue[i]->inflight && queue[i]->id == id) {
+            queue[i]->valid = false;
+            queue[i]->inflight = false;
+            queue[i]->id = 0;
+        }
+    }
+}
+
+// Handle every complete packet in the input buffer; false if the connection was dropped.
+static bool parse_input(mqtt_t *m, uint64_t now) {
+    size_t off = 0;
+    while (m->in_len - off >= 2) {
+        size_t rem = 0, hdr = 1;
+        unsigned shift = 0;
+        uint8_t b;
+        do {
+            if (hdr >= m->in_len - off)
+                goto partial;
+            b = m->in[off + hdr++];
+            rem |= (size_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while ((b & 0x80) && hdr < 5);
+        if (hdr + rem > sizeof(m->in)) {
+            drop_connection(m, now, "oversized packet from broker");
+            return false;
+        }
+        if (m->in_len - off < hdr + rem)
+            break;
+
+        const uint8_t *body = m->in + off + hdr;
+        switch (m->in[off] & 0xf0) {
+            case PKT_CONNACK:
+                if (rem < 2 || body[1] != 0) {
+                    char why[48];
+                    snprintf(why, sizeof(why), "connection refused, code %u", rem < 2 ? 255u : body[1]);
+                    drop_connection(m, now, why);
+                    return false;
+                }
+                m->state = MQTT_CONNECTED;
+                m->connects++;
+                m->backoff_ns = m->backoff_min_ns;
+                m->ping_sent_ns = 0;
+                memcpy(m->online.payload, "1", 1);
+                m->online.len = 1;
+                m->online.valid = true;
+                m->online.sent = false;
+                m->online.inflight = false;
+                m->online.id = 0;
+                fprintf(stderr, "mqtt.connection.up: %s\n", m->host);
+                break;
+            case PKT_PUBACK:
+                if (rem >= 2)
+                    on_puback(m, (uint16_t)(body[0] << 8 | body[1]));
+                break;
+            case PKT_PINGRESP:
+                m->ping_sent_ns = 0;
+                break;
+            default:
+                break;
+        }
+        off += hdr + rem;
+    }
+partial:
+    memmove(m->in, m->in + off, m->in_len - off);
+    m->in_len -= off;
+    return true;
+}
+
+void mqtt_io(mqtt_t *m, uint32_t events, uint64_t now) {
+    if (m->fd < 0)
+        return;
+    if (m->state == MQTT_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(m->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+        if (err) {
+            drop_connection(m, now, strerror(err));
+            return;
+        }
+        on_connected(m, now);
+        if (m->fd < 0)
+            return;
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        drop_connection(m, now, "socket error");
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        while (1) {
+            ssize_t n = recv(m->fd, m->in + m->in_len, sizeof(m->in) - m->in_len, MSG_DONTWAIT);
+            if (n == 0) {
+                drop_connection(m, now, "closed by broker");
+                return;
+            }
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    break;
+                drop_connection(m, now, strerror(errno));
+                return;
+            }
+            m->in_len += (size_t)n;
+            if (!parse_input(m, now))
+                return;
+        }
+    }
+    pump(m, now);
+}
+
+static void replace_msg(mqtt_t *m, mqtt_msg_t *msg, const char *payload, int len) {
+    if (len < 0 || (size_t)len >= sizeof(msg->payload))
+        return;
+    if (msg->valid)
+        m->superseded++;
+    memcpy(msg->payload, payload, (size_t)len);
+    msg->len = (size_t)len;
+    msg->valid = true;
+    msg->sent = false;
+    msg->inflight = false;
+    msg->id = 0;
+}
+
+void mqtt_timeout(mqtt_t *m, uint64_t now, const modsw_shm_t *shm) {
+    if (!m->enabled)
+        return;
+    uint64_t keepalive_ns = (uint64_t)m->keepalive_s * 1000000000ull;
+    switch (m->state) {
+        case MQTT_DISCONNECTED:
+            if (now >= m->reconnect_ns)
+                start_connect(m, now);
+            break;
+        case MQTT_CONNECTING:
+        case MQTT_CONNACK_WAIT:
+            if (now >= m->connect_deadline_ns)
+                drop_connection(m, now, "connect timeout");
+            break;
+        case MQTT_CONNECTED:
+            if (!keepalive_ns)
+                break;
+            if (m->ping_sent_ns && now - m->ping_sent_ns >= keepalive_ns) {
+                drop_connection(m, now, "keepalive timeout");
+            } else if (!m->ping_sent_ns && now - m->last_tx_ns >= keepalive_ns) {
+                static const uint8_t ping[2] = { PKT_PINGREQ, 0 };
+                if (append(m, ping, sizeof(ping)))
+                    m->ping_sent_ns = now;
+            }
+            break;
+    }
+
+    if (m->stats_ns && now >= m->next_stats_ns) {
+        m->next_stats_ns += m->stats_ns;
+        if (m->next_stats_ns <= now)
+            m->next_stats_ns = now + m->stats_ns;
+        char buf[MQTT_PAYLOAD_MAX];
+        int len = snprintf(buf, sizeof(buf),
+                           "{\"mode\":%u,\"transitions\":%" PRIu64 ",\"coalesced\":%" PRIu64 ",\"invalid\":%" PRIu64 ",\"gestures\":%" PRIu64
+                           ",\"mqtt_connects\":%" PRIu64 ",\"mqtt_disconnects\":%" PRIu64 ",\"mqtt_published\":%" PRIu64 ",\"mqtt_superseded\":%" PRIu64 "}",
+                           shm->mode, shm->stats.transitions, shm->stats.coalesced, shm->stats.invalid, shm->stats.gestures,
+                           m->connects, m->disconnects, m->published, m->superseded);
+        replace_msg(m, &m->stats, buf, len);
+    }
+    pump(m, now);
+}
+
+uint64_t mqtt_next_deadline(const mqtt_t *m) {
+    if (!m->enabled)
+        return MQTT_NO_DEADLINE;
+    uint64_t deadline = m->stats_ns ? m->next_stats_ns : MQTT_NO_DEADLINE;
+    uint64_t keepalive_ns = (uint64_t)m->keepalive_s * 1000000000ull;
+    uint64_t t = MQTT_NO_DEADLINE;
+    if (m->state == MQTT_DISCONNECTED)
+        t = m->reconnect_ns;
+    else if (m->state != MQTT_CONNECTED)
+        t = m->connect_deadline_ns;
+    else if (keepalive_ns)
+        t = (m->ping_sent_ns ? m->ping_sent_ns : m->last_tx_ns) + keepalive_ns;
+    return t < deadline ? t : deadline;
+}
+
+int mqtt_deliver(void *ctx, const sink_msg_t *msg) {
+    mqtt_t *m = ctx;
+    if (msg->ev.type != MODSW_EVENT_MODE)
+        return 0;
+
+    char name[MODSW_NAME_MAX * 6 + 1];
+    json_escape(name, sizeof(name), msg->ev.name, MODSW_NAME_MAX);
+    char buf[MQTT_PAYLOAD_MAX];
+    int len = snprintf(buf, sizeof(buf),
+                       "{\"mode\":%u,\"char\":\"%c\",\"name\":\"%s\",\"raw\":%u,\"seq\":%" PRIu64 ",\"ts_ms\":%" PRIu64 "}",
+                       msg->ev.mode, modsw_mode_char(msg->ev.mode), name, msg->raw, msg->ev.seq, msg->rt_ns / 1000000);
+    replace_msg(m, &m->mode, buf, len);
+    pump(m, monotonic_ns());
+    return 0;
+}
+
+void mqtt_close(mqtt_t *m) {
+    if (!m->enabled || m->fd < 0)
+        return;
+    if (m->state == MQTT_CONNECTED) {
+        static const uint8_t disconnect[2] = { PKT_DISCONNECT, 0 };
+        send(m->fd, disconnect, sizeof(disconnect), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    close(m->fd);
+    m->fd = -1;
+    m->state = MQTT_DISCONNECTED;
+}
@@ -0,0 +1,191 @@
+/*
+ * mqtt.h - rpi-modswitch MQTT publisher sink
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file is a small MQTT 3.1.1 publisher driven entirely by the daemon's
+ * event loop: the socket is non-blocking, registered in the daemon's epoll
+ * set, and every timer (connect timeout, keepalive, reconnect backoff, stats
+ * period) is reported through mqtt_next_deadline(). Nothing in here ever
+ * waits on the broker, so an outage only delays MQTT output.
+ *
+ * Topics, below the configured prefix:
+ *   - <topic>/mode    retained JSON of the current mode, on every transition.
+ *   - <topic>/stats   JSON daemon counters, every stats_s seconds.
+ *   - <topic>/online  retained "1" after connecting, "0" as the last will.
+ *
+ * Only the newest mode and stats messages are kept while the broker is away;
+ * they are sent on reconnect. With qos = 1 they stay pending until the broker
+ * acknowledges them and are resent after a reconnect. QoS 2 is not supported.
+ *
+ * A broker given by name is resolved once at startup, before the event loop
+ * runs; use a numeric address where DNS may not be up at boot.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include "modsw_shm.h"
+#include "sink.h"
+
+#define MQTT_NO_DEADLINE UINT64_MAX
+#define MQTT_BUF_SIZE 2048
+#define MQTT_TOPIC_MAX 128
+#define MQTT_PAYLOAD_MAX 384
+
+typedef enum mqtt_state_t {
+    MQTT_DISCONNECTED = 0,      // waiting for reconnect_ns
+    MQTT_CONNECTING,            // TCP connect in progress
+    MQTT_CONNACK_WAIT,          // CONNECT sent
+    MQTT_CONNECTED,
+} mqtt_state_t;
+
+typedef struct mqtt_msg_t {
+    bool valid;                 // waiting to be sent or acknowledged
+    bool sent;                  // written at least once (resent with DUP)
+    bool inflight;              // written on the current connection
+    uint16_t id;                // packet identifier, QoS 1 only
+    bool retain;
+    char topic[MQTT_TOPIC_MAX];
+    char payload[MQTT_PAYLOAD_MAX];
+    size_t len;
+} mqtt_msg_t;
+
+typedef struct mqtt_t {
+    bool enabled;
+    char host[128];
+    uint16_t port;
+    char client_id[64];
+    char topic[MQTT_TOPIC_MAX - 16];
+    char username[64];
+    char password[64];
+    unsigned qos;
+    bool retain;
+    unsigned keepalive_s;
+    uint64_t stats_ns;
+    uint64_t backoff_min_ns;
+    uint64_t backoff_max_ns;
+    bool defaults;              // defaults applied
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int fd;
+    int epoll_fd;
+    uint32_t epoll_tag;
+    uint32_t epoll_events;      // currently registered interest, 0 = not registered
+    mqtt_state_t state;
+    uint64_t backoff_ns;
+    uint64_t reconnect_ns;
+    uint64_t connect_deadline_ns;
+    uint64_t last_tx_ns;
+    uint64_t ping_sent_ns;      // 0 = no PINGREQ outstanding
+    uint64_t next_stats_ns;
+    uint16_t next_id;
+
+    uint8_t out[MQTT_BUF_SIZE];
+    size_t out_len;
+    uint8_t in[MQTT_BUF_SIZE];
+    size_t in_len;
+
+    mqtt_msg_t online;
+    mqtt_msg_t mode;
+    mqtt_msg_t stats;
+
+    uint64_t connects;
+    uint64_t disconnects;
+    uint64_t published;
+    uint64_t superseded;        // messages replaced before the broker got them
+} mqtt_t;
+
+
+/**
+ * Apply one key of the [mqtt] configuration section.
+ *
+ * @param m      Client.
+ * @param key    One of enable, host, port, client_id, topic, username,
+ *               password, qos, retain, keepalive_s, stats_s,
+ *               backoff_min_ms, backoff_max_ms.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool mqtt_conf(mqtt_t *m, const char *key, const char *value);
+
+/**
+ * Resolve the broker address. Does nothing if the client is not enabled.
+ *
+ * @param m      Client.
+ * @return       0 on success, -1 on failure (message printed).
+ */
+int mqtt_open(mqtt_t *m);
+
+/**
+ * Attach to the daemon's epoll set and schedule the first connect.
+ *
+ * @param m         Client.
+ * @param epoll_fd  Epoll instance the socket is registered in.
+ * @param tag       epoll_data.u32 of the socket's events.
+ * @param now       Current time.
+ */
+void mqtt_start(mqtt_t *m, int epoll_fd, uint32_t tag, uint64_t now);
+
+/**
+ * Handle readiness of the socket.
+ *
+ * @param m         Client.
+ * @param events    EPOLL* bits reported for the socket.
+ * @param now       Current time.
+ */
+void mqtt_io(mqtt_t *m, uint32_t events, uint64_t now);
+
+/**
+ * Run expired timers: reconnect, connect timeout, keepalive and stats.
+ *
+ * @param m         Client.
+ * @param now       Current time.
+ * @param shm       Daemon shared memory, source of the stats message.
+ */
+void mqtt_timeout(mqtt_t *m, uint64_t now, const modsw_shm_t *shm);
+
+/**
+ * Time of the next timer.
+ *
+ * @param m      Client.
+ * @return       Absolute CLOCK_MONOTONIC time, or MQTT_NO_DEADLINE.
+ */
+uint64_t mqtt_next_deadline(const mqtt_t *m);
+
+/**
+ * Sink delivery function: replaces the pending mode message for
+ * MODSW_EVENT_MODE messages and ignores the rest. Must be drained by the
+ * event loop.
+ *
+ * @param ctx    The mqtt_t.
+ * @param msg    Message.
+ * @return       0.
+ */
+int mqtt_deliver(void *ctx, const sink_msg_t *msg);
+
+/**
+ * Send DISCONNECT if connected and close the socket.
+ *
+ * @param m      Client.
+ */
+void mqtt_close(mqtt_t *m);
+
+#endif /* MQTT_H */
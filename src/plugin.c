@@ -0,0 +1,198 @@
+/*
+ * plugin.c - rpi-modswitch plugin loader
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the plugin loader described in plugin.h. Ticks travel
+ * through the plugin's sink queue like events, as messages with event type 0,
+ * so both callbacks run on the same executor and never overlap.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include "plugin.h"
+#include "utils.h"
+
+#define PLUGIN_MSG_TICK 0       // never a MODSW_EVENT_* type
+
+// The plugin was built with a header that already had this callback.
+#define HAS_CALLBACK(api, field) \
+    ((api)->size >= offsetof(modsw_plugin_t, field) + sizeof((api)->field) && (api)->field)
+
+static plugin_t *plugin_lookup(plugin_set_t *set, const char *name) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (strcmp(set->p[i].name, name) == 0)
+            return &set->p[i];
+    }
+    if (set->n >= PLUGIN_MAX || strlen(name) >= sizeof(set->p[0].name) || !name[0])
+        return NULL;
+
+    plugin_t *p = &set->p[set->n++];
+    memset(p, 0, sizeof(*p));
+    strcpy(p->name, name);
+    p->queue = (sink_conf_t)SINK_CONF_DEFAULT;
+    return p;
+}
+
+bool plugin_conf(plugin_set_t *set, const char *name, const char *key, const char *value) {
+    plugin_t *p = plugin_lookup(set, name);
+    if (!p)
+        return false;
+
+    uintmax_t num;
+    if (strcmp(key, "path") == 0) {
+        if (!value[0] || strlen(value) >= sizeof(p->path))
+            return false;
+        strcpy(p->path, value);
+    } else if (strcmp(key, "arg") == 0) {
+        if (strlen(value) >= sizeof(p->arg))
+            return false;
+        strcpy(p->arg, value);
+    } else if (strcmp(key, "tick_ms") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        p->tick_ns = (uint64_t)num * 1000000ull;
+    } else {
+        // Evicting a queued tick would leave tick_pending set for good.
+        return sink_conf(&p->queue, key, value) && p->queue.policy != SINK_POLICY_LATEST;
+    }
+    return true;
+}
+
+static bool plugin_load(plugin_t *p) {
+    if (!p->path[0]) {
+        fprintf(stderr, "plugin.load.no_path: [plugin.%s] path is not set\n", p->name);
+        return false;
+    }
+    p->handle = dlopen(p->path, RTLD_NOW | RTLD_LOCAL);
+    if (!p->handle) {
+        fprintf(stderr, "plugin.load.dlopen_failed: %s\n", dlerror());
+        return false;
+    }
+    p->api = dlsym(p->handle, MODSW_PLUGIN_SYMBOL);
+    if (!p->api) {
+        fprintf(stderr, "plugin.load.no_entry_symbol: %s: %s\n", p->path, dlerror());
+    } else if (p->api->abi_version != MODSW_PLUGIN_ABI_VERSION || p->api->size < offsetof(modsw_plugin_t, init)) {
+        fprintf(stderr, "plugin.load.abi_mismatch: %s: abi %u, expected %u\n", p->path, p->api->abi_version, MODSW_PLUGIN_ABI_VERSION);
+    } else if (HAS_CALLBACK(p->api, init) && p->api->init(&p->ctx, p->arg) != 0) {
+        fprintf(stderr, "plugin.load.init_failed: %s\n", p->path);
+    } else {
+        return true;
+    }
+    dlclose(p->handle);
+    p->handle = NULL;
+    p->api = NULL;
+    return false;
+}
+
+int plugin_set_open(plugin_set_t *set, sink_set_t *sinks) {
+    for (unsigned i = 0; i < set->n; i++) {
+        plugin_t *p = &set->p[i];
+        if (!plugin_load(p)) {
+            fprintf(stderr, "plugin.open.skipped: continuing without plugin %s\n", p->name);
+            continue;
+        }
+        char name[MODSW_NAME_MAX];
+        snprintf(name, sizeof(name), "plugin.%s", p->name);
+        p->queue.thread = true;     // a plugin never runs on the event loop
+        p->sink = sink_set_add(sinks, name, &p->queue, plugin_deliver, p);
+        if (!p->sink)
+            return -1;
+    }
+    return 0;
+}
+
+void plugin_set_start(plugin_set_t *set, uint64_t now) {
+    for (unsigned i = 0; i < set->n; i++)
+        set->p[i].next_tick_ns = now + set->p[i].tick_ns;
+}
+
+static bool ticking(const plugin_t *p) {
+    return p->sink && p->tick_ns && HAS_CALLBACK(p->api, on_tick);
+}
+
+void plugin_set_timeout(plugin_set_t *set, uint64_t now) {
+    for (unsigned i = 0; i < set->n; i++) {
+        plugin_t *p = &set->p[i];
+        if (!ticking(p) || now < p->next_tick_ns)
+            continue;
+        sink_msg_t msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.ev.type = PLUGIN_MSG_TICK;
+        msg.ev.ts_ns = p->next_tick_ns;
+        p->next_tick_ns += p->tick_ns;
+        if (p->next_tick_ns <= now)
+            p->next_tick_ns = now + p->tick_ns;
+        if (__atomic_exchange_n(&p->tick_pending, 1, __ATOMIC_ACQ_REL))
+            continue;       // the previous tick is still queued
+        if (!sink_publish(p->sink, &msg, now))
+            __atomic_store_n(&p->tick_pending, 0, __ATOMIC_RELEASE);
+    }
+}
+
+uint64_t plugin_set_next_deadline(const plugin_set_t *set) {
+    uint64_t deadline = PLUGIN_NO_DEADLINE;
+    for (unsigned i = 0; i < set->n; i++) {
+        if (ticking(&set->p[i]) && set->p[i].next_tick_ns < deadline)
+            deadline = set->p[i].next_tick_ns;
+    }
+    return deadline;
+}
+
+int plugin_deliver(void *ctx, const sink_msg_t *msg) {
+    plugin_t *p = ctx;
+    if (msg->ev.type == PLUGIN_MSG_TICK) {
+        __atomic_store_n(&p->tick_pending, 0, __ATOMIC_RELEASE);
+        return p->api->on_tick(p->ctx, msg->ev.ts_ns);
+    }
+    if (msg->ev.type != MODSW_EVENT_MODE || !HAS_CALLBACK(p->api, on_transition))
+        return 0;
+
+    char name[MODSW_NAME_MAX + 1];
+    memcpy(name, msg->ev.name, MODSW_NAME_MAX);
+    name[MODSW_NAME_MAX] = '\0';
+    modsw_plugin_event_t ev = {
+        .seq = msg->ev.seq,
+        .ts_ns = msg->ev.ts_ns,
+        .rt_ns = msg->rt_ns,
+        .mode = msg->ev.mode,
+        .from = msg->ev.arg,
+        .raw = msg->raw,
+        .name = name,
+    };
+    return p->api->on_transition(p->ctx, &ev);
+}
+
+void plugin_set_close(plugin_set_t *set) {
+    for (unsigned i = 0; i < set->n; i++) {
+        plugin_t *p = &set->p[i];
+        if (!p->handle)
+            continue;
+        if (HAS_CALLBACK(p->api, shutdown))
+            p->api->shutdown(p->ctx);
+        dlclose(p->handle);
+        p->handle = NULL;
+        p->api = NULL;
+        p->sink = NULL;
+    }
+}
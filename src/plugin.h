@@ -0,0 +1,122 @@
+/*
+ * plugin.h - rpi-modswitch plugin loader
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file loads the plugins of the [plugin.NAME] sections (ABI in
+ * modsw_plugin.h) and registers each as an output sink named "plugin.NAME"
+ * whose worker thread is the plugin's executor. Time spent inside the
+ * plugin's callbacks shows up as the exec figures of that sink's metrics.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+#include "modsw_plugin.h"
+#include "sink.h"
+
+#define PLUGIN_MAX 4
+#define PLUGIN_PATH_MAX 256
+#define PLUGIN_NO_DEADLINE UINT64_MAX
+
+typedef struct plugin_t {
+    char name[MODSW_NAME_MAX - 8];      // leaves room for the "plugin." sink prefix
+    char path[PLUGIN_PATH_MAX];
+    char arg[PLUGIN_PATH_MAX];
+    uint64_t tick_ns;                   // 0 = no ticks
+    sink_conf_t queue;
+
+    void *handle;                       // dlopen() handle, NULL when not loaded
+    const modsw_plugin_t *api;
+    void *ctx;
+    sink_t *sink;
+    uint64_t next_tick_ns;
+    uint32_t tick_pending;              // set by the event loop, cleared by the executor
+} plugin_t;
+
+typedef struct plugin_set_t {
+    plugin_t p[PLUGIN_MAX];
+    unsigned n;
+} plugin_set_t;
+
+
+/**
+ * Apply one key of a [plugin.NAME] configuration section.
+ *
+ * @param set    Plugin set.
+ * @param name   Plugin name (section suffix).
+ * @param key    One of path, arg, tick_ms, or a queue key (see sink_conf());
+ *               the latest policy is refused, it could evict a pending tick.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool plugin_conf(plugin_set_t *set, const char *name, const char *key, const char *value);
+
+/**
+ * Load and initialize every configured plugin and register its sink. A
+ * plugin that cannot be loaded is reported and skipped.
+ *
+ * @param set    Plugin set.
+ * @param sinks  Sink set the executors are added to.
+ * @return       0 on success, -1 with errno set if a sink cannot be added.
+ */
+int plugin_set_open(plugin_set_t *set, sink_set_t *sinks);
+
+/**
+ * Schedule the first ticks.
+ *
+ * @param set    Plugin set.
+ * @param now    Current time.
+ */
+void plugin_set_start(plugin_set_t *set, uint64_t now);
+
+/**
+ * Queue the ticks that came due on their executors.
+ *
+ * @param set    Plugin set.
+ * @param now    Current time.
+ */
+void plugin_set_timeout(plugin_set_t *set, uint64_t now);
+
+/**
+ * Time of the next tick.
+ *
+ * @param set    Plugin set.
+ * @return       Absolute CLOCK_MONOTONIC time, or PLUGIN_NO_DEADLINE.
+ */
+uint64_t plugin_set_next_deadline(const plugin_set_t *set);
+
+/**
+ * Sink delivery function: runs on_transition() for mode events and on_tick()
+ * for ticks, on the plugin's executor thread.
+ *
+ * @param ctx    The plugin_t.
+ * @param msg    Message.
+ * @return       The callback's result.
+ */
+int plugin_deliver(void *ctx, const sink_msg_t *msg);
+
+/**
+ * Shut every plugin down and unload it. The executors must be stopped.
+ *
+ * @param set    Plugin set.
+ */
+void plugin_set_close(plugin_set_t *set);
+
+#endif /* PLUGIN_H */
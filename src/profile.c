@@ -0,0 +1,107 @@
+/*
+ * profile.c - rpi-modswitch per-mode configuration profiles
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the profile set described in profile.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "profile.h"
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+static const char *find_key(const char *data, size_t len, const char *key) {
+    const char *p = data;
+    while (p < data + len) {
+        const char *value = p + strlen(p) + 1;
+        if (strcmp(p, key) == 0)
+            return value;
+        p = value + strlen(value) + 1;
+    }
+    return NULL;
+}
+
+int profile_set_add(profile_set_t *set, unsigned mode, const char *key, const char *value) {
+    if (!set || mode >= MODSW_MAX_MODES || !key[0]) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (find_key(set->mode[mode].data, set->mode[mode].len, key)) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    size_t klen = strlen(key) + 1;
+    size_t vlen = strlen(value) + 1;
+    char *data = realloc(set->mode[mode].data, set->mode[mode].len + klen + vlen);
+    if (!data) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(data + set->mode[mode].len, key, klen);
+    memcpy(data + set->mode[mode].len + klen, value, vlen);
+    set->mode[mode].data = data;
+    set->mode[mode].len += klen + vlen;
+    set->mode[mode].count++;
+    return 0;
+}
+
+size_t profile_set_packed_size(const profile_set_t *set) {
+    size_t size = 0;
+    for (unsigned i = 0; i < MODSW_MAX_MODES; i++) {
+        if (set->mode[i].count)
+            size += ALIGN8(sizeof(modsw_profile_t) + set->mode[i].len);
+    }
+    if (size == 0)
+        return 0;
+    return ALIGN8(sizeof(uint32_t) * MODSW_MAX_MODES) + size;
+}
+
+void profile_set_pack(profile_set_t *set, void *base, uint32_t off) {
+    uint32_t *index = (uint32_t *)((uint8_t *)base + off);
+    uint32_t pos = off + ALIGN8(sizeof(uint32_t) * MODSW_MAX_MODES);
+
+    for (unsigned i = 0; i < MODSW_MAX_MODES; i++) {
+        if (!set->mode[i].count) {
+            index[i] = 0;
+            set->blob_off[i] = 0;
+            continue;
+        }
+        modsw_profile_t *blob = (modsw_profile_t *)((uint8_t *)base + pos);
+        blob->mode = (uint16_t)i;
+        blob->count = (uint16_t)set->mode[i].count;
+        blob->len = (uint32_t)set->mode[i].len;
+        memcpy(blob->data, set->mode[i].data, set->mode[i].len);
+        index[i] = pos;
+        set->blob_off[i] = pos;
+        pos += ALIGN8(sizeof(modsw_profile_t) + set->mode[i].len);
+    }
+}
+
+void profile_set_free(profile_set_t *set) {
+    for (unsigned i = 0; i < MODSW_MAX_MODES; i++) {
+        free(set->mode[i].data);
+        set->mode[i].data = NULL;
+        set->mode[i].len = 0;
+        set->mode[i].count = 0;
+    }
+}
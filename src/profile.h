@@ -0,0 +1,76 @@
+/*
+ * profile.h - rpi-modswitch per-mode configuration profiles
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file collects the key/value pairs of the [mode.N] sections of
+ * modswitch.conf and packs them into the immutable profile blobs laid out in
+ * modsw_shm.h, so consumers never have to parse configuration themselves.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "modsw_shm.h"
+
+typedef struct profile_set_t {
+    struct {
+        char *data;         // packed "key\0value\0" pairs
+        size_t len;
+        unsigned count;
+    } mode[MODSW_MAX_MODES];
+    uint32_t blob_off[MODSW_MAX_MODES];  // filled by profile_set_pack(), relative to the region
+} profile_set_t;
+
+
+/**
+ * Append a key/value pair to the profile of a mode.
+ *
+ * @param set    Profile set.
+ * @param mode   Mode index, below MODSW_MAX_MODES.
+ * @param key    Key, must not already exist in this profile.
+ * @param value  Value.
+ * @return       0 on success, -1 with errno set (EINVAL, EEXIST, ENOMEM).
+ */
+int profile_set_add(profile_set_t *set, unsigned mode, const char *key, const char *value);
+
+/**
+ * Size of the packed profile area, including the per-mode index.
+ *
+ * @param set    Profile set.
+ * @return       Size in bytes, 0 if no mode has a profile.
+ */
+size_t profile_set_packed_size(const profile_set_t *set);
+
+/**
+ * Pack all profiles into the shared region.
+ *
+ * @param set    Profile set; blob_off[] is filled with region offsets.
+ * @param base   Start of the shared region.
+ * @param off    Offset of the profile area, 8-byte aligned.
+ */
+void profile_set_pack(profile_set_t *set, void *base, uint32_t off);
+
+/**
+ * Release the memory held by a profile set.
+ *
+ * @param set    Profile set.
+ */
+void profile_set_free(profile_set_t *set);
+
+#endif /* PROFILE_H */
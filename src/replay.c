@@ -0,0 +1,147 @@
+/*
+ * replay.c - rpi-modswitch scripted switch input
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file reads the scripts described in replay.h and plays them back
+ * against the daemon's clock.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include "replay.h"
+#include "utils.h"
+
+// "COUNT[unit]" to nanoseconds.
+static bool parse_time(const char *str, uint64_t *ns) {
+    static const struct { const char *unit; uint64_t ns; } units[] = {
+        { "", 1000ull }, { "us", 1000ull }, { "ms", 1000000ull }, { "s", 1000000000ull },
+        { "m", 60000000000ull }, { "h", 3600000000000ull },
+    };
+    char *end;
+    errno = 0;
+    if (!isdigit((unsigned char)*str))
+        return false;
+    unsigned long long count = strtoull(str, &end, 10);
+    if (errno)
+        return false;
+    for (size_t i = 0; i < sizeof(units)/sizeof(units[0]); i++) {
+        if (strcmp(end, units[i].unit) == 0) {
+            if (count > UINT64_MAX / units[i].ns)
+                return false;
+            *ns = count * units[i].ns;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_line(replay_t *r, char *line, uint64_t *prev_ns) {
+    char *hash = strchr(line, '#');
+    if (hash)
+        *hash = '\0';
+    char *time_str = strtok(line, " \t\r\n");
+    if (!time_str)
+        return true;
+    char *levels_str = strtok(NULL, " \t\r\n");
+    if (!levels_str || strtok(NULL, " \t\r\n"))
+        return false;
+    if (r->end_ns != REPLAY_NO_DEADLINE)        // nothing after the end step
+        return false;
+
+    bool relative = time_str[0] == '+';
+    uint64_t ns;
+    if (!parse_time(time_str + relative, &ns))
+        return false;
+    if (relative)
+        ns += *prev_ns;
+    if (ns < *prev_ns)
+        return false;
+    *prev_ns = ns;
+
+    if (strcmp(levels_str, "end") == 0) {
+        r->end_ns = ns;
+        return true;
+    }
+    uintmax_t bits;
+    if (!xstr2umax(levels_str, 0, &bits) || bits > UINT64_MAX)
+        return false;
+    if (r->n == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 64;
+        replay_step_t *step = realloc(r->step, cap * sizeof(*step));
+        if (!step)
+            return false;
+        r->step = step;
+        r->cap = cap;
+    }
+    r->step[r->n++] = (replay_step_t){ ns, (uint64_t)bits };
+    return true;
+}
+
+int replay_load(replay_t *r, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    r->end_ns = REPLAY_NO_DEADLINE;
+    char line[256];
+    uint64_t prev_ns = 0;
+    int lineno = 0, ret = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (!parse_line(r, line, &prev_ns)) {
+            ret = lineno;
+            break;
+        }
+    }
+    fclose(f);
+    r->last_ns = prev_ns;
+    return ret;
+}
+
+void replay_start(replay_t *r, uint64_t now, uint64_t tail_ns) {
+    if (r->end_ns == REPLAY_NO_DEADLINE)
+        r->end_ns = r->last_ns + tail_ns;
+    r->start_ns = now;
+    r->pos = 0;
+    r->bits = 0;
+}
+
+uint64_t replay_levels(replay_t *r, uint64_t now) {
+    while (r->pos < r->n && r->start_ns + r->step[r->pos].at_ns <= now)
+        r->bits = r->step[r->pos++].bits;
+    return r->bits;
+}
+
+// Steps are picked up by the sampling ticks; waking for one that no tick reads yet would spin.
+uint64_t replay_next_deadline(const replay_t *r) {
+    return r->start_ns + r->end_ns;
+}
+
+bool replay_done(const replay_t *r, uint64_t now) {
+    return now - r->start_ns >= r->end_ns;
+}
+
+void replay_free(replay_t *r) {
+    free(r->step);
+    r->step = NULL;
+    r->n = r->cap = 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * replay.h - rpi-modswitch scripted switch input
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file runs `modswitchd -r SCRIPT`: the switch lines are read from a
+ * script instead of the GPIO chip, and the daemon runs on the virtual clock
+ * of utils.h. The event loop advances the clock straight to its next
+ * deadline instead of sleeping, so settle windows, gesture timers and
+ * heartbeats behave exactly as on a board, but hours of scripted activity
+ * take milliseconds and every run publishes the same sequence.
+ *
+ * A replay only prints what it publishes. Its regions are private memory
+ * instead of the named objects, it takes no lock, and the uinput, statefile,
+ * journal, mqtt, http, plugin, service and ack outputs are off, so it can run
+ * next to a live daemon without touching anything the daemon owns.
+ *
+ * A script has one step per line, '#' starts a comment:
+ *
+ *   TIME LEVELS       levels of the switch lines from TIME on
+ *   TIME end          stop the replay at TIME
+ *
+ * TIME is a count with an optional unit (us, ms, s, m, h; default us) since
+ * the start of the replay, or after the previous step when prefixed with
+ * '+'. Steps must not go back in time. LEVELS are the active lines as a
+ * number in C notation: bit N is line N of the main switch, and the lines of
+ * [group.NAME] sections follow in configuration order. Without an end step
+ * the replay runs on after the last step long enough for it to settle and be
+ * published.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define REPLAY_NO_DEADLINE UINT64_MAX
+
+typedef struct replay_step_t {
+    uint64_t at_ns;             // since the start of the replay
+    uint64_t bits;
+} replay_step_t;
+
+typedef struct replay_t {
+    replay_step_t *step;
+    size_t n;
+    size_t cap;
+    uint64_t end_ns;            // since the start of the replay, REPLAY_NO_DEADLINE without an end step
+    uint64_t last_ns;           // time of the last step
+    uint64_t start_ns;          // CLOCK_MONOTONIC at replay_start()
+    size_t pos;                 // next step to take effect
+    uint64_t bits;              // levels in effect
+} replay_t;
+
+
+/**
+ * Read a script.
+ *
+ * @param r      Replay, zeroed.
+ * @param path   Script file.
+ * @return       0 on success, -1 with errno set if the file cannot be read,
+ *               or the number of the first malformed line.
+ */
+int replay_load(replay_t *r, const char *path);
+
+/**
+ * Start the replay: step times count from now, all lines are inactive until
+ * the first step.
+ *
+ * @param r      Replay.
+ * @param now    Current time.
+ * @param tail_ns  Without an end step, how long to run on after the last
+ *               step: at least the longest settle window plus two sampling
+ *               ticks, so its levels get published.
+ */
+void replay_start(replay_t *r, uint64_t now, uint64_t tail_ns);
+
+/**
+ * Levels of the switch lines at a time.
+ *
+ * @param r      Replay.
+ * @param now    Current time, not before the previous call.
+ * @return       Active lines, see the script format above.
+ */
+uint64_t replay_levels(replay_t *r, uint64_t now);
+
+/**
+ * Time of the end of the replay. Steps need no wakeup of their own, the
+ * sampling ticks read them.
+ *
+ * @param r      Replay.
+ * @return       Absolute CLOCK_MONOTONIC time.
+ */
+uint64_t replay_next_deadline(const replay_t *r);
+
+/**
+ * Check whether the replay is over.
+ *
+ * @param r      Replay.
+ * @param now    Current time.
+ * @return       true once the end of the replay has been reached.
+ */
+bool replay_done(const replay_t *r, uint64_t now);
+
+/**
+ * Free the script.
+ *
+ * @param r      Replay.
+ */
+void replay_free(replay_t *r);
+
+#endif /* REPLAY_H */
@@ -0,0 +1,162 @@
+/*
+ * shiftreg.c - rpi-modswitch parallel-in shift register chain backend
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the 74HC165 chain reader described in shiftreg.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "shiftreg.h"
+#include "utils.h"
+
+#define DEFAULT_BITS 32
+#define DEFAULT_SCAN_US 10000
+#define DEFAULT_DEBOUNCE_READS 2
+
+bool shiftreg_conf(shiftreg_t *s, const char *key, const char *value) {
+    if (s->scan_ns == 0) {
+        s->load_pin = -1;
+        s->clock_pin = -1;
+        s->data_pin = -1;
+        s->bias = 1;
+        s->nbits = DEFAULT_BITS;
+        s->scan_ns = DEFAULT_SCAN_US * 1000ull;
+        s->debounce = DEFAULT_DEBOUNCE_READS;
+    }
+
+    uintmax_t num;
+    if (strcmp(key, "load_pin") == 0 || strcmp(key, "clock_pin") == 0 || strcmp(key, "data_pin") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 0xffff)
+            return false;
+        if (key[0] == 'l')
+            s->load_pin = (int)num;
+        else if (key[0] == 'c')
+            s->clock_pin = (int)num;
+        else
+            s->data_pin = (int)num;
+    } else if (strcmp(key, "bias") == 0) {
+        if (strcmp(value, "pullup") == 0)
+            s->bias = 1;
+        else if (strcmp(value, "pulldown") == 0)
+            s->bias = 0;
+        else if (strcmp(value, "disabled") == 0)
+            s->bias = -1;
+        else
+            return false;
+    } else if (strcmp(key, "invert") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        s->invert = num;
+    } else if (strcmp(key, "bits") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1 || num > MODSW_SHIFTREG_MAX_BITS)
+            return false;
+        s->nbits = (unsigned)num;
+    } else if (strcmp(key, "scan_us") == 0) {
+        if (!xstr2umax(value, 10, &num) || num == 0)
+            return false;
+        s->scan_ns = (uint64_t)num * 1000ull;
+    } else if (strcmp(key, "debounce_reads") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1 || num > VDEBOUNCE_MAX_SAMPLES)
+            return false;
+        s->debounce = (unsigned)num;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int shiftreg_add_lines(shiftreg_t *s, gpio_req_t *req) {
+    uint64_t data_flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (s->bias > 0)
+        data_flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    else if (s->bias == 0)
+        data_flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+    else
+        data_flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+    if (s->invert)
+        data_flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+
+    if ((s->req_load = gpio_req_add(req, s->load_pin, GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_ACTIVE_LOW)) < 0 ||
+        (s->req_clock = gpio_req_add(req, s->clock_pin, GPIO_V2_LINE_FLAG_OUTPUT)) < 0 ||
+        (s->req_data = gpio_req_add(req, s->data_pin, data_flags)) < 0)
+        return -1;
+    return 0;
+}
+
+void shiftreg_start(shiftreg_t *s, uint64_t now) {
+    memset(s->bits, 0, sizeof(s->bits));
+    if (s->nbits)
+        vdebounce_init(&s->vd, s->nbits, s->debounce, NULL);
+    s->next_scan_ns = now;
+}
+
+int shiftreg_scan(shiftreg_t *s, const gpio_req_t *req, uint64_t now, uint64_t changed[MODSW_SHIFTREG_WORDS]) {
+    memset(changed, 0, sizeof(uint64_t) * MODSW_SHIFTREG_WORDS);
+    if (s->nbits == 0 || now < s->next_scan_ns)
+        return 0;
+
+    uint64_t mask = (1ull << s->req_load) | (1ull << s->req_clock);
+    uint64_t load = 1ull << s->req_load;
+    uint64_t clock = 1ull << s->req_clock;
+    uint64_t data = 1ull << s->req_data;
+    uint64_t cur[MODSW_SHIFTREG_WORDS] = {0};
+
+    // Latch the parallel inputs, then leave load with the clock still low: QH now holds bit 0.
+    uint64_t start = monotonic_ns();    // now is when the loop woke, not when the read began
+    if (gpio_req_set(req, mask, load) < 0 || gpio_req_set(req, mask, 0) < 0)
+        return -1;
+    for (unsigned i = 0; i < s->nbits; i++) {
+        uint64_t v;
+        if (gpio_req_get(req, data, &v) < 0)
+            return -1;
+        if (v)
+            cur[i / 64] |= 1ull << (i % 64);
+        if (i + 1 < s->nbits && (gpio_req_set(req, mask, clock) < 0 || gpio_req_set(req, mask, 0) < 0))
+            return -1;
+    }
+
+    uint64_t end = monotonic_ns();
+    s->read_ns = end - start;
+    s->reads++;
+    s->next_scan_ns = now + s->scan_ns;
+
+    if (vdebounce_sample(&s->vd, cur, changed)) {
+        memcpy(s->bits, s->vd.state, sizeof(s->bits));
+        s->changes++;
+    }
+    return 1;
+}
+
+uint64_t shiftreg_next_deadline(const shiftreg_t *s) {
+    return s->nbits ? s->next_scan_ns : SHIFTREG_NO_DEADLINE;
+}
+
+void shiftreg_publish(const shiftreg_t *s, modsw_shiftreg_t *out) {
+    out->nbits = s->nbits;
+    memcpy(out->bits, s->bits, sizeof(out->bits));
+    out->reads = s->reads;
+    out->changes = s->changes;
+    out->read_ns = s->read_ns;
+    out->bit_rate = s->read_ns ? (uint64_t)s->nbits * 1000000000ull / s->read_ns : 0;
+    out->scan_us = (uint32_t)(s->scan_ns / 1000);
+}
@@ -0,0 +1,121 @@
+/*
+ * shiftreg.h - rpi-modswitch parallel-in shift register chain backend
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file reads a chain of cascaded 74HC165 parallel-in shift registers
+ * through three lines of the daemon's line request: load (SH/LD, active low),
+ * clock and serial data (QH of the last chip). Load and clock are set together
+ * with one ioctl per edge and data is read with one ioctl per bit, so a chain
+ * of N bits costs about 3N ioctls; at that rate the chips' own timing limits
+ * are never approached and no delays are inserted.
+ *
+ * Bit 0 of the published bitset is the first bit shifted out, i.e. input H of
+ * the chip wired to the data line. An input flips once debounce_reads
+ * consecutive reads disagree with it, which filters out DIP contacts caught
+ * mid-flip; the whole chain is filtered with vertical counters (vdebounce.h).
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef SHIFTREG_H
+#define SHIFTREG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "modsw_shm.h"
+#include "gpio.h"
+#include "vdebounce.h"
+
+#define SHIFTREG_NO_DEADLINE UINT64_MAX
+
+typedef struct shiftreg_t {
+    int load_pin;
+    int clock_pin;
+    int data_pin;
+    int bias;                   // data line: 1 pull-up, 0 pull-down, -1 disabled
+    bool invert;                // request the data line active-low
+    unsigned nbits;             // chain length in bits, 0 = no chain configured
+    unsigned debounce;          // reads an input must disagree before it flips
+    uint64_t scan_ns;
+
+    int req_load;
+    int req_clock;
+    int req_data;
+
+    uint64_t bits[MODSW_SHIFTREG_WORDS];        // published
+    vdebounce_t vd;
+    uint64_t next_scan_ns;
+    uint64_t reads;
+    uint64_t changes;
+    uint64_t read_ns;           // duration of the last full chain read
+} shiftreg_t;
+
+
+/**
+ * Apply one key of the [shiftreg] configuration section.
+ *
+ * @param s      Shift register chain.
+ * @param key    One of load_pin, clock_pin, data_pin, bias, invert, bits,
+ *               scan_us, debounce_reads.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool shiftreg_conf(shiftreg_t *s, const char *key, const char *value);
+
+/**
+ * Add the load, clock and data lines to the daemon's line request.
+ *
+ * @param s      Shift register chain.
+ * @param req    Line request that is not opened yet.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int shiftreg_add_lines(shiftreg_t *s, gpio_req_t *req);
+
+/**
+ * Start reading.
+ *
+ * @param s      Shift register chain.
+ * @param now    Current time.
+ */
+void shiftreg_start(shiftreg_t *s, uint64_t now);
+
+/**
+ * Read the whole chain if its interval has elapsed.
+ *
+ * @param s        Shift register chain.
+ * @param req      Opened line request.
+ * @param now      Current time.
+ * @param changed  Receives the bits that flipped in the published bitset.
+ * @return         1 if a read ran, 0 if it was not due, -1 on ioctl failure.
+ */
+int shiftreg_scan(shiftreg_t *s, const gpio_req_t *req, uint64_t now, uint64_t changed[MODSW_SHIFTREG_WORDS]);
+
+/**
+ * Time of the next chain read.
+ *
+ * @param s      Shift register chain.
+ * @return       Absolute CLOCK_MONOTONIC time, or SHIFTREG_NO_DEADLINE.
+ */
+uint64_t shiftreg_next_deadline(const shiftreg_t *s);
+
+/**
+ * Fill the shared memory record of the chain.
+ *
+ * @param s      Shift register chain.
+ * @param out    Shared memory record.
+ */
+void shiftreg_publish(const shiftreg_t *s, modsw_shiftreg_t *out);
+
+#endif /* SHIFTREG_H */
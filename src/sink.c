@@ -0,0 +1,384 @@
+/*
+ * sink.c - rpi-modswitch asynchronous publish fan-out
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the sink rings described in sink.h.
+ *
+ * The event loop is the only producer of a ring and the drain context its
+ * only consumer. The consumer claims a slot with a compare-and-swap on tail
+ * after copying it, so the latest policy can discard the oldest slot from the
+ * producer side: a copy that raced with it fails the swap and is thrown away.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#define _GNU_SOURCE     // pthread_timedjoin_np()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "sink.h"
+#include "utils.h"
+
+#define SINK_MAX_QUEUE 4096
+
+static void futex_wait(uint32_t *addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void stat_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static uint64_t stat_get(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+bool sink_conf(sink_conf_t *c, const char *key, const char *value) {
+    uintmax_t num;
+    if (strcmp(key, "queue") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1 || num > SINK_MAX_QUEUE)
+            return false;
+        c->queue_len = (unsigned)num;
+    } else if (strcmp(key, "policy") == 0) {
+        if (strcmp(value, "drop") == 0)
+            c->policy = SINK_POLICY_DROP;
+        else if (strcmp(value, "latest") == 0)
+            c->policy = SINK_POLICY_LATEST;
+        else if (strcmp(value, "block") == 0)
+            c->policy = SINK_POLICY_BLOCK;
+        else
+            return false;
+    } else if (strcmp(key, "block_us") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        c->block_ns = (uint64_t)num * 1000ull;
+    } else if (strcmp(key, "rate") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1000000)
+            return false;
+        c->rate = (unsigned)num;
+    } else if (strcmp(key, "burst") == 0) {
+        if (!xstr2umax(value, 10, &num) || num < 1 || num > SINK_MAX_QUEUE)
+            return false;
+        c->burst = (unsigned)num;
+    } else if (strcmp(key, "worker") == 0) {
+        if (strcmp(value, "thread") == 0)
+            c->thread = true;
+        else if (strcmp(value, "loop") == 0)
+            c->thread = false;
+        else
+            return false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+sink_t *sink_set_add(sink_set_t *set, const char *name, const sink_conf_t *conf, sink_deliver_fn deliver, void *ctx) {
+    if (set->n >= MODSW_MAX_SINKS || strlen(name) >= MODSW_NAME_MAX) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    void *mem;
+    if ((errno = posix_memalign(&mem, 64, sizeof(sink_t))) != 0)
+        return NULL;
+    sink_t *s = mem;
+    memset(s, 0, sizeof(*s));
+    strcpy(s->name, name);
+    s->conf = *conf;
+    s->deliver = deliver;
+    s->ctx = ctx;
+
+    uint64_t cap = 2;
+    while (cap < conf->queue_len)
+        cap <<= 1;
+    s->ring = calloc(cap, sizeof(sink_slot_t));
+    if (!s->ring) {
+        free(s);
+        return NULL;
+    }
+    s->mask = cap - 1;
+    if (conf->rate) {
+        s->interval_ns = 1000000000ull / conf->rate;
+        if (s->conf.burst == 0)
+            s->conf.burst = 1;
+    }
+    set->s[set->n++] = s;
+    return s;
+}
+
+// Copy the oldest slot and claim it; false when the ring is empty.
+static bool ring_pop(sink_t *s, sink_slot_t *out) {
+    uint64_t tail = __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+    while (tail != __atomic_load_n(&s->head, __ATOMIC_ACQUIRE)) {
+        *out = s->ring[tail & s->mask];
+        if (__atomic_compare_exchange_n(&s->tail, &tail, tail + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return true;
+    }
+    return false;
+}
+
+static unsigned drain(sink_t *s) {
+    sink_slot_t slot;
+    unsigned n = 0;
+    while (ring_pop(s, &slot)) {
+        uint64_t start = monotonic_ns();
+        int ret = s->deliver(s->ctx, &slot.msg);
+        uint64_t end = monotonic_ns();
+        uint64_t latency = end - slot.queued_ns;
+        uint64_t exec = end - start;
+        stat_add(ret < 0 ? &s->failed : &s->delivered, 1);
+        stat_add(&s->total_exec_ns, exec);
+        __atomic_store_n(&s->last_exec_ns, exec, __ATOMIC_RELAXED);
+        if (exec > s->max_exec_ns)
+            __atomic_store_n(&s->max_exec_ns, exec, __ATOMIC_RELAXED);
+        stat_add(&s->total_latency_ns, latency);
+        __atomic_store_n(&s->last_latency_ns, latency, __ATOMIC_RELAXED);
+        if (latency > s->max_latency_ns)
+            __atomic_store_n(&s->max_latency_ns, latency, __ATOMIC_RELAXED);
+        n++;
+    }
+    return n;
+}
+
+static void *sink_worker(void *arg) {
+    sink_t *s = arg;
+    while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+        if (drain(s))
+            continue;
+        // Announce the sleep before the last emptiness check; the producer checks in the opposite order.
+        __atomic_store_n(&s->sleeping, 1, __ATOMIC_SEQ_CST);
+        uint32_t wake = __atomic_load_n(&s->wake, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&s->head, __ATOMIC_SEQ_CST) == __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST) &&
+            !__atomic_load_n(&s->stop, __ATOMIC_SEQ_CST))
+            futex_wait(&s->wake, wake);
+        __atomic_store_n(&s->sleeping, 0, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+int sink_set_start(sink_set_t *set, uint64_t now) {
+    set->next_metrics_ns = now;
+    for (unsigned i = 0; i < set->n; i++) {
+        sink_t *s = set->s[i];
+        if (!s->conf.thread)
+            continue;
+        if ((errno = pthread_create(&s->thread, NULL, sink_worker, s)) != 0)
+            return -1;
+        s->started = true;
+    }
+    return 0;
+}
+
+static bool ring_push(sink_t *s, const sink_msg_t *msg, uint64_t now) {
+    uint64_t head = s->head;
+    uint64_t tail = __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > s->mask) {
+        if (s->conf.policy == SINK_POLICY_DROP)
+            return false;
+        if (s->conf.policy == SINK_POLICY_LATEST) {
+            // Losing the race means the consumer freed the slot itself.
+            if (__atomic_compare_exchange_n(&s->tail, &tail, tail + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                stat_add(&s->dropped, 1);
+        } else {
+            uint64_t until = now + s->conf.block_ns;
+            uint64_t t = now;
+            while (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) > s->mask && (t = monotonic_ns()) < until)
+                sched_yield();
+            stat_add(&s->blocked_ns, t - now);
+            if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) > s->mask)
+                return false;
+        }
+    }
+    sink_slot_t *slot = &s->ring[head & s->mask];
+    slot->msg = *msg;
+    slot->queued_ns = now;
+    __atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+
+    uint64_t depth = head + 1 - __atomic_load_n(&s->tail, __ATOMIC_RELAXED);
+    if (depth > s->high_water)
+        __atomic_store_n(&s->high_water, depth, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool sink_publish(sink_t *s, const sink_msg_t *msg, uint64_t now) {
+    if (!ring_push(s, msg, now)) {
+        stat_add(&s->dropped, 1);
+        return false;
+    }
+    stat_add(&s->enqueued, 1);
+    if (!s->started)
+        return true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->sleeping, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&s->wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&s->wake);
+    }
+    return true;
+}
+
+// Earliest time the bucket has a token; a full bucket spends its last one at tat_ns - interval_ns.
+static uint64_t token_at(const sink_t *s) {
+    uint64_t window = s->interval_ns * (s->conf.burst - 1);
+    return s->tat_ns > window ? s->tat_ns - window : 0;
+}
+
+static bool take_token(sink_t *s, uint64_t now) {
+    if (now < token_at(s))
+        return false;
+    s->tat_ns = (s->tat_ns > now ? s->tat_ns : now) + s->interval_ns;
+    return true;
+}
+
+void sink_set_publish(sink_set_t *set, const sink_msg_t *msg, uint64_t now) {
+    for (unsigned i = 0; i < set->n; i++) {
+        sink_t *s = set->s[i];
+        if (s->interval_ns && msg->ev.type == MODSW_EVENT_MODE && (s->holding || !take_token(s, now))) {
+            if (s->holding)
+                stat_add(&s->suppressed, 1);
+            s->held = *msg;
+            s->holding = true;
+            set->last_held_ns = now;
+            continue;
+        }
+        sink_publish(s, msg, now);
+    }
+}
+
+bool sink_set_timeout(sink_set_t *set, uint64_t now) {
+    bool queued = false;
+    for (unsigned i = 0; i < set->n; i++) {
+        sink_t *s = set->s[i];
+        if (s->holding && take_token(s, now)) {
+            s->holding = false;
+            sink_publish(s, &s->held, now);
+            queued = true;
+        }
+    }
+    if (set->last_held_ns && now - set->last_held_ns >= SINK_CHATTER_NS)
+        set->last_held_ns = 0;
+    return queued;
+}
+
+bool sink_set_chattering(const sink_set_t *set, uint64_t now) {
+    return set->last_held_ns && now - set->last_held_ns < SINK_CHATTER_NS;
+}
+
+void sink_set_lost(sink_set_t *set, uint64_t n) {
+    for (unsigned i = 0; i < set->n; i++)
+        stat_add(&set->s[i]->dropped, n);
+}
+
+void sink_set_drain(sink_set_t *set) {
+    for (unsigned i = 0; i < set->n; i++) {
+        if (!set->s[i]->started)
+            drain(set->s[i]);
+    }
+}
+
+uint64_t sink_set_next_deadline(const sink_set_t *set) {
+    if (set->n == 0)
+        return SINK_NO_DEADLINE;
+    uint64_t deadline = set->next_metrics_ns;
+    for (unsigned i = 0; i < set->n; i++) {
+        if (set->s[i]->holding && token_at(set->s[i]) < deadline)
+            deadline = token_at(set->s[i]);
+    }
+    if (set->last_held_ns && set->last_held_ns + SINK_CHATTER_NS < deadline)
+        deadline = set->last_held_ns + SINK_CHATTER_NS;
+    return deadline;
+}
+
+bool sink_set_metrics(sink_set_t *set, uint64_t now, modsw_sinks_t *out) {
+    if (set->n == 0 || now < set->next_metrics_ns)
+        return false;
+    set->next_metrics_ns = now + SINK_METRICS_NS;
+
+    out->count = set->n;
+    for (unsigned i = 0; i < set->n; i++) {
+        const sink_t *s = set->s[i];
+        modsw_sink_stats_t *o = &out->s[i];
+        memcpy(o->name, s->name, MODSW_NAME_MAX);
+        o->policy = s->conf.policy;
+        o->thread = s->conf.thread;
+        o->capacity = (uint32_t)(s->mask + 1);
+        o->depth = (uint32_t)(s->head - __atomic_load_n(&s->tail, __ATOMIC_RELAXED));
+        o->enqueued = stat_get(&s->enqueued);
+        o->dropped = stat_get(&s->dropped);
+        o->high_water = stat_get(&s->high_water);
+        o->blocked_ns = stat_get(&s->blocked_ns);
+        o->delivered = stat_get(&s->delivered);
+        o->failed = stat_get(&s->failed);
+        o->last_latency_ns = stat_get(&s->last_latency_ns);
+        o->max_latency_ns = stat_get(&s->max_latency_ns);
+        uint64_t done = o->delivered + o->failed;
+        o->avg_latency_ns = done ? stat_get(&s->total_latency_ns) / done : 0;
+        o->last_exec_ns = stat_get(&s->last_exec_ns);
+        o->max_exec_ns = stat_get(&s->max_exec_ns);
+        o->avg_exec_ns = done ? stat_get(&s->total_exec_ns) / done : 0;
+        o->suppressed = stat_get(&s->suppressed);
+        o->rate = s->conf.rate;
+        o->burst = s->conf.burst;
+        o->holding = s->holding;
+    }
+    return true;
+}
+
+unsigned sink_set_stop(sink_set_t *set) {
+    for (unsigned i = 0; i < set->n; i++) {
+        sink_t *s = set->s[i];
+        if (!s->started)
+            continue;
+        __atomic_store_n(&s->stop, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&s->wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&s->wake);
+    }
+
+    // One deadline for all workers; the real clock, as the virtual one does not move here.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SINK_STOP_NS / 1000000000ull;
+    unsigned stuck = 0;
+    for (unsigned i = 0; i < set->n; i++) {
+        sink_t *s = set->s[i];
+        if (s->started && pthread_timedjoin_np(s->thread, NULL, &deadline) != 0) {
+            // Still inside deliver(); it may touch the sink, so it is leaked.
+            fprintf(stderr, "sink.stop.worker_stuck: %s left running\n", s->name);
+            pthread_detach(s->thread);
+            stuck++;
+            set->s[i] = NULL;
+            continue;
+        }
+        s->started = false;
+        free(s->ring);
+        free(s);
+        set->s[i] = NULL;
+    }
+    set->n = 0;
+    return stuck;
+}
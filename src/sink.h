@@ -0,0 +1,253 @@
+/*
+ * sink.h - rpi-modswitch asynchronous publish fan-out
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file feeds published events to the outputs other than shared memory.
+ * The shared memory write stays synchronous; every other sink owns a
+ * single-producer single-consumer ring that the event loop fills without
+ * locks. A ring is drained either by a worker thread of its own or by the
+ * event loop between samples, so a slow sink never stalls acquisition unless
+ * it asked for backpressure.
+ *
+ * What happens when a ring is full is chosen per sink:
+ *   - drop:   the new message is discarded.
+ *   - latest: the oldest queued message is discarded to make room, for sinks
+ *             that only care about the newest state.
+ *   - block:  the event loop waits up to block_us for room, then drops.
+ *
+ * Mode transitions also go through a token bucket per sink (rate per second,
+ * burst deep) before they are queued. A transition that finds the bucket
+ * empty is held back, replacing any transition already held, and the held
+ * one is queued as soon as a token is available again: a chattering contact
+ * costs a sink at most `rate` deliveries per second, and the sink still ends
+ * up with the latest state. Replaced transitions are counted as suppressed.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "modsw_shm.h"
+
+#define SINK_NO_DEADLINE UINT64_MAX
+#define SINK_METRICS_NS 1000000000ull   // metrics refresh in shared memory
+#define SINK_DEFAULT_RATE 20            // mode transitions per second
+#define SINK_DEFAULT_BURST 10
+#define SINK_CHATTER_NS 1000000000ull   // chattering until this long without a held transition
+#define SINK_STOP_NS 1000000000ull      // longest wait for the workers on stop
+
+typedef enum sink_policy_t {
+    SINK_POLICY_DROP = 0,
+    SINK_POLICY_LATEST,
+    SINK_POLICY_BLOCK,
+} sink_policy_t;
+
+typedef struct sink_conf_t {
+    unsigned queue_len;         // rounded up to a power of two
+    sink_policy_t policy;
+    uint64_t block_ns;          // longest wait of the block policy
+    bool thread;                // drained by a worker thread, else by the event loop
+    unsigned rate;              // mode transitions per second, 0 = unlimited
+    unsigned burst;             // bucket depth
+} sink_conf_t;
+
+#define SINK_CONF_DEFAULT { .queue_len = 64, .policy = SINK_POLICY_DROP, .block_ns = 1000000, .thread = true, \
+                            .rate = SINK_DEFAULT_RATE, .burst = SINK_DEFAULT_BURST }
+
+typedef struct sink_msg_t {
+    modsw_event_t ev;
+    uint64_t rt_ns;             // CLOCK_REALTIME when the event was handed to the sinks
+    uint8_t raw;                // published switch line levels
+    uint8_t reserved[7];
+} sink_msg_t;
+
+/**
+ * Deliver one message to the sink's output.
+ *
+ * @param ctx    Context given to sink_set_add().
+ * @param msg    Message.
+ * @return       0 on success, -1 on failure (counted, not retried).
+ */
+typedef int (*sink_deliver_fn)(void *ctx, const sink_msg_t *msg);
+
+typedef struct sink_slot_t {
+    sink_msg_t msg;
+    uint64_t queued_ns;
+} sink_slot_t;
+
+typedef struct sink_t {
+    char name[MODSW_NAME_MAX];
+    sink_conf_t conf;
+    sink_deliver_fn deliver;
+    void *ctx;
+
+    sink_slot_t *ring;
+    uint64_t mask;
+    uint64_t head __attribute__((aligned(64)));     // next slot to fill, producer only
+    uint64_t tail __attribute__((aligned(64)));     // next slot to drain
+    uint32_t wake;              // futex word bumped by the producer
+    uint32_t sleeping;          // worker is about to wait on `wake`
+    uint32_t stop;
+    pthread_t thread;
+    bool started;
+
+    // Token bucket, event loop only: a token is available once now >= tat_ns - (burst - 1) intervals.
+    uint64_t interval_ns;       // 0 = unlimited
+    uint64_t tat_ns;
+    sink_msg_t held;
+    bool holding;
+    uint64_t suppressed;
+
+    // Written by one side each, read by the event loop with relaxed loads.
+    uint64_t enqueued __attribute__((aligned(64)));
+    uint64_t dropped;
+    uint64_t high_water;
+    uint64_t blocked_ns;
+    uint64_t delivered __attribute__((aligned(64)));
+    uint64_t failed;
+    uint64_t last_latency_ns;
+    uint64_t max_latency_ns;
+    uint64_t total_latency_ns;
+    uint64_t last_exec_ns;      // time spent inside deliver
+    uint64_t max_exec_ns;
+    uint64_t total_exec_ns;
+} sink_t;
+
+typedef struct sink_set_t {
+    sink_t *s[MODSW_MAX_SINKS];
+    unsigned n;
+    uint64_t next_metrics_ns;
+    uint64_t last_held_ns;      // last time a transition was held back, 0 = never
+} sink_set_t;
+
+
+/**
+ * Apply one of the queue keys shared by every sink section.
+ *
+ * @param c      Sink configuration.
+ * @param key    One of queue, policy, block_us, worker, rate, burst.
+ * @param value  Value.
+ * @return       true if the key was a queue key with a valid value.
+ */
+bool sink_conf(sink_conf_t *c, const char *key, const char *value);
+
+/**
+ * Register a sink.
+ *
+ * @param set      Sink set.
+ * @param name     Name shown in the metrics.
+ * @param conf     Queue configuration.
+ * @param deliver  Output function, called from the draining context.
+ * @param ctx      Passed to deliver.
+ * @return         The sink, or NULL with errno set.
+ */
+sink_t *sink_set_add(sink_set_t *set, const char *name, const sink_conf_t *conf, sink_deliver_fn deliver, void *ctx);
+
+/**
+ * Start the worker threads.
+ *
+ * @param set    Sink set.
+ * @param now    Current time.
+ * @return       0 on success, -1 with errno set.
+ */
+int sink_set_start(sink_set_t *set, uint64_t now);
+
+/**
+ * Queue a message on one sink and wake its worker if it sleeps.
+ *
+ * @param s      Sink.
+ * @param msg    Message.
+ * @param now    Current time.
+ * @return       true if queued, false if dropped (counted).
+ */
+bool sink_publish(sink_t *s, const sink_msg_t *msg, uint64_t now);
+
+/**
+ * Queue a message on every sink and wake the sleeping workers.
+ *
+ * @param set    Sink set.
+ * @param msg    Message.
+ * @param now    Current time.
+ */
+void sink_set_publish(sink_set_t *set, const sink_msg_t *msg, uint64_t now);
+
+/**
+ * Queue the held transitions whose sink has a token again.
+ *
+ * @param set    Sink set.
+ * @param now    Current time.
+ * @return       true if something was queued.
+ */
+bool sink_set_timeout(sink_set_t *set, uint64_t now);
+
+/**
+ * Whether some sink had to hold a transition back within the last
+ * SINK_CHATTER_NS.
+ *
+ * @param set    Sink set.
+ * @param now    Current time.
+ * @return       true while the switch chatters faster than a sink's limit.
+ */
+bool sink_set_chattering(const sink_set_t *set, uint64_t now);
+
+/**
+ * Count messages that never reached the sinks as dropped by every sink.
+ *
+ * @param set    Sink set.
+ * @param n      Number of lost messages.
+ */
+void sink_set_lost(sink_set_t *set, uint64_t n);
+
+/**
+ * Deliver what is queued on the sinks drained by the event loop.
+ *
+ * @param set    Sink set.
+ */
+void sink_set_drain(sink_set_t *set);
+
+/**
+ * Time of the next metrics refresh, held transition release or end of
+ * chatter.
+ *
+ * @param set    Sink set.
+ * @return       Absolute CLOCK_MONOTONIC time, or SINK_NO_DEADLINE.
+ */
+uint64_t sink_set_next_deadline(const sink_set_t *set);
+
+/**
+ * Copy the metrics of every sink if their refresh is due.
+ *
+ * @param set    Sink set.
+ * @param now    Current time.
+ * @param out    Shared memory area; written only when due.
+ * @return       true if the metrics were copied.
+ */
+bool sink_set_metrics(sink_set_t *set, uint64_t now, modsw_sinks_t *out);
+
+/**
+ * Stop the workers, deliver nothing more and free every sink. A worker still
+ * inside its deliver function after SINK_STOP_NS is detached and its sink
+ * left allocated, so a hung output cannot hold up the daemon's exit.
+ *
+ * @param set    Sink set.
+ * @return       Number of workers left running.
+ */
+unsigned sink_set_stop(sink_set_t *set);
+
+#endif /* SINK_H */
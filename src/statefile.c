@@ -0,0 +1,115 @@
+/*
+ * statefile.c - rpi-modswitch atomic state file sink
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the state file sink described in statefile.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "statefile.h"
+#include "modsw_shm.h"
+#include "utils.h"
+
+static void statefile_set_path(statefile_t *f, const char *path) {
+    strcpy(f->path, path);
+    snprintf(f->tmp_path, sizeof(f->tmp_path), "%s.tmp", path);
+}
+
+bool statefile_conf(statefile_t *f, const char *key, const char *value) {
+    uintmax_t num;
+    if (!f->path[0])
+        statefile_set_path(f, STATEFILE_DEFAULT_PATH);
+
+    if (strcmp(key, "enable") == 0) {
+        if (!xstr2umax(value, 10, &num) || num > 1)
+            return false;
+        f->enabled = num;
+    } else if (strcmp(key, "path") == 0) {
+        // Leave room for the ".tmp" suffix; the temporary file must share the directory.
+        if (value[0] != '/' || strlen(value) + 5 > sizeof(f->path))
+            return false;
+        statefile_set_path(f, value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int statefile_open(statefile_t *f) {
+    if (!f->enabled)
+        return 0;
+
+    char dir[PATH_MAX];
+    strcpy(dir, f->path);
+    char *slash = strrchr(dir, '/');
+    if (slash != dir) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+            return -1;
+    }
+    f->opened = true;
+    return 0;
+}
+
+int statefile_deliver(void *ctx, const sink_msg_t *msg) {
+    statefile_t *f = ctx;
+    if (msg->ev.type != MODSW_EVENT_MODE)
+        return 0;
+
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf),
+                       "mode=%u\nchar=%c\nname=%.*s\nraw=0x%02x\nseq=%" PRIu64 "\nchanged_ns=%" PRIu64 "\nchanged_rt_ns=%" PRIu64 "\n",
+                       msg->ev.mode, modsw_mode_char(msg->ev.mode), MODSW_NAME_MAX, msg->ev.name, msg->raw,
+                       msg->ev.seq, msg->ev.ts_ns, msg->rt_ns);
+
+    int fd = open(f->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    errno = 0;
+    if (write(fd, buf, (size_t)len) != len) {
+        int err = errno ? errno : EIO;
+        close(fd);
+        unlink(f->tmp_path);
+        errno = err;
+        return -1;
+    }
+    if (close(fd) < 0 || rename(f->tmp_path, f->path) < 0) {
+        int err = errno;
+        unlink(f->tmp_path);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void statefile_close(statefile_t *f) {
+    if (!f->opened)
+        return;
+    unlink(f->path);
+    unlink(f->tmp_path);
+    f->opened = false;
+}
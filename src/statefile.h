@@ -0,0 +1,89 @@
+/*
+ * statefile.h - rpi-modswitch atomic state file sink
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file publishes the current mode to a small file, normally on tmpfs,
+ * for consumers that can only watch files. Every published transition writes
+ * a complete new file next to the old one and rename()s it into place, so a
+ * reader never sees a partial file and an inotify watch on the directory gets
+ * exactly one IN_MOVED_TO per transition.
+ *
+ * The file holds shell-sourceable key=value lines:
+ *
+ *   mode=2
+ *   char=2
+ *   name=night
+ *   raw=0x02
+ *   seq=17
+ *   changed_ns=123456789
+ *   changed_rt_ns=1760000000000000000
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <stdbool.h>
+#include <limits.h>
+#include "sink.h"
+
+#define STATEFILE_DEFAULT_PATH "/run/modswitch/state"
+
+typedef struct statefile_t {
+    bool enabled;
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    bool opened;
+} statefile_t;
+
+
+/**
+ * Apply one key of the [statefile] configuration section.
+ *
+ * @param f      State file sink.
+ * @param key    One of enable, path.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool statefile_conf(statefile_t *f, const char *key, const char *value);
+
+/**
+ * Create the directory of the state file. Does nothing if the sink is not
+ * enabled.
+ *
+ * @param f      State file sink.
+ * @return       0 on success, -1 with errno set on failure.
+ */
+int statefile_open(statefile_t *f);
+
+/**
+ * Sink delivery function: rewrites the file for MODSW_EVENT_MODE messages
+ * and ignores the rest.
+ *
+ * @param ctx    The statefile_t.
+ * @param msg    Message.
+ * @return       0 on success, -1 with errno set.
+ */
+int statefile_deliver(void *ctx, const sink_msg_t *msg);
+
+/**
+ * Remove the state file, so a stale state never outlives the daemon.
+ *
+ * @param f      State file sink.
+ */
+void statefile_close(statefile_t *f);
+
+#endif /* STATEFILE_H */
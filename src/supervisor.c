@@ -0,0 +1,494 @@
+/*
+ * supervisor.c - rpi-modswitch mode-driven process supervisor
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the supervisor described in supervisor.h.
+ *
+ * The daemon has other threads by the time services are spawned, so a child
+ * only makes async-signal-safe calls between fork() and execv(): it resets
+ * every signal disposition, moves to a process group of its own, closes the
+ * gates of the other standbys (so their EOF still means cancel) and, for a
+ * fork standby, waits on its own gate. All signals stay blocked until right before exec, so a
+ * signal sent early can never run one of the daemon's handlers in the child.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#define _GNU_SOURCE     // pipe2()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include "supervisor.h"
+#include "utils.h"
+
+#define DEFAULT_WARMUP_MS 500
+#define DEFAULT_STOP_MS 2000
+#define DEFAULT_RESTART_MS 1000
+
+static service_t *service_lookup(supervisor_t *sv, const char *name) {
+    for (unsigned i = 0; i < sv->n; i++) {
+        if (strcmp(sv->s[i].name, name) == 0)
+            return &sv->s[i];
+    }
+    if (sv->n >= MODSW_MAX_SERVICES || strlen(name) >= MODSW_NAME_MAX || !name[0])
+        return NULL;
+
+    service_t *svc = &sv->s[sv->n++];
+    memset(svc, 0, sizeof(*svc));
+    strcpy(svc->name, name);
+    svc->standby = SERVICE_STANDBY_FORK;
+    svc->warmup_ns = DEFAULT_WARMUP_MS * 1000000ull;
+    svc->stop_ns = DEFAULT_STOP_MS * 1000000ull;
+    svc->restart_ns = DEFAULT_RESTART_MS * 1000000ull;
+    svc->gate_fd = -1;
+    svc->timer_ns = SUPERVISOR_NO_DEADLINE;
+    return svc;
+}
+
+static bool parse_exec(service_t *svc, const char *value) {
+    if (value[0] != '/' || strlen(value) >= sizeof(svc->cmd))
+        return false;
+    strcpy(svc->cmd, value);
+    unsigned argc = 0;
+    for (char *tok = strtok(svc->cmd, " \t"); tok; tok = strtok(NULL, " \t")) {
+        if (argc >= SERVICE_ARGS_MAX)
+            return false;
+        svc->argv[argc++] = tok;
+    }
+    svc->argv[argc] = NULL;
+    return argc > 0;
+}
+
+static bool parse_modes(service_t *svc, const char *value) {
+    char buf[256];
+    if (strlen(value) >= sizeof(buf))
+        return false;
+    strcpy(buf, value);
+    memset(svc->modes, 0, sizeof(svc->modes));
+    for (char *tok = strtok(buf, ", \t"); tok; tok = strtok(NULL, ", \t")) {
+        uintmax_t mode;
+        if (!xstr2umax(tok, 10, &mode) || mode >= MODSW_MAX_MODES)
+            return false;
+        svc->modes[mode / 64] |= 1ull << (mode % 64);
+    }
+    return true;
+}
+
+bool supervisor_conf(supervisor_t *sv, const char *name, const char *key, const char *value) {
+    service_t *svc = service_lookup(sv, name);
+    if (!svc)
+        return false;
+
+    uintmax_t num;
+    if (strcmp(key, "exec") == 0) {
+        return parse_exec(svc, value);
+    } else if (strcmp(key, "modes") == 0) {
+        return parse_modes(svc, value);
+    } else if (strcmp(key, "standby") == 0) {
+        if (strcmp(value, "none") == 0)
+            svc->standby = SERVICE_STANDBY_NONE;
+        else if (strcmp(value, "fork") == 0)
+            svc->standby = SERVICE_STANDBY_FORK;
+        else if (strcmp(value, "warm") == 0)
+            svc->standby = SERVICE_STANDBY_WARM;
+        else
+            return false;
+    } else if (strcmp(key, "warmup_ms") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        svc->warmup_ns = (uint64_t)num * 1000000ull;
+    } else if (strcmp(key, "stop_ms") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        svc->stop_ns = (uint64_t)num * 1000000ull;
+    } else if (strcmp(key, "restart_ms") == 0) {
+        if (!xstr2umax(value, 10, &num))
+            return false;
+        svc->restart_ns = (uint64_t)num * 1000000ull;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int supervisor_open(supervisor_t *sv) {
+    sv->signal_fd = -1;
+    sv->mode = -1;
+    sv->predicted = -1;
+    if (sv->n == 0)
+        return 0;
+    for (unsigned i = 0; i < sv->n; i++) {
+        service_t *svc = &sv->s[i];
+        bool any = false;
+        for (unsigned w = 0; w < MODSW_MAX_MODES / 64; w++)
+            any |= svc->modes[w] != 0;
+        if (!svc->argv[0] || !any) {
+            fprintf(stderr, "supervisor.open.incomplete_service: [service.%s] needs exec and modes\n", svc->name);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    if ((errno = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0)
+        return -1;
+    sv->signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    return sv->signal_fd < 0 ? -1 : 0;
+}
+
+static bool wanted(const service_t *svc, int mode) {
+    return mode >= 0 && (svc->modes[mode / 64] >> (mode % 64)) & 1;
+}
+
+static bool spawn(supervisor_t *sv, service_t *svc, bool gated) {
+    int gate[2] = { -1, -1 };
+    if (gated && pipe2(gate, O_CLOEXEC) < 0) {
+        perror("supervisor.spawn.pipe_failed");
+        return false;
+    }
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct sigaction dfl;
+        memset(&dfl, 0, sizeof(dfl));
+        dfl.sa_handler = SIG_DFL;
+        for (int sig = 1; sig < NSIG; sig++)
+            sigaction(sig, &dfl, NULL);
+        setpgid(0, 0);
+        for (unsigned i = 0; i < sv->n; i++) {
+            if (sv->s[i].gate_fd >= 0)
+                close(sv->s[i].gate_fd);
+        }
+        if (gated) {
+            char b;
+            ssize_t n;
+            close(gate[1]);
+            while ((n = read(gate[0], &b, 1)) < 0 && errno == EINTR)
+                ;
+            if (n != 1)
+                _exit(0);       // standby cancelled
+        }
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        execv(svc->argv[0], svc->argv);
+        _exit(127);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (gated)
+        close(gate[0]);
+    if (pid < 0) {
+        perror("supervisor.spawn.fork_failed");
+        if (gated)
+            close(gate[1]);
+        return false;
+    }
+    setpgid(pid, pid);      // also here, so the group exists before the child runs
+    svc->pid = pid;
+    svc->gate_fd = gate[1];
+    svc->timer_ns = SUPERVISOR_NO_DEADLINE;
+    svc->starts++;
+    return true;
+}
+
+static void start_running(supervisor_t *sv, service_t *svc) {
+    if (spawn(sv, svc, false))
+        svc->state = SERVICE_RUNNING;
+}
+
+static void start_standby(supervisor_t *sv, service_t *svc, uint64_t now) {
+    if (!spawn(sv, svc, svc->standby == SERVICE_STANDBY_FORK))
+        return;
+    if (svc->standby == SERVICE_STANDBY_FORK) {
+        svc->state = SERVICE_STANDBY;
+    } else {
+        svc->state = SERVICE_WARMING;
+        svc->timer_ns = now + svc->warmup_ns;
+    }
+}
+
+static void resume(service_t *svc) {
+    if (svc->gate_fd >= 0) {
+        if (write(svc->gate_fd, "", 1) != 1)
+            perror("supervisor.resume.gate_write_failed");
+        close(svc->gate_fd);
+        svc->gate_fd = -1;
+    } else if (svc->state == SERVICE_STANDBY) {
+        kill(-svc->pid, SIGCONT);
+    }
+    svc->state = SERVICE_RUNNING;
+    svc->timer_ns = SUPERVISOR_NO_DEADLINE;
+}
+
+static void terminate(service_t *svc, uint64_t now) {
+    if (svc->gate_fd >= 0) {
+        close(svc->gate_fd);        // the waiting child exits on EOF
+        svc->gate_fd = -1;
+    } else {
+        kill(-svc->pid, SIGTERM);
+        if (svc->state == SERVICE_STANDBY)
+            kill(-svc->pid, SIGCONT);
+    }
+    svc->state = SERVICE_STOPPING;
+    svc->timer_ns = now + svc->stop_ns;
+}
+
+// Put a service of the predicted mode on standby, or drop a standby that is
+// no longer predicted. Services of the current mode are left alone.
+static void refill(supervisor_t *sv, service_t *svc, uint64_t now) {
+    if (wanted(svc, sv->mode))
+        return;
+    bool keep = wanted(svc, sv->predicted) && svc->standby != SERVICE_STANDBY_NONE;
+    if (keep && svc->state == SERVICE_IDLE)
+        start_standby(sv, svc, now);
+    else if (!keep && (svc->state == SERVICE_STANDBY || svc->state == SERVICE_WARMING))
+        terminate(svc, now);
+}
+
+// Most frequent transition out of `mode`, else the mode just left.
+static int predict(int mode, int from, const modsw_acct_t *acct, unsigned nmodes) {
+    int best = -1;
+    uint32_t best_n = 0;
+    for (unsigned to = 0; to < nmodes; to++) {
+        uint32_t n = acct->pairs[(unsigned)mode * nmodes + to];
+        if ((int)to != mode && n > best_n) {
+            best = (int)to;
+            best_n = n;
+        }
+    }
+    return best >= 0 ? best : (from != mode ? from : -1);
+}
+
+void supervisor_switch(supervisor_t *sv, int mode, int from, const modsw_acct_t *acct, unsigned nmodes, uint64_t now) {
+    if (sv->n == 0)
+        return;
+    uint64_t start = monotonic_ns();    // now is the transition, which may be well before this call
+    sv->mode = mode;
+    sv->switch_start_ns = now;
+
+    for (unsigned i = 0; i < sv->n; i++) {
+        service_t *svc = &sv->s[i];
+        if (wanted(svc, mode)) {
+            switch (svc->state) {
+                case SERVICE_WARMING:
+                case SERVICE_STANDBY:
+                    resume(svc);
+                    sv->standby_hits++;
+                    break;
+                case SERVICE_IDLE:
+                    start_running(sv, svc);
+                    sv->standby_misses++;
+                    break;
+                case SERVICE_STOPPING:
+                    svc->respawn = true;
+                    sv->standby_misses++;
+                    break;
+                case SERVICE_RUNNING:
+                    break;
+            }
+        } else if (svc->state == SERVICE_RUNNING) {
+            terminate(svc, now);
+            sv->draining = true;
+        } else if (svc->state == SERVICE_STOPPING) {
+            svc->respawn = false;
+        } else if (svc->state == SERVICE_IDLE) {
+            svc->timer_ns = SUPERVISOR_NO_DEADLINE;     // no restart outside its modes
+        }
+    }
+    if (from >= 0) {
+        uint64_t took = monotonic_ns() - start;
+        sv->switchovers++;
+        sv->last_switch_ns = took;
+        sv->total_switch_ns += took;
+        if (took > sv->max_switch_ns)
+            sv->max_switch_ns = took;
+    }
+
+    // Refill the standby set for the likely next mode; it is off the switchover path.
+    sv->predicted = predict(mode, from, acct, nmodes);
+    for (unsigned i = 0; i < sv->n; i++)
+        refill(sv, &sv->s[i], now);
+}
+
+static void service_exited(supervisor_t *sv, service_t *svc, int status, uint64_t now) {
+    service_state_t prev = svc->state;
+    svc->exits++;
+    svc->last_status = status;
+    svc->pid = 0;
+    svc->state = SERVICE_IDLE;
+    svc->timer_ns = SUPERVISOR_NO_DEADLINE;
+    if (svc->gate_fd >= 0) {
+        close(svc->gate_fd);
+        svc->gate_fd = -1;
+    }
+
+    if (prev == SERVICE_STOPPING && svc->respawn) {
+        svc->respawn = false;
+        start_running(sv, svc);
+    } else if (prev == SERVICE_STOPPING) {
+        refill(sv, svc, now);       // stopped from the old mode, maybe needed next
+    } else if (prev != SERVICE_STOPPING && wanted(svc, sv->mode)) {
+        fprintf(stderr, "supervisor.service.exited: %s, status 0x%x, restarting in %llu ms\n",
+                svc->name, (unsigned)status, (unsigned long long)(svc->restart_ns / 1000000));
+        svc->timer_ns = now + svc->restart_ns;
+    } else if (prev != SERVICE_STOPPING) {
+        fprintf(stderr, "supervisor.service.standby_exited: %s, status 0x%x\n", svc->name, (unsigned)status);
+    }
+}
+
+bool supervisor_reap(supervisor_t *sv, uint64_t now) {
+    struct signalfd_siginfo si[8];
+    while (read(sv->signal_fd, si, sizeof(si)) > 0)
+        ;
+
+    // Only our own children: a plugin may wait for its own.
+    bool changed = false;
+    for (unsigned i = 0; i < sv->n; i++) {
+        service_t *svc = &sv->s[i];
+        int status;
+        if (svc->pid > 0 && waitpid(svc->pid, &status, WNOHANG) == svc->pid) {
+            service_exited(sv, svc, status, now);
+            changed = true;
+        }
+    }
+    if (sv->draining) {
+        bool stopping = false;
+        for (unsigned i = 0; i < sv->n; i++)
+            stopping |= sv->s[i].state == SERVICE_STOPPING;
+        if (!stopping) {
+            sv->draining = false;
+            sv->last_drain_ns = now - sv->switch_start_ns;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool supervisor_timeout(supervisor_t *sv, uint64_t now) {
+    bool changed = false;
+    for (unsigned i = 0; i < sv->n; i++) {
+        service_t *svc = &sv->s[i];
+        if (now < svc->timer_ns)
+            continue;
+        svc->timer_ns = SUPERVISOR_NO_DEADLINE;
+        switch (svc->state) {
+            case SERVICE_WARMING:
+                kill(-svc->pid, SIGSTOP);
+                svc->state = SERVICE_STANDBY;
+                changed = true;
+                break;
+            case SERVICE_STOPPING:
+                fprintf(stderr, "supervisor.service.stop_timeout: %s, sending SIGKILL\n", svc->name);
+                kill(-svc->pid, SIGKILL);
+                break;
+            case SERVICE_IDLE:
+                if (wanted(svc, sv->mode)) {
+                    start_running(sv, svc);
+                    svc->restarts++;
+                    changed = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return changed;
+}
+
+uint64_t supervisor_next_deadline(const supervisor_t *sv) {
+    uint64_t deadline = SUPERVISOR_NO_DEADLINE;
+    for (unsigned i = 0; i < sv->n; i++) {
+        if (sv->s[i].timer_ns < deadline)
+            deadline = sv->s[i].timer_ns;
+    }
+    return deadline;
+}
+
+void supervisor_publish(const supervisor_t *sv, modsw_services_t *out) {
+    out->count = sv->n;
+    out->predicted = sv->predicted;
+    out->switchovers = sv->switchovers;
+    out->standby_hits = sv->standby_hits;
+    out->standby_misses = sv->standby_misses;
+    out->last_switch_ns = sv->last_switch_ns;
+    out->max_switch_ns = sv->max_switch_ns;
+    out->avg_switch_ns = sv->switchovers ? sv->total_switch_ns / sv->switchovers : 0;
+    out->last_drain_ns = sv->last_drain_ns;
+    for (unsigned i = 0; i < sv->n; i++) {
+        const service_t *svc = &sv->s[i];
+        modsw_service_t *o = &out->s[i];
+        memcpy(o->name, svc->name, MODSW_NAME_MAX);
+        o->pid = svc->pid;
+        o->state = svc->state;
+        o->standby = svc->standby;
+        o->last_status = svc->last_status;
+        o->starts = svc->starts;
+        o->restarts = svc->restarts;
+        o->exits = svc->exits;
+    }
+}
+
+void supervisor_close(supervisor_t *sv) {
+    uint64_t wait_ns = 0;
+    for (unsigned i = 0; i < sv->n; i++) {
+        service_t *svc = &sv->s[i];
+        if (svc->pid <= 0)
+            continue;
+        if (svc->state != SERVICE_STOPPING)
+            terminate(svc, 0);
+        if (svc->stop_ns > wait_ns)
+            wait_ns = svc->stop_ns;
+    }
+
+    uint64_t until = monotonic_ns() + wait_ns;
+    while (1) {
+        bool alive = false;
+        for (unsigned i = 0; i < sv->n; i++) {
+            service_t *svc = &sv->s[i];
+            int status;
+            if (svc->pid > 0 && waitpid(svc->pid, &status, WNOHANG) == svc->pid)
+                svc->pid = 0;
+            alive |= svc->pid > 0;
+        }
+        if (!alive || monotonic_ns() >= until)
+            break;
+        sleep_ns(10000000);
+    }
+    for (unsigned i = 0; i < sv->n; i++) {
+        service_t *svc = &sv->s[i];
+        if (svc->pid <= 0)
+            continue;
+        kill(-svc->pid, SIGKILL);
+        waitpid(svc->pid, NULL, 0);
+        svc->pid = 0;
+    }
+    if (sv->signal_fd >= 0)
+        close(sv->signal_fd);
+    sv->signal_fd = -1;
+}
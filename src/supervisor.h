@@ -0,0 +1,185 @@
+/*
+ * supervisor.h - rpi-modswitch mode-driven process supervisor
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file runs the [service.NAME] sections: each service is a command run
+ * while the published mode is one of its `modes`. On a transition the
+ * services of the old mode are sent SIGTERM (SIGKILL after stop_ms) and those
+ * of the new mode are started.
+ *
+ * To make the switch fast, the services of the mode most likely to come next
+ * (the most frequent transition out of the current mode in the accounting
+ * area, else the mode just left) are kept on standby:
+ *   - standby = fork: the process is forked and waits on a pipe right before
+ *                     exec; resuming it is one write().
+ *   - standby = warm: the process is executed, left to initialize for
+ *                     warmup_ms, then stopped with SIGSTOP; resuming it is a
+ *                     SIGCONT. Only for programs that tolerate being frozen
+ *                     and that do not claim resources the running set needs.
+ *
+ * Commands are split on whitespace and must name an absolute path; there is
+ * no shell. A running service that exits on its own is restarted after
+ * restart_ms. Every service runs in a process group of its own, and
+ * signals go to the whole group. Children are reaped through a signalfd, so
+ * SIGCHLD is blocked in every thread of the daemon.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "modsw_shm.h"
+
+#define SUPERVISOR_NO_DEADLINE UINT64_MAX
+#define SERVICE_CMD_MAX 256
+#define SERVICE_ARGS_MAX 32
+
+typedef enum service_state_t {
+    SERVICE_IDLE = 0,
+    SERVICE_WARMING,            // warm standby, running until warmup_ns
+    SERVICE_STANDBY,            // waiting on its gate pipe or stopped
+    SERVICE_RUNNING,
+    SERVICE_STOPPING,           // SIGTERM sent, waiting for the exit
+} service_state_t;
+
+typedef enum service_standby_t {
+    SERVICE_STANDBY_NONE = 0,
+    SERVICE_STANDBY_FORK,
+    SERVICE_STANDBY_WARM,
+} service_standby_t;
+
+typedef struct service_t {
+    char name[MODSW_NAME_MAX];
+    char cmd[SERVICE_CMD_MAX];          // argv strings, split in place
+    char *argv[SERVICE_ARGS_MAX + 1];
+    uint64_t modes[MODSW_MAX_MODES / 64];
+    service_standby_t standby;
+    uint64_t warmup_ns;
+    uint64_t stop_ns;
+    uint64_t restart_ns;
+
+    pid_t pid;
+    service_state_t state;
+    int gate_fd;                        // write end of a fork standby's gate, -1 otherwise
+    uint64_t timer_ns;                  // warmup end, SIGKILL time or restart time
+    bool respawn;                       // start again as soon as the stopping process is gone
+
+    uint64_t starts;
+    uint64_t restarts;
+    uint64_t exits;
+    int last_status;
+} service_t;
+
+typedef struct supervisor_t {
+    service_t s[MODSW_MAX_SERVICES];
+    unsigned n;
+    int signal_fd;
+    int mode;                           // current mode, -1 before the first publish
+    int predicted;
+    uint64_t switch_start_ns;
+    bool draining;
+
+    uint64_t switchovers;
+    uint64_t standby_hits;
+    uint64_t standby_misses;
+    uint64_t last_switch_ns;
+    uint64_t max_switch_ns;
+    uint64_t total_switch_ns;
+    uint64_t last_drain_ns;
+} supervisor_t;
+
+
+/**
+ * Apply one key of a [service.NAME] configuration section.
+ *
+ * @param sv     Supervisor.
+ * @param name   Service name (section suffix).
+ * @param key    One of exec, modes (comma separated mode indexes), standby
+ *               (none|fork|warm), warmup_ms, stop_ms, restart_ms.
+ * @param value  Value.
+ * @return       true on success, false on a bad key or value.
+ */
+bool supervisor_conf(supervisor_t *sv, const char *name, const char *key, const char *value);
+
+/**
+ * Block SIGCHLD and open the signalfd. Must run before any thread is created.
+ * Does nothing without services.
+ *
+ * @param sv     Supervisor.
+ * @return       0 on success, -1 with errno set (message printed for bad
+ *               configuration).
+ */
+int supervisor_open(supervisor_t *sv);
+
+/**
+ * Start the services of a newly published mode and stop the others, then
+ * refill the standby set.
+ *
+ * @param sv      Supervisor.
+ * @param mode    New mode.
+ * @param from    Previous mode, -1 on the first publish.
+ * @param acct    Accounting area, source of the transition counts.
+ * @param nmodes  Number of modes.
+ * @param now     Time of the transition.
+ */
+void supervisor_switch(supervisor_t *sv, int mode, int from, const modsw_acct_t *acct, unsigned nmodes, uint64_t now);
+
+/**
+ * Reap exited children. Call when the signalfd is readable.
+ *
+ * @param sv     Supervisor.
+ * @param now    Current time.
+ * @return       true if the published state changed.
+ */
+bool supervisor_reap(supervisor_t *sv, uint64_t now);
+
+/**
+ * Run expired timers: end of warm-up, SIGKILL, restarts.
+ *
+ * @param sv     Supervisor.
+ * @param now    Current time.
+ * @return       true if the published state changed.
+ */
+bool supervisor_timeout(supervisor_t *sv, uint64_t now);
+
+/**
+ * Time of the next timer.
+ *
+ * @param sv     Supervisor.
+ * @return       Absolute CLOCK_MONOTONIC time, or SUPERVISOR_NO_DEADLINE.
+ */
+uint64_t supervisor_next_deadline(const supervisor_t *sv);
+
+/**
+ * Copy the state of every service.
+ *
+ * @param sv     Supervisor.
+ * @param out    Shared memory area.
+ */
+void supervisor_publish(const supervisor_t *sv, modsw_services_t *out);
+
+/**
+ * Terminate every process, waiting up to the longest stop_ms before killing
+ * the rest, and close the signalfd.
+ *
+ * @param sv     Supervisor.
+ */
+void supervisor_close(supervisor_t *sv);
+
+#endif /* SUPERVISOR_H */
@@ -17,6 +17,14 @@
  *   - xstr2char(): Convert single-character string to char with validation.
  *   - int_in_list(): Check if an integer is in a given integer list.
  *   - str_in_list(): Check if a string is in a given string list.
+ *   - monotonic_ns(): Read CLOCK_MONOTONIC in nanoseconds.
+ *   - realtime_ns(): Read CLOCK_REALTIME in nanoseconds.
+ *   - sleep_ns(): Sleep for a relative time.
+ *   - vclock_start(), vclock_advance(), vclock_active(): Replace both clocks
+ *     and sleeping with a virtual clock that moves only when told to.
+ *   - futex_bump_shared(): Advance a shared futex word and wake its waiters.
+ *   - xstr2intlist(): Convert a comma-separated string to an integer list.
+ *   - json_escape(): Escape a string for use inside a JSON string literal.
  *
  * These functions are designed for strict input validation and error handling,
  * ensuring robustness in command-line argument parsing and configuration loading.
@@ -39,6 +47,11 @@
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 
 bool xstr2umax(const char *str, int base, uintmax_t *val) {
@@ -80,3 +93,109 @@ bool str_in_list(const char *s, const char * const list[], size_t len) {
     return false;
 }
 
+/*
+ * Virtual clock: monotonic time only moves through vclock_advance(), and wall
+ * time keeps its offset to it. Sink workers read it from their own threads.
+ */
+static bool vclock_on = false;
+static uint64_t vclock_mono;
+static uint64_t vclock_rt_offset;
+
+uint64_t monotonic_ns(void) {
+    if (vclock_on)
+        return __atomic_load_n(&vclock_mono, __ATOMIC_ACQUIRE);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t realtime_ns(void) {
+    if (vclock_on)
+        return __atomic_load_n(&vclock_mono, __ATOMIC_ACQUIRE) + vclock_rt_offset;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void vclock_advance(uint64_t to_ns) {
+    if (to_ns > vclock_mono)
+        __atomic_store_n(&vclock_mono, to_ns, __ATOMIC_RELEASE);
+}
+
+void sleep_ns(uint64_t ns) {
+    if (vclock_on) {
+        vclock_advance(monotonic_ns() + ns);
+        return;
+    }
+    struct timespec ts = { .tv_sec = (time_t)(ns / 1000000000ull), .tv_nsec = (long)(ns % 1000000000ull) };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+void vclock_start(void) {
+    if (vclock_on)
+        return;
+    vclock_mono = monotonic_ns();
+    vclock_rt_offset = realtime_ns() - vclock_mono;
+    __atomic_store_n(&vclock_on, true, __ATOMIC_RELEASE);
+}
+
+bool vclock_active(void) {
+    return vclock_on;
+}
+
+void futex_bump_shared(uint32_t *word) {
+    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+int xstr2intlist(const char *str, int *list, size_t max) {
+    size_t n = 0;
+    const char *p = str;
+    while (*p) {
+        while (isspace((unsigned char)*p))
+            p++;
+        char *endptr;
+        errno = 0;
+        long v = strtol(p, &endptr, 10);
+        if (endptr == p || errno == ERANGE || v < 0 || v > 0xffff) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (n >= max) {
+            errno = E2BIG;
+            return -1;
+        }
+        list[n++] = (int)v;
+        p = endptr;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == ',')
+            p++;
+        else if (*p) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return (int)n;
+}
+
+size_t json_escape(char *dst, size_t size, const char *src, size_t max) {
+    size_t o = 0;
+    for (size_t i = 0; i < max && src[i]; i++) {
+        unsigned char c = (unsigned char)src[i];
+        size_t len = c == '"' || c == '\\' ? 2 : c < 0x20 ? 6 : 1;
+        if (o + len >= size)        // keep room for the NUL
+            break;
+        if (c == '"' || c == '\\') {
+            dst[o++] = '\\';
+            dst[o++] = (char)c;
+        } else if (c < 0x20) {
+            o += (size_t)snprintf(dst + o, size - o, "\\u%04x", c);
+        } else {
+            dst[o++] = (char)c;
+        }
+    }
+    dst[o] = '\0';
+    return o;
+}
@@ -17,6 +17,14 @@
  *   - xstr2char(): Convert single-character string to char with validation.
  *   - int_in_list(): Check if an integer is in a given integer list.
  *   - str_in_list(): Check if a string is in a given string list.
+ *   - monotonic_ns(): Read CLOCK_MONOTONIC in nanoseconds.
+ *   - realtime_ns(): Read CLOCK_REALTIME in nanoseconds.
+ *   - sleep_ns(): Sleep for a relative time.
+ *   - vclock_start(), vclock_advance(), vclock_active(): Replace both clocks
+ *     and sleeping with a virtual clock that moves only when told to.
+ *   - futex_bump_shared(): Advance a shared futex word and wake its waiters.
+ *   - xstr2intlist(): Convert a comma-separated string to an integer list.
+ *   - json_escape(): Escape a string for use inside a JSON string literal.
  *
  * These functions are designed for strict input validation and error handling,
  * ensuring robustness in command-line argument parsing and configuration loading.
@@ -76,5 +84,81 @@ bool int_in_list(int value, const int *list, size_t len);
  */
 bool str_in_list(const char *s, const char * const list[], size_t len);
 
+/**
+ * Read the monotonic clock.
+ *
+ * @return      CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t monotonic_ns(void);
+
+/**
+ * Read the wall clock.
+ *
+ * @return      CLOCK_REALTIME time in nanoseconds since the epoch.
+ */
+uint64_t realtime_ns(void);
+
+/**
+ * Sleep for a relative time, restarting after signals. On the virtual clock
+ * this advances the clock instead and returns at once.
+ *
+ * @param ns    Time to sleep in nanoseconds.
+ */
+void sleep_ns(uint64_t ns);
+
+/**
+ * Switch monotonic_ns(), realtime_ns() and sleep_ns() of the whole process to
+ * a virtual clock, starting at the current real times. From then on time
+ * stands still until vclock_advance() moves it, so timing logic runs as fast
+ * as the CPU allows and gives the same results on every run.
+ */
+void vclock_start(void);
+
+/**
+ * Check whether the virtual clock is in use.
+ *
+ * @return      true after vclock_start().
+ */
+bool vclock_active(void);
+
+/**
+ * Move the virtual clock forward. Earlier times are ignored, so monotonic
+ * time never goes backwards.
+ *
+ * @param to_ns Absolute CLOCK_MONOTONIC time in nanoseconds.
+ */
+void vclock_advance(uint64_t to_ns);
+
+/**
+ * Convert a comma-separated list of non-negative decimal integers.
+ *
+ * @param str   The input string, e.g. "5, 6, 13".
+ * @param list  Array to store the values.
+ * @param max   Capacity of list.
+ * @return      Number of values stored, or -1 with errno set to EINVAL on a
+ *              malformed entry or E2BIG if there are more than max values.
+ */
+int xstr2intlist(const char *str, int *list, size_t max);
+
+/**
+ * Increment a futex word in shared memory and wake every process waiting on
+ * it.
+ *
+ * @param word  Futex word.
+ */
+void futex_bump_shared(uint32_t *word);
+
+/**
+ * Escape a string for use inside a JSON string literal. Output that does not
+ * fit is dropped, never half an escape; a size of max * 6 + 1 always fits.
+ *
+ * @param dst   Output buffer, always NUL-terminated.
+ * @param size  Size of dst, at least 1.
+ * @param src   Input string.
+ * @param max   Most bytes of src to read, for fields that need no NUL.
+ * @return      Length of the escaped string.
+ */
+size_t json_escape(char *dst, size_t size, const char *src, size_t max);
+
 
 #endif /* UTILS_H */
@@ -0,0 +1,65 @@
+/*
+ * vdebounce.c - rpi-modswitch bit-sliced vertical counter debounce
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file implements the vertical counters described in vdebounce.h.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "vdebounce.h"
+
+int vdebounce_init(vdebounce_t *vd, unsigned nbits, unsigned samples, const uint64_t *initial) {
+    if (nbits == 0 || nbits > VDEBOUNCE_MAX_WORDS * 64 || samples == 0 || samples > VDEBOUNCE_MAX_SAMPLES) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(vd, 0, sizeof(*vd));
+    vd->nwords = (nbits + 63) / 64;
+    vd->samples = samples;
+    if (initial)
+        memcpy(vd->state, initial, vd->nwords * sizeof(uint64_t));
+    return 0;
+}
+
+uint64_t vdebounce_sample(vdebounce_t *vd, const uint64_t *raw, uint64_t *changed) {
+    uint64_t any = 0;
+    for (unsigned w = 0; w < vd->nwords; w++) {
+        uint64_t delta = raw[w] ^ vd->state[w];
+
+        // Clear the counters of agreeing inputs, then add one to the rest with a ripple carry.
+        uint64_t carry = delta;
+        for (unsigned p = 0; p < VDEBOUNCE_PLANES; p++) {
+            uint64_t c = vd->cnt[p][w] & delta;
+            vd->cnt[p][w] = c ^ carry;
+            carry &= c;
+        }
+
+        // Flip the inputs whose counter reached `samples` and restart their count.
+        uint64_t hit = delta;
+        for (unsigned p = 0; p < VDEBOUNCE_PLANES; p++)
+            hit &= (vd->samples >> p) & 1 ? vd->cnt[p][w] : ~vd->cnt[p][w];
+        for (unsigned p = 0; p < VDEBOUNCE_PLANES; p++)
+            vd->cnt[p][w] &= ~hit;
+        vd->state[w] ^= hit;
+        changed[w] = hit;
+        any |= hit;
+    }
+    return any;
+}
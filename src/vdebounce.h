@@ -0,0 +1,69 @@
+/*
+ * vdebounce.h - rpi-modswitch bit-sliced vertical counter debounce
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This file debounces a bank of input bits sample by sample. Instead of one
+ * counter per input, bit N of every input's counter is stored in plane N, so
+ * one 64-bit word operation advances the counters of 64 inputs at once. An
+ * input flips once `samples` consecutive samples disagree with its debounced
+ * state; any agreeing sample resets its counter.
+ *
+ * The word loops are plain and dependency-free across words, so the compiler
+ * is free to vectorize them where the target has SIMD registers.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+#ifndef VDEBOUNCE_H
+#define VDEBOUNCE_H
+
+#include <stdint.h>
+
+#define VDEBOUNCE_PLANES 4
+#define VDEBOUNCE_MAX_SAMPLES ((1u << VDEBOUNCE_PLANES) - 1)
+#define VDEBOUNCE_MAX_WORDS 16          // 1024 inputs
+
+typedef struct vdebounce_t {
+    unsigned nwords;
+    unsigned samples;                   // 1 .. VDEBOUNCE_MAX_SAMPLES
+    uint64_t state[VDEBOUNCE_MAX_WORDS];                    // debounced inputs
+    uint64_t cnt[VDEBOUNCE_PLANES][VDEBOUNCE_MAX_WORDS];    // counter bit planes
+} vdebounce_t;
+
+
+/**
+ * Prepare a bank and set its debounced state.
+ *
+ * @param vd        Bank.
+ * @param nbits     Number of inputs, 1 .. VDEBOUNCE_MAX_WORDS * 64.
+ * @param samples   Consecutive disagreeing samples before an input flips,
+ *                  1 .. VDEBOUNCE_MAX_SAMPLES.
+ * @param initial   Initial state, nbits bits in 64-bit words, or NULL for all
+ *                  zero.
+ * @return          0 on success, -1 with errno set to EINVAL.
+ */
+int vdebounce_init(vdebounce_t *vd, unsigned nbits, unsigned samples, const uint64_t *initial);
+
+/**
+ * Feed one raw sample of every input.
+ *
+ * @param vd        Bank.
+ * @param raw       Raw input bits, nwords words.
+ * @param changed   Receives the inputs that flipped, nwords words.
+ * @return          Nonzero if any input flipped.
+ */
+uint64_t vdebounce_sample(vdebounce_t *vd, const uint64_t *raw, uint64_t *changed);
+
+#endif /* VDEBOUNCE_H */
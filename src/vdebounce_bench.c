@@ -0,0 +1,129 @@
+/*
+ * vdebounce_bench.c - rpi-modswitch debounce benchmark
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This program measures the cost of one debounce sample against the number of
+ * inputs, for the bit-sliced vertical counters of vdebounce.c and for a plain
+ * per-input counter loop doing the same filtering. Inputs are fed a
+ * pre-generated stream in which a few percent of the bits bounce on every
+ * sample. Build it with `make bench` in src/.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include "vdebounce.h"
+#include "utils.h"
+
+#define STREAM_LEN 1024                 // pre-generated samples, power of two
+#define ROUNDS 200000
+#define SAMPLES 4
+
+static uint64_t stream[STREAM_LEN][VDEBOUNCE_MAX_WORDS];
+
+static uint64_t xorshift64(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+// Slowly toggling levels with about 3% of the bits flipped at random on each sample.
+static void fill_stream(unsigned nwords) {
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    uint64_t level[VDEBOUNCE_MAX_WORDS] = {0};
+    for (unsigned i = 0; i < STREAM_LEN; i++) {
+        for (unsigned w = 0; w < nwords; w++) {
+            if (i % 64 == 0)
+                level[w] ^= xorshift64(&seed);
+            uint64_t noise = xorshift64(&seed) & xorshift64(&seed) & xorshift64(&seed) & xorshift64(&seed) & xorshift64(&seed);
+            stream[i][w] = level[w] ^ noise;
+        }
+    }
+}
+
+typedef struct scalar_t {
+    unsigned nbits;
+    uint8_t state[VDEBOUNCE_MAX_WORDS * 64];
+    uint8_t count[VDEBOUNCE_MAX_WORDS * 64];
+} scalar_t;
+
+static uint64_t scalar_sample(scalar_t *s, const uint64_t *raw) {
+    uint64_t flips = 0;
+    for (unsigned i = 0; i < s->nbits; i++) {
+        uint8_t bit = (raw[i / 64] >> (i % 64)) & 1;
+        if (bit == s->state[i]) {
+            s->count[i] = 0;
+        } else if (++s->count[i] >= SAMPLES) {
+            s->count[i] = 0;
+            s->state[i] = bit;
+            flips++;
+        }
+    }
+    return flips;
+}
+
+int main(void) {
+    static const unsigned lines[] = { 64, 128, 256, 512, 1024 };
+
+    fprintf(stdout, "%8s %14s %14s %8s %10s\n", "lines", "vertical ns", "per-line ns", "speedup", "flips");
+    for (unsigned l = 0; l < sizeof(lines)/sizeof(lines[0]); l++) {
+        unsigned nbits = lines[l];
+        unsigned nwords = (nbits + 63) / 64;
+        fill_stream(nwords);
+
+        static vdebounce_t vd;
+        uint64_t changed[VDEBOUNCE_MAX_WORDS];
+        uint64_t vflips = 0;
+        vdebounce_init(&vd, nbits, SAMPLES, NULL);
+        uint64_t start = monotonic_ns();
+        for (unsigned r = 0; r < ROUNDS; r++) {
+            if (vdebounce_sample(&vd, stream[r % STREAM_LEN], changed)) {
+                for (unsigned w = 0; w < nwords; w++)
+                    vflips += (uint64_t)__builtin_popcountll(changed[w]);
+            }
+        }
+        double vns = (double)(monotonic_ns() - start) / ROUNDS;
+
+        static scalar_t sc;
+        memset(&sc, 0, sizeof(sc));
+        sc.nbits = nbits;
+        uint64_t sflips = 0;
+        start = monotonic_ns();
+        for (unsigned r = 0; r < ROUNDS; r++)
+            sflips += scalar_sample(&sc, stream[r % STREAM_LEN]);
+        double sns = (double)(monotonic_ns() - start) / ROUNDS;
+
+        // Both filters must agree, or the numbers mean nothing.
+        if (vflips != sflips) {
+            fprintf(stderr, "bench.verify.mismatch: %" PRIu64 " flips against %" PRIu64 " after %u samples\n", vflips, sflips, ROUNDS);
+            return 1;
+        }
+        for (unsigned i = 0; i < nbits; i++) {
+            if (((vd.state[i / 64] >> (i % 64)) & 1) != sc.state[i]) {
+                fprintf(stderr, "bench.verify.mismatch: input %u differs after %u samples\n", i, ROUNDS);
+                return 1;
+            }
+        }
+        fprintf(stdout, "%8u %14.1f %14.1f %7.1fx %10" PRIu64 "\n", nbits, vns, sns, sns / vns, vflips);
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * wake_bench.c - rpi-modswitch futex wakeup benchmark
+ *
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Copyright (C) 2025 KaliAssistant
+ * Author: KaliAssistant
+ *
+ * This file is part of the rpi-modswitch project and is licensed under the GNU
+ * General Public License v3.0 or later.
+ *
+ * This program compares two ways of waking readers blocked until the switch
+ * reaches a given mode, like `cat4mod -l -c 2`: one shared change counter
+ * that every waiter sleeps on, and one futex word per mode (modsw_wake_t).
+ * Waiter threads are spread evenly over the modes and sleep on shared futex
+ * words in a MAP_SHARED mapping, as separate processes would. The driver
+ * publishes transitions to random modes and waits for every waiter of the
+ * new mode to see it before the next one. Each row reports the futex
+ * wakeups per transition, how many of them were useful, the time until the
+ * last waiter of the new mode ran, and the CPU time burnt by the whole
+ * process. Build it with `make bench` in src/.
+ *
+ * Project GitHub: https://github.com/KaliAssistant/rpi-modswitch
+ *
+ * This project includes components under the following licenses:
+ *   - inih: BSD-3-Clause (https://github.com/benhoyt/inih)
+ *
+ * See LICENSE for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "modsw_shm.h"
+#include "utils.h"
+
+#define MODES 16
+#define TRANSITIONS 2000
+#define MAX_WAITERS 512
+
+typedef struct bench_t {
+    bool per_mode;
+    modsw_wake_t *wake;             // in a MAP_SHARED mapping
+    uint32_t mode;                  // published mode
+    uint32_t gen;                   // published transition count
+    uint32_t seen;                  // waiters of the new mode that saw it
+    uint32_t stop;
+    uint64_t wakeups;
+    uint64_t useful;
+} bench_t;
+
+typedef struct waiter_t {
+    bench_t *b;
+    uint32_t mode;
+} waiter_t;
+
+static uint64_t cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *waiter(void *arg) {
+    waiter_t *w = arg;
+    bench_t *b = w->b;
+    uint32_t *word = b->per_mode ? &b->wake->mode[w->mode] : &b->wake->change;
+    uint32_t last_gen = 0;
+    while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+        uint32_t val = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        uint32_t gen = __atomic_load_n(&b->gen, __ATOMIC_ACQUIRE);
+        if (gen != last_gen && __atomic_load_n(&b->mode, __ATOMIC_ACQUIRE) == w->mode) {
+            last_gen = gen;
+            __atomic_add_fetch(&b->useful, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&b->seen, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+        syscall(SYS_futex, word, FUTEX_WAIT, val, NULL, NULL, 0);
+        __atomic_add_fetch(&b->wakeups, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static uint64_t xorshift64(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int run(bool per_mode, unsigned nwaiters) {
+    bench_t b = { .per_mode = per_mode };
+    b.wake = mmap(NULL, sizeof(modsw_wake_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (b.wake == MAP_FAILED) {
+        perror("bench.run.mmap_failed");
+        return -1;
+    }
+    b.mode = MODES;     // nothing published yet
+
+    static pthread_t threads[MAX_WAITERS];
+    static waiter_t waiters[MAX_WAITERS];
+    unsigned per_mode_waiters[MODES] = {0};
+    for (unsigned i = 0; i < nwaiters; i++) {
+        waiters[i] = (waiter_t){ .b = &b, .mode = i % MODES };
+        per_mode_waiters[i % MODES]++;
+        if (pthread_create(&threads[i], NULL, waiter, &waiters[i]) != 0) {
+            perror("bench.run.pthread_create_failed");
+            return -1;
+        }
+    }
+    usleep(100000);     // let every waiter block
+
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    uint64_t latency = 0;
+    uint64_t cpu_start = cpu_ns();
+    __atomic_store_n(&b.wakeups, 0, __ATOMIC_RELAXED);
+    for (unsigned t = 0; t < TRANSITIONS; t++) {
+        uint32_t mode;
+        do
+            mode = (uint32_t)(xorshift64(&seed) % MODES);
+        while (mode == b.mode);
+
+        uint64_t start = monotonic_ns();
+        __atomic_store_n(&b.seen, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&b.mode, mode, __ATOMIC_RELEASE);
+        __atomic_store_n(&b.gen, t + 1, __ATOMIC_RELEASE);
+        futex_bump_shared(per_mode ? &b.wake->mode[mode] : &b.wake->change);
+        while (__atomic_load_n(&b.seen, __ATOMIC_ACQUIRE) < per_mode_waiters[mode])
+            sched_yield();
+        latency += monotonic_ns() - start;
+    }
+    usleep(10000);      // let the losers of the last wakeup go back to sleep
+    uint64_t cpu = cpu_ns() - cpu_start;
+    uint64_t wakeups = __atomic_load_n(&b.wakeups, __ATOMIC_RELAXED);
+    uint64_t useful = __atomic_load_n(&b.useful, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&b.stop, 1, __ATOMIC_RELEASE);
+    futex_bump_shared(&b.wake->change);
+    for (unsigned m = 0; m < MODES; m++)
+        futex_bump_shared(&b.wake->mode[m]);
+    for (unsigned i = 0; i < nwaiters; i++)
+        pthread_join(threads[i], NULL);
+    munmap(b.wake, sizeof(modsw_wake_t));
+
+    fprintf(stdout, "%8u %10s %12.1f %12.1f %14.1f %14.1f\n", nwaiters, per_mode ? "per-mode" : "global",
+            (double)wakeups / TRANSITIONS, (double)useful / TRANSITIONS,
+            latency / 1e3 / TRANSITIONS, cpu / 1e3 / TRANSITIONS);
+    return 0;
+}
+
+int main(void) {
+    static const unsigned waiters[] = { 16, 64, 256, 512 };
+
+    fprintf(stdout, "%u modes, %u transitions\n", MODES, TRANSITIONS);
+    fprintf(stdout, "%8s %10s %12s %12s %14s %14s\n", "waiters", "words", "wakeups/tr", "useful/tr", "latency us/tr", "cpu us/tr");
+    for (unsigned i = 0; i < sizeof(waiters)/sizeof(waiters[0]); i++) {
+        if (run(false, waiters[i]) < 0 || run(true, waiters[i]) < 0)
+            return 1;
+    }
+    return 0;
+}
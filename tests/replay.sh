@@ -0,0 +1,17 @@
+#!/bin/sh
+#
+# Run every replay/NAME.script against replay/NAME.conf and compare what the
+# daemon publishes with replay/NAME.out.
+
+: "${srcdir:=.}"
+: "${MODSWITCHD:=../src/modswitchd}"
+
+status=0
+for script in "$srcdir"/replay/*.script; do
+    name=${script%.script}
+    if ! "$MODSWITCHD" -c "$name.conf" -r "$script" | diff -u "$name.out" - ; then
+        echo "replay: $(basename "$name") differs from its transcript" >&2
+        status=1
+    fi
+done
+exit $status